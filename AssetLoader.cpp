@@ -0,0 +1,173 @@
+//--------------------------------------------------------------------------------------
+// Loads a batch of meshes and textures using several threads
+//--------------------------------------------------------------------------------------
+
+#include "AssetLoader.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+#include "GraphicsHelpers.h"
+
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+
+// Request a mesh (see Mesh constructor for options). The mesh pointer is set when Load is called
+void AssetLoader::AddMesh(const std::string& fileName, bool requireTangents, Mesh** mesh, const VertexFormat& format /*= VertexFormat()*/)
+{
+    std::size_t job = SIZE_MAX;
+    if (!gMeshCache.IsLoaded(fileName, requireTangents, format))
+    {
+        std::string key = MeshCache::MakeKey(fileName, requireTangents, format);
+        auto sameFile = [&](const Job& j) { return j.isMesh && j.key == key; };
+        job = std::find_if(mJobs.begin(), mJobs.end(), sameFile) - mJobs.begin();
+        if (job == mJobs.size())
+        {
+            mJobs.emplace_back();
+            mJobs.back().key = key;
+            mJobs.back().fileName = fileName;
+            mJobs.back().isMesh = true;
+            mJobs.back().requireTangents = requireTangents;
+            mJobs.back().format = format;
+        }
+    }
+    mMeshRequests.push_back({ fileName, requireTangents, format, mesh, job });
+}
+
+
+// Request a texture (see TextureCache.h). The texture pointer is set when Load is called
+void AssetLoader::AddTexture(const std::string& fileName, ID3D11ShaderResourceView** textureSRV)
+{
+    std::size_t job = SIZE_MAX;
+    if (!gTextureCache.IsLoaded(fileName))
+    {
+        std::string key = TextureCache::MakeKey(fileName);
+        auto sameFile = [&](const Job& j) { return !j.isMesh && j.key == key; };
+        job = std::find_if(mJobs.begin(), mJobs.end(), sameFile) - mJobs.begin();
+        if (job == mJobs.size())
+        {
+            mJobs.emplace_back();
+            mJobs.back().key = key;
+            mJobs.back().fileName = fileName;
+            mJobs.back().isMesh = false;
+            mJobs.back().requireTangents = false;
+        }
+    }
+    mTextureRequests.push_back({ fileName, textureSRV, job });
+}
+
+
+// Load everything requested since the last call. Returns false on failure and sets gLastError to the first error.
+// Assets that did load are still set up, so the usual cleanup code will release them
+bool AssetLoader::Load()
+{
+    //// Read files and import meshes on worker threads ////
+
+    // Each thread (including this one) takes the next job until there are none left
+    std::atomic<std::size_t> nextJob(0);
+    auto worker = [&]()
+    {
+        for (std::size_t job = nextJob++; job < mJobs.size(); job = nextJob++)
+        {
+            LoadFile(job);
+        }
+    };
+
+    std::size_t numThreads = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u), mJobs.size());
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < numThreads; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+
+    //// Create GPU resources on this thread ////
+
+    std::string firstError;
+    for (auto& request : mMeshRequests)
+    {
+        try
+        {
+            if (request.job == SIZE_MAX)
+            {
+                *request.mesh = gMeshCache.Acquire(request.fileName, request.requireTangents, request.format);
+            }
+            else
+            {
+                Job& job = mJobs[request.job];
+                if (!job.error.empty())  throw std::runtime_error(job.error);
+                *request.mesh = gMeshCache.Acquire(request.fileName, request.requireTangents, job.meshData);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            if (firstError.empty())  firstError = e.what();
+        }
+    }
+
+    for (auto& request : mTextureRequests)
+    {
+        if (request.job == SIZE_MAX)
+        {
+            *request.textureSRV = gTextureCache.Acquire(request.fileName);
+        }
+        else
+        {
+            Job& job = mJobs[request.job];
+            *request.textureSRV = job.error.empty() ? gTextureCache.Acquire(request.fileName, job.fileData.data(), job.fileData.size()) : nullptr;
+        }
+        if (*request.textureSRV == nullptr && firstError.empty())  firstError = "Error loading texture " + request.fileName;
+    }
+
+    mMeshRequests.clear();
+    mTextureRequests.clear();
+    mJobs.clear();
+
+    if (!firstError.empty())
+    {
+        gLastError = firstError;
+        return false;
+    }
+    return true;
+}
+
+
+// Work done on the worker threads - import meshes, read the contents of texture files
+// Nothing may be thrown out of here, an exception leaving a worker thread would end the app
+void AssetLoader::LoadFile(std::size_t jobIndex)
+{
+    Job& job = mJobs[jobIndex];
+    try
+    {
+        if (job.isMesh)
+        {
+            job.meshData = LoadMeshData(job.fileName, job.requireTangents, job.format);
+        }
+        else
+        {
+            std::ifstream file(TextureFileToLoad(job.fileName), std::ios::binary | std::ios::ate);
+            if (!file)
+            {
+                job.error = "Error loading texture " + job.fileName;
+                return;
+            }
+            job.fileData.resize(static_cast<std::size_t>(file.tellg()));
+            file.seekg(0);
+            if (!file.read(reinterpret_cast<char*>(job.fileData.data()), job.fileData.size()))
+            {
+                job.error = "Error loading texture " + job.fileName;
+            }
+        }
+    }
+    catch (const std::exception& e) // e.g. std::bad_alloc from a huge or corrupt file as well as loading errors
+    {
+        job.error = e.what();
+    }
+}
@@ -0,0 +1,84 @@
+//--------------------------------------------------------------------------------------
+// Loads a batch of meshes and textures using several threads
+//--------------------------------------------------------------------------------------
+// Add the meshes and textures needed, then call Load. Files are read and meshes imported on a pool of worker
+// threads, one per CPU core. GPU resources are then created on the calling thread, since the DirectX context
+// can only be used from one thread. Meshes come from gMeshCache and textures from gTextureCache, so the same rules
+// apply to releasing them.
+//
+// Example:
+//     AssetLoader loader;
+//     loader.AddMesh("Teapot.x", false, &gTeapotMesh);
+//     loader.AddTexture("CargoA.dds", &gTeapotDiffuseMapSRV);
+//     if (!loader.Load())  return false; // gLastError holds the reason
+
+#include "Common.h"
+#include "MeshData.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#ifndef _ASSET_LOADER_H_INCLUDED_
+#define _ASSET_LOADER_H_INCLUDED_
+
+class Mesh;
+
+
+class AssetLoader
+{
+public:
+    // Request a mesh (see Mesh constructor for options). The mesh pointer is set when Load is called
+    void AddMesh(const std::string& fileName, bool requireTangents, Mesh** mesh, const VertexFormat& format = VertexFormat());
+
+    // Request a texture (see TextureCache.h). The texture pointer is set when Load is called
+    void AddTexture(const std::string& fileName, ID3D11ShaderResourceView** textureSRV);
+
+    // Load everything requested since the last call. Returns false on failure and sets gLastError to the first error.
+    // Assets that did load are still set up, so the usual cleanup code will release them
+    bool Load();
+
+
+private:
+    // Work done on the worker threads
+    void LoadFile(std::size_t jobIndex);
+
+    struct MeshRequest
+    {
+        std::string  fileName;
+        bool         requireTangents;
+        VertexFormat format;
+        Mesh**       mesh;
+        std::size_t  job;   // Job loading this mesh's data, or SIZE_MAX if the mesh is already in the cache
+    };
+
+    struct TextureRequest
+    {
+        std::string                fileName;
+        ID3D11ShaderResourceView** textureSRV;
+        std::size_t                job;   // Job reading this texture's file, or SIZE_MAX if the texture is already in the cache
+    };
+
+    // One job for each different file, requests for the same file share a job. Files are matched with the cache keys,
+    // so names differing only in case or slashes share a job rather than two threads loading (and cooking) one file
+    struct Job
+    {
+        std::string  key;      // Key of the file in gMeshCache or gTextureCache
+        std::string  fileName;
+        bool         isMesh;
+        bool         requireTangents;
+        VertexFormat format;
+
+        // Results, written by the worker thread
+        MeshData             meshData;
+        std::vector<uint8_t> fileData;  // Contents of texture files
+        std::string          error;     // Empty if successful
+    };
+
+    std::vector<MeshRequest>    mMeshRequests;
+    std::vector<TextureRequest> mTextureRequests;
+    std::vector<Job>            mJobs;
+};
+
+
+#endif //_ASSET_LOADER_H_INCLUDED_
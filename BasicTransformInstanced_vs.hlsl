@@ -0,0 +1,42 @@
+//--------------------------------------------------------------------------------------
+// Instanced Light Model Vertex Shader
+//--------------------------------------------------------------------------------------
+// Basic matrix transformations only, as BasicTransform_vs, but draws a whole batch of models sharing a mesh in one
+// instanced draw. Each model's world matrix and colour come from the instance data rather than the per-model constants
+
+#include "Common.hlsli" // Shaders can also use include files - note the extension
+
+
+//--------------------------------------------------------------------------------------
+// Instance data
+//--------------------------------------------------------------------------------------
+
+// World matrix and colour of every model drawn instanced this pass, the C++ code sets it in vertex shader slot 0
+// Each instanced draw uses the entries from gFirstInstance onwards
+StructuredBuffer<InstanceData> gInstances : register(t0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// The GPU numbers the instances in each draw from 0 (SV_InstanceID), which picks this vertex's model from the batch
+SimplePixelShaderInput main(BasicVertex modelVertex, uint instanceID : SV_InstanceID)
+{
+    SimplePixelShaderInput output; // This is the data the pixel shader requires from this vertex shader
+
+    InstanceData instance = gInstances[gFirstInstance + instanceID];
+
+    // Transform the decoded model position into world space with this instance's world matrix, then into view space
+    // and 2D projection space as usual
+    float4 modelPosition     = float4(DecodePosition(modelVertex.position), 1);
+    float4 worldPosition     = mul(instance.worldMatrix, modelPosition);
+    float4 viewPosition      = mul(gViewMatrix,          worldPosition);
+    output.projectedPosition = mul(gProjectionMatrix,    viewPosition);
+
+    // Pass texture coordinates (UVs) and the instance's colour on to the pixel shader
+    output.uv           = DecodeUV(modelVertex.uv);
+    output.objectColour = instance.objectColour;
+
+    return output; // Ouput data sent down the pipeline (to the pixel shader)
+}
@@ -17,7 +17,8 @@ SimplePixelShaderInput main(BasicVertex modelVertex)
     SimplePixelShaderInput output; // This is the data the pixel shader requires from this vertex shader
 
     // Input position is x,y,z only - need a 4th element to multiply by a 4x4 matrix. Use 1 for a point (0 for a vector) - recall lectures
-    float4 modelPosition = float4(modelVertex.position, 1); 
+    // Positions may be stored in a compact format, decode them first (see Common.hlsli)
+    float4 modelPosition = float4(DecodePosition(modelVertex.position), 1); 
 
     // Multiply by the world matrix passed from C++ to transform the model vertex position into world space. 
     // In a similar way use the view matrix to transform the vertex from world space into view space (camera's point of view)
@@ -27,7 +28,10 @@ SimplePixelShaderInput main(BasicVertex modelVertex)
     output.projectedPosition = mul(gProjectionMatrix, viewPosition);
 
     // Pass texture coordinates (UVs) on to the pixel shader, the vertex shader doesn't need them
-    output.uv = modelVertex.uv;
+    output.uv = DecodeUV(modelVertex.uv);
+
+    // Pass the model's colour on too, instanced draws get it from the instance data instead
+    output.objectColour = gObjectColour;
 
     return output; // Ouput data sent down the pipeline (to the pixel shader)
 }
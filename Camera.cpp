@@ -10,22 +10,24 @@ void Camera::Control(float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode
                                       KeyCode moveForward, KeyCode moveBackward, KeyCode moveLeft, KeyCode moveRight)
 {
 	//**** ROTATION ****
+	// Pitch around the camera's local X axis, yaw around the world Y axis - same behaviour as the old Euler angles
 	if (KeyHeld(turnDown))
 	{
-		mRotation.x += ROTATION_SPEED * frameTime; // Use of frameTime to ensure same speed on different machines
+		mRotation = QuaternionRotationX(ROTATION_SPEED * frameTime) * mRotation; // Use of frameTime to ensure same speed on different machines
 	}
 	if (KeyHeld(turnUp))
 	{
-		mRotation.x -= ROTATION_SPEED * frameTime;
+		mRotation = QuaternionRotationX(-ROTATION_SPEED * frameTime) * mRotation;
 	}
 	if (KeyHeld(turnRight))
 	{
-		mRotation.y += ROTATION_SPEED * frameTime;
+		mRotation *= QuaternionRotationY(ROTATION_SPEED * frameTime);
 	}
 	if (KeyHeld(turnLeft))
 	{
-		mRotation.y -= ROTATION_SPEED * frameTime;
+		mRotation *= QuaternionRotationY(-ROTATION_SPEED * frameTime);
 	}
+	mRotation = Normalise(mRotation);
 
 	//**** LOCAL MOVEMENT ****
 	if (KeyHeld(moveRight))
@@ -59,7 +61,7 @@ void Camera::Control(float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode
 void Camera::UpdateMatrices()
 {
     // "World" matrix for the camera - treat it like a model at first
-    mWorldMatrix = MatrixRotationZ(mRotation.z) * MatrixRotationX(mRotation.x) * MatrixRotationY(mRotation.y) * MatrixTranslation(mPosition);
+    mWorldMatrix = MatrixTransform(mPosition, mRotation, { 1, 1, 1 });
 
     // View matrix is the usual matrix used for the camera in shaders, it is the inverse of the world matrix (see lectures)
     mViewMatrix = InverseAffine(mWorldMatrix);
@@ -6,6 +6,7 @@
 #include "Common.h"
 #include "CVector3.h"
 #include "CMatrix4x4.h"
+#include "CQuaternion.h"
 #include "MathHelpers.h"
 #include "Input.h"
 
@@ -23,7 +24,7 @@ public:
 	// Constructor - initialise all settings, sensible defaults provided for everything.
 	Camera(CVector3 position = {0,0,0}, CVector3 rotation = {0,0,0}, 
            float fov = PI/3, float aspectRatio = 4.0f / 3.0f, float nearClip = 0.1f, float farClip = 10000.0f)
-        : mPosition(position), mRotation(rotation), mFOVx(fov), mAspectRatio(aspectRatio), mNearClip(nearClip), mFarClip(farClip)
+        : mPosition(position), mRotation(QuaternionFromEuler(rotation)), mFOVx(fov), mAspectRatio(aspectRatio), mNearClip(nearClip), mFarClip(farClip)
     {
     }
 
@@ -39,9 +40,12 @@ public:
 
 	// Getters / setters
 	CVector3 Position()  { return mPosition; }
-	CVector3 Rotation()  { return mRotation;	}
+	CVector3 Rotation()  { return ToEulerAngles(mRotation); }
 	void SetPosition(CVector3 position)  { mPosition = position; }
-	void SetRotation(CVector3 rotation)  { mRotation = rotation; }
+	void SetRotation(CVector3 rotation)  { mRotation = QuaternionFromEuler(rotation); }
+
+	CQuaternion Orientation()                    { return mRotation;        }
+	void SetOrientation(CQuaternion orientation)  { mRotation = orientation; }
 
 	float FOV()       { return mFOVx;     }
 	float NearClip()  { return mNearClip; }
@@ -65,8 +69,8 @@ private:
 	void UpdateMatrices();
 
 	// Postition and rotations for the camera (rarely scale cameras)
-	CVector3 mPosition;
-	CVector3 mRotation;
+	CVector3    mPosition;
+	CQuaternion mRotation;
 
 	// Camera settings: field of view, aspect ratio, near and far clip plane distances.
 	// Note that the FOVx angle is measured in radians (radians = degrees * PI/180) from left to right of screen
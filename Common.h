@@ -9,8 +9,10 @@
                  // Use this line before windows.h to remove the problematic legacy definitions
 #include <windows.h>
 #include <d3d11.h>
+#include <d3d11_1.h>
 #include <string>
 
+#include "CVector2.h"
 #include "CVector3.h"
 #include "CMatrix4x4.h"
 
@@ -34,6 +36,7 @@ extern int gViewportHeight;
 // Important DirectX variables
 extern ID3D11Device*           gD3DDevice;
 extern ID3D11DeviceContext*    gD3DContext;
+extern ID3D11DeviceContext1*   gD3DContext1;             // Direct3D 11.1 version of gD3DContext, nullptr if not available
 extern IDXGISwapChain*         gSwapChain;
 extern ID3D11RenderTargetView* gBackBufferRenderTarget;  // Back buffer is where we render to
 extern ID3D11DepthStencilView* gDepthStencil;            // The depth buffer contains a depth for each back buffer pixel
@@ -112,11 +115,34 @@ struct PerModelConstants
 {
     CMatrix4x4 worldMatrix;
     CVector3   objectColour; // Allows each light model to be tinted to match the light colour they cast
-    float      padding8;
+    UINT       firstInstance; // Instanced draws only - index in the instance buffer of the batch's first model (see InstanceBuffer.h)
     float      wiggle;
 };
 extern PerModelConstants gPerModelConstants;      // This variable holds the CPU-side constant buffer described above
 extern ID3D11Buffer*     gPerModelConstantBuffer; // This variable controls the GPU-side constant buffer related to the above structure
 
 
+// Instanced draws take the world matrix and colour of each model in the batch from an array of these in a structured
+// buffer, rather than from the per-model constants above (see InstanceBuffer.h). There is a matching shader structure
+struct InstanceData
+{
+    CMatrix4x4 worldMatrix;
+    CVector3   objectColour;
+    float      padding;
+};
+
+
+// Values the vertex shader uses to decode the compact vertex formats a mesh uses (see VertexDecoding in MeshData.h)
+// Each mesh has its own constant buffer holding these, which is created when the mesh is loaded and never changes
+struct PerMeshConstants
+{
+    CVector3   positionScale;
+    float      octahedralNormals;
+    CVector3   positionOffset;
+    float      padding9;
+    CVector2   uvScale;
+    CVector2   uvOffset;
+};
+
+
 #endif //_COMMON_H_INCLUDED_
@@ -63,6 +63,7 @@ struct SimplePixelShaderInput
 {
     float4 projectedPosition : SV_Position;
     float2 uv : uv;
+    float3 objectColour : objectColour; // Tint for the model, from the per-model constants or the model's instance data
 };
 
 
@@ -131,8 +132,76 @@ cbuffer PerModelConstants : register(b1) // The b1 gives this constant buffer th
     float4x4 gWorldMatrix;
 
     float3   gObjectColour;
-    float    padding8;  // See notes on padding in structure above
+    uint     gFirstInstance; // Instanced draws only - index in gInstances of the first instance (also pads gObjectColour, see notes above)
     float    wiggle;
 }
 
+
+// Instanced draws get the world matrix and colour of each instance from a structured buffer instead of the per-model
+// constants above, one entry per model in the batch (see InstanceBuffer.h). Vertex shaders for instanced draws
+// declare the buffer themselves, as it uses a texture slot which pixel shaders use for other things
+// This structure must match exactly the InstanceData structure in Common.h
+struct InstanceData
+{
+    float4x4 worldMatrix;
+    float3   objectColour;
+    float    padding;
+};
+
+
+// Meshes can store their vertices in compact formats to save memory (see MeshData.h). Each mesh has its own constant
+// buffer with the values needed to turn the compact values back into model space values, set when the mesh is rendered
+// These variables must match exactly the PerMeshConstants structure in Common.h
+cbuffer PerMeshConstants : register(b2)
+{
+    float3   gPositionScale;
+    float    gOctahedralNormals; // 1 if normals and tangents are octahedral encoded, 0 if they are plain float3s
+    float3   gPositionOffset;
+    float    padding9;
+    float2   gUVScale;
+    float2   gUVOffset;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Vertex decoding
+//--------------------------------------------------------------------------------------
+// Vertex shaders should pass vertex data from meshes through these functions before using it. They work whatever
+// format the mesh uses, the GPU has already converted 16-bit values into floats in the range 0 to 1 (or -1 to 1)
+
+float3 DecodePosition(float3 position)
+{
+    return position * gPositionScale + gPositionOffset;
+}
+
+// Octahedral normals arrive as float3(x, y, 0). Unfold the lower half of the octahedron then project back onto a sphere
+float3 DecodeNormal(float3 normal)
+{
+    if (gOctahedralNormals == 0)  return normal;
+
+    float3 n = float3(normal.xy, 1 - abs(normal.x) - abs(normal.y));
+    float t = saturate(-n.z);
+    n.xy += n.xy >= 0 ? -t : t;
+    return normalize(n);
+}
+
+float2 DecodeUV(float2 uv)
+{
+    return uv * gUVScale + gUVOffset;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Normal map decoding
+//--------------------------------------------------------------------------------------
+
+// Tangent space normal from the red and green of a normal map sample. Tangent space normals point out of the surface,
+// so z is rebuilt from x and y. This works for rgb normal maps and for the two channel BC5 normal maps made by the
+// texture cooker (see Tools/TextureCooker), which have no blue channel
+float3 DecodeNormalMap(float2 rg)
+{
+    float2 xy = 2.0f * rg - 1.0f; // Scale from 0->1 to -1->1
+    return float3(xy, sqrt(saturate(1.0f - dot(xy, xy))));
+}
+
 #endif
\ No newline at end of file
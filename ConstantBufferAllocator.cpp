@@ -0,0 +1,111 @@
+//--------------------------------------------------------------------------------------
+// Constant buffer allocator - per-model constants for many draws from one buffer
+//--------------------------------------------------------------------------------------
+
+#include "ConstantBufferAllocator.h"
+
+#include <cstring>
+
+
+namespace
+{
+    // Offsets given to VSSetConstantBuffers1 etc. must be a multiple of 16 constants, which is 256 bytes
+    const std::size_t CONSTANT_SIZE      = 16;
+    const std::size_t CONSTANT_ALIGNMENT = 256;
+
+    std::size_t AlignUp(std::size_t size)
+    {
+        return (size + CONSTANT_ALIGNMENT - 1) & ~(CONSTANT_ALIGNMENT - 1);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Construction / Usage
+-----------------------------------------------------------------------------------------*/
+
+// Create the buffer, size in bytes. Returns false on failure, with gLastError set. If the system does not support
+// binding part of a constant buffer no buffer is created, but that is not a failure (see IsAvailable)
+bool ConstantBufferAllocator::Create(std::size_t size)
+{
+    Release();
+
+    if (gD3DContext1 == nullptr)  return true;
+    D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+    if (FAILED(gD3DDevice->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) ||
+        !options.ConstantBufferOffsetting)
+    {
+        return true;
+    }
+
+    D3D11_BUFFER_DESC bufferDesc;
+    bufferDesc.ByteWidth = static_cast<UINT>(AlignUp(size));
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;  // Written by the CPU once per batch
+    bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.MiscFlags = 0;
+    bufferDesc.StructureByteStride = 0;
+    if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mBuffer)))
+    {
+        mBuffer = nullptr;
+        gLastError = "Error creating constant buffer allocator";
+        return false;
+    }
+
+    mSize = bufferDesc.ByteWidth;
+    return true;
+}
+
+
+// Release the buffer, can be created again afterwards
+void ConstantBufferAllocator::Release()
+{
+    Unmap();
+    if (mBuffer)  mBuffer->Release();
+    mBuffer = nullptr;
+    mSize = 0;
+    mUsed = 0;
+}
+
+
+// Start a new batch of constants, discarding the last one. Returns false if the allocator is not available or
+// the buffer could not be mapped
+bool ConstantBufferAllocator::Map()
+{
+    if (mBuffer == nullptr)  return false;
+    Unmap();
+
+    // Discarding gives the buffer fresh memory, draws already issued still see the previous batch
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (FAILED(gD3DContext->Map(mBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return false;
+
+    mMapped = static_cast<uint8_t*>(mapped.pData);
+    mUsed = 0;
+    return true;
+}
+
+
+// Copy a set of constants into the current batch and get the range of the buffer to bind for them. Returns false
+// if the buffer is full or not mapped, leaving range.buffer as nullptr
+bool ConstantBufferAllocator::Write(const void* constants, std::size_t size, ConstantBufferRange& range)
+{
+    range.buffer = nullptr;
+    std::size_t allocated = AlignUp(size);
+    if (mMapped == nullptr || allocated > mSize - mUsed)  return false;
+
+    std::memcpy(mMapped + mUsed, constants, size);
+    range.buffer        = mBuffer;
+    range.firstConstant = static_cast<UINT>(mUsed / CONSTANT_SIZE);
+    range.numConstants  = static_cast<UINT>(allocated / CONSTANT_SIZE);
+    mUsed += allocated;
+    return true;
+}
+
+
+// Finish the current batch, must be called before drawing with any of its ranges
+void ConstantBufferAllocator::Unmap()
+{
+    if (mMapped == nullptr)  return;
+    gD3DContext->Unmap(mBuffer, 0);
+    mMapped = nullptr;
+}
@@ -0,0 +1,105 @@
+//--------------------------------------------------------------------------------------
+// Constant buffer allocator - per-model constants for many draws from one buffer
+//--------------------------------------------------------------------------------------
+// Updating a small constant buffer with Map / WRITE_DISCARD before every draw costs a trip through the DirectX
+// runtime and driver each time, and the driver has to find fresh memory for the buffer on every discard. With
+// thousands of draws this becomes a large part of the frame's CPU time.
+//
+// Instead, the constants for every draw in a pass are written into one large buffer with a single Map. Each set of
+// constants goes at its own offset, and each draw binds just its part of the buffer with VSSetConstantBuffers1 etc.
+// (Direct3D 11.1). Offsets must be a multiple of 256 bytes, so each set of constants takes at least that much space.
+//
+// Usage per batch (e.g. a render pass):
+//   Map, then Write the constants for every draw, keeping the ranges returned
+//   Unmap, then draw, binding each draw's range
+// Each Map discards the previous batch, which is safe as draws already issued keep the contents they were given.
+// Without Direct3D 11.1 (or if creation failed) Map returns false and callers must update a constant buffer per draw
+
+#include "Common.h"
+
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _CONSTANT_BUFFER_ALLOCATOR_H_INCLUDED_
+#define _CONSTANT_BUFFER_ALLOCATOR_H_INCLUDED_
+
+
+// Part of a constant buffer holding one set of constants, ready to pass to VSSetConstantBuffers1 etc. Both counts
+// are in constants (16 bytes each). A null buffer means the constants could not be allocated
+struct ConstantBufferRange
+{
+    ID3D11Buffer* buffer        = nullptr;
+    UINT          firstConstant = 0;
+    UINT          numConstants  = 0;
+};
+
+
+class ConstantBufferAllocator
+{
+public:
+    //-------------------------------------
+    // Construction / Usage
+    //-------------------------------------
+
+    ConstantBufferAllocator() = default;
+    ~ConstantBufferAllocator()  { Release(); }
+
+    // The buffer is a GPU resource, so cannot be copied
+    ConstantBufferAllocator(const ConstantBufferAllocator&) = delete;
+    ConstantBufferAllocator& operator=(const ConstantBufferAllocator&) = delete;
+
+    // Create the buffer, size in bytes. Returns false on failure, with gLastError set. If the system does not support
+    // binding part of a constant buffer no buffer is created, but that is not a failure (see IsAvailable)
+    bool Create(std::size_t size);
+
+    // Release the buffer, can be created again afterwards
+    void Release();
+
+    // Whether the buffer was created, if not Map always returns false
+    bool IsAvailable() const  { return mBuffer != nullptr; }
+
+
+    // Start a new batch of constants, discarding the last one. Returns false if the allocator is not available or
+    // the buffer could not be mapped
+    bool Map();
+
+    // Copy a set of constants into the current batch and get the range of the buffer to bind for them. Returns false
+    // if the buffer is full or not mapped, leaving range.buffer as nullptr
+    bool Write(const void* constants, std::size_t size, ConstantBufferRange& range);
+
+    template <typename T>
+    bool Write(const T& constants, ConstantBufferRange& range)  { return Write(&constants, sizeof(T), range); }
+
+    // Finish the current batch, must be called before drawing with any of its ranges
+    void Unmap();
+
+
+    //-------------------------------------
+    // Statistics
+    //-------------------------------------
+
+    // Bytes used by the current (or last) batch, and the size of the buffer
+    std::size_t Used() const  { return mUsed; }
+    std::size_t Size() const  { return mSize; }
+
+
+    //-------------------------------------
+    // Private data / members
+    //-------------------------------------
+private:
+    ID3D11Buffer* mBuffer = nullptr;
+    std::size_t   mSize   = 0;
+    std::size_t   mUsed   = 0;
+    uint8_t*      mMapped = nullptr; // CPU address of the buffer between Map and Unmap
+};
+
+
+//--------------------------------------------------------------------------------------
+// Global Variables
+//--------------------------------------------------------------------------------------
+
+// Per-model constants for every draw in a pass (see Model::RenderModels), created with the other constant buffers
+extern ConstantBufferAllocator gPerModelConstantAllocator;
+
+
+#endif //_CONSTANT_BUFFER_ALLOCATOR_H_INCLUDED_
@@ -0,0 +1,153 @@
+//--------------------------------------------------------------------------------------
+// Visibility culling - skipping models that cannot be seen
+//--------------------------------------------------------------------------------------
+// Before rendering a view (from the camera or a light), call CullModels with the view's frustum. Each model's
+// visible flag is set, and Model::Render does nothing for models outside the frustum.
+
+#include "Culling.h"
+#include "Model.h"
+#include "Mesh.h"
+
+#include <vector>
+#include <algorithm>
+
+
+namespace
+{
+    // Working arrays are kept between calls to avoid allocating memory every frame
+    std::vector<float>   x, y, z, radius;
+    std::vector<uint8_t> visible, passed;
+
+    // Copy the world space bounding spheres of the models into the working arrays
+    void GatherSpheres(Model* const* models, std::size_t count)
+    {
+        x.resize(count);  y.resize(count);  z.resize(count);  radius.resize(count);
+        visible.resize(count);
+        passed.resize(count);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            Sphere sphere = models[i]->WorldBoundingSphere();
+            x[i] = sphere.centre.x;
+            y[i] = sphere.centre.y;
+            z[i] = sphere.centre.z;
+            radius[i] = sphere.radius;
+        }
+    }
+}
+
+
+// Set the visible flag of each of the given models depending on whether it is inside the frustum
+// Returns the number of visible models
+std::size_t CullModels(const Frustum& frustum, Model* const* models, std::size_t count)
+{
+    GatherSpheres(models, count);
+    std::size_t numVisible = CullSpheres(frustum, x.data(), y.data(), z.data(), radius.data(), count, visible.data());
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        models[i]->SetVisible(visible[i] != 0);
+    }
+    return numVisible;
+}
+
+
+// Set the visible flag of every model in the tree depending on whether it is inside the frustum. The tree finds the
+// models whose boxes overlap the frustum, then their bounding spheres are tested as above. The visibleModels vector
+// is filled with the visible models, it can be kept between calls to avoid allocations
+// Returns the number of visible models
+std::size_t CullModels(const Frustum& frustum, const SceneBVH& bvh, std::vector<Model*>& visibleModels)
+{
+    for (auto model : bvh.Models())  model->SetVisible(false);
+
+    // Box and sphere tests can each let through models just outside the frustum, using both culls more of them
+    bvh.QueryFrustum(frustum, visibleModels);
+    CullModels(frustum, visibleModels.data(), visibleModels.size());
+    visibleModels.erase(std::remove_if(visibleModels.begin(), visibleModels.end(), [](Model* model) { return !model->IsVisible(); }),
+                        visibleModels.end());
+    return visibleModels.size();
+}
+
+// Set the visible flag of each of the given models depending on whether it could cast a shadow visible to the camera
+// for a spotlight with the given frustum and cone. The cone's range is used as the furthest distance shadows reach
+// Returns the number of visible models
+std::size_t CullShadowCasters(const Frustum& lightFrustum, const Cone& lightCone, const Frustum& viewFrustum,
+                              Model* const* models, std::size_t count)
+{
+    GatherSpheres(models, count);
+
+    // Each test is run over all the models, results are combined after each one. The cone is tighter than the
+    // frustum at the corners, the frustum is tighter near the light and limits the depth
+    CullSpheres(lightFrustum, x.data(), y.data(), z.data(), radius.data(), count, visible.data());
+    CullSpheres(lightCone,    x.data(), y.data(), z.data(), radius.data(), count, passed.data());
+    for (std::size_t i = 0; i < count; ++i)  visible[i] &= passed[i];
+    CullShadowSpheres(viewFrustum, lightCone.apex, lightCone.range, x.data(), y.data(), z.data(), radius.data(), count, passed.data());
+
+    std::size_t numVisible = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        bool isVisible = (visible[i] & passed[i]) != 0;
+        models[i]->SetVisible(isVisible);
+        numVisible += isVisible ? 1 : 0;
+    }
+    return numVisible;
+}
+
+
+// Find the models in the tree on the given layers that could cast a shadow visible to the camera, as above. The
+// casters vector is filled with these models, which are also flagged visible. Other models' flags are unchanged
+void CullShadowCasters(const Frustum& lightFrustum, const Cone& lightCone, const Frustum& viewFrustum,
+                       const SceneBVH& bvh, uint32_t layers, std::vector<Model*>& casters)
+{
+    // The tree finds models in the light's frustum, then the remaining tests are run on those only
+    bvh.QueryFrustum(lightFrustum, casters, layers);
+    CullShadowCasters(lightFrustum, lightCone, viewFrustum, casters.data(), casters.size());
+    casters.erase(std::remove_if(casters.begin(), casters.end(), [](Model* model) { return !model->IsVisible(); }), casters.end());
+}
+
+
+// Draw the visible occluders among the given models (see Model::SetOccluder) into the occlusion buffer for a view with
+// the given view-projection matrix, then clear the visible flag of every other visible model hidden behind them.
+// Returns the number of models culled
+std::size_t CullOccludedModels(OcclusionBuffer& buffer, const CMatrix4x4& viewProjectionMatrix,
+                               Model* const* models, std::size_t count)
+{
+    buffer.Clear(viewProjectionMatrix);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        Model* model = models[i];
+        if (model->IsVisible() && model->IsOccluder())
+        {
+            Mesh* mesh = model->GetMesh();
+            buffer.AddOccluder(mesh->Positions().data(), mesh->Positions().size(),
+                               mesh->Indices().data(), mesh->Indices().size(), model->WorldMatrix());
+        }
+    }
+    if (buffer.NumTriangles() == 0)  return 0;
+    buffer.Rasterise();
+
+    std::size_t numCulled = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        Model* model = models[i];
+        if (model->IsVisible() && !model->IsOccluder() && !buffer.IsVisible(model->WorldBoundingBox()))
+        {
+            model->SetVisible(false);
+            ++numCulled;
+        }
+    }
+    return numCulled;
+}
+
+
+// Cull the meshlets of each of the given models that is visible, for a view with the given frustum and viewer
+// position (see Model::CullMeshlets). Returns the total number of meshlets culled
+std::size_t CullMeshlets(const Frustum& frustum, const CVector3& viewPosition, Model* const* models, std::size_t count)
+{
+    std::size_t numCulled = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (models[i]->IsVisible())  numCulled += models[i]->CullMeshlets(frustum, viewPosition);
+    }
+    return numCulled;
+}
@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// Visibility culling - skipping models that cannot be seen
+//--------------------------------------------------------------------------------------
+// Before rendering a view (from the camera or a light), call CullModels with the view's frustum. Each model's
+// visible flag is set, and Model::Render does nothing for models outside the frustum. The world space bounding
+// spheres of all models are gathered into separate x, y, z and radius arrays so they can be tested against the
+// frustum several at a time with SIMD instructions.
+//
+// With a SceneBVH the frustum is tested against the tree first, so only models in parts of the scene that
+// overlap the frustum have their spheres tested.
+//
+// Shadow passes use CullShadowCasters instead. A caster is only rendered if it is inside the light's frustum and
+// cone and if its shadow could reach the camera's view, so lights facing away from the view cost very little.
+//
+// After frustum culling, CullOccludedModels hides visible models that are behind large occluder models such as the
+// ground, using a small depth buffer drawn on the CPU (see OcclusionCulling.h).
+//
+// After whole models are culled (and LODs chosen), CullMeshlets culls the meshlets of visible models (see Meshlets.h)
+// so only the parts of large models that may be seen are drawn.
+
+#include "Bounds.h"
+#include "CVector3.h"
+#include "SceneBVH.h"
+#include "OcclusionCulling.h"
+#include <vector>
+#include <cstddef>
+
+#ifndef _CULLING_H_INCLUDED_
+#define _CULLING_H_INCLUDED_
+
+class Model;
+
+// Set the visible flag of each of the given models depending on whether it is inside the frustum
+// Returns the number of visible models
+std::size_t CullModels(const Frustum& frustum, Model* const* models, std::size_t count);
+
+// Set the visible flag of every model in the tree depending on whether it is inside the frustum. The tree finds the
+// models whose boxes overlap the frustum, then their bounding spheres are tested as above. The visibleModels vector
+// is filled with the visible models, it can be kept between calls to avoid allocations
+// Returns the number of visible models
+std::size_t CullModels(const Frustum& frustum, const SceneBVH& bvh, std::vector<Model*>& visibleModels);
+
+// Set the visible flag of each of the given models depending on whether it could cast a shadow visible to the camera
+// for a spotlight with the given frustum and cone. The cone's range is used as the furthest distance shadows reach
+// Returns the number of visible models
+std::size_t CullShadowCasters(const Frustum& lightFrustum, const Cone& lightCone, const Frustum& viewFrustum,
+                              Model* const* models, std::size_t count);
+
+// Find the models in the tree on the given layers that could cast a shadow visible to the camera, as above. The
+// casters vector is filled with these models, which are also flagged visible. Other models' flags are unchanged
+void CullShadowCasters(const Frustum& lightFrustum, const Cone& lightCone, const Frustum& viewFrustum,
+                       const SceneBVH& bvh, uint32_t layers, std::vector<Model*>& casters);
+
+// Draw the visible occluders among the given models (see Model::SetOccluder) into the occlusion buffer for a view with
+// the given view-projection matrix, then clear the visible flag of every other visible model hidden behind them.
+// Returns the number of models culled
+std::size_t CullOccludedModels(OcclusionBuffer& buffer, const CMatrix4x4& viewProjectionMatrix,
+                               Model* const* models, std::size_t count);
+
+// Cull the meshlets of each of the given models that is visible, for a view with the given frustum and viewer
+// position (see Model::CullMeshlets). Returns the total number of meshlets culled
+std::size_t CullMeshlets(const Frustum& frustum, const CVector3& viewPosition, Model* const* models, std::size_t count);
+
+
+#endif //_CULLING_H_INCLUDED_
@@ -6,6 +6,7 @@
 #include "Shader.h"
 #include "Common.h"
 #include <d3d11.h>
+#include <d3d11_1.h>
 #include <vector>
 
 
@@ -15,8 +16,9 @@
 // Globals used to keep code simpler, but try to architect your own code in a better way
 
 // The main Direct3D (D3D) variables
-ID3D11Device*        gD3DDevice  = nullptr; // D3D device for overall features
-ID3D11DeviceContext* gD3DContext = nullptr; // D3D context for specific rendering tasks
+ID3D11Device*         gD3DDevice   = nullptr; // D3D device for overall features
+ID3D11DeviceContext*  gD3DContext  = nullptr; // D3D context for specific rendering tasks
+ID3D11DeviceContext1* gD3DContext1 = nullptr; // Direct3D 11.1 interface to the same context, nullptr on systems without it
 
 // Swap chain and back buffer
 IDXGISwapChain*         gSwapChain              = nullptr;
@@ -63,6 +65,13 @@ bool InitDirect3D()
         return false;
     }
 
+    // Direct3D 11.1 adds binding part of a constant buffer (see ConstantBufferAllocator.h). Older systems don't have it,
+    // which is not an error - gD3DContext1 is left as nullptr and the code that uses it falls back to other methods
+    if (FAILED(gD3DContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&gD3DContext1))))
+    {
+        gD3DContext1 = nullptr;
+    }
+
 
     // Get a "render target view" of back-buffer - standard behaviour
     ID3D11Texture2D* backBuffer;
@@ -132,6 +141,7 @@ void ShutdownDirect3D()
         gD3DContext->ClearState(); // This line is also needed to reset the GPU before shutting down DirectX
         gD3DContext->Release();
     }
+    if (gD3DContext1)            gD3DContext1->Release();
     if (gDepthStencil)           gDepthStencil->Release();
     if (gDepthStencilTexture)    gDepthStencilTexture->Release();
     if (gBackBufferRenderTarget) gBackBufferRenderTarget->Release();
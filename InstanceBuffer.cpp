@@ -0,0 +1,96 @@
+//--------------------------------------------------------------------------------------
+// Instance buffer - world matrices and colours for instanced draws
+//--------------------------------------------------------------------------------------
+
+#include "InstanceBuffer.h"
+
+
+/*-----------------------------------------------------------------------------------------
+    Construction / Usage
+-----------------------------------------------------------------------------------------*/
+
+// Create the buffer with room for the given number of instances. Returns false on failure, with gLastError set
+bool InstanceBuffer::Create(std::size_t maxInstances)
+{
+    Release();
+
+    D3D11_BUFFER_DESC bufferDesc;
+    bufferDesc.ByteWidth = static_cast<UINT>(maxInstances * sizeof(InstanceData));
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;  // Written by the CPU once per pass
+    bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    bufferDesc.StructureByteStride = sizeof(InstanceData);
+    if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mBuffer)))
+    {
+        mBuffer = nullptr;
+        gLastError = "Error creating instance buffer";
+        return false;
+    }
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = DXGI_FORMAT_UNKNOWN; // Structured buffers have no format, the shader gives the structure
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    srvDesc.Buffer.FirstElement = 0;
+    srvDesc.Buffer.NumElements = static_cast<UINT>(maxInstances);
+    if (FAILED(gD3DDevice->CreateShaderResourceView(mBuffer, &srvDesc, &mSRV)))
+    {
+        mSRV = nullptr;
+        Release();
+        gLastError = "Error creating instance buffer view";
+        return false;
+    }
+
+    mMaxInstances = maxInstances;
+    return true;
+}
+
+
+// Release the buffer, can be created again afterwards
+void InstanceBuffer::Release()
+{
+    Unmap();
+    if (mSRV)     mSRV->Release();
+    if (mBuffer)  mBuffer->Release();
+    mSRV = nullptr;
+    mBuffer = nullptr;
+    mMaxInstances = 0;
+    mNumInstances = 0;
+}
+
+
+// Start filling the buffer, discarding what it held. Returns false if the buffer could not be mapped
+bool InstanceBuffer::Map()
+{
+    if (mBuffer == nullptr)  return false;
+    Unmap();
+
+    // Discarding gives the buffer fresh memory, draws already issued still see the previous contents
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (FAILED(gD3DContext->Map(mBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return false;
+
+    mMapped = static_cast<InstanceData*>(mapped.pData);
+    mNumInstances = 0;
+    return true;
+}
+
+
+// Get space for a batch of instances. Returns a pointer to fill in and the index of the first instance in the
+// buffer, or nullptr if the buffer is full or not mapped
+InstanceData* InstanceBuffer::Allocate(std::size_t numInstances, UINT& firstInstance)
+{
+    if (mMapped == nullptr || numInstances > mMaxInstances - mNumInstances)  return nullptr;
+
+    firstInstance = static_cast<UINT>(mNumInstances);
+    mNumInstances += numInstances;
+    return mMapped + firstInstance;
+}
+
+
+// Finish filling the buffer, must be called before drawing any of its instances
+void InstanceBuffer::Unmap()
+{
+    if (mMapped == nullptr)  return;
+    gD3DContext->Unmap(mBuffer, 0);
+    mMapped = nullptr;
+}
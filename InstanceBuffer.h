@@ -0,0 +1,84 @@
+//--------------------------------------------------------------------------------------
+// Instance buffer - world matrices and colours for instanced draws
+//--------------------------------------------------------------------------------------
+// Many models often share a mesh and material (e.g. the light models, or a crowd of repeated props). Rather than one
+// draw per model, such models can be drawn as a batch with a single instanced draw (see RenderQueue.h). The GPU draws
+// the mesh once per instance and the vertex shader picks the instance's world matrix and colour from this buffer.
+//
+// The buffer is a dynamic structured buffer of InstanceData (see Common.h), filled like the constant buffer allocator:
+//   Map, then Allocate space for each batch and fill in one InstanceData per model
+//   Unmap, then bind the buffer to the vertex shader and draw each batch, passing the index of its first instance
+//   in the per-model constants (firstInstance)
+// The first instance is passed in constants because the GPU numbers each draw's instances from 0, whatever instance
+// the draw starts at. Each Map discards the previous contents, draws already issued keep the contents they were given
+
+#include "Common.h"
+
+#include <cstddef>
+
+#ifndef _INSTANCE_BUFFER_H_INCLUDED_
+#define _INSTANCE_BUFFER_H_INCLUDED_
+
+
+class InstanceBuffer
+{
+public:
+    //-------------------------------------
+    // Construction / Usage
+    //-------------------------------------
+
+    InstanceBuffer() = default;
+    ~InstanceBuffer()  { Release(); }
+
+    // The buffer is a GPU resource, so cannot be copied
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    // Create the buffer with room for the given number of instances. Returns false on failure, with gLastError set
+    bool Create(std::size_t maxInstances);
+
+    // Release the buffer, can be created again afterwards
+    void Release();
+
+
+    // Start filling the buffer, discarding what it held. Returns false if the buffer could not be mapped
+    bool Map();
+
+    // Get space for a batch of instances. Returns a pointer to fill in and the index of the first instance in the
+    // buffer, or nullptr if the buffer is full or not mapped
+    InstanceData* Allocate(std::size_t numInstances, UINT& firstInstance);
+
+    // Finish filling the buffer, must be called before drawing any of its instances
+    void Unmap();
+
+
+    //-------------------------------------
+    // Data access
+    //-------------------------------------
+
+    // Shader access to the buffer, for vertex shaders that draw instances
+    ID3D11ShaderResourceView* SRV()  { return mSRV; }
+
+
+    //-------------------------------------
+    // Private data / members
+    //-------------------------------------
+private:
+    ID3D11Buffer*             mBuffer = nullptr;
+    ID3D11ShaderResourceView* mSRV    = nullptr;
+
+    std::size_t   mMaxInstances = 0;
+    std::size_t   mNumInstances = 0; // Instances allocated since Map
+    InstanceData* mMapped       = nullptr;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Global Variables
+//--------------------------------------------------------------------------------------
+
+// Instance data for every instanced draw in a pass (see RenderQueue::Render), created with the constant buffers
+extern InstanceBuffer gInstanceBuffer;
+
+
+#endif //_INSTANCE_BUFFER_H_INCLUDED_
@@ -1,7 +1,8 @@
 //--------------------------------------------------------------------------------------
 // Light Model Pixel Shader
 //--------------------------------------------------------------------------------------
-// Pixel shader simply samples a diffuse texture map and tints with a fixed colour sent over from the CPU via a constant buffer
+// Pixel shader simply samples a diffuse texture map and tints with a fixed colour sent over from the CPU (via a constant buffer
+// or the instance data for instanced draws, the vertex shader passes it on either way)
 
 #include "Common.hlsli" // Shaders can also use include files - note the extension
 
@@ -30,8 +31,8 @@ float4 main(SimplePixelShaderInput input) : SV_Target
     // Ignoring any gAlpha in the texture, just reading RGB
     float3 diffuseMapColour = DiffuseMap.Sample(TexSampler, input.uv).rgb;
     
-    // Blend texture colour with fixed per-object colour
-    float3 finalColour = gObjectColour * diffuseMapColour;
+    // Blend texture colour with fixed per-object colour, passed on by the vertex shader
+    float3 finalColour = input.objectColour * diffuseMapColour;
 
     return float4(finalColour, 1.0f); // Always use 1.0f for gAlpha - no gAlpha blending in this lab
 }
\ No newline at end of file
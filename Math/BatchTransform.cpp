@@ -0,0 +1,390 @@
+//--------------------------------------------------------------------------------------
+// Transforming arrays of points and normals by a single matrix
+//--------------------------------------------------------------------------------------
+// All layouts are converted to x, y and z registers holding 4 (SSE) or 8 (AVX) vectors, which are
+// transformed together, then converted back. Any remainder that doesn't fill a register is done
+// with plain C++ code.
+
+#include "BatchTransform.h"
+#include "MathSIMD.h"
+
+#include <cstring>
+
+
+/*-----------------------------------------------------------------------------------------
+    Plain C++ versions - used for the remainders and when SIMD is not available
+-----------------------------------------------------------------------------------------*/
+
+// Transform a single vector given as x, y, z. Template parameter selects points (w = 1) or normals (w = 0)
+template <bool IsPoint>
+static inline void TransformOne(const CMatrix4x4& m, float x, float y, float z, float& outX, float& outY, float& outZ)
+{
+    float tx = x * m.e00 + y * m.e10 + z * m.e20;
+    float ty = x * m.e01 + y * m.e11 + z * m.e21;
+    float tz = x * m.e02 + y * m.e12 + z * m.e22;
+    if (IsPoint)
+    {
+        outX = tx + m.e30;
+        outY = ty + m.e31;
+        outZ = tz + m.e32;
+    }
+    else
+    {
+        float lengthSq = tx*tx + ty*ty + tz*tz;
+        float invLength = IsZero(lengthSq) ? 0.0f : InvSqrt(lengthSq);
+        outX = tx * invLength;
+        outY = ty * invLength;
+        outZ = tz * invLength;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    SIMD versions
+-----------------------------------------------------------------------------------------*/
+
+#if defined(MATH_SSE)
+
+// Matrix elements each broadcast to every element of a register. Plain structures rather than one template for
+// both register types, as GCC warns that the attributes of __m128 / __m256 are ignored in template arguments
+struct BroadcastMatrix4
+{
+    __m128 e00, e01, e02;
+    __m128 e10, e11, e12;
+    __m128 e20, e21, e22;
+    __m128 e30, e31, e32;
+};
+
+static inline BroadcastMatrix4 Broadcast4(const CMatrix4x4& m)
+{
+    return { _mm_set1_ps(m.e00), _mm_set1_ps(m.e01), _mm_set1_ps(m.e02),
+             _mm_set1_ps(m.e10), _mm_set1_ps(m.e11), _mm_set1_ps(m.e12),
+             _mm_set1_ps(m.e20), _mm_set1_ps(m.e21), _mm_set1_ps(m.e22),
+             _mm_set1_ps(m.e30), _mm_set1_ps(m.e31), _mm_set1_ps(m.e32) };
+}
+
+// Transform 4 vectors held as x, y and z registers, in place
+template <bool IsPoint>
+static inline void Transform4(const BroadcastMatrix4& m, __m128& x, __m128& y, __m128& z)
+{
+    __m128 tx = IsPoint ? MulAdd(x, m.e00, m.e30) : _mm_mul_ps(x, m.e00);
+    __m128 ty = IsPoint ? MulAdd(x, m.e01, m.e31) : _mm_mul_ps(x, m.e01);
+    __m128 tz = IsPoint ? MulAdd(x, m.e02, m.e32) : _mm_mul_ps(x, m.e02);
+    tx = MulAdd(y, m.e10, tx);
+    ty = MulAdd(y, m.e11, ty);
+    tz = MulAdd(y, m.e12, tz);
+    tx = MulAdd(z, m.e20, tx);
+    ty = MulAdd(z, m.e21, ty);
+    tz = MulAdd(z, m.e22, tz);
+
+    if (!IsPoint)
+    {
+        // Approximate reciprocal square root refined with one Newton-Raphson step, masked to zero for zero length normals
+        __m128 lengthSq = MulAdd(tx, tx, MulAdd(ty, ty, _mm_mul_ps(tz, tz)));
+        __m128 r = _mm_rsqrt_ps(lengthSq);
+        r = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), r), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(lengthSq, r), r)));
+        r = _mm_and_ps(r, _mm_cmpge_ps(lengthSq, _mm_set1_ps(EPSILON)));
+        tx = _mm_mul_ps(tx, r);
+        ty = _mm_mul_ps(ty, r);
+        tz = _mm_mul_ps(tz, r);
+    }
+
+    x = tx;
+    y = ty;
+    z = tz;
+}
+
+// Load 4 CVector3s into x, y, z registers. 4 CVector3s are exactly 3 registers: (x0 y0 z0 x1) (y1 z1 x2 y2) (z2 x3 y3 z3)
+static inline void LoadVector3s4(const float* src, __m128& x, __m128& y, __m128& z)
+{
+    __m128 v0 = _mm_loadu_ps(src + 0);
+    __m128 v1 = _mm_loadu_ps(src + 4);
+    __m128 v2 = _mm_loadu_ps(src + 8);
+
+    x = _mm_shuffle_ps(v0, _mm_shuffle_ps(v1, v2, MATH_SHUFFLE(2,2,1,1)), MATH_SHUFFLE(0,3,0,2));
+    y = _mm_shuffle_ps(_mm_shuffle_ps(v0, v1, MATH_SHUFFLE(1,1,0,0)), _mm_shuffle_ps(v1, v2, MATH_SHUFFLE(3,3,2,2)), MATH_SHUFFLE(0,2,0,2));
+    z = _mm_shuffle_ps(_mm_shuffle_ps(v0, v1, MATH_SHUFFLE(2,2,1,1)), _mm_shuffle_ps(v2, v2, MATH_SHUFFLE(0,0,3,3)), MATH_SHUFFLE(0,2,0,2));
+}
+
+#if defined(MATH_AVX)
+struct BroadcastMatrix8
+{
+    __m256 e00, e01, e02;
+    __m256 e10, e11, e12;
+    __m256 e20, e21, e22;
+    __m256 e30, e31, e32;
+};
+
+static inline BroadcastMatrix8 Broadcast8(const CMatrix4x4& m)
+{
+    return { _mm256_set1_ps(m.e00), _mm256_set1_ps(m.e01), _mm256_set1_ps(m.e02),
+             _mm256_set1_ps(m.e10), _mm256_set1_ps(m.e11), _mm256_set1_ps(m.e12),
+             _mm256_set1_ps(m.e20), _mm256_set1_ps(m.e21), _mm256_set1_ps(m.e22),
+             _mm256_set1_ps(m.e30), _mm256_set1_ps(m.e31), _mm256_set1_ps(m.e32) };
+}
+
+// Transform 8 vectors held as x, y and z registers, in place
+template <bool IsPoint>
+static inline void Transform8(const BroadcastMatrix8& m, __m256& x, __m256& y, __m256& z)
+{
+    __m256 tx = IsPoint ? MulAdd(x, m.e00, m.e30) : _mm256_mul_ps(x, m.e00);
+    __m256 ty = IsPoint ? MulAdd(x, m.e01, m.e31) : _mm256_mul_ps(x, m.e01);
+    __m256 tz = IsPoint ? MulAdd(x, m.e02, m.e32) : _mm256_mul_ps(x, m.e02);
+    tx = MulAdd(y, m.e10, tx);
+    ty = MulAdd(y, m.e11, ty);
+    tz = MulAdd(y, m.e12, tz);
+    tx = MulAdd(z, m.e20, tx);
+    ty = MulAdd(z, m.e21, ty);
+    tz = MulAdd(z, m.e22, tz);
+
+    if (!IsPoint)
+    {
+        __m256 lengthSq = MulAdd(tx, tx, MulAdd(ty, ty, _mm256_mul_ps(tz, tz)));
+        __m256 r = _mm256_rsqrt_ps(lengthSq);
+        r = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), r), _mm256_sub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(_mm256_mul_ps(lengthSq, r), r)));
+        r = _mm256_and_ps(r, _mm256_cmp_ps(lengthSq, _mm256_set1_ps(EPSILON), _CMP_GE_OQ));
+        tx = _mm256_mul_ps(tx, r);
+        ty = _mm256_mul_ps(ty, r);
+        tz = _mm256_mul_ps(tz, r);
+    }
+
+    x = tx;
+    y = ty;
+    z = tz;
+}
+#endif // MATH_AVX
+
+#endif // MATH_SSE
+
+
+/*-----------------------------------------------------------------------------------------
+    Array of CVector3
+-----------------------------------------------------------------------------------------*/
+
+template <bool IsPoint>
+static void TransformArray(const CMatrix4x4& m, const CVector3* in, CVector3* out, std::size_t count)
+{
+    std::size_t i = 0;
+
+#if defined(MATH_SSE)
+    // Shuffle 4 CVector3s into x, y, z registers, transform, then shuffle back
+    BroadcastMatrix4 bm = Broadcast4(m);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x, y, z;
+        LoadVector3s4(&in[i].x, x, y, z);
+
+        Transform4<IsPoint>(bm, x, y, z);
+
+        __m128 v0 = _mm_shuffle_ps(_mm_shuffle_ps(x, y, MATH_SHUFFLE(0,0,0,0)), _mm_shuffle_ps(z, x, MATH_SHUFFLE(0,0,1,1)), MATH_SHUFFLE(0,2,0,2));
+        __m128 v1 = _mm_shuffle_ps(_mm_shuffle_ps(y, z, MATH_SHUFFLE(1,1,1,1)), _mm_shuffle_ps(x, y, MATH_SHUFFLE(2,2,2,2)), MATH_SHUFFLE(0,2,0,2));
+        __m128 v2 = _mm_shuffle_ps(_mm_shuffle_ps(z, x, MATH_SHUFFLE(2,2,3,3)), _mm_shuffle_ps(y, z, MATH_SHUFFLE(3,3,3,3)), MATH_SHUFFLE(0,2,0,2));
+
+        float* dest = &out[i].x;
+        _mm_storeu_ps(dest + 0, v0);
+        _mm_storeu_ps(dest + 4, v1);
+        _mm_storeu_ps(dest + 8, v2);
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        TransformOne<IsPoint>(m, in[i].x, in[i].y, in[i].z, out[i].x, out[i].y, out[i].z);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Separate x, y, z arrays
+-----------------------------------------------------------------------------------------*/
+
+template <bool IsPoint>
+static void TransformSoA(const CMatrix4x4& m, const float* inX, const float* inY, const float* inZ,
+                                              float* outX, float* outY, float* outZ, std::size_t count)
+{
+    std::size_t i = 0;
+
+#if defined(MATH_AVX)
+    BroadcastMatrix8 bm8 = Broadcast8(m);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(inX + i);
+        __m256 y = _mm256_loadu_ps(inY + i);
+        __m256 z = _mm256_loadu_ps(inZ + i);
+        Transform8<IsPoint>(bm8, x, y, z);
+        _mm256_storeu_ps(outX + i, x);
+        _mm256_storeu_ps(outY + i, y);
+        _mm256_storeu_ps(outZ + i, z);
+    }
+#endif
+
+#if defined(MATH_SSE)
+    BroadcastMatrix4 bm = Broadcast4(m);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(inX + i);
+        __m128 y = _mm_loadu_ps(inY + i);
+        __m128 z = _mm_loadu_ps(inZ + i);
+        Transform4<IsPoint>(bm, x, y, z);
+        _mm_storeu_ps(outX + i, x);
+        _mm_storeu_ps(outY + i, y);
+        _mm_storeu_ps(outZ + i, z);
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        TransformOne<IsPoint>(m, inX[i], inY[i], inZ[i], outX[i], outY[i], outZ[i]);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Interleaved data
+-----------------------------------------------------------------------------------------*/
+
+template <bool IsPoint>
+static void TransformStrided(const CMatrix4x4& m, const void* in, std::size_t inStride, void* out, std::size_t outStride, std::size_t count)
+{
+    const unsigned char* src = static_cast<const unsigned char*>(in);
+    unsigned char* dest = static_cast<unsigned char*>(out);
+    std::size_t i = 0;
+
+#if defined(MATH_SSE)
+    // Read 4 vectors as full registers (the 4th float is whatever follows in the vertex), transpose into
+    // x, y, z registers, transform, then transpose back and write only 3 floats for each. Reading 4 floats
+    // is only safe if the stride is at least that large and there is another vector following, so the
+    // last vector is always left for the plain C++ code below
+    if (inStride >= 4 * sizeof(float))
+    {
+        BroadcastMatrix4 bm = Broadcast4(m);
+        for (; i + 4 < count; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(reinterpret_cast<const float*>(src + (i + 0) * inStride));
+            __m128 y = _mm_loadu_ps(reinterpret_cast<const float*>(src + (i + 1) * inStride));
+            __m128 z = _mm_loadu_ps(reinterpret_cast<const float*>(src + (i + 2) * inStride));
+            __m128 w = _mm_loadu_ps(reinterpret_cast<const float*>(src + (i + 3) * inStride));
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+
+            Transform4<IsPoint>(bm, x, y, z);
+
+            w = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            __m128 results[4] = { x, y, z, w };
+            for (int j = 0; j < 4; ++j)
+            {
+                float* v = reinterpret_cast<float*>(dest + (i + j) * outStride);
+                _mm_storel_pi(reinterpret_cast<__m64*>(v), results[j]);
+                _mm_store_ss(v + 2, _mm_movehl_ps(results[j], results[j]));
+            }
+        }
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        float v[3];
+        std::memcpy(v, src + i * inStride, sizeof(v));
+        TransformOne<IsPoint>(m, v[0], v[1], v[2], v[0], v[1], v[2]);
+        std::memcpy(dest + i * outStride, v, sizeof(v));
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Homogeneous output
+-----------------------------------------------------------------------------------------*/
+
+// Transform an array of points by a full 4x4 matrix, writing x, y, z, w for each. No perspective division is performed
+static void TransformArrayHomogeneous(const CMatrix4x4& m, const CVector3* in, float* out, std::size_t count)
+{
+    std::size_t i = 0;
+
+#if defined(MATH_SSE)
+    // Shuffle 4 CVector3s into x, y, z registers, transform into x, y, z, w registers, then transpose those to give the
+    // 4 output points. The AVX build uses this too, its advantage is lost in the shuffles
+    __m128 e00 = _mm_set1_ps(m.e00), e01 = _mm_set1_ps(m.e01), e02 = _mm_set1_ps(m.e02), e03 = _mm_set1_ps(m.e03);
+    __m128 e10 = _mm_set1_ps(m.e10), e11 = _mm_set1_ps(m.e11), e12 = _mm_set1_ps(m.e12), e13 = _mm_set1_ps(m.e13);
+    __m128 e20 = _mm_set1_ps(m.e20), e21 = _mm_set1_ps(m.e21), e22 = _mm_set1_ps(m.e22), e23 = _mm_set1_ps(m.e23);
+    __m128 e30 = _mm_set1_ps(m.e30), e31 = _mm_set1_ps(m.e31), e32 = _mm_set1_ps(m.e32), e33 = _mm_set1_ps(m.e33);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x, y, z;
+        LoadVector3s4(&in[i].x, x, y, z);
+
+        __m128 tx = MulAdd(z, e20, MulAdd(y, e10, MulAdd(x, e00, e30)));
+        __m128 ty = MulAdd(z, e21, MulAdd(y, e11, MulAdd(x, e01, e31)));
+        __m128 tz = MulAdd(z, e22, MulAdd(y, e12, MulAdd(x, e02, e32)));
+        __m128 tw = MulAdd(z, e23, MulAdd(y, e13, MulAdd(x, e03, e33)));
+        _MM_TRANSPOSE4_PS(tx, ty, tz, tw);
+
+        float* dest = out + i * 4;
+        _mm_storeu_ps(dest + 0,  tx);
+        _mm_storeu_ps(dest + 4,  ty);
+        _mm_storeu_ps(dest + 8,  tz);
+        _mm_storeu_ps(dest + 12, tw);
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        const CVector3& p = in[i];
+        float* v = out + i * 4;
+        v[0] = p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30;
+        v[1] = p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31;
+        v[2] = p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32;
+        v[3] = p.x * m.e03 + p.y * m.e13 + p.z * m.e23 + m.e33;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Public functions
+-----------------------------------------------------------------------------------------*/
+
+// Transform an array of points
+void TransformPoints(const CMatrix4x4& m, const CVector3* in, CVector3* out, std::size_t count)
+{
+    TransformArray<true>(m, in, out, count);
+}
+
+// Transform points stored as separate x, y and z arrays
+void TransformPoints(const CMatrix4x4& m, const float* inX, const float* inY, const float* inZ,
+                                          float* outX, float* outY, float* outZ, std::size_t count)
+{
+    TransformSoA<true>(m, inX, inY, inZ, outX, outY, outZ, count);
+}
+
+// Transform points in interleaved data. Pointers are to the first point, strides are the byte distance between points
+void TransformPoints(const CMatrix4x4& m, const void* in, std::size_t inStride, void* out, std::size_t outStride, std::size_t count)
+{
+    TransformStrided<true>(m, in, inStride, out, outStride, count);
+}
+
+
+// Transform an array of normals
+void TransformNormals(const CMatrix4x4& m, const CVector3* in, CVector3* out, std::size_t count)
+{
+    TransformArray<false>(m, in, out, count);
+}
+
+// Transform normals stored as separate x, y and z arrays
+void TransformNormals(const CMatrix4x4& m, const float* inX, const float* inY, const float* inZ,
+                                           float* outX, float* outY, float* outZ, std::size_t count)
+{
+    TransformSoA<false>(m, inX, inY, inZ, outX, outY, outZ, count);
+}
+
+// Transform normals in interleaved data. Pointers are to the first normal, strides are the byte distance between normals
+void TransformNormals(const CMatrix4x4& m, const void* in, std::size_t inStride, void* out, std::size_t outStride, std::size_t count)
+{
+    TransformStrided<false>(m, in, inStride, out, outStride, count);
+}
+
+
+// Transform an array of points by a full 4x4 matrix (e.g. world-view-projection), writing x, y, z, w for each point
+// to out, which must have room for count * 4 floats
+void TransformPointsHomogeneous(const CMatrix4x4& m, const CVector3* in, float* out, std::size_t count)
+{
+    TransformArrayHomogeneous(m, in, out, count);
+}
@@ -0,0 +1,66 @@
+//--------------------------------------------------------------------------------------
+// Transforming arrays of points and normals by a single matrix
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Much faster than transforming CVector3s one at a time in a loop - several vectors are processed
+// together with SIMD instructions. Useful for CPU-side work on whole meshes such as calculating
+// bounds, picking or skinning. Three data layouts are supported:
+//   - Arrays of CVector3 (array of structures)
+//   - Separate arrays of x, y and z values (structure of arrays) - the fastest layout
+//   - Points or normals inside interleaved vertex data, e.g. the CPU copy of a mesh's vertex buffer
+//     where each vertex is mVertexSize bytes. Pass a pointer to the first point and the stride in bytes
+// Transformations assume an affine matrix, except TransformPointsHomogeneous which outputs w for projection matrices.
+// No perspective division is performed
+// Output may be the same array as the input, but otherwise the two must not overlap
+
+#ifndef _BATCH_TRANSFORM_H_DEFINED_
+#define _BATCH_TRANSFORM_H_DEFINED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include <cstddef>
+
+
+/*-----------------------------------------------------------------------------------------
+    Points - transformed with position (w = 1)
+-----------------------------------------------------------------------------------------*/
+
+// Transform an array of points
+void TransformPoints(const CMatrix4x4& m, const CVector3* in, CVector3* out, std::size_t count);
+
+// Transform points stored as separate x, y and z arrays
+void TransformPoints(const CMatrix4x4& m, const float* inX, const float* inY, const float* inZ,
+                                          float* outX, float* outY, float* outZ, std::size_t count);
+
+// Transform points in interleaved data. Pointers are to the first point, strides are the byte distance between points
+void TransformPoints(const CMatrix4x4& m, const void* in, std::size_t inStride, void* out, std::size_t outStride, std::size_t count);
+
+
+/*-----------------------------------------------------------------------------------------
+    Normals - transformed without position (w = 0) then renormalised
+-----------------------------------------------------------------------------------------*/
+// For matrices with non-uniform scaling pass the transpose of the inverse of the matrix used for the points.
+// Zero length normals remain zero length
+
+// Transform an array of normals
+void TransformNormals(const CMatrix4x4& m, const CVector3* in, CVector3* out, std::size_t count);
+
+// Transform normals stored as separate x, y and z arrays
+void TransformNormals(const CMatrix4x4& m, const float* inX, const float* inY, const float* inZ,
+                                           float* outX, float* outY, float* outZ, std::size_t count);
+
+// Transform normals in interleaved data. Pointers are to the first normal, strides are the byte distance between normals
+void TransformNormals(const CMatrix4x4& m, const void* in, std::size_t inStride, void* out, std::size_t outStride, std::size_t count);
+
+
+
+/*-----------------------------------------------------------------------------------------
+    Points to homogeneous coordinates - transformed by a full 4x4 matrix
+-----------------------------------------------------------------------------------------*/
+
+// Transform an array of points by a full 4x4 matrix (e.g. world-view-projection), writing x, y, z, w for each point
+// to out, which must have room for count * 4 floats
+void TransformPointsHomogeneous(const CMatrix4x4& m, const CVector3* in, float* out, std::size_t count);
+
+
+#endif // _BATCH_TRANSFORM_H_DEFINED_
@@ -0,0 +1,456 @@
+//--------------------------------------------------------------------------------------
+// Bounding volumes and view frustums, used for visibility culling
+//--------------------------------------------------------------------------------------
+
+#include "Bounds.h"
+#include "MathSIMD.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+/*-----------------------------------------------------------------------------------------
+    Creating bounds
+-----------------------------------------------------------------------------------------*/
+
+// Return a box around the given points. Point pointer and stride in bytes allow points in interleaved vertex data
+AABB BoundingBoxFromPoints(const void* points, std::size_t stride, std::size_t count)
+{
+    if (count == 0)  return { { 0, 0, 0 }, { 0, 0, 0 } };
+
+    const unsigned char* point = static_cast<const unsigned char*>(points);
+    CVector3 p;
+    std::memcpy(&p, point, sizeof(CVector3));
+    AABB box = { p, p };
+    for (std::size_t i = 1; i < count; ++i)
+    {
+        point += stride;
+        std::memcpy(&p, point, sizeof(CVector3));
+        box.minPoint = { std::min(box.minPoint.x, p.x), std::min(box.minPoint.y, p.y), std::min(box.minPoint.z, p.z) };
+        box.maxPoint = { std::max(box.maxPoint.x, p.x), std::max(box.maxPoint.y, p.y), std::max(box.maxPoint.z, p.z) };
+    }
+    return box;
+}
+
+
+// Return a sphere around the given points, centred at the centre of the given box around the same points
+Sphere BoundingSphereFromPoints(const void* points, std::size_t stride, std::size_t count, const AABB& box)
+{
+    Sphere sphere = { (box.minPoint + box.maxPoint) * 0.5f, 0.0f };
+
+    // Radius is the distance to the furthest point from the centre
+    const unsigned char* point = static_cast<const unsigned char*>(points);
+    float radiusSq = 0.0f;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        CVector3 p;
+        std::memcpy(&p, point, sizeof(CVector3));
+        CVector3 offset = p - sphere.centre;
+        radiusSq = std::max(radiusSq, Dot(offset, offset));
+        point += stride;
+    }
+    sphere.radius = std::sqrt(radiusSq);
+    return sphere;
+}
+
+
+// Return the frustum for a view-projection matrix, planes are normalised
+// Uses the DirectX convention for clip space depth (0 to 1). Pass a world-view-projection matrix to get the
+// frustum in model space instead of world space
+Frustum FrustumFromMatrix(const CMatrix4x4& m)
+{
+    // Points are multiplied as rows (p * m), so clip space x = Dot(p, column 0) + e30 etc. A point is inside when
+    // -w <= x <= w, -w <= y <= w and 0 <= z <= w, each of these is one plane built from matrix columns
+    Plane x = { { m.e00, m.e10, m.e20 }, m.e30 };
+    Plane y = { { m.e01, m.e11, m.e21 }, m.e31 };
+    Plane z = { { m.e02, m.e12, m.e22 }, m.e32 };
+    Plane w = { { m.e03, m.e13, m.e23 }, m.e33 };
+
+    Frustum frustum;
+    frustum.planes[0] = { w.normal + x.normal, w.d + x.d }; // Left
+    frustum.planes[1] = { w.normal - x.normal, w.d - x.d }; // Right
+    frustum.planes[2] = { w.normal + y.normal, w.d + y.d }; // Bottom
+    frustum.planes[3] = { w.normal - y.normal, w.d - y.d }; // Top
+    frustum.planes[4] = z;                                  // Near
+    frustum.planes[5] = { w.normal - z.normal, w.d - z.d }; // Far
+
+    // Normalise so plane equations give true distances, needed to compare against sphere radius
+    for (auto& plane : frustum.planes)
+    {
+        float invLength = 1.0f / Length(plane.normal);
+        plane.normal *= invLength;
+        plane.d *= invLength;
+    }
+    return frustum;
+}
+
+
+// Return the smallest box containing both the given boxes
+AABB MergeBoxes(const AABB& a, const AABB& b)
+{
+    return { { std::min(a.minPoint.x, b.minPoint.x), std::min(a.minPoint.y, b.minPoint.y), std::min(a.minPoint.z, b.minPoint.z) },
+             { std::max(a.maxPoint.x, b.maxPoint.x), std::max(a.maxPoint.y, b.maxPoint.y), std::max(a.maxPoint.z, b.maxPoint.z) } };
+}
+
+// Surface area of a box, used to judge how well a group of boxes fits together
+float SurfaceArea(const AABB& box)
+{
+    CVector3 size = box.maxPoint - box.minPoint;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Transforming bounds
+-----------------------------------------------------------------------------------------*/
+
+// Return a box containing the given box after it is transformed by the given matrix (usually a world matrix)
+AABB TransformBoundingBox(const AABB& box, const CMatrix4x4& m)
+{
+    // Transform the centre, then find the extent of the box along each world axis from the absolute values
+    // of the matrix - avoids transforming all eight corners
+    CVector3 centre = (box.minPoint + box.maxPoint) * 0.5f;
+    CVector3 extent = (box.maxPoint - box.minPoint) * 0.5f;
+
+    CVector3 newCentre = { centre.x * m.e00 + centre.y * m.e10 + centre.z * m.e20 + m.e30,
+                           centre.x * m.e01 + centre.y * m.e11 + centre.z * m.e21 + m.e31,
+                           centre.x * m.e02 + centre.y * m.e12 + centre.z * m.e22 + m.e32 };
+    CVector3 newExtent = { extent.x * std::abs(m.e00) + extent.y * std::abs(m.e10) + extent.z * std::abs(m.e20),
+                           extent.x * std::abs(m.e01) + extent.y * std::abs(m.e11) + extent.z * std::abs(m.e21),
+                           extent.x * std::abs(m.e02) + extent.y * std::abs(m.e12) + extent.z * std::abs(m.e22) };
+
+    return { newCentre - newExtent, newCentre + newExtent };
+}
+
+
+// Return the given sphere after it is transformed by the given matrix (usually a world matrix). With non-uniform
+// scaling the largest scale is used, so the sphere still contains everything it did before
+Sphere TransformBoundingSphere(const Sphere& sphere, const CMatrix4x4& m)
+{
+    const CVector3& c = sphere.centre;
+    CVector3 newCentre = { c.x * m.e00 + c.y * m.e10 + c.z * m.e20 + m.e30,
+                           c.x * m.e01 + c.y * m.e11 + c.z * m.e21 + m.e31,
+                           c.x * m.e02 + c.y * m.e12 + c.z * m.e22 + m.e32 };
+
+    float scaleSq = std::max(std::max(m.e00 * m.e00 + m.e01 * m.e01 + m.e02 * m.e02,
+                                      m.e10 * m.e10 + m.e11 * m.e11 + m.e12 * m.e12),
+                                      m.e20 * m.e20 + m.e21 * m.e21 + m.e22 * m.e22);
+    return { newCentre, sphere.radius * std::sqrt(scaleSq) };
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Visibility tests
+-----------------------------------------------------------------------------------------*/
+
+// Return true if the sphere is partly or wholly inside the frustum
+bool IsVisible(const Frustum& frustum, const Sphere& sphere)
+{
+    for (auto& plane : frustum.planes)
+    {
+        if (Dot(plane.normal, sphere.centre) + plane.d < -sphere.radius)  return false;
+    }
+    return true;
+}
+
+
+// Return true if the box is partly or wholly inside the frustum
+bool IsVisible(const Frustum& frustum, const AABB& box)
+{
+    // For each plane test the corner of the box furthest in the direction of the plane normal
+    for (auto& plane : frustum.planes)
+    {
+        CVector3 corner = { plane.normal.x >= 0 ? box.maxPoint.x : box.minPoint.x,
+                            plane.normal.y >= 0 ? box.maxPoint.y : box.minPoint.y,
+                            plane.normal.z >= 0 ? box.maxPoint.z : box.minPoint.z };
+        if (Dot(plane.normal, corner) + plane.d < 0)  return false;
+    }
+    return true;
+}
+
+
+// Return true if the sphere is partly or wholly inside the cone
+bool IsVisible(const Cone& cone, const Sphere& sphere)
+{
+    // Distance along the cone axis and from the axis, then distance from the cone's surface using the angle
+    CVector3 offset = sphere.centre - cone.apex;
+    float alongAxis = Dot(offset, cone.direction);
+    float fromAxis  = std::sqrt(std::max(Dot(offset, offset) - alongAxis * alongAxis, 0.0f));
+    float fromSurface = std::cos(cone.halfAngle) * fromAxis - std::sin(cone.halfAngle) * alongAxis;
+    return fromSurface <= sphere.radius && alongAxis >= -sphere.radius && alongAxis <= cone.range + sphere.radius;
+}
+
+
+// Return true if the shadow cast by the sphere from a point light could be partly or wholly inside the frustum
+bool IsShadowVisible(const Frustum& frustum, const CVector3& lightPosition, float range, const Sphere& sphere)
+{
+    // The shadow is the cone from the light through the sphere, cut off at range. This is contained by the sphere
+    // together with a copy of it scaled away from the light to reach range. The shadow is outside the frustum if
+    // both of these are outside the same plane
+    float distance = Length(sphere.centre - lightPosition);
+    if (distance <= sphere.radius)  return true; // Light inside sphere, shadow everywhere
+    float scale = std::max(range / distance, 1.0f);
+
+    for (auto& plane : frustum.planes)
+    {
+        float lightDistance  = Dot(plane.normal, lightPosition) + plane.d;
+        float sphereDistance = Dot(plane.normal, sphere.centre) + plane.d;
+        float farDistance    = lightDistance + scale * (sphereDistance - lightDistance);
+        if (sphereDistance < -sphere.radius && farDistance < -sphere.radius * scale)  return false;
+    }
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Batch visibility tests
+-----------------------------------------------------------------------------------------*/
+// Each test is written once as a template and used with 4-wide (SSE) and 8-wide (AVX) registers. The
+// registers hold the same value for several spheres, and the frustum/cone values are broadcast into registers.
+// Tests produce a bit mask of visible spheres, which is written out to the visible array by CullBlocks
+namespace
+{
+#if defined(MATH_SSE)
+    struct SSE
+    {
+        typedef __m128 Reg;
+        static const int width = 4;
+        static Reg  Load(const float* p)   { return _mm_loadu_ps(p); }
+        static Reg  Set (float f)          { return _mm_set1_ps(f); }
+        static Reg  Add (Reg a, Reg b)     { return _mm_add_ps(a, b); }
+        static Reg  Sub (Reg a, Reg b)     { return _mm_sub_ps(a, b); }
+        static Reg  Mul (Reg a, Reg b)     { return _mm_mul_ps(a, b); }
+        static Reg  Div (Reg a, Reg b)     { return _mm_div_ps(a, b); }
+        static Reg  Max (Reg a, Reg b)     { return _mm_max_ps(a, b); }
+        static Reg  Sqrt(Reg a)            { return _mm_sqrt_ps(a); }
+        static Reg  Or  (Reg a, Reg b)     { return _mm_or_ps(a, b); }
+        static Reg  And (Reg a, Reg b)     { return _mm_and_ps(a, b); }
+        static Reg  Less(Reg a, Reg b)     { return _mm_cmplt_ps(a, b); }
+        static int  Mask(Reg a)            { return _mm_movemask_ps(a); } // Sign bit of each element
+    };
+#endif
+
+#if defined(MATH_AVX)
+    struct AVX
+    {
+        typedef __m256 Reg;
+        static const int width = 8;
+        static Reg  Load(const float* p)   { return _mm256_loadu_ps(p); }
+        static Reg  Set (float f)          { return _mm256_set1_ps(f); }
+        static Reg  Add (Reg a, Reg b)     { return _mm256_add_ps(a, b); }
+        static Reg  Sub (Reg a, Reg b)     { return _mm256_sub_ps(a, b); }
+        static Reg  Mul (Reg a, Reg b)     { return _mm256_mul_ps(a, b); }
+        static Reg  Div (Reg a, Reg b)     { return _mm256_div_ps(a, b); }
+        static Reg  Max (Reg a, Reg b)     { return _mm256_max_ps(a, b); }
+        static Reg  Sqrt(Reg a)            { return _mm256_sqrt_ps(a); }
+        static Reg  Or  (Reg a, Reg b)     { return _mm256_or_ps(a, b); }
+        static Reg  And (Reg a, Reg b)     { return _mm256_and_ps(a, b); }
+        static Reg  Less(Reg a, Reg b)     { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static int  Mask(Reg a)            { return _mm256_movemask_ps(a); }
+    };
+#endif
+
+#if defined(MATH_SSE)
+    // Distance of several points from a plane
+    template <typename S>
+    inline typename S::Reg PlaneDistance(const Plane& plane, typename S::Reg x, typename S::Reg y, typename S::Reg z)
+    {
+        typename S::Reg distance = MulAdd(x, S::Set(plane.normal.x), S::Set(plane.d));
+        distance = MulAdd(y, S::Set(plane.normal.y), distance);
+        return MulAdd(z, S::Set(plane.normal.z), distance);
+    }
+
+    // Visible spheres for frustum culling
+    template <typename S>
+    inline int FrustumMask(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius)
+    {
+        typename S::Reg sx = S::Load(x), sy = S::Load(y), sz = S::Load(z);
+        typename S::Reg negRadius = S::Sub(S::Set(0.0f), S::Load(radius));
+        typename S::Reg outside = S::Set(0.0f);
+        for (auto& plane : frustum.planes)
+        {
+            outside = S::Or(outside, S::Less(PlaneDistance<S>(plane, sx, sy, sz), negRadius));
+        }
+        return ~S::Mask(outside);
+    }
+
+    // Visible spheres for cone culling, same maths as IsVisible for cones
+    template <typename S>
+    inline int ConeMask(const Cone& cone, const float* x, const float* y, const float* z, const float* radius)
+    {
+        typename S::Reg ox = S::Sub(S::Load(x), S::Set(cone.apex.x));
+        typename S::Reg oy = S::Sub(S::Load(y), S::Set(cone.apex.y));
+        typename S::Reg oz = S::Sub(S::Load(z), S::Set(cone.apex.z));
+        typename S::Reg r  = S::Load(radius);
+
+        typename S::Reg alongAxis = MulAdd(ox, S::Set(cone.direction.x), MulAdd(oy, S::Set(cone.direction.y), S::Mul(oz, S::Set(cone.direction.z))));
+        typename S::Reg lengthSq  = MulAdd(ox, ox, MulAdd(oy, oy, S::Mul(oz, oz)));
+        typename S::Reg fromAxis  = S::Sqrt(S::Max(S::Sub(lengthSq, S::Mul(alongAxis, alongAxis)), S::Set(0.0f)));
+        typename S::Reg fromSurface = S::Sub(S::Mul(S::Set(std::cos(cone.halfAngle)), fromAxis), S::Mul(S::Set(std::sin(cone.halfAngle)), alongAxis));
+
+        typename S::Reg outside = S::Less(r, fromSurface);
+        outside = S::Or(outside, S::Less(alongAxis, S::Sub(S::Set(0.0f), r)));
+        outside = S::Or(outside, S::Less(S::Add(S::Set(cone.range), r), alongAxis));
+        return ~S::Mask(outside);
+    }
+
+    // Spheres whose shadow may be visible, same maths as IsShadowVisible
+    template <typename S>
+    inline int ShadowMask(const Frustum& frustum, const CVector3& lightPosition, float range,
+                          const float* x, const float* y, const float* z, const float* radius)
+    {
+        typename S::Reg sx = S::Load(x), sy = S::Load(y), sz = S::Load(z), r = S::Load(radius);
+        typename S::Reg ox = S::Sub(sx, S::Set(lightPosition.x));
+        typename S::Reg oy = S::Sub(sy, S::Set(lightPosition.y));
+        typename S::Reg oz = S::Sub(sz, S::Set(lightPosition.z));
+        typename S::Reg distance = S::Sqrt(MulAdd(ox, ox, MulAdd(oy, oy, S::Mul(oz, oz))));
+        typename S::Reg lightOutside = S::Less(r, distance);
+        typename S::Reg scale = S::Max(S::Div(S::Set(range), S::Max(distance, S::Set(1e-6f))), S::Set(1.0f));
+        typename S::Reg negRadius = S::Sub(S::Set(0.0f), r);
+        typename S::Reg negFarRadius = S::Mul(negRadius, scale);
+
+        typename S::Reg outside = S::Set(0.0f);
+        for (auto& plane : frustum.planes)
+        {
+            typename S::Reg lightDistance  = S::Set(Dot(plane.normal, lightPosition) + plane.d);
+            typename S::Reg sphereDistance = PlaneDistance<S>(plane, sx, sy, sz);
+            typename S::Reg farDistance    = MulAdd(scale, S::Sub(sphereDistance, lightDistance), lightDistance);
+            outside = S::Or(outside, S::And(S::Less(sphereDistance, negRadius), S::Less(farDistance, negFarRadius)));
+        }
+        return ~S::Mask(outside) | ~S::Mask(lightOutside); // Light inside sphere, shadow everywhere
+    }
+
+    // Run a mask function on blocks of spheres the width of the registers, writing the results to the visible array.
+    // Updates i to the first sphere not processed and adds to the visible count
+    template <typename S, typename MaskFunction>
+    inline void CullBlocks(std::size_t& i, std::size_t count, uint8_t* visible, std::size_t& numVisible, MaskFunction maskFunction)
+    {
+        for (; i + S::width <= count; i += S::width)
+        {
+            int mask = maskFunction(i);
+            for (int k = 0; k < S::width; ++k)
+            {
+                visible[i + k] = (mask >> k) & 1;
+                numVisible += visible[i + k];
+            }
+        }
+    }
+#endif
+}
+
+
+// Test an array of spheres against the frustum, 4 or 8 at a time. Sets visible[i] to 1 if sphere i is partly
+// or wholly inside the frustum, 0 if not. Returns the number of visible spheres
+std::size_t CullSpheres(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius,
+                        std::size_t count, uint8_t* visible)
+{
+    std::size_t numVisible = 0;
+    std::size_t i = 0;
+#if defined(MATH_AVX)
+    CullBlocks<AVX>(i, count, visible, numVisible, [&](std::size_t i) { return FrustumMask<AVX>(frustum, x + i, y + i, z + i, radius + i); });
+#endif
+#if defined(MATH_SSE)
+    CullBlocks<SSE>(i, count, visible, numVisible, [&](std::size_t i) { return FrustumMask<SSE>(frustum, x + i, y + i, z + i, radius + i); });
+#endif
+    for (; i < count; ++i)
+    {
+        visible[i] = IsVisible(frustum, Sphere{ { x[i], y[i], z[i] }, radius[i] }) ? 1 : 0;
+        numVisible += visible[i];
+    }
+    return numVisible;
+}
+
+
+// Test an array of spheres against a cone, as above
+std::size_t CullSpheres(const Cone& cone, const float* x, const float* y, const float* z, const float* radius,
+                        std::size_t count, uint8_t* visible)
+{
+    std::size_t numVisible = 0;
+    std::size_t i = 0;
+#if defined(MATH_AVX)
+    CullBlocks<AVX>(i, count, visible, numVisible, [&](std::size_t i) { return ConeMask<AVX>(cone, x + i, y + i, z + i, radius + i); });
+#endif
+#if defined(MATH_SSE)
+    CullBlocks<SSE>(i, count, visible, numVisible, [&](std::size_t i) { return ConeMask<SSE>(cone, x + i, y + i, z + i, radius + i); });
+#endif
+    for (; i < count; ++i)
+    {
+        visible[i] = IsVisible(cone, Sphere{ { x[i], y[i], z[i] }, radius[i] }) ? 1 : 0;
+        numVisible += visible[i];
+    }
+    return numVisible;
+}
+
+
+// Test an array of spheres lit by a point light to see if their shadows may be visible in the frustum, as above
+std::size_t CullShadowSpheres(const Frustum& frustum, const CVector3& lightPosition, float range,
+                              const float* x, const float* y, const float* z, const float* radius,
+                              std::size_t count, uint8_t* visible)
+{
+    std::size_t numVisible = 0;
+    std::size_t i = 0;
+#if defined(MATH_AVX)
+    CullBlocks<AVX>(i, count, visible, numVisible, [&](std::size_t i) { return ShadowMask<AVX>(frustum, lightPosition, range, x + i, y + i, z + i, radius + i); });
+#endif
+#if defined(MATH_SSE)
+    CullBlocks<SSE>(i, count, visible, numVisible, [&](std::size_t i) { return ShadowMask<SSE>(frustum, lightPosition, range, x + i, y + i, z + i, radius + i); });
+#endif
+    for (; i < count; ++i)
+    {
+        visible[i] = IsShadowVisible(frustum, lightPosition, range, Sphere{ { x[i], y[i], z[i] }, radius[i] }) ? 1 : 0;
+        numVisible += visible[i];
+    }
+    return numVisible;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Overlap and ray tests
+-----------------------------------------------------------------------------------------*/
+
+// Return true if the two boxes overlap
+bool Overlaps(const AABB& a, const AABB& b)
+{
+    return a.minPoint.x <= b.maxPoint.x && a.maxPoint.x >= b.minPoint.x &&
+           a.minPoint.y <= b.maxPoint.y && a.maxPoint.y >= b.minPoint.y &&
+           a.minPoint.z <= b.maxPoint.z && a.maxPoint.z >= b.minPoint.z;
+}
+
+// Return true if the sphere and box overlap
+bool Overlaps(const Sphere& sphere, const AABB& box)
+{
+    // Find the point in the box nearest the sphere centre
+    const CVector3& c = sphere.centre;
+    CVector3 nearest = { std::min(std::max(c.x, box.minPoint.x), box.maxPoint.x),
+                         std::min(std::max(c.y, box.minPoint.y), box.maxPoint.y),
+                         std::min(std::max(c.z, box.minPoint.z), box.maxPoint.z) };
+    CVector3 offset = nearest - c;
+    return Dot(offset, offset) <= sphere.radius * sphere.radius;
+}
+
+// Return true if the ray hits the box no further than maxDistance along the ray. If so, distance is set to where the
+// ray enters the box, or 0 if it starts inside the box
+bool RayIntersects(const Ray& ray, const AABB& box, float maxDistance, float& distance)
+{
+    // Slab method - find the range of distances the ray is between each pair of box faces, the ray hits the box if
+    // these ranges overlap. Division by a zero direction gives infinity, which gives the correct result unless the
+    // ray starts exactly on a face, where it is counted as a hit
+    float nearDistance = 0.0f;
+    float farDistance  = maxDistance;
+    const float* origin    = &ray.origin.x;
+    const float* direction = &ray.direction.x;
+    const float* minPoint  = &box.minPoint.x;
+    const float* maxPoint  = &box.maxPoint.x;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float inverse = 1.0f / direction[axis];
+        float t0 = (minPoint[axis] - origin[axis]) * inverse;
+        float t1 = (maxPoint[axis] - origin[axis]) * inverse;
+        if (t0 > t1)  std::swap(t0, t1);
+        if (t0 > nearDistance)  nearDistance = t0; // NaN (0 * infinity) fails these comparisons, leaving the range unchanged
+        if (t1 < farDistance)   farDistance  = t1;
+        if (nearDistance > farDistance)  return false;
+    }
+    distance = nearDistance;
+    return true;
+}
@@ -0,0 +1,150 @@
+//--------------------------------------------------------------------------------------
+// Bounding volumes and view frustums, used for visibility culling
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// Bounding boxes (axis-aligned) and spheres are calculated once for a mesh in model space, then
+// transformed by the model's world matrix to test against a view frustum. A frustum is held as six
+// planes extracted from a view-projection matrix, each facing inwards.
+// CullSpheres tests many spheres at once with SIMD instructions, it expects the spheres in separate
+// arrays of x, y, z and radius (see BatchTransform.h for the same layout).
+
+#ifndef _BOUNDS_H_DEFINED_
+#define _BOUNDS_H_DEFINED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include <cstddef>
+#include <cstdint>
+
+
+// Axis-aligned bounding box
+struct AABB
+{
+    CVector3 minPoint;
+    CVector3 maxPoint;
+};
+
+// Bounding sphere
+struct Sphere
+{
+    CVector3 centre;
+    float    radius;
+};
+
+// Plane - points p on the plane satisfy Dot(normal, p) + d = 0, points in front give a positive value
+struct Plane
+{
+    CVector3 normal;
+    float    d;
+};
+
+// View frustum as six inward facing planes: left, right, bottom, top, near, far
+struct Frustum
+{
+    Plane planes[6];
+};
+
+// Cone, e.g. the area lit by a spotlight. Direction must be unit length, halfAngle is the angle (in radians)
+// between the direction and the edge of the cone. Range is the length of the cone along its direction
+struct Cone
+{
+    CVector3 apex;
+    CVector3 direction;
+    float    halfAngle;
+    float    range;
+};
+
+// Ray starting at origin going in the given direction. Distances along the ray are measured in multiples of the
+// direction's length, so use a unit length direction to get distances in world units
+struct Ray
+{
+    CVector3 origin;
+    CVector3 direction;
+};
+
+
+/*-----------------------------------------------------------------------------------------
+    Creating bounds
+-----------------------------------------------------------------------------------------*/
+
+// Return a box around the given points. Point pointer and stride in bytes allow points in interleaved vertex data
+AABB BoundingBoxFromPoints(const void* points, std::size_t stride, std::size_t count);
+
+// Return a sphere around the given points, centred at the centre of the given box around the same points
+Sphere BoundingSphereFromPoints(const void* points, std::size_t stride, std::size_t count, const AABB& box);
+
+// Return the frustum for a view-projection matrix, planes are normalised
+// Uses the DirectX convention for clip space depth (0 to 1). Pass a world-view-projection matrix to get the
+// frustum in model space instead of world space
+Frustum FrustumFromMatrix(const CMatrix4x4& viewProj);
+
+// Return the smallest box containing both the given boxes
+AABB MergeBoxes(const AABB& a, const AABB& b);
+
+// Surface area of a box, used to judge how well a group of boxes fits together
+float SurfaceArea(const AABB& box);
+
+
+/*-----------------------------------------------------------------------------------------
+    Transforming bounds
+-----------------------------------------------------------------------------------------*/
+
+// Return a box containing the given box after it is transformed by the given matrix (usually a world matrix)
+AABB TransformBoundingBox(const AABB& box, const CMatrix4x4& m);
+
+// Return the given sphere after it is transformed by the given matrix (usually a world matrix). With non-uniform
+// scaling the largest scale is used, so the sphere still contains everything it did before
+Sphere TransformBoundingSphere(const Sphere& sphere, const CMatrix4x4& m);
+
+
+/*-----------------------------------------------------------------------------------------
+    Visibility tests
+-----------------------------------------------------------------------------------------*/
+// Tests are conservative - they may report an object is visible when it is just outside the frustum near
+// a corner, but will never report a visible object as outside
+
+// Return true if the sphere is partly or wholly inside the frustum
+bool IsVisible(const Frustum& frustum, const Sphere& sphere);
+
+// Return true if the box is partly or wholly inside the frustum
+bool IsVisible(const Frustum& frustum, const AABB& box);
+
+// Return true if the sphere is partly or wholly inside the cone
+bool IsVisible(const Cone& cone, const Sphere& sphere);
+
+// Return true if the shadow cast by the sphere from a point light could be partly or wholly inside the frustum
+// Shadows are assumed to stop at the given range from the light. Used to skip shadow casters that cannot affect a view
+bool IsShadowVisible(const Frustum& frustum, const CVector3& lightPosition, float range, const Sphere& sphere);
+
+
+// Test an array of spheres against the frustum, 4 or 8 at a time. Sets visible[i] to 1 if sphere i is partly
+// or wholly inside the frustum, 0 if not. Returns the number of visible spheres
+std::size_t CullSpheres(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius,
+                        std::size_t count, uint8_t* visible);
+
+// Test an array of spheres against a cone, as above
+std::size_t CullSpheres(const Cone& cone, const float* x, const float* y, const float* z, const float* radius,
+                        std::size_t count, uint8_t* visible);
+
+// Test an array of spheres lit by a point light to see if their shadows may be visible in the frustum, as above
+std::size_t CullShadowSpheres(const Frustum& frustum, const CVector3& lightPosition, float range,
+                              const float* x, const float* y, const float* z, const float* radius,
+                              std::size_t count, uint8_t* visible);
+
+
+/*-----------------------------------------------------------------------------------------
+    Overlap and ray tests
+-----------------------------------------------------------------------------------------*/
+
+// Return true if the two boxes overlap
+bool Overlaps(const AABB& a, const AABB& b);
+
+// Return true if the sphere and box overlap
+bool Overlaps(const Sphere& sphere, const AABB& box);
+
+// Return true if the ray hits the box no further than maxDistance along the ray. If so, distance is set to where the
+// ray enters the box, or 0 if it starts inside the box
+bool RayIntersects(const Ray& ray, const AABB& box, float maxDistance, float& distance);
+
+
+#endif // _BOUNDS_H_DEFINED_
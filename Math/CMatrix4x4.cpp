@@ -3,6 +3,76 @@
 //--------------------------------------------------------------------------------------
 
 #include "CMatrix4x4.h"
+#include "MathSIMD.h"
+
+
+/*-----------------------------------------------------------------------------------------
+    SIMD helpers
+-----------------------------------------------------------------------------------------*/
+// The matrix rows are 16 floats in memory so each row fits exactly in one SSE register. Unaligned loads are used
+// since matrices are not 16-byte aligned
+
+#if defined(MATH_SSE)
+
+// Multiply two matrices m1 * m2, writing result to mOut. All of m2 and each row of m1 are read
+// into registers before the corresponding output is written, so mOut may be the same as m1 or m2
+// AVX builds use this too (with FMA). Multiplying two rows at a time in 256-bit registers was tried, but reading a
+// matrix that has just been written a row at a time stalls the 256-bit loads, which made operator*= slower
+// than this version (see Tools/MathBench)
+static inline void MultiplySIMD(const CMatrix4x4& m1, const CMatrix4x4& m2, CMatrix4x4& mOut)
+{
+    const float* a = &m1.e00;
+    const float* b = &m2.e00;
+    float* out = &mOut.e00;
+
+    // Each output row is the sum of the rows of m2 scaled by the elements of the matching row of m1
+    __m128 b0 = _mm_loadu_ps(b + 0);
+    __m128 b1 = _mm_loadu_ps(b + 4);
+    __m128 b2 = _mm_loadu_ps(b + 8);
+    __m128 b3 = _mm_loadu_ps(b + 12);
+    for (int row = 0; row < 16; row += 4)
+    {
+        __m128 aRow = _mm_loadu_ps(a + row);
+        __m128 r = _mm_mul_ps(_mm_shuffle_ps(aRow, aRow, MATH_SHUFFLE(0,0,0,0)), b0);
+        r = MulAdd(_mm_shuffle_ps(aRow, aRow, MATH_SHUFFLE(1,1,1,1)), b1, r);
+        r = MulAdd(_mm_shuffle_ps(aRow, aRow, MATH_SHUFFLE(2,2,2,2)), b2, r);
+        r = MulAdd(_mm_shuffle_ps(aRow, aRow, MATH_SHUFFLE(3,3,3,3)), b3, r);
+        _mm_storeu_ps(out + row, r);
+    }
+}
+
+// Cross product of the xyz parts of two registers, w of the result is 0 if w of both inputs is 0
+static inline __m128 CrossSIMD(__m128 v1, __m128 v2)
+{
+    __m128 v1yzx = _mm_shuffle_ps(v1, v1, MATH_SHUFFLE(1,2,0,3));
+    __m128 v2yzx = _mm_shuffle_ps(v2, v2, MATH_SHUFFLE(1,2,0,3));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(v1, v2yzx), _mm_mul_ps(v1yzx, v2));
+    return _mm_shuffle_ps(c, c, MATH_SHUFFLE(1,2,0,3));
+}
+
+// Multiply two 2x2 matrices held in registers as (m00, m01, m10, m11) - used by the general inverse
+static inline __m128 Mat2Mul(__m128 m1, __m128 m2)
+{
+    return _mm_add_ps(_mm_mul_ps(m1, _mm_shuffle_ps(m2, m2, MATH_SHUFFLE(0,3,0,3))),
+                      _mm_mul_ps(_mm_shuffle_ps(m1, m1, MATH_SHUFFLE(1,0,3,2)), _mm_shuffle_ps(m2, m2, MATH_SHUFFLE(2,1,2,1))));
+}
+
+// Adjugate(m1) * m2 for 2x2 matrices
+static inline __m128 Mat2AdjMul(__m128 m1, __m128 m2)
+{
+    return _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(m1, m1, MATH_SHUFFLE(3,3,0,0)), m2),
+                      _mm_mul_ps(_mm_shuffle_ps(m1, m1, MATH_SHUFFLE(1,1,2,2)), _mm_shuffle_ps(m2, m2, MATH_SHUFFLE(2,3,0,1))));
+}
+
+// m1 * Adjugate(m2) for 2x2 matrices
+static inline __m128 Mat2MulAdj(__m128 m1, __m128 m2)
+{
+    return _mm_sub_ps(_mm_mul_ps(m1, _mm_shuffle_ps(m2, m2, MATH_SHUFFLE(3,0,3,0))),
+                      _mm_mul_ps(_mm_shuffle_ps(m1, m1, MATH_SHUFFLE(1,0,3,2)), _mm_shuffle_ps(m2, m2, MATH_SHUFFLE(2,1,2,1))));
+}
+
+#endif // MATH_SSE
+
 
 /*-----------------------------------------------------------------------------------------
     Member functions
@@ -30,6 +100,9 @@ CVector3 CMatrix4x4::GetRow(int iRow) const
 // Post-multiply this matrix by the given one
 CMatrix4x4& CMatrix4x4::operator*=(const CMatrix4x4& m)
 {
+#if defined(MATH_SSE)
+    MultiplySIMD(*this, m, *this);
+#else
     if (this == &m)
     {
         // Special case of multiplying by self - no copy optimisations so use binary version
@@ -71,6 +144,7 @@ CMatrix4x4& CMatrix4x4::operator*=(const CMatrix4x4& m)
         e31 = t1;
         e32 = t2;
     }
+#endif
     return *this;
 }
 
@@ -84,6 +158,9 @@ CMatrix4x4 operator*(const CMatrix4x4& m1, const CMatrix4x4& m2)
 {
     CMatrix4x4 mOut;
 
+#if defined(MATH_SSE)
+    MultiplySIMD(m1, m2, mOut);
+#else
     mOut.e00 = m1.e00*m2.e00 + m1.e01*m2.e10 + m1.e02*m2.e20 + m1.e03*m2.e30;
     mOut.e01 = m1.e00*m2.e01 + m1.e01*m2.e11 + m1.e02*m2.e21 + m1.e03*m2.e31;
     mOut.e02 = m1.e00*m2.e02 + m1.e01*m2.e12 + m1.e02*m2.e22 + m1.e03*m2.e32;
@@ -103,6 +180,7 @@ CMatrix4x4 operator*(const CMatrix4x4& m1, const CMatrix4x4& m2)
     mOut.e31 = m1.e30*m2.e01 + m1.e31*m2.e11 + m1.e32*m2.e21 + m1.e33*m2.e31;
     mOut.e32 = m1.e30*m2.e02 + m1.e31*m2.e12 + m1.e32*m2.e22 + m1.e33*m2.e32;
     mOut.e33 = m1.e30*m2.e03 + m1.e31*m2.e13 + m1.e32*m2.e23 + m1.e33*m2.e33;
+#endif
 
     return mOut;
 }
@@ -198,6 +276,41 @@ CMatrix4x4 InverseAffine(const CMatrix4x4& m)
 {
     CMatrix4x4 mOut;
 
+#if defined(MATH_SSE)
+    // The columns of the inverse 3x3 are the cross products of pairs of rows, divided by the determinant
+    const __m128 xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    __m128 r0 = _mm_and_ps(_mm_loadu_ps(&m.e00), xyzMask);
+    __m128 r1 = _mm_and_ps(_mm_loadu_ps(&m.e10), xyzMask);
+    __m128 r2 = _mm_and_ps(_mm_loadu_ps(&m.e20), xyzMask);
+    __m128 c0 = CrossSIMD(r1, r2);
+    __m128 c1 = CrossSIMD(r2, r0);
+    __m128 c2 = CrossSIMD(r0, r1);
+
+    // Determinant is r0.c0, summed into every element
+    __m128 det = _mm_mul_ps(r0, c0);
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, MATH_SHUFFLE(1,0,3,2)));
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, MATH_SHUFFLE(2,3,0,1)));
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+    c0 = _mm_mul_ps(c0, invDet);
+    c1 = _mm_mul_ps(c1, invDet);
+    c2 = _mm_mul_ps(c2, invDet);
+
+    // Transpose the columns into rows, 4th column is zero since the w of the cross products is 0
+    __m128 c3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+    // Transform negative translation by inverted 3x3 to get inverse, then add the 1 in the bottom-right
+    __m128 t = _mm_loadu_ps(&m.e30);
+    __m128 pos = _mm_mul_ps(_mm_shuffle_ps(t, t, MATH_SHUFFLE(0,0,0,0)), c0);
+    pos = MulAdd(_mm_shuffle_ps(t, t, MATH_SHUFFLE(1,1,1,1)), c1, pos);
+    pos = MulAdd(_mm_shuffle_ps(t, t, MATH_SHUFFLE(2,2,2,2)), c2, pos);
+    pos = _mm_sub_ps(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f), pos);
+
+    _mm_storeu_ps(&mOut.e00, c0);
+    _mm_storeu_ps(&mOut.e10, c1);
+    _mm_storeu_ps(&mOut.e20, c2);
+    _mm_storeu_ps(&mOut.e30, pos);
+#else
     // Calculate determinant of upper left 3x3
     float det0 = m.e11*m.e22 - m.e12*m.e21;
     float det1 = m.e12*m.e20 - m.e10*m.e22;
@@ -228,6 +341,103 @@ CMatrix4x4 InverseAffine(const CMatrix4x4& m)
     mOut.e13 = 0.0f;
     mOut.e23 = 0.0f;
     mOut.e33 = 1.0f;
+#endif
+
+    return mOut;
+}
+
+
+// Return the inverse of any (non-singular) matrix, e.g. to go from clip space back to world space
+// with an inverse view-projection matrix. Use InverseAffine for world and view matrices, it is faster
+CMatrix4x4 Inverse(const CMatrix4x4& m)
+{
+    CMatrix4x4 mOut;
+
+#if defined(MATH_SSE)
+    // Block-wise inverse treating the matrix as four 2x2 sub-matrices  | A B |
+    //                                                                  | C D |
+    __m128 row0 = _mm_loadu_ps(&m.e00);
+    __m128 row1 = _mm_loadu_ps(&m.e10);
+    __m128 row2 = _mm_loadu_ps(&m.e20);
+    __m128 row3 = _mm_loadu_ps(&m.e30);
+    __m128 A = _mm_movelh_ps(row0, row1);
+    __m128 B = _mm_movehl_ps(row1, row0);
+    __m128 C = _mm_movelh_ps(row2, row3);
+    __m128 D = _mm_movehl_ps(row3, row2);
+
+    // Determinants of the sub-matrices as (|A|, |B|, |C|, |D|)
+    __m128 detSub = _mm_sub_ps(
+        _mm_mul_ps(_mm_shuffle_ps(row0, row2, MATH_SHUFFLE(0,2,0,2)), _mm_shuffle_ps(row1, row3, MATH_SHUFFLE(1,3,1,3))),
+        _mm_mul_ps(_mm_shuffle_ps(row0, row2, MATH_SHUFFLE(1,3,1,3)), _mm_shuffle_ps(row1, row3, MATH_SHUFFLE(0,2,0,2))));
+    __m128 detA = _mm_shuffle_ps(detSub, detSub, MATH_SHUFFLE(0,0,0,0));
+    __m128 detB = _mm_shuffle_ps(detSub, detSub, MATH_SHUFFLE(1,1,1,1));
+    __m128 detC = _mm_shuffle_ps(detSub, detSub, MATH_SHUFFLE(2,2,2,2));
+    __m128 detD = _mm_shuffle_ps(detSub, detSub, MATH_SHUFFLE(3,3,3,3));
+
+    // Adjugates of the blocks of the inverse (X Y / Z W) scaled by |M|
+    __m128 D_C = Mat2AdjMul(D, C);
+    __m128 A_B = Mat2AdjMul(A, B);
+    __m128 X = _mm_sub_ps(_mm_mul_ps(detD, A), Mat2Mul(B, D_C));
+    __m128 W = _mm_sub_ps(_mm_mul_ps(detA, D), Mat2Mul(C, A_B));
+    __m128 Y = _mm_sub_ps(_mm_mul_ps(detB, C), Mat2MulAdj(D, A_B));
+    __m128 Z = _mm_sub_ps(_mm_mul_ps(detC, B), Mat2MulAdj(A, D_C));
+
+    // |M| = |A||D| + |B||C| - trace((A#B)(D#C))
+    __m128 tr = _mm_mul_ps(A_B, _mm_shuffle_ps(D_C, D_C, MATH_SHUFFLE(0,2,1,3)));
+    tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, MATH_SHUFFLE(1,0,3,2)));
+    tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, MATH_SHUFFLE(2,3,0,1)));
+    __m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), tr);
+
+    // Divide by the determinant, including the sign pattern of the adjugate
+    __m128 invDet = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+    X = _mm_mul_ps(X, invDet);
+    Y = _mm_mul_ps(Y, invDet);
+    Z = _mm_mul_ps(Z, invDet);
+    W = _mm_mul_ps(W, invDet);
+
+    // Shuffle the adjugates back into rows
+    _mm_storeu_ps(&mOut.e00, _mm_shuffle_ps(X, Y, MATH_SHUFFLE(3,1,3,1)));
+    _mm_storeu_ps(&mOut.e10, _mm_shuffle_ps(X, Y, MATH_SHUFFLE(2,0,2,0)));
+    _mm_storeu_ps(&mOut.e20, _mm_shuffle_ps(Z, W, MATH_SHUFFLE(3,1,3,1)));
+    _mm_storeu_ps(&mOut.e30, _mm_shuffle_ps(Z, W, MATH_SHUFFLE(2,0,2,0)));
+#else
+    // Cofactors of the first two rows use 2x2 determinants of the bottom two rows and vice versa
+    float s0 = m.e00*m.e11 - m.e10*m.e01;
+    float s1 = m.e00*m.e12 - m.e10*m.e02;
+    float s2 = m.e00*m.e13 - m.e10*m.e03;
+    float s3 = m.e01*m.e12 - m.e11*m.e02;
+    float s4 = m.e01*m.e13 - m.e11*m.e03;
+    float s5 = m.e02*m.e13 - m.e12*m.e03;
+
+    float c5 = m.e22*m.e33 - m.e32*m.e23;
+    float c4 = m.e21*m.e33 - m.e31*m.e23;
+    float c3 = m.e21*m.e32 - m.e31*m.e22;
+    float c2 = m.e20*m.e33 - m.e30*m.e23;
+    float c1 = m.e20*m.e32 - m.e30*m.e22;
+    float c0 = m.e20*m.e31 - m.e30*m.e21;
+
+    float invDet = 1.0f / (s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0);
+
+    mOut.e00 = ( m.e11*c5 - m.e12*c4 + m.e13*c3) * invDet;
+    mOut.e01 = (-m.e01*c5 + m.e02*c4 - m.e03*c3) * invDet;
+    mOut.e02 = ( m.e31*s5 - m.e32*s4 + m.e33*s3) * invDet;
+    mOut.e03 = (-m.e21*s5 + m.e22*s4 - m.e23*s3) * invDet;
+
+    mOut.e10 = (-m.e10*c5 + m.e12*c2 - m.e13*c1) * invDet;
+    mOut.e11 = ( m.e00*c5 - m.e02*c2 + m.e03*c1) * invDet;
+    mOut.e12 = (-m.e30*s5 + m.e32*s2 - m.e33*s1) * invDet;
+    mOut.e13 = ( m.e20*s5 - m.e22*s2 + m.e23*s1) * invDet;
+
+    mOut.e20 = ( m.e10*c4 - m.e11*c2 + m.e13*c0) * invDet;
+    mOut.e21 = (-m.e00*c4 + m.e01*c2 - m.e03*c0) * invDet;
+    mOut.e22 = ( m.e30*s4 - m.e31*s2 + m.e33*s0) * invDet;
+    mOut.e23 = (-m.e20*s4 + m.e21*s2 - m.e23*s0) * invDet;
+
+    mOut.e30 = (-m.e10*c3 + m.e11*c1 - m.e12*c0) * invDet;
+    mOut.e31 = ( m.e00*c3 - m.e01*c1 + m.e02*c0) * invDet;
+    mOut.e32 = (-m.e30*s3 + m.e31*s1 - m.e32*s0) * invDet;
+    mOut.e33 = ( m.e20*s3 - m.e21*s1 + m.e22*s0) * invDet;
+#endif
 
     return mOut;
 }
@@ -98,5 +98,9 @@ CMatrix4x4 MatrixScaling(const float s);
 // Advanced calulation needed to get the view matrix from the camera's positioning matrix
 CMatrix4x4 InverseAffine(const CMatrix4x4& m);
 
+// Return the inverse of any (non-singular) matrix, e.g. to go from clip space back to world space
+// with an inverse view-projection matrix. Use InverseAffine for world and view matrices, it is faster
+CMatrix4x4 Inverse(const CMatrix4x4& m);
+
 
 #endif // _CMATRIX4X4_H_DEFINED_
@@ -0,0 +1,263 @@
+//--------------------------------------------------------------------------------------
+// Quaternion class (cut down version) to hold rotations for 3D
+//--------------------------------------------------------------------------------------
+
+#include "CQuaternion.h"
+#include <algorithm>
+
+/*-----------------------------------------------------------------------------------------
+    Member functions
+-----------------------------------------------------------------------------------------*/
+
+// Follow this rotation by the given one
+CQuaternion& CQuaternion::operator*= (const CQuaternion& q)
+{
+    *this = *this * q;
+    return *this;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Operators
+-----------------------------------------------------------------------------------------*/
+
+// Combine two rotations - rotation q1 followed by rotation q2
+// This is the usual quaternion product q2q1, reversed to match the matrix multiplication order
+CQuaternion operator* (const CQuaternion& q1, const CQuaternion& q2)
+{
+    return CQuaternion{ q2.w*q1.x + q2.x*q1.w + q2.y*q1.z - q2.z*q1.y,
+                        q2.w*q1.y - q2.x*q1.z + q2.y*q1.w + q2.z*q1.x,
+                        q2.w*q1.z + q2.x*q1.y - q2.y*q1.x + q2.z*q1.w,
+                        q2.w*q1.w - q2.x*q1.x - q2.y*q1.y - q2.z*q1.z };
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Non-member functions
+-----------------------------------------------------------------------------------------*/
+
+// Return the identity quaternion (no rotation)
+CQuaternion QuaternionIdentity()
+{
+    return CQuaternion{ 0, 0, 0, 1 };
+}
+
+// Return a rotation of the given angle (in radians) around the given axis (need not be normalised)
+CQuaternion QuaternionRotationAxis(const CVector3& axis, float angle)
+{
+    CVector3 a = Normalise(axis) * std::sin(angle * 0.5f);
+    return CQuaternion{ a.x, a.y, a.z, std::cos(angle * 0.5f) };
+}
+
+// Return rotations of the given angle (in radians) around the X, Y or Z axis
+CQuaternion QuaternionRotationX(float x)
+{
+    return CQuaternion{ std::sin(x * 0.5f), 0, 0, std::cos(x * 0.5f) };
+}
+CQuaternion QuaternionRotationY(float y)
+{
+    return CQuaternion{ 0, std::sin(y * 0.5f), 0, std::cos(y * 0.5f) };
+}
+CQuaternion QuaternionRotationZ(float z)
+{
+    return CQuaternion{ 0, 0, std::sin(z * 0.5f), std::cos(z * 0.5f) };
+}
+
+
+// Return the rotation given by Euler angles (in radians), uses the same order as the models and camera
+// in this project (Z, then X, then Y). Product of the three single-axis rotations written out in full
+CQuaternion QuaternionFromEuler(const CVector3& angles)
+{
+    float sX = std::sin(angles.x * 0.5f), cX = std::cos(angles.x * 0.5f);
+    float sY = std::sin(angles.y * 0.5f), cY = std::cos(angles.y * 0.5f);
+    float sZ = std::sin(angles.z * 0.5f), cZ = std::cos(angles.z * 0.5f);
+
+    return CQuaternion{ cY*sX*cZ + sY*cX*sZ,
+                        sY*cX*cZ - cY*sX*sZ,
+                        cY*cX*sZ - sY*sX*cZ,
+                        cY*cX*cZ + sY*sX*sZ };
+}
+
+
+// Return the rotation stored in the given matrix, any scaling in the matrix is ignored
+CQuaternion QuaternionFromMatrix(const CMatrix4x4& m)
+{
+    // Remove scaling from the 3x3 part of the matrix
+    CVector3 scale = m.GetScale();
+    CVector3 row0 = m.GetXAxis() * (1.0f / scale.x);
+    CVector3 row1 = m.GetYAxis() * (1.0f / scale.y);
+    CVector3 row2 = m.GetZAxis() * (1.0f / scale.z);
+
+    // Pick the largest of w, x, y, z to calculate first, to avoid dividing by a small number
+    CQuaternion q;
+    float trace = row0.x + row1.y + row2.z;
+    if (trace > 0.0f)
+    {
+        float s = 0.5f / std::sqrt(1.0f + trace);
+        q.w = 0.25f / s;
+        q.x = (row1.z - row2.y) * s;
+        q.y = (row2.x - row0.z) * s;
+        q.z = (row0.y - row1.x) * s;
+    }
+    else if (row0.x > row1.y && row0.x > row2.z)
+    {
+        float s = 0.5f / std::sqrt(1.0f + row0.x - row1.y - row2.z);
+        q.x = 0.25f / s;
+        q.w = (row1.z - row2.y) * s;
+        q.y = (row0.y + row1.x) * s;
+        q.z = (row0.z + row2.x) * s;
+    }
+    else if (row1.y > row2.z)
+    {
+        float s = 0.5f / std::sqrt(1.0f + row1.y - row0.x - row2.z);
+        q.y = 0.25f / s;
+        q.w = (row2.x - row0.z) * s;
+        q.x = (row0.y + row1.x) * s;
+        q.z = (row1.z + row2.y) * s;
+    }
+    else
+    {
+        float s = 0.5f / std::sqrt(1.0f + row2.z - row0.x - row1.y);
+        q.z = 0.25f / s;
+        q.w = (row0.y - row1.x) * s;
+        q.x = (row0.z + row2.x) * s;
+        q.y = (row1.z + row2.y) * s;
+    }
+    return Normalise(q);
+}
+
+
+// Return the Euler angles (in radians) of the given rotation, same order as QuaternionFromEuler
+// Uses the same method as CMatrix4x4::GetEulerAngles, but only calculates the matrix elements needed
+CVector3 ToEulerAngles(const CQuaternion& q)
+{
+    float sX = -2.0f * (q.y*q.z - q.x*q.w); // -e21
+    sX = std::min(std::max(sX, -1.0f), 1.0f);
+    float cX = std::sqrt(1.0f - sX*sX);
+
+    float sY, cY, sZ, cZ;
+    if (std::abs(cX) > 0.001f)
+    {
+        // No gimbal lock
+        float invCX = 1.0f / cX;
+        sZ = 2.0f * (q.x*q.y + q.z*q.w) * invCX;        // e01
+        cZ = (1.0f - 2.0f * (q.x*q.x + q.z*q.z)) * invCX; // e11
+        sY = 2.0f * (q.x*q.z + q.y*q.w) * invCX;        // e20
+        cY = (1.0f - 2.0f * (q.x*q.x + q.y*q.y)) * invCX; // e22
+    }
+    else
+    {
+        // Gimbal lock - force Z angle to 0
+        sZ = 0.0f;
+        cZ = 1.0f;
+        sY = -2.0f * (q.x*q.z - q.y*q.w);         // -e02
+        cY = 1.0f - 2.0f * (q.y*q.y + q.z*q.z);   // e00
+    }
+
+    return { std::atan2(sX, cX), std::atan2(sY, cY), std::atan2(sZ, cZ) };
+}
+
+
+// Dot product of two quaternions - gives cos of half the angle between unit quaternions
+float Dot(const CQuaternion& q1, const CQuaternion& q2)
+{
+    return q1.x*q2.x + q1.y*q2.y + q1.z*q2.z + q1.w*q2.w;
+}
+
+// Return unit length quaternion in the same direction as given one
+CQuaternion Normalise(const CQuaternion& q)
+{
+    float lengthSq = Dot(q, q);
+
+    // Zero length quaternion is not a rotation, return the identity
+    if (IsZero(lengthSq))
+    {
+        return QuaternionIdentity();
+    }
+    else
+    {
+        float invLength = InvSqrt(lengthSq);
+        return CQuaternion{ q.x * invLength, q.y * invLength, q.z * invLength, q.w * invLength };
+    }
+}
+
+// Return the opposite rotation, assumes a unit quaternion
+CQuaternion Inverse(const CQuaternion& q)
+{
+    return CQuaternion{ -q.x, -q.y, -q.z, q.w };
+}
+
+// Rotate a vector by a quaternion
+CVector3 Rotate(const CVector3& v, const CQuaternion& q)
+{
+    // Optimised form of q * v * q^-1
+    CVector3 axis = { q.x, q.y, q.z };
+    CVector3 t = 2.0f * Cross(axis, v);
+    return v + q.w * t + Cross(axis, t);
+}
+
+
+// Blend between two rotations, t is 0 to 1. Normalised linear interpolation is very fast and gives
+// good results for small angles, but the rotation speed is not constant over larger ones
+CQuaternion NLerp(const CQuaternion& q1, const CQuaternion& q2, float t)
+{
+    // q and -q are the same rotation, flip q2 if needed to take the shorter path
+    float t2 = (Dot(q1, q2) < 0.0f) ? -t : t;
+    float t1 = 1.0f - t;
+    return Normalise(CQuaternion{ q1.x*t1 + q2.x*t2, q1.y*t1 + q2.y*t2, q1.z*t1 + q2.z*t2, q1.w*t1 + q2.w*t2 });
+}
+
+// Spherical linear interpolation between two rotations, t is 0 to 1. Constant rotation speed but uses trig
+CQuaternion Slerp(const CQuaternion& q1, const CQuaternion& q2, float t)
+{
+    float cosAngle = Dot(q1, q2);
+    float sign = 1.0f;
+    if (cosAngle < 0.0f)
+    {
+        cosAngle = -cosAngle;
+        sign = -1.0f;
+    }
+
+    // Nearly identical rotations - sin(angle) below is close to 0, but NLerp is accurate here
+    if (cosAngle > 0.9995f)  return NLerp(q1, q2, t);
+
+    float angle = std::acos(cosAngle);
+    float invSin = 1.0f / std::sin(angle);
+    float t1 = std::sin((1.0f - t) * angle) * invSin;
+    float t2 = std::sin(t * angle) * invSin * sign;
+    return CQuaternion{ q1.x*t1 + q2.x*t2, q1.y*t1 + q2.y*t2, q1.z*t1 + q2.z*t2, q1.w*t1 + q2.w*t2 };
+}
+
+// Approximate spherical interpolation, a corrected NLerp that stays within about 0.1 degrees of Slerp and needs no trig
+// The t value is adjusted by a polynomial fitted to the difference between NLerp and Slerp
+CQuaternion FastSlerp(const CQuaternion& q1, const CQuaternion& q2, float t)
+{
+    float d = std::abs(Dot(q1, q2));
+    float A = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+    float B = 0.848013f + d * (-1.06021f + d * 0.215638f);
+    float k = A * (t - 0.5f) * (t - 0.5f) + B;
+    float tAdjusted = t + t * (t - 0.5f) * (t - 1.0f) * k;
+    return NLerp(q1, q2, tAdjusted);
+}
+
+
+// Return a rotation matrix of the given quaternion (assumed unit length)
+CMatrix4x4 MatrixRotation(const CQuaternion& q)
+{
+    return MatrixTransform({ 0, 0, 0 }, q, { 1, 1, 1 });
+}
+
+// Return a full model/world matrix from a position, rotation and scale. Same result as
+//     MatrixScaling(scale) * MatrixRotation(rotation) * MatrixTranslation(position)
+// Rows of the rotation matrix are scaled by the scale values, position goes straight into the bottom row
+CMatrix4x4 MatrixTransform(const CVector3& position, const CQuaternion& rotation, const CVector3& scale)
+{
+    float xx = rotation.x * rotation.x, yy = rotation.y * rotation.y, zz = rotation.z * rotation.z;
+    float xy = rotation.x * rotation.y, xz = rotation.x * rotation.z, yz = rotation.y * rotation.z;
+    float wx = rotation.w * rotation.x, wy = rotation.w * rotation.y, wz = rotation.w * rotation.z;
+
+    return CMatrix4x4{ scale.x * (1.0f - 2.0f*(yy + zz)), scale.x * 2.0f*(xy + wz),          scale.x * 2.0f*(xz - wy),          0,
+                       scale.y * 2.0f*(xy - wz),          scale.y * (1.0f - 2.0f*(xx + zz)), scale.y * 2.0f*(yz + wx),          0,
+                       scale.z * 2.0f*(xz + wy),          scale.z * 2.0f*(yz - wx),          scale.z * (1.0f - 2.0f*(xx + yy)), 0,
+                       position.x,                        position.y,                        position.z,                        1 };
+}
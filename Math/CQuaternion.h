@@ -0,0 +1,122 @@
+//--------------------------------------------------------------------------------------
+// Quaternion class (cut down version) to hold rotations for 3D
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// A quaternion holds a rotation in 4 floats. Compared to Euler angles they have no gimbal lock, can
+// be combined and blended cheaply, and convert to a matrix without any sin/cos calculations.
+// Quaternions here are multiplied in the same order as matrices in this project: q1 * q2 is the rotation
+// q1 followed by the rotation q2, so MatrixRotation(q1 * q2) == MatrixRotation(q1) * MatrixRotation(q2)
+
+#ifndef _CQUATERNION_H_DEFINED_
+#define _CQUATERNION_H_DEFINED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include <cmath>
+
+
+// Quaternion class
+class CQuaternion
+{
+// Concrete class - public access
+public:
+    // Quaternion components - x, y, z is the axis of rotation scaled by sin(angle/2), w is cos(angle/2)
+    float x;
+    float y;
+    float z;
+    float w;
+
+    /*-----------------------------------------------------------------------------------------
+        Constructors
+    -----------------------------------------------------------------------------------------*/
+
+    // Default constructor - leaves values uninitialised (for performance)
+    CQuaternion() {}
+
+    // Construct with 4 values
+    CQuaternion(const float xIn, const float yIn, const float zIn, const float wIn)
+    {
+        x = xIn;
+        y = yIn;
+        z = zIn;
+        w = wIn;
+    }
+
+
+    /*-----------------------------------------------------------------------------------------
+        Member functions
+    -----------------------------------------------------------------------------------------*/
+
+    // Follow this rotation by the given one
+    CQuaternion& operator*= (const CQuaternion& q);
+};
+
+
+/*-----------------------------------------------------------------------------------------
+    Non-member operators
+-----------------------------------------------------------------------------------------*/
+
+// Combine two rotations - rotation q1 followed by rotation q2
+CQuaternion operator* (const CQuaternion& q1, const CQuaternion& q2);
+
+
+/*-----------------------------------------------------------------------------------------
+    Non-member functions
+-----------------------------------------------------------------------------------------*/
+
+// Return the identity quaternion (no rotation)
+CQuaternion QuaternionIdentity();
+
+// Return a rotation of the given angle (in radians) around the given axis (need not be normalised)
+CQuaternion QuaternionRotationAxis(const CVector3& axis, float angle);
+
+// Return rotations of the given angle (in radians) around the X, Y or Z axis
+CQuaternion QuaternionRotationX(float x);
+CQuaternion QuaternionRotationY(float y);
+CQuaternion QuaternionRotationZ(float z);
+
+// Return the rotation given by Euler angles (in radians), uses the same order as the models and camera
+// in this project (Z, then X, then Y)
+CQuaternion QuaternionFromEuler(const CVector3& angles);
+
+// Return the rotation stored in the given matrix, any scaling in the matrix is ignored
+CQuaternion QuaternionFromMatrix(const CMatrix4x4& m);
+
+// Return the Euler angles (in radians) of the given rotation, same order as QuaternionFromEuler
+CVector3 ToEulerAngles(const CQuaternion& q);
+
+
+// Dot product of two quaternions - gives cos of half the angle between unit quaternions
+float Dot(const CQuaternion& q1, const CQuaternion& q2);
+
+// Return unit length quaternion in the same direction as given one
+CQuaternion Normalise(const CQuaternion& q);
+
+// Return the opposite rotation, assumes a unit quaternion
+CQuaternion Inverse(const CQuaternion& q);
+
+// Rotate a vector by a quaternion
+CVector3 Rotate(const CVector3& v, const CQuaternion& q);
+
+
+// Blend between two rotations, t is 0 to 1. Normalised linear interpolation is very fast and gives
+// good results for small angles, but the rotation speed is not constant over larger ones
+CQuaternion NLerp(const CQuaternion& q1, const CQuaternion& q2, float t);
+
+// Spherical linear interpolation between two rotations, t is 0 to 1. Constant rotation speed but uses trig
+CQuaternion Slerp(const CQuaternion& q1, const CQuaternion& q2, float t);
+
+// Approximate spherical interpolation, a corrected NLerp that stays within about 0.1 degrees of Slerp and needs no trig
+CQuaternion FastSlerp(const CQuaternion& q1, const CQuaternion& q2, float t);
+
+
+// Return a rotation matrix of the given quaternion (assumed unit length)
+CMatrix4x4 MatrixRotation(const CQuaternion& q);
+
+// Return a full model/world matrix from a position, rotation and scale. Same result as
+//     MatrixScaling(scale) * MatrixRotation(rotation) * MatrixTranslation(position)
+// but written out directly, so it is far cheaper than the three matrix multiplies
+CMatrix4x4 MatrixTransform(const CVector3& position, const CQuaternion& rotation, const CVector3& scale);
+
+
+#endif // _CQUATERNION_H_DEFINED_
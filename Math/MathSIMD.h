@@ -0,0 +1,61 @@
+//--------------------------------------------------------------------------------------
+// SIMD instruction set selection for the maths classes
+//--------------------------------------------------------------------------------------
+// Picks the widest instruction set the compiler has been allowed to use. All x64 builds have SSE2,
+// AVX/AVX2/FMA are used when building with /arch:AVX2 (Visual Studio) or -mavx2 -mfma (GCC/Clang).
+// Define MATH_NO_SIMD before including any maths header to force the plain C++ versions of the code,
+// which is useful when checking the SIMD code gives the same results.
+
+#ifndef _MATH_SIMD_H_DEFINED_
+#define _MATH_SIMD_H_DEFINED_
+
+#if !defined(MATH_NO_SIMD)
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define MATH_SSE 1
+    #include <emmintrin.h>
+#endif
+
+#if defined(MATH_SSE) && defined(__AVX__)
+    #define MATH_AVX 1
+    #include <immintrin.h>
+#endif
+
+// Visual Studio does not define __FMA__, but every CPU that supports AVX2 also supports FMA
+#if defined(MATH_AVX) && (defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__)))
+    #define MATH_FMA 1
+#endif
+
+#endif // !MATH_NO_SIMD
+
+
+#if defined(MATH_SSE)
+
+// Build a shuffle mask from four element indices (first index is the lowest element), used with _mm_shuffle_ps
+#define MATH_SHUFFLE(x, y, z, w)  ((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
+
+// a * b + c, using a fused multiply-add where available
+inline __m128 MulAdd(__m128 a, __m128 b, __m128 c)
+{
+#if defined(MATH_FMA)
+    return _mm_fmadd_ps(a, b, c);
+#else
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+
+#if defined(MATH_AVX)
+inline __m256 MulAdd(__m256 a, __m256 b, __m256 c)
+{
+#if defined(MATH_FMA)
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+#endif
+
+#endif // MATH_SSE
+
+
+#endif // _MATH_SIMD_H_DEFINED_
@@ -1,209 +1,56 @@
 //--------------------------------------------------------------------------------------
 // Class encapsulating a mesh
 //--------------------------------------------------------------------------------------
-// The mesh class splits the mesh into sub-meshes that only use one texture each.
-// ** THIS VERSION WILL ONLY KEEP THE FIRST SUB-MESH OTHER PARTS WILL BE MISSING **
-// ** DO NOT USE THIS VERSION FOR PROJECTS **
-// The class also doesn't load textures, filters or shaders as the outer code is
-// expected to select these things. A later lab will introduce a more robust loader.
+// Every mesh in the file is kept as a sub-mesh. All the sub-meshes share one vertex buffer and one index buffer, each
+// using a range of them, so the whole mesh is drawn with a single draw call.
+// The class doesn't load textures, filters or shaders as the outer code is expected to select these things.
 
 #include "Mesh.h"
+#include "StateCache.h"
 #include "Shader.h" // Needed for helper function CreateSignatureForVertexLayout
-#include "CVector2.h" 
-#include "CVector3.h" 
 
-#include <assimp/Importer.hpp>
-#include <assimp/DefaultLogger.hpp>
-#include <assimp/postprocess.h>
-#include <assimp/scene.h>
 
-#include <memory>
-
-
-// Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types
-// Optionally request tangents to be calculated (for normal and parallax mapping - see later lab)
+// Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types, and
+// saves a cooked copy of the mesh that is loaded much faster next time (see MeshData.h)
+// Optionally request tangents to be calculated (for normal and parallax mapping - see later lab) and the formats
+// to store vertices in (see VertexFormat in MeshData.h)
 // Will throw a std::runtime_error exception on failure (since constructors can't return errors).
-Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/)
+Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/, const VertexFormat& format /*= VertexFormat()*/)
+    : Mesh(LoadMeshData(fileName, requireTangents, format), fileName)
 {
-    Assimp::Importer importer;
-
-    // Flags for processing the mesh. Assimp provides a huge amount of control - right click any of these
-    // and "Peek Definition" to see documention above each constant
-    unsigned int assimpFlags = aiProcess_MakeLeftHanded |
-                               aiProcess_GenSmoothNormals |
-                               aiProcess_FixInfacingNormals |
-                               aiProcess_GenUVCoords | 
-                               aiProcess_TransformUVCoords |
-                               aiProcess_FlipUVs |
-                               aiProcess_FlipWindingOrder |
-                               aiProcess_Triangulate |
-                               aiProcess_PreTransformVertices |
-                               aiProcess_JoinIdenticalVertices |
-                               aiProcess_ImproveCacheLocality |
-                               aiProcess_SortByPType |
-                               aiProcess_FindInvalidData | 
-                               aiProcess_OptimizeMeshes |
-                               aiProcess_FindInstances |
-                               aiProcess_FindDegenerates |
-                               aiProcess_RemoveRedundantMaterials |
-                               aiProcess_Debone |
-                               aiProcess_RemoveComponent;
-
-    // Flags to specify what mesh data to ignore
-    int removeComponents = aiComponent_LIGHTS | aiComponent_CAMERAS | aiComponent_TEXTURES | aiComponent_COLORS | 
-                           aiComponent_BONEWEIGHTS | aiComponent_ANIMATIONS | aiComponent_MATERIALS;
-
-    // Add / remove tangents as required by user
-    if (requireTangents)
-    {
-        assimpFlags |= aiProcess_CalcTangentSpace;
-    }
-    else
-    {
-        removeComponents |= aiComponent_TANGENTS_AND_BITANGENTS;
-    }
-
-    // Other miscellaneous settings
-    importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, 80.0f); // Smoothing angle for normals
-    importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);  // Remove points and lines (keep triangles only)
-    importer.SetPropertyBool(AI_CONFIG_PP_FD_REMOVE, true);                 // Remove degenerate triangles
-    importer.SetPropertyBool(AI_CONFIG_PP_DB_ALL_OR_NONE, true);            // Default to removing bones/weights from meshes that don't need skinning
-  
-    importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, removeComponents);
-
-    // Import mesh with assimp given above requirements - log output
-    Assimp::DefaultLogger::create("", Assimp::DefaultLogger::VERBOSE);
-    const aiScene* scene = importer.ReadFile(fileName, assimpFlags);
-    Assimp::DefaultLogger::kill();
-    if (scene == nullptr)  throw std::runtime_error("Error loading mesh (" + fileName + "). " + importer.GetErrorString());
-    if (scene->mNumMeshes == 0)  throw std::runtime_error("No usable geometry in mesh: " + fileName);
-
-
-    //-----------------------------------
+}
 
-    // Only importing first submesh - significant limitation - do not use this importer for your own projects
-    aiMesh* assimpMesh = scene->mMeshes[0];
-    std::string subMeshName = assimpMesh->mName.C_Str();
 
-    
-    //-----------------------------------
+// Create a mesh from data that has already been loaded. The name is used in error messages
+// Will throw a std::runtime_error exception on failure
+Mesh::Mesh(const MeshData& data, const std::string& name)
+{
+    mVertexSize  = data.vertexSize;
+    mNumVertices = data.numVertices;
+    mNumIndices  = data.numIndices;
+    mIndexFormat = data.indexSize == 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
 
-    // Check for presence of position and normal data. Tangents and UVs are optional.
-    std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
-    unsigned int offset = 0;
-    
-    if (!assimpMesh->HasPositions())  throw std::runtime_error("No position data for sub-mesh " + subMeshName + " in " + fileName);
-    unsigned int positionOffset = offset;
-    vertexElements.push_back( { "Position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, positionOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-    offset += 12;
-
-    if (!assimpMesh->HasNormals())  throw std::runtime_error("No normal data for sub-mesh " + subMeshName + " in " + fileName);
-    unsigned int normalOffset = offset;
-    vertexElements.push_back( { "Normal", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, normalOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-    offset += 12;
-
-    unsigned int tangentOffset = offset;
-    if (requireTangents)
-    {
-        if (!assimpMesh->HasTangentsAndBitangents())  throw std::runtime_error("No tangent data for sub-mesh " + subMeshName + " in " + fileName);
-        vertexElements.push_back( { "Tangent", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, tangentOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-        offset += 12;
-    }
-    
-    unsigned int uvOffset = offset;
-    if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
-    {
-        if (assimpMesh->mNumUVComponents[0] != 2)  throw std::runtime_error("Unsupported texture coordinates in " + subMeshName + " in " + fileName);
-        vertexElements.push_back( { "UV", 0, DXGI_FORMAT_R32G32_FLOAT, 0, uvOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-        offset += 8;
-    }
+    // Bounds for visibility culling
+    mBoundingBox    = data.boundingBox;
+    mBoundingSphere = data.boundingSphere;
+    mSubMeshes      = data.subMeshes;
+    mLODs           = data.lods;
+    mMeshlets       = data.meshlets;
 
-    mVertexSize = offset;
+    // Keep the full detail triangles for ray casts and occlusion culling, GPU buffers can't be read back
+    mPositions = DecodePositions(data);
+    mIndices.resize(mLODs[0].numIndices);
+    for (std::size_t i = 0; i < mIndices.size(); ++i)  mIndices[i] = data.Index(mLODs[0].indexStart + i);
+    mTriangles.Build(mPositions.data(), mPositions.size(), mIndices.data(), mIndices.size());
 
 
     // Create a "vertex layout" to describe to DirectX what is data in each vertex of this mesh
-    auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
-    HRESULT hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
+    auto shaderSignature = CreateSignatureForVertexLayout(data.vertexElements.data(), static_cast<int>(data.vertexElements.size()));
+    HRESULT hr = gD3DDevice->CreateInputLayout(data.vertexElements.data(), static_cast<UINT>(data.vertexElements.size()),
                                                shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
                                                &mVertexLayout);
     if (shaderSignature)  shaderSignature->Release();
-    if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for " + fileName);
-
-
-
-    //-----------------------------------
-
-    // Create CPU-side buffers to hold current mesh data - exact content is flexible so can't use a structure for a vertex - so just a block of bytes
-    // Note: for large arrays a unique_ptr is better than a vector because vectors default-initialise all the values which is a waste of time.
-    mNumVertices = assimpMesh->mNumVertices;
-    mNumIndices  = assimpMesh->mNumFaces * 3;
-    auto vertices = std::make_unique<unsigned char[]>(mNumVertices * mVertexSize);
-    auto indices  = std::make_unique<unsigned char[]>(mNumIndices * 4); // Using 32 bit indexes (4 bytes) for each indeex
-
-
-    //-----------------------------------
-
-    // Copy mesh data from assimp to our CPU-side vertex buffer
-
-    CVector3* assimpPosition = reinterpret_cast<CVector3*>(assimpMesh->mVertices);
-    unsigned char* position = vertices.get() + positionOffset;
-    unsigned char* positionEnd = position + mNumVertices * mVertexSize;
-    while (position != positionEnd)
-    {
-        *(CVector3*)position = *assimpPosition;
-        position += mVertexSize;
-        ++assimpPosition;
-    }
-
-    CVector3* assimpNormal = reinterpret_cast<CVector3*>(assimpMesh->mNormals);
-    unsigned char* normal = vertices.get() + normalOffset;
-    unsigned char* normalEnd = normal + mNumVertices * mVertexSize;
-    while (normal != normalEnd)
-    {
-        *(CVector3*)normal = *assimpNormal;
-        normal += mVertexSize;
-        ++assimpNormal;
-    }
-
-    if (requireTangents)
-    {
-      CVector3* assimpTangent = reinterpret_cast<CVector3*>(assimpMesh->mTangents);
-      unsigned char* tangent =  vertices.get() + tangentOffset;
-      unsigned char* tangentEnd = tangent + mNumVertices * mVertexSize;
-      while (tangent != tangentEnd)
-      {
-        *(CVector3*)tangent = *assimpTangent;
-        tangent += mVertexSize;
-        ++assimpTangent;
-      }
-    }
-
-    if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
-    {
-        aiVector3D* assimpUV = assimpMesh->mTextureCoords[0];
-        unsigned char* uv = vertices.get() + uvOffset;
-        unsigned char* uvEnd = uv + mNumVertices * mVertexSize;
-        while (uv != uvEnd)
-        {
-            *(CVector2*)uv = CVector2(assimpUV->x, assimpUV->y);
-            uv += mVertexSize;
-            ++assimpUV;
-        }
-    }
-
-
-    //-----------------------------------
-
-    // Copy face data from assimp to our CPU-side index buffer
-    if (!assimpMesh->HasFaces())  throw std::runtime_error("No face data in " + subMeshName + " in " + fileName);
-
-    DWORD* index = reinterpret_cast<DWORD*>(indices.get());
-    for (unsigned int face = 0; face < assimpMesh->mNumFaces; ++face)
-    {
-        *index++ = assimpMesh->mFaces[face].mIndices[0];
-        *index++ = assimpMesh->mFaces[face].mIndices[1];
-        *index++ = assimpMesh->mFaces[face].mIndices[2];
-    }
+    if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for " + name);
 
 
     //-----------------------------------
@@ -211,33 +58,70 @@ Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/)
     D3D11_BUFFER_DESC bufferDesc;
     D3D11_SUBRESOURCE_DATA initData;
 
-    // Create GPU-side vertex buffer and copy the vertices imported by assimp into it
+    // Create GPU-side vertex buffer and copy the vertices into it. When loaded from a cooked file this reads
+    // straight from the mapped file
     bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER; // Indicate it is a vertex buffer
     bufferDesc.Usage = D3D11_USAGE_DEFAULT;          // Default usage for this buffer - we'll see other usages later
     bufferDesc.ByteWidth = mNumVertices * mVertexSize; // Size of the buffer in bytes
     bufferDesc.CPUAccessFlags = 0;
     bufferDesc.MiscFlags = 0;
-    initData.pSysMem = vertices.get(); // Fill the new vertex buffer with data loaded by assimp
-    
+    initData.pSysMem = data.vertices; // Fill the new vertex buffer with the loaded data
+
     hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &mVertexBuffer);
-    if (FAILED(hr))  throw std::runtime_error("Failure creating vertex buffer for " + fileName);
+    if (FAILED(hr))
+    {
+        mVertexLayout->Release();
+        throw std::runtime_error("Failure creating vertex buffer for " + name);
+    }
 
 
-    // Create GPU-side index buffer and copy the vertices imported by assimp into it
+    // Create GPU-side index buffer and copy the indices into it
     bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER; // Indicate it is an index buffer
     bufferDesc.Usage = D3D11_USAGE_DEFAULT;         // Default usage for this buffer - we'll see other usages later
-    bufferDesc.ByteWidth = mNumIndices * sizeof(DWORD); // Size of the buffer in bytes
+    bufferDesc.ByteWidth = mNumIndices * data.indexSize; // Size of the buffer in bytes
     bufferDesc.CPUAccessFlags = 0;
     bufferDesc.MiscFlags = 0;
-    initData.pSysMem = indices.get(); // Fill the new index buffer with data loaded by assimp
+    initData.pSysMem = data.indices; // Fill the new index buffer with the loaded data
 
     hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &mIndexBuffer);
-    if (FAILED(hr))  throw std::runtime_error("Failure creating index buffer for " + fileName);
+    if (FAILED(hr))
+    {
+        mVertexBuffer->Release();
+        mVertexLayout->Release();
+        throw std::runtime_error("Failure creating index buffer for " + name);
+    }
+
+
+    // Create a constant buffer with the values the vertex shader needs to decode the vertices. They never change
+    // so the buffer is immutable, unlike the constant buffers created in Scene.cpp
+    PerMeshConstants meshConstants = {};
+    meshConstants.positionScale     = data.decoding.positionScale;
+    meshConstants.positionOffset    = data.decoding.positionOffset;
+    meshConstants.uvScale           = data.decoding.uvScale;
+    meshConstants.uvOffset          = data.decoding.uvOffset;
+    meshConstants.octahedralNormals = static_cast<float>(data.decoding.octahedralNormals);
+
+    bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    bufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+    bufferDesc.ByteWidth = 16 * ((sizeof(PerMeshConstants) + 15) / 16); // Constant buffer size must be a multiple of 16
+    bufferDesc.CPUAccessFlags = 0;
+    bufferDesc.MiscFlags = 0;
+    initData.pSysMem = &meshConstants;
+
+    hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &mConstantBuffer);
+    if (FAILED(hr))
+    {
+        mIndexBuffer->Release();
+        mVertexBuffer->Release();
+        mVertexLayout->Release();
+        throw std::runtime_error("Failure creating constant buffer for " + name);
+    }
 }
 
 
 Mesh::~Mesh()
 {
+    if (mConstantBuffer)  mConstantBuffer->Release();
     if (mIndexBuffer)   mIndexBuffer ->Release();
     if (mVertexBuffer)  mVertexBuffer->Release();
     if (mVertexLayout)  mVertexLayout->Release();
@@ -246,22 +130,63 @@ Mesh::~Mesh()
 
 // The render function assumes shaders, matrices, textures, samplers etc. have been set up already.
 // It simply draws this mesh with whatever settings the GPU is currently using.
-void Mesh::Render()
+// Optionally choose a simplified level of detail to draw (see NumLODs)
+void Mesh::Render(std::size_t lod /*= 0*/)
+{
+    SetBuffers();
+
+    // Sub-meshes follow each other in the index buffer and indices refer to the whole vertex buffer, so all of
+    // them can be drawn at once. Each LOD is a single range of indices covering all the sub-meshes
+    gD3DContext->DrawIndexed(mLODs[lod].numIndices, mLODs[lod].indexStart, 0);
+}
+
+
+// Draw several instances of the mesh at the given level of detail in one draw, with the same assumptions as
+// Render. The vertex shader gets each instance's world matrix itself (see InstanceBuffer.h)
+void Mesh::RenderInstanced(std::size_t lod, std::size_t numInstances)
+{
+    SetBuffers();
+    gD3DContext->DrawIndexedInstanced(mLODs[lod].numIndices, static_cast<UINT>(numInstances), mLODs[lod].indexStart, 0, 0);
+}
+
+
+// Draw a single sub-mesh at full detail, with the same assumptions as Render
+void Mesh::RenderSubMesh(std::size_t subMesh)
+{
+    SetBuffers();
+    gD3DContext->DrawIndexed(mSubMeshes[subMesh].numIndices, mSubMeshes[subMesh].indexStart, 0);
+}
+
+
+// Draw ranges of the full detail indices, usually the meshlets left after culling (see CullMeshlets in Meshlets.h),
+// with the same assumptions as Render
+void Mesh::RenderRanges(const std::vector<IndexRange>& ranges)
+{
+    SetBuffers();
+    for (auto& range : ranges)
+    {
+        gD3DContext->DrawIndexed(range.numIndices, range.indexStart, 0);
+    }
+}
+
+
+// Set the vertex and index buffers and other input assembler state needed to draw this mesh
+void Mesh::SetBuffers()
 {
     // Set vertex buffer as next data source for GPU
     UINT stride = mVertexSize;
     UINT offset = 0;
-    gD3DContext->IASetVertexBuffers(0, 1, &mVertexBuffer, &stride, &offset);
+    gStateCache.IASetVertexBuffers(0, 1, &mVertexBuffer, &stride, &offset);
 
     // Indicate the layout of vertex buffer
-    gD3DContext->IASetInputLayout(mVertexLayout);
+    gStateCache.IASetInputLayout(mVertexLayout);
 
-    // Set index buffer as next data source for GPU, indicate it uses 32-bit integers
-    gD3DContext->IASetIndexBuffer(mIndexBuffer, DXGI_FORMAT_R32_UINT, 0);
+    // Set index buffer as next data source for GPU, indicate whether it uses 16 or 32-bit integers
+    gStateCache.IASetIndexBuffer(mIndexBuffer, mIndexFormat, 0);
 
-    // Using triangle lists only in this class
-    gD3DContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    // Values to decode the compact vertex formats, used by all the vertex shaders that draw meshes
+    gStateCache.VSSetConstantBuffers(2, 1, &mConstantBuffer);
 
-    // Render mesh
-    gD3DContext->DrawIndexed(mNumIndices, 0, 0);
+    // Using triangle lists only in this class
+    gStateCache.IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 }
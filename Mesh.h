@@ -1,15 +1,18 @@
 //--------------------------------------------------------------------------------------
 // Class encapsulating a mesh
 //--------------------------------------------------------------------------------------
-// The mesh class splits the mesh into sub-meshes that only use one texture each.
-// ** THIS VERSION WILL ONLY KEEP THE FIRST SUB-MESH OTHER PARTS WILL BE MISSING **
-// ** DO NOT USE THIS VERSION FOR PROJECTS **
-// The class also doesn't load textures, filters or shaders as the outer code is
-// expected to select these things. A later lab will introduce a more robust loader.
+// Every mesh in the file is kept as a sub-mesh. All the sub-meshes share one vertex buffer and one index buffer, each
+// using a range of them, so the whole mesh is drawn with a single draw call.
+// The class doesn't load textures, filters or shaders as the outer code is expected to select these things.
+// Loading the file itself is done by LoadMeshData (see MeshData.h), this class creates the GPU-side data.
 
 #include "common.h"
+#include "Bounds.h"
+#include "MeshData.h"
+#include "TriangleBVH.h"
 
 #include <string>
+#include <vector>
 
 #ifndef _MESH_H_INCLUDED_
 #define _MESH_H_INCLUDED_
@@ -17,15 +20,59 @@
 class Mesh
 {
 public:
-    // Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types
-    // Optionally request tangents to be calculated (for normal and parallax mapping - see later lab)
+    // Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types, and
+    // saves a cooked copy of the mesh that is loaded much faster next time (see MeshData.h)
+    // Optionally request tangents to be calculated (for normal and parallax mapping - see later lab) and the formats
+    // to store vertices in (see VertexFormat in MeshData.h)
     // Will throw a std::runtime_error exception on failure (since constructors can't return errors).
-    Mesh(const std::string& fileName, bool requireTangents = false);
+    Mesh(const std::string& fileName, bool requireTangents = false, const VertexFormat& format = VertexFormat());
+
+    // Create a mesh from data that has already been loaded. The name is used in error messages
+    // Will throw a std::runtime_error exception on failure
+    Mesh(const MeshData& data, const std::string& name);
     ~Mesh();
 
     // The render function assumes shaders, matrices, textures, samplers etc. have been set up already.
     // It simply draws this mesh with whatever settings the GPU is currently using.
-    void Render();
+    // Optionally choose a simplified level of detail to draw (see NumLODs)
+    void Render(std::size_t lod = 0);
+
+    // Draw several instances of the mesh at the given level of detail in one draw, with the same assumptions as
+    // Render. The vertex shader gets each instance's world matrix itself (see InstanceBuffer.h)
+    void RenderInstanced(std::size_t lod, std::size_t numInstances);
+
+    // Draw a single sub-mesh at full detail, with the same assumptions as Render
+    void RenderSubMesh(std::size_t subMesh);
+
+    // Draw ranges of the full detail indices, usually the meshlets left after culling (see CullMeshlets in Meshlets.h),
+    // with the same assumptions as Render
+    void RenderRanges(const std::vector<IndexRange>& ranges);
+
+
+    // Bounds of the mesh in model space, calculated when loaded
+    const AABB&   BoundingBox()     { return mBoundingBox;    }
+    const Sphere& BoundingSphere()  { return mBoundingSphere; }
+
+    // Parts of the mesh, each with its own range of vertices and indices and its own bounds
+    std::size_t    NumSubMeshes()                   { return mSubMeshes.size(); }
+    const SubMesh& GetSubMesh(std::size_t subMesh)  { return mSubMeshes[subMesh]; }
+
+    // Levels of detail, 0 is the full detail mesh and higher numbers have fewer triangles. The error is roughly how
+    // far the LOD's surface is from the full detail surface, in model space units
+    std::size_t NumLODs()                  { return mLODs.size(); }
+    float       LODError(std::size_t lod)  { return mLODs[lod].error; }
+
+    // Small clusters of the full detail mesh's triangles, each with bounds for culling (see Meshlets.h)
+    const std::vector<Meshlet>& Meshlets()  { return mMeshlets; }
+
+    // CPU copy of the full detail triangles in model space, for ray casts. Triangle t uses full detail indices 3t to
+    // 3t + 2, so GetSubMesh etc. can be used to find which part of the mesh was hit
+    const TriangleBVH& Triangles()  { return mTriangles; }
+
+    // CPU copy of the full detail positions (in model space) and indices, e.g. to draw the mesh as an occluder (see
+    // OcclusionCulling.h). Empty if the vertices have no positions
+    const std::vector<CVector3>& Positions()  { return mPositions; }
+    const std::vector<uint32_t>& Indices()    { return mIndices;   }
 
 
 private:
@@ -37,7 +84,25 @@ private:
     ID3D11Buffer*      mVertexBuffer = nullptr;
 
     unsigned int       mNumIndices;
+    DXGI_FORMAT        mIndexFormat;            // 16 or 32 bit indices
     ID3D11Buffer*      mIndexBuffer  = nullptr;
+
+    ID3D11Buffer*      mConstantBuffer = nullptr; // PerMeshConstants for the vertex shader to decode compact vertices
+
+    AABB   mBoundingBox;
+    Sphere mBoundingSphere;
+
+    std::vector<SubMesh> mSubMeshes;
+    std::vector<MeshLOD> mLODs;
+    std::vector<Meshlet> mMeshlets;
+
+    std::vector<CVector3> mPositions;
+    std::vector<uint32_t> mIndices;
+    TriangleBVH           mTriangles;
+
+
+    // Set the vertex and index buffers and other input assembler state needed to draw this mesh
+    void SetBuffers();
 };
 
 
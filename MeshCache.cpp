@@ -0,0 +1,92 @@
+//--------------------------------------------------------------------------------------
+// Cache of loaded meshes so each mesh file is only loaded once
+//--------------------------------------------------------------------------------------
+
+#include "MeshCache.h"
+
+#include <algorithm>
+#include <cctype>
+
+
+// Meshes used by the app
+MeshCache gMeshCache;
+
+
+// Return the mesh for the given file and options (see Mesh constructor), loading it if it is not already loaded.
+// Will throw a std::runtime_error exception on failure
+Mesh* MeshCache::Acquire(const std::string& fileName, bool requireTangents /*= false*/, const VertexFormat& format /*= VertexFormat()*/)
+{
+    std::string key = MakeKey(fileName, requireTangents, format);
+    auto found = mEntries.find(key);
+    if (found != mEntries.end())
+    {
+        ++found->second.refCount;
+        return found->second.mesh;
+    }
+
+    return Acquire(fileName, requireTangents, LoadMeshData(fileName, requireTangents, format));
+}
+
+
+// As above, but if the mesh is not already loaded it is created from the given data, which must have been loaded
+// from the file with the same options (see LoadMeshData), including the vertex format it holds. Used when mesh files
+// are loaded on other threads
+Mesh* MeshCache::Acquire(const std::string& fileName, bool requireTangents, const MeshData& data)
+{
+    std::string key = MakeKey(fileName, requireTangents, data.format);
+    auto found = mEntries.find(key);
+    if (found != mEntries.end())
+    {
+        ++found->second.refCount;
+        return found->second.mesh;
+    }
+
+    Mesh* mesh = new Mesh(data, fileName); // Nothing is added to the cache if this throws
+    mEntries[key] = { mesh, 1 };
+    mKeys[mesh] = key;
+    return mesh;
+}
+
+
+// Returns true if the mesh for the given file and options is currently loaded
+bool MeshCache::IsLoaded(const std::string& fileName, bool requireTangents, const VertexFormat& format /*= VertexFormat()*/) const
+{
+    return mEntries.find(MakeKey(fileName, requireTangents, format)) != mEntries.end();
+}
+
+
+// Add a reference to a mesh returned by Acquire, so it needs an extra Release
+void MeshCache::AddRef(Mesh* mesh)
+{
+    auto key = mKeys.find(mesh);
+    if (key == mKeys.end())  return;
+    ++mEntries[key->second].refCount;
+}
+
+
+// Release a reference to a mesh returned by Acquire, deleting the mesh if it was the last one. Nullptr is ignored
+void MeshCache::Release(Mesh* mesh)
+{
+    auto key = mKeys.find(mesh);
+    if (key == mKeys.end())  return;
+
+    auto entry = mEntries.find(key->second);
+    if (--entry->second.refCount == 0)
+    {
+        delete mesh;
+        mEntries.erase(entry);
+        mKeys.erase(key);
+    }
+}
+
+
+// Key identifying a file loaded with particular options, names that refer to the same file (differing in case or
+// slashes) get the same key. File names are not case sensitive on Windows and may use either slash
+std::string MeshCache::MakeKey(const std::string& fileName, bool requireTangents, const VertexFormat& format)
+{
+    std::string key = fileName;
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return c == '\\' ? '/' : static_cast<char>(std::tolower(c)); });
+    key += requireTangents ? "|tangents|" : "||";
+    key += VertexFormatName(format);
+    return key;
+}
@@ -0,0 +1,61 @@
+//--------------------------------------------------------------------------------------
+// Cache of loaded meshes so each mesh file is only loaded once
+//--------------------------------------------------------------------------------------
+// Asking for a mesh that has already been loaded with the same options returns the same Mesh, sharing its GPU
+// buffers. Meshes are reference counted in the same way as DirectX objects: each Acquire (or AddRef) must be
+// matched by a Release, and the mesh is deleted by the last Release. Don't delete cached meshes directly.
+
+#include "Mesh.h"
+
+#include <string>
+#include <unordered_map>
+
+#ifndef _MESH_CACHE_H_INCLUDED_
+#define _MESH_CACHE_H_INCLUDED_
+
+
+class MeshCache
+{
+public:
+    // Return the mesh for the given file and options (see Mesh constructor), loading it if it is not already loaded.
+    // Will throw a std::runtime_error exception on failure
+    Mesh* Acquire(const std::string& fileName, bool requireTangents = false, const VertexFormat& format = VertexFormat());
+
+    // As above, but if the mesh is not already loaded it is created from the given data, which must have been loaded
+    // from the file with the same options (see LoadMeshData), including the vertex format it holds. Used when mesh files
+    // are loaded on other threads
+    Mesh* Acquire(const std::string& fileName, bool requireTangents, const MeshData& data);
+
+    // Returns true if the mesh for the given file and options is currently loaded
+    bool IsLoaded(const std::string& fileName, bool requireTangents, const VertexFormat& format = VertexFormat()) const;
+
+    // Add a reference to a mesh returned by Acquire, so it needs an extra Release
+    void AddRef(Mesh* mesh);
+
+    // Release a reference to a mesh returned by Acquire, deleting the mesh if it was the last one. Nullptr is ignored
+    void Release(Mesh* mesh);
+
+    // Number of different meshes currently loaded
+    std::size_t Count() const  { return mEntries.size(); }
+
+    // Key identifying a file loaded with particular options, names that refer to the same file (differing in case or
+    // slashes) get the same key
+    static std::string MakeKey(const std::string& fileName, bool requireTangents, const VertexFormat& format);
+
+
+private:
+    struct Entry
+    {
+        Mesh* mesh;
+        int   refCount;
+    };
+    std::unordered_map<std::string, Entry> mEntries;
+    std::unordered_map<Mesh*, std::string> mKeys;    // Key for each loaded mesh, used when releasing
+};
+
+
+// Meshes used by the app
+extern MeshCache gMeshCache;
+
+
+#endif //_MESH_CACHE_H_INCLUDED_
@@ -0,0 +1,853 @@
+//--------------------------------------------------------------------------------------
+// Loading mesh data from files, ready to create GPU buffers
+//--------------------------------------------------------------------------------------
+
+#include "MeshData.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "Meshlets.h"
+#include "CVector2.h"
+#include "CVector3.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/DefaultLogger.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <mutex>
+
+
+/*-----------------------------------------------------------------------------------------
+    Cooked file format
+-----------------------------------------------------------------------------------------*/
+namespace
+{
+    // Increase the version whenever the layout of cooked files or the processing done when importing changes, so
+    // old cooked files are imported again
+    const char     COOKED_MESH_ID[4]    = { 'M', 'E', 'S', 'H' };
+    const uint32_t COOKED_MESH_VERSION  = 6;
+    const uint64_t COOKED_MESH_ALIGNMENT = 16;
+
+    // Levels of detail built when importing. Each LOD aims for LOD_REDUCTION times the triangles of the one before. The
+    // chain stops at MAX_LODS, when a mesh gets down to LOD_MIN_TRIANGLES, when simplifying would move the surface more
+    // than LOD_MAX_ERROR times the bounding sphere radius, or when simplifying doesn't remove enough triangles
+    const unsigned int MAX_LODS          = 6; // Including the full detail mesh
+    const float        LOD_REDUCTION     = 0.5f;
+    const unsigned int LOD_MIN_TRIANGLES = 64;
+    const float        LOD_MAX_ERROR     = 0.1f;
+
+    struct CookedMeshHeader
+    {
+        char     id[4];
+        uint32_t version;
+        uint32_t hasTangents;
+        uint32_t numVertexElements;
+        uint32_t numSubMeshes;
+        uint32_t numLODs;
+        uint32_t numMeshlets;
+        uint32_t vertexSize;
+        uint32_t numVertices;
+        uint32_t numIndices;
+        uint32_t indexSize;        // 2 or 4 bytes
+        uint32_t positionFormat;   // VertexFormat used, so a cooked file is imported again if a different one is requested
+        uint32_t normalFormat;
+        uint32_t uvFormat;
+        AABB     boundingBox;
+        Sphere   boundingSphere;
+        VertexDecoding decoding;
+        uint64_t vertexDataOffset;
+        uint64_t indexDataOffset;
+    };
+
+    struct CookedVertexElement
+    {
+        char     semanticName[16]; // Zero terminated
+        uint32_t semanticIndex;
+        uint32_t format;           // DXGI_FORMAT
+        uint32_t offset;           // Offset of this element in a vertex
+    };
+
+    uint64_t AlignUp(uint64_t offset)
+    {
+        return (offset + COOKED_MESH_ALIGNMENT - 1) & ~(COOKED_MESH_ALIGNMENT - 1);
+    }
+
+
+    // Assimp's logger is shared by all importers, so when meshes are imported on several threads at once it is
+    // created by the first import to start and destroyed by the last to finish
+    std::mutex gImportLoggerMutex;
+    int        gNumImports = 0;
+
+    struct ImportLogger
+    {
+        ImportLogger()
+        {
+            std::lock_guard<std::mutex> lock(gImportLoggerMutex);
+            if (gNumImports++ == 0)  Assimp::DefaultLogger::create("", Assimp::DefaultLogger::VERBOSE);
+        }
+        ~ImportLogger()
+        {
+            std::lock_guard<std::mutex> lock(gImportLoggerMutex);
+            if (--gNumImports == 0)  Assimp::DefaultLogger::kill();
+        }
+    };
+
+
+    /*-----------------------------------------------------------------------------------------
+        Compact vertex formats
+    -----------------------------------------------------------------------------------------*/
+
+    // Convert a float to a 16-bit half float, rounding to nearest even. Values too large for a half become infinity
+    uint16_t FloatToHalf(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign     = (bits >> 16) & 0x8000;
+        uint32_t mantissa = bits & 0x7fffff;
+        int      exponent = static_cast<int>((bits >> 23) & 0xff);
+        if (exponent == 0xff)  return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0)); // Infinity or NaN
+
+        exponent += 15 - 127;
+        if (exponent >= 31)  return static_cast<uint16_t>(sign | 0x7c00);
+
+        uint32_t half, shift;
+        if (exponent <= 0) // Too small for a normal half, use a denormal
+        {
+            if (exponent < -10)  return static_cast<uint16_t>(sign);
+            mantissa |= 0x800000;
+            shift = 14 - exponent;
+            half  = mantissa >> shift;
+        }
+        else
+        {
+            shift = 13;
+            half  = (exponent << 10) | (mantissa >> shift);
+        }
+
+        // Round, a carry into the exponent gives the correct result (up to infinity)
+        uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1) != 0))  ++half;
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    // Store a value in the range offset to offset + scale in 16 bits
+    uint16_t QuantiseUNorm16(float value, float offset, float scale)
+    {
+        float t = scale > 0.0f ? (value - offset) / scale : 0.0f;
+        return static_cast<uint16_t>(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f + 0.5f);
+    }
+
+    int16_t QuantiseSNorm16(float value)
+    {
+        return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+    }
+
+    // Store a unit vector as two 16-bit values. The vector is projected onto the octahedron |x|+|y|+|z| = 1, then the
+    // lower half of the octahedron is folded out over the upper half to give a square. Error is under 0.05 degrees
+    void EncodeOctahedral(const CVector3& v, int16_t* encoded)
+    {
+        float sum = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+        float x = sum > 0.0f ? v.x / sum : 0.0f;
+        float y = sum > 0.0f ? v.y / sum : 0.0f;
+        if (v.z < 0.0f)
+        {
+            float foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            float foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+            x = foldedX;
+            y = foldedY;
+        }
+        encoded[0] = QuantiseSNorm16(x);
+        encoded[1] = QuantiseSNorm16(y);
+    }
+
+
+    // Offsets of each element in the float vertices built by ImportMeshData, tangent and uv are -1 if not present
+    struct FloatVertexLayout
+    {
+        unsigned int size;
+        int position, normal, tangent, uv;
+    };
+
+    // Replace the float vertices and 32-bit indices of imported mesh data with the given vertex format and the
+    // smallest index size that fits. The bounding box must already be calculated
+    void CompactMeshData(MeshData& data, const FloatVertexLayout& floatLayout, const VertexFormat& format)
+    {
+        data.format   = format;
+        data.decoding = VertexDecoding();
+        VertexDecoding& decoding = data.decoding;
+
+        // Vertex layout and decoding values for the new formats
+        std::vector<D3D11_INPUT_ELEMENT_DESC>& vertexElements = data.vertexElements;
+        vertexElements.clear();
+        unsigned int offset = 0;
+
+        unsigned int positionOffset = offset;
+        if (format.position == PositionFormat::UNorm16)
+        {
+            vertexElements.push_back( { "Position", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, positionOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+            offset += 8;
+            decoding.positionOffset = data.boundingBox.minPoint;
+            decoding.positionScale  = data.boundingBox.maxPoint - data.boundingBox.minPoint;
+        }
+        else
+        {
+            vertexElements.push_back( { "Position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, positionOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+            offset += 12;
+        }
+
+        bool octahedral = format.normal == NormalFormat::Octahedral16;
+        DXGI_FORMAT  normalFormat = octahedral ? DXGI_FORMAT_R16G16_SNORM : DXGI_FORMAT_R32G32B32_FLOAT;
+        unsigned int normalSize   = octahedral ? 4 : 12;
+        decoding.octahedralNormals = octahedral ? 1 : 0;
+
+        unsigned int normalOffset = offset;
+        vertexElements.push_back( { "Normal", 0, normalFormat, 0, normalOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+        offset += normalSize;
+
+        unsigned int tangentOffset = offset;
+        if (floatLayout.tangent >= 0)
+        {
+            vertexElements.push_back( { "Tangent", 0, normalFormat, 0, tangentOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+            offset += normalSize;
+        }
+
+        unsigned int uvOffset = offset;
+        if (floatLayout.uv >= 0)
+        {
+            if (format.uv == UVFormat::UNorm16)
+            {
+                CVector2 minUV = *reinterpret_cast<const CVector2*>(data.vertices + floatLayout.uv);
+                CVector2 maxUV = minUV;
+                for (unsigned int v = 1; v < data.numVertices; ++v)
+                {
+                    const CVector2& uv = *reinterpret_cast<const CVector2*>(data.vertices + v * floatLayout.size + floatLayout.uv);
+                    minUV.x = std::min(minUV.x, uv.x);  maxUV.x = std::max(maxUV.x, uv.x);
+                    minUV.y = std::min(minUV.y, uv.y);  maxUV.y = std::max(maxUV.y, uv.y);
+                }
+                decoding.uvOffset = minUV;
+                decoding.uvScale  = maxUV - minUV;
+            }
+            DXGI_FORMAT uvFormat = format.uv == UVFormat::Float32 ? DXGI_FORMAT_R32G32_FLOAT :
+                                   format.uv == UVFormat::Float16 ? DXGI_FORMAT_R16G16_FLOAT : DXGI_FORMAT_R16G16_UNORM;
+            vertexElements.push_back( { "UV", 0, uvFormat, 0, uvOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+            offset += format.uv == UVFormat::Float32 ? 8 : 4;
+        }
+
+        data.vertexSize = offset; // Always a multiple of 4 so indices after the vertices are aligned
+        data.indexSize  = data.numVertices < 65536 ? 2 : 4;
+
+
+        // Convert the vertices and indices into a new allocation
+        std::size_t verticesSize = static_cast<std::size_t>(data.numVertices) * data.vertexSize;
+        std::unique_ptr<unsigned char[]> storage = std::make_unique<unsigned char[]>(verticesSize + data.numIndices * data.indexSize);
+        unsigned char* vertices = storage.get();
+
+        for (unsigned int v = 0; v < data.numVertices; ++v)
+        {
+            const unsigned char* floatVertex = data.vertices + v * floatLayout.size;
+            unsigned char*       vertex      = vertices + v * data.vertexSize;
+
+            const CVector3& position = *reinterpret_cast<const CVector3*>(floatVertex + floatLayout.position);
+            if (format.position == PositionFormat::UNorm16)
+            {
+                uint16_t* quantised = reinterpret_cast<uint16_t*>(vertex + positionOffset);
+                quantised[0] = QuantiseUNorm16(position.x, decoding.positionOffset.x, decoding.positionScale.x);
+                quantised[1] = QuantiseUNorm16(position.y, decoding.positionOffset.y, decoding.positionScale.y);
+                quantised[2] = QuantiseUNorm16(position.z, decoding.positionOffset.z, decoding.positionScale.z);
+                quantised[3] = 0;
+            }
+            else
+            {
+                *reinterpret_cast<CVector3*>(vertex + positionOffset) = position;
+            }
+
+            const CVector3& normal = *reinterpret_cast<const CVector3*>(floatVertex + floatLayout.normal);
+            if (octahedral)  EncodeOctahedral(normal, reinterpret_cast<int16_t*>(vertex + normalOffset));
+            else             *reinterpret_cast<CVector3*>(vertex + normalOffset) = normal;
+
+            if (floatLayout.tangent >= 0)
+            {
+                const CVector3& tangent = *reinterpret_cast<const CVector3*>(floatVertex + floatLayout.tangent);
+                if (octahedral)  EncodeOctahedral(tangent, reinterpret_cast<int16_t*>(vertex + tangentOffset));
+                else             *reinterpret_cast<CVector3*>(vertex + tangentOffset) = tangent;
+            }
+
+            if (floatLayout.uv >= 0)
+            {
+                const CVector2& uv = *reinterpret_cast<const CVector2*>(floatVertex + floatLayout.uv);
+                if (format.uv == UVFormat::Float32)
+                {
+                    *reinterpret_cast<CVector2*>(vertex + uvOffset) = uv;
+                }
+                else
+                {
+                    uint16_t* packed = reinterpret_cast<uint16_t*>(vertex + uvOffset);
+                    if (format.uv == UVFormat::Float16)
+                    {
+                        packed[0] = FloatToHalf(uv.x);
+                        packed[1] = FloatToHalf(uv.y);
+                    }
+                    else
+                    {
+                        packed[0] = QuantiseUNorm16(uv.x, decoding.uvOffset.x, decoding.uvScale.x);
+                        packed[1] = QuantiseUNorm16(uv.y, decoding.uvOffset.y, decoding.uvScale.y);
+                    }
+                }
+            }
+        }
+
+        const uint32_t* oldIndices = static_cast<const uint32_t*>(data.indices);
+        if (data.indexSize == 2)
+        {
+            uint16_t* indices = reinterpret_cast<uint16_t*>(vertices + verticesSize);
+            for (unsigned int i = 0; i < data.numIndices; ++i)  indices[i] = static_cast<uint16_t>(oldIndices[i]);
+        }
+        else
+        {
+            std::memcpy(vertices + verticesSize, oldIndices, data.numIndices * sizeof(uint32_t));
+        }
+
+        data.vertices = vertices;
+        data.indices  = vertices + verticesSize;
+        data.storage  = std::move(storage);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Loading
+-----------------------------------------------------------------------------------------*/
+
+// Load the mesh in the given file, from its cooked file if there is an up-to-date one, otherwise importing it with
+// assimp and saving a cooked file for next time. Optionally request tangents to be calculated (for normal mapping)
+// and the formats to store vertices in
+// Will throw a std::runtime_error exception on failure. Does not use DirectX, so can be called on any thread
+MeshData LoadMeshData(const std::string& fileName, bool requireTangents /*= false*/, const VertexFormat& format /*= VertexFormat()*/)
+{
+    std::string cookedFileName = CookedMeshFileName(fileName, requireTangents, format);
+    uint64_t cookedTime = FileWriteTime(cookedFileName);
+
+    MeshData data;
+    if (cookedTime != 0 && cookedTime >= FileWriteTime(fileName) && LoadCookedMeshData(cookedFileName, requireTangents, format, data))
+    {
+        return data;
+    }
+
+    data = ImportMeshData(fileName, requireTangents, format);
+    SaveCookedMeshData(data, cookedFileName); // Not an error if this fails (e.g. read-only folder), just slower next time
+    return data;
+}
+
+
+// Import the mesh in the given file with assimp (http://www.assimp.org/), which supports many file types
+// Will throw a std::runtime_error exception on failure
+MeshData ImportMeshData(const std::string& fileName, bool requireTangents /*= false*/, const VertexFormat& format /*= VertexFormat()*/)
+{
+    Assimp::Importer importer;
+
+    // Flags for processing the mesh. Assimp provides a huge amount of control - right click any of these
+    // and "Peek Definition" to see documention above each constant
+    unsigned int assimpFlags = aiProcess_MakeLeftHanded |
+                               aiProcess_GenSmoothNormals |
+                               aiProcess_FixInfacingNormals |
+                               aiProcess_GenUVCoords |
+                               aiProcess_TransformUVCoords |
+                               aiProcess_FlipUVs |
+                               aiProcess_FlipWindingOrder |
+                               aiProcess_Triangulate |
+                               aiProcess_PreTransformVertices |
+                               aiProcess_JoinIdenticalVertices |
+                               aiProcess_ImproveCacheLocality |
+                               aiProcess_SortByPType |
+                               aiProcess_FindInvalidData |
+                               aiProcess_OptimizeMeshes |
+                               aiProcess_FindInstances |
+                               aiProcess_FindDegenerates |
+                               aiProcess_RemoveRedundantMaterials |
+                               aiProcess_Debone |
+                               aiProcess_RemoveComponent;
+
+    // Flags to specify what mesh data to ignore
+    int removeComponents = aiComponent_LIGHTS | aiComponent_CAMERAS | aiComponent_TEXTURES | aiComponent_COLORS |
+                           aiComponent_BONEWEIGHTS | aiComponent_ANIMATIONS | aiComponent_MATERIALS;
+
+    // Add / remove tangents as required by user
+    if (requireTangents)
+    {
+        assimpFlags |= aiProcess_CalcTangentSpace;
+    }
+    else
+    {
+        removeComponents |= aiComponent_TANGENTS_AND_BITANGENTS;
+    }
+
+    // Other miscellaneous settings
+    importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, 80.0f); // Smoothing angle for normals
+    importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);  // Remove points and lines (keep triangles only)
+    importer.SetPropertyBool(AI_CONFIG_PP_FD_REMOVE, true);                 // Remove degenerate triangles
+    importer.SetPropertyBool(AI_CONFIG_PP_DB_ALL_OR_NONE, true);            // Default to removing bones/weights from meshes that don't need skinning
+
+    importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, removeComponents);
+
+    // Import mesh with assimp given above requirements - log output
+    const aiScene* scene;
+    {
+        ImportLogger logger;
+        scene = importer.ReadFile(fileName, assimpFlags);
+    }
+    if (scene == nullptr)  throw std::runtime_error("Error loading mesh (" + fileName + "). " + importer.GetErrorString());
+    if (scene->mNumMeshes == 0)  throw std::runtime_error("No usable geometry in mesh: " + fileName);
+
+
+    //-----------------------------------
+
+    // Every mesh in the file becomes a sub-mesh. They are packed one after another into a single set of vertices and
+    // indices, so they all need the same vertex layout. Check for presence of position and normal data in each, tangents
+    // are required in all of them if requested. UVs are optional, sub-meshes without them get zero UVs if others have them
+    bool hasUVs = false;
+    unsigned int totalVertices = 0, totalIndices = 0;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        aiMesh* assimpMesh = scene->mMeshes[m];
+        std::string subMeshName = assimpMesh->mName.C_Str();
+        if (!assimpMesh->HasPositions())  throw std::runtime_error("No position data for sub-mesh " + subMeshName + " in " + fileName);
+        if (!assimpMesh->HasNormals())  throw std::runtime_error("No normal data for sub-mesh " + subMeshName + " in " + fileName);
+        if (requireTangents && !assimpMesh->HasTangentsAndBitangents())  throw std::runtime_error("No tangent data for sub-mesh " + subMeshName + " in " + fileName);
+        if (!assimpMesh->HasFaces())  throw std::runtime_error("No face data in " + subMeshName + " in " + fileName);
+        if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
+        {
+            if (assimpMesh->mNumUVComponents[0] != 2)  throw std::runtime_error("Unsupported texture coordinates in " + subMeshName + " in " + fileName);
+            hasUVs = true;
+        }
+        totalVertices += assimpMesh->mNumVertices;
+        totalIndices  += assimpMesh->mNumFaces * 3;
+    }
+
+
+    //-----------------------------------
+
+    // Vertices are built with float elements first, they are converted to the requested formats at the end
+    MeshData data;
+    std::vector<D3D11_INPUT_ELEMENT_DESC>& vertexElements = data.vertexElements;
+    unsigned int offset = 0;
+
+    unsigned int positionOffset = offset;
+    vertexElements.push_back( { "Position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, positionOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+    offset += 12;
+
+    unsigned int normalOffset = offset;
+    vertexElements.push_back( { "Normal", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, normalOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+    offset += 12;
+
+    unsigned int tangentOffset = offset;
+    if (requireTangents)
+    {
+        vertexElements.push_back( { "Tangent", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, tangentOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+        offset += 12;
+    }
+
+    unsigned int uvOffset = offset;
+    if (hasUVs)
+    {
+        vertexElements.push_back( { "UV", 0, DXGI_FORMAT_R32G32_FLOAT, 0, uvOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+        offset += 8;
+    }
+
+    data.vertexSize = offset;
+    FloatVertexLayout floatLayout = { offset, static_cast<int>(positionOffset), static_cast<int>(normalOffset),
+                                      requireTangents ? static_cast<int>(tangentOffset) : -1, hasUVs ? static_cast<int>(uvOffset) : -1 };
+
+
+    //-----------------------------------
+
+    // Create CPU-side buffers to hold current mesh data - exact content is flexible so can't use a structure for a vertex - so just a block of bytes
+    // Vertices and indices share one allocation, indices after the vertices (vertex size is a multiple of 4 so indices are aligned)
+    // Note: for large arrays a unique_ptr is better than a vector because vectors default-initialise all the values which is a waste of time.
+    data.numVertices = totalVertices;
+    data.numIndices  = totalIndices;
+    std::size_t verticesSize = static_cast<std::size_t>(data.numVertices) * data.vertexSize;
+    data.storage = std::make_unique<unsigned char[]>(verticesSize + data.numIndices * sizeof(uint32_t)); // Using 32 bit indexes (4 bytes) for each index
+    unsigned char* vertices = data.storage.get();
+    uint32_t*      indices  = reinterpret_cast<uint32_t*>(vertices + verticesSize);
+    data.vertices = vertices;
+    data.indices  = indices;
+
+
+    //-----------------------------------
+
+    // Copy mesh data from assimp to our CPU-side vertex and index buffers, one sub-mesh after another. Indices refer
+    // to the vertices of the whole mesh
+    unsigned int vertexStart = 0, indexStart = 0;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        aiMesh* assimpMesh = scene->mMeshes[m];
+        unsigned char* subMeshVertices = vertices + static_cast<std::size_t>(vertexStart) * data.vertexSize;
+
+        for (unsigned int v = 0; v < assimpMesh->mNumVertices; ++v)
+        {
+            unsigned char* vertex = subMeshVertices + static_cast<std::size_t>(v) * data.vertexSize;
+            *(CVector3*)(vertex + positionOffset) = *reinterpret_cast<CVector3*>(&assimpMesh->mVertices[v]);
+            *(CVector3*)(vertex + normalOffset)   = *reinterpret_cast<CVector3*>(&assimpMesh->mNormals[v]);
+            if (requireTangents)
+            {
+                *(CVector3*)(vertex + tangentOffset) = *reinterpret_cast<CVector3*>(&assimpMesh->mTangents[v]);
+            }
+            if (hasUVs)
+            {
+                bool subMeshHasUVs = assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0);
+                const aiVector3D* assimpUV = subMeshHasUVs ? &assimpMesh->mTextureCoords[0][v] : nullptr;
+                *(CVector2*)(vertex + uvOffset) = assimpUV ? CVector2(assimpUV->x, assimpUV->y) : CVector2(0, 0);
+            }
+        }
+
+        uint32_t* index = indices + indexStart;
+        for (unsigned int face = 0; face < assimpMesh->mNumFaces; ++face)
+        {
+            *index++ = vertexStart + assimpMesh->mFaces[face].mIndices[0];
+            *index++ = vertexStart + assimpMesh->mFaces[face].mIndices[1];
+            *index++ = vertexStart + assimpMesh->mFaces[face].mIndices[2];
+        }
+
+        SubMesh subMesh = {};
+        subMesh.vertexStart = vertexStart;
+        subMesh.numVertices = assimpMesh->mNumVertices;
+        subMesh.indexStart  = indexStart;
+        subMesh.numIndices  = assimpMesh->mNumFaces * 3;
+        data.subMeshes.push_back(subMesh);
+
+        vertexStart += subMesh.numVertices;
+        indexStart  += subMesh.numIndices;
+    }
+
+
+    //-----------------------------------
+
+    // Reorder triangles and vertices so the GPU processes them faster (see MeshOptimizer.h). Assimp has already
+    // improved the order a little, report how much better our order is in Visual Studio's output window
+    // Each sub-mesh is optimised on its own so they stay separate. Optimising vertex fetch can remove unused vertices,
+    // so sub-meshes are moved down afterwards to close any gaps
+    MeshStats before = AnalyseMesh(indices, data.numIndices, vertices, data.vertexSize, data.numVertices);
+
+    unsigned int packedStart = 0;
+    for (auto& subMesh : data.subMeshes)
+    {
+        uint32_t*      subMeshIndices  = indices + subMesh.indexStart;
+        unsigned char* subMeshVertices = vertices + static_cast<std::size_t>(subMesh.vertexStart) * data.vertexSize;
+        for (unsigned int i = 0; i < subMesh.numIndices; ++i)  subMeshIndices[i] -= subMesh.vertexStart;
+
+        OptimizeVertexCache(subMeshIndices, subMesh.numIndices, subMesh.numVertices);
+        OptimizeOverdraw(subMeshIndices, subMesh.numIndices, subMeshVertices, data.vertexSize, subMesh.numVertices);
+        subMesh.numVertices = static_cast<uint32_t>(OptimizeVertexFetch(subMeshVertices, data.vertexSize, subMesh.numVertices,
+                                                                        subMeshIndices, subMesh.numIndices));
+
+        unsigned char* packedVertices = vertices + static_cast<std::size_t>(packedStart) * data.vertexSize;
+        std::memmove(packedVertices, subMeshVertices, static_cast<std::size_t>(subMesh.numVertices) * data.vertexSize);
+        for (unsigned int i = 0; i < subMesh.numIndices; ++i)  subMeshIndices[i] += packedStart;
+        subMesh.vertexStart = packedStart;
+        packedStart += subMesh.numVertices;
+
+        // Bounds of each sub-mesh for visibility culling
+        subMesh.boundingBox    = BoundingBoxFromPoints(packedVertices + positionOffset, data.vertexSize, subMesh.numVertices);
+        subMesh.boundingSphere = BoundingSphereFromPoints(packedVertices + positionOffset, data.vertexSize, subMesh.numVertices, subMesh.boundingBox);
+    }
+    data.numVertices = packedStart;
+
+    // Split the sub-meshes into meshlets for finer culling. This reorders triangles but keeps most of the vertex cache
+    // benefit, as each meshlet is optimised for the cache and meshlets follow the optimised order
+    for (auto& subMesh : data.subMeshes)
+    {
+        BuildMeshlets(indices, subMesh.indexStart, subMesh.numIndices, vertices, data.vertexSize, data.numVertices, data.meshlets);
+    }
+
+    MeshStats after = AnalyseMesh(indices, data.numIndices, vertices, data.vertexSize, data.numVertices);
+
+    char report[256];
+    std::snprintf(report, sizeof(report), "Optimised mesh %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f, overfetch %.3f -> %.3f\n",
+                  fileName.c_str(), before.acmr, after.acmr, before.atvr, after.atvr, before.overdraw, after.overdraw, before.overfetch, after.overfetch);
+    OutputDebugStringA(report);
+
+
+    // Bounds of the whole mesh for visibility culling
+    data.boundingBox    = BoundingBoxFromPoints(vertices + positionOffset, data.vertexSize, data.numVertices);
+    data.boundingSphere = BoundingSphereFromPoints(vertices + positionOffset, data.vertexSize, data.numVertices, data.boundingBox);
+
+
+    //-----------------------------------
+
+    // Build the chain of simplified LODs, each simplified from the full detail mesh so its error is measured against
+    // the original surface. LOD indices go after the full detail indices
+    std::vector<uint32_t> allIndices(indices, indices + data.numIndices);
+    data.lods.push_back({ 0, data.numIndices, 0.0f });
+
+    std::vector<uint32_t> lodIndices(data.numIndices);
+    std::size_t previousCount = data.numIndices;
+    while (data.lods.size() < MAX_LODS && previousCount / 3 > LOD_MIN_TRIANGLES)
+    {
+        std::size_t target = static_cast<std::size_t>(previousCount / 3 * LOD_REDUCTION) * 3;
+        float error;
+        std::size_t count = SimplifyMesh(lodIndices.data(), indices, data.numIndices, vertices, data.vertexSize, data.numVertices,
+                                         target, data.boundingSphere.radius * LOD_MAX_ERROR, &error);
+        if (count == 0 || count > previousCount * 9 / 10)  break; // Not worth another level
+
+        OptimizeVertexCache(lodIndices.data(), count, data.numVertices);
+        data.lods.push_back({ static_cast<uint32_t>(allIndices.size()), static_cast<uint32_t>(count), error });
+        allIndices.insert(allIndices.end(), lodIndices.begin(), lodIndices.begin() + count);
+        previousCount = count;
+    }
+    data.indices    = allIndices.data(); // Copied into the mesh's storage by CompactMeshData below
+    data.numIndices = static_cast<unsigned int>(allIndices.size());
+
+    // Convert to the requested vertex formats and 16-bit indices if possible
+    std::size_t floatSize = static_cast<std::size_t>(data.numVertices) * data.vertexSize + data.numIndices * sizeof(uint32_t);
+    CompactMeshData(data, floatLayout, format);
+
+    std::snprintf(report, sizeof(report), "Compacted mesh %s: %zu -> %zu bytes (%u byte vertices, %u byte indices)\n", fileName.c_str(),
+                  floatSize, static_cast<std::size_t>(data.numVertices) * data.vertexSize + data.numIndices * data.indexSize,
+                  data.vertexSize, data.indexSize);
+    OutputDebugStringA(report);
+
+    std::snprintf(report, sizeof(report), "  %zu meshlets\n", data.meshlets.size());
+    OutputDebugStringA(report);
+    for (std::size_t lod = 1; lod < data.lods.size(); ++lod)
+    {
+        std::snprintf(report, sizeof(report), "  LOD %zu: %u triangles, error %g\n", lod, data.lods[lod].numIndices / 3, data.lods[lod].error);
+        OutputDebugStringA(report);
+    }
+
+    return data;
+}
+
+
+// Memory map the given cooked mesh file. Returns false if the file doesn't exist, is not a valid cooked mesh or
+// doesn't have the required tangents and vertex format
+bool LoadCookedMeshData(const std::string& cookedFileName, bool requireTangents, const VertexFormat& format, MeshData& data)
+{
+    MappedFile file;
+    if (!file.Open(cookedFileName))  return false;
+
+    // Check the header and that everything it refers to is inside the file
+    const unsigned char* fileData = file.Data();
+    uint64_t fileSize = file.Size();
+    if (fileSize < sizeof(CookedMeshHeader))  return false;
+    const CookedMeshHeader* header = reinterpret_cast<const CookedMeshHeader*>(fileData);
+    if (std::memcmp(header->id, COOKED_MESH_ID, sizeof(COOKED_MESH_ID)) != 0 || header->version != COOKED_MESH_VERSION)  return false;
+    if ((header->hasTangents != 0) != requireTangents)  return false;
+    if (header->positionFormat != static_cast<uint32_t>(format.position) || header->normalFormat != static_cast<uint32_t>(format.normal) ||
+        header->uvFormat != static_cast<uint32_t>(format.uv) || (header->indexSize != 2 && header->indexSize != 4))
+    {
+        return false;
+    }
+
+    uint64_t elementsEnd  = sizeof(CookedMeshHeader) + header->numVertexElements * sizeof(CookedVertexElement);
+    uint64_t subMeshesEnd = elementsEnd + static_cast<uint64_t>(header->numSubMeshes) * sizeof(SubMesh);
+    uint64_t lodsEnd      = subMeshesEnd + static_cast<uint64_t>(header->numLODs) * sizeof(MeshLOD);
+    uint64_t meshletsEnd  = lodsEnd + static_cast<uint64_t>(header->numMeshlets) * sizeof(Meshlet);
+    uint64_t verticesSize = static_cast<uint64_t>(header->numVertices) * header->vertexSize;
+    uint64_t indicesSize  = static_cast<uint64_t>(header->numIndices) * header->indexSize;
+    if (header->numVertexElements > D3D11_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT ||
+        header->numSubMeshes == 0 || header->numLODs == 0 || meshletsEnd > fileSize ||
+        header->vertexDataOffset < meshletsEnd || header->vertexDataOffset + verticesSize > fileSize ||
+        header->indexDataOffset < header->vertexDataOffset + verticesSize || header->indexDataOffset + indicesSize > fileSize)
+    {
+        return false;
+    }
+
+    // Vertex layout - semantic names are used directly from the file
+    const CookedVertexElement* elements = reinterpret_cast<const CookedVertexElement*>(fileData + sizeof(CookedMeshHeader));
+    data.vertexElements.clear();
+    for (uint32_t i = 0; i < header->numVertexElements; ++i)
+    {
+        if (elements[i].semanticName[sizeof(elements[i].semanticName) - 1] != 0)  return false;
+        data.vertexElements.push_back( { elements[i].semanticName, elements[i].semanticIndex, static_cast<DXGI_FORMAT>(elements[i].format),
+                                         0, elements[i].offset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+    }
+
+    // Sub-meshes must be inside the vertices and indices
+    const SubMesh* subMeshes = reinterpret_cast<const SubMesh*>(fileData + elementsEnd);
+    for (uint32_t i = 0; i < header->numSubMeshes; ++i)
+    {
+        if (static_cast<uint64_t>(subMeshes[i].vertexStart) + subMeshes[i].numVertices > header->numVertices ||
+            static_cast<uint64_t>(subMeshes[i].indexStart)  + subMeshes[i].numIndices  > header->numIndices)
+        {
+            return false;
+        }
+    }
+    data.subMeshes.assign(subMeshes, subMeshes + header->numSubMeshes);
+
+    // As do LODs
+    const MeshLOD* lods = reinterpret_cast<const MeshLOD*>(fileData + subMeshesEnd);
+    for (uint32_t i = 0; i < header->numLODs; ++i)
+    {
+        if (static_cast<uint64_t>(lods[i].indexStart) + lods[i].numIndices > header->numIndices)  return false;
+    }
+    data.lods.assign(lods, lods + header->numLODs);
+
+    // And meshlets
+    const Meshlet* meshlets = reinterpret_cast<const Meshlet*>(fileData + lodsEnd);
+    for (uint32_t i = 0; i < header->numMeshlets; ++i)
+    {
+        if (static_cast<uint64_t>(meshlets[i].indexStart) + meshlets[i].numIndices > header->numIndices)  return false;
+    }
+    data.meshlets.assign(meshlets, meshlets + header->numMeshlets);
+
+    // Every index must refer to a vertex - a truncated or corrupt file would otherwise cause reads past the vertices
+    // in the BVH, meshlet and occlusion code. Indices are for the whole mesh, so one pass over them all is enough
+    const void* indices = fileData + header->indexDataOffset;
+    uint32_t maxIndex = 0;
+    if (header->indexSize == 2)
+    {
+        const uint16_t* indices16 = static_cast<const uint16_t*>(indices);
+        for (uint32_t i = 0; i < header->numIndices; ++i)  maxIndex = std::max<uint32_t>(maxIndex, indices16[i]);
+    }
+    else
+    {
+        const uint32_t* indices32 = static_cast<const uint32_t*>(indices);
+        for (uint32_t i = 0; i < header->numIndices; ++i)  maxIndex = std::max(maxIndex, indices32[i]);
+    }
+    if (header->numIndices > 0 && maxIndex >= header->numVertices)  return false;
+
+    data.vertexSize     = header->vertexSize;
+    data.numVertices    = header->numVertices;
+    data.numIndices     = header->numIndices;
+    data.indexSize      = header->indexSize;
+    data.vertices       = fileData + header->vertexDataOffset;
+    data.indices        = indices;
+    data.format         = format;
+    data.decoding       = header->decoding;
+    data.boundingBox    = header->boundingBox;
+    data.boundingSphere = header->boundingSphere;
+    data.storage.reset();
+    data.file = std::move(file); // Keep the file mapped for as long as the data is needed
+    return true;
+}
+
+
+// Save mesh data as a cooked mesh file. Returns false on failure
+bool SaveCookedMeshData(const MeshData& data, const std::string& cookedFileName)
+{
+    CookedMeshHeader header = {};
+    std::memcpy(header.id, COOKED_MESH_ID, sizeof(COOKED_MESH_ID));
+    header.version           = COOKED_MESH_VERSION;
+    header.hasTangents       = 0;
+    header.numVertexElements = static_cast<uint32_t>(data.vertexElements.size());
+    header.numSubMeshes      = static_cast<uint32_t>(data.subMeshes.size());
+    header.numLODs           = static_cast<uint32_t>(data.lods.size());
+    header.numMeshlets       = static_cast<uint32_t>(data.meshlets.size());
+    header.vertexSize        = data.vertexSize;
+    header.numVertices       = data.numVertices;
+    header.numIndices        = data.numIndices;
+    header.indexSize         = data.indexSize;
+    header.positionFormat    = static_cast<uint32_t>(data.format.position);
+    header.normalFormat      = static_cast<uint32_t>(data.format.normal);
+    header.uvFormat          = static_cast<uint32_t>(data.format.uv);
+    header.boundingBox       = data.boundingBox;
+    header.boundingSphere    = data.boundingSphere;
+    header.decoding          = data.decoding;
+
+    std::vector<CookedVertexElement> elements(data.vertexElements.size());
+    for (std::size_t i = 0; i < elements.size(); ++i)
+    {
+        const D3D11_INPUT_ELEMENT_DESC& element = data.vertexElements[i];
+        if (std::strlen(element.SemanticName) >= sizeof(elements[i].semanticName))  return false;
+        std::memset(&elements[i], 0, sizeof(CookedVertexElement));
+        std::strcpy(elements[i].semanticName, element.SemanticName);
+        elements[i].semanticIndex = element.SemanticIndex;
+        elements[i].format        = element.Format;
+        elements[i].offset        = element.AlignedByteOffset;
+        if (std::strcmp(element.SemanticName, "Tangent") == 0)  header.hasTangents = 1;
+    }
+
+    uint64_t verticesSize = static_cast<uint64_t>(data.numVertices) * data.vertexSize;
+    uint64_t meshletsEnd = sizeof(CookedMeshHeader) + elements.size() * sizeof(CookedVertexElement) +
+                           data.subMeshes.size() * sizeof(SubMesh) + data.lods.size() * sizeof(MeshLOD) +
+                           data.meshlets.size() * sizeof(Meshlet);
+    header.vertexDataOffset = AlignUp(meshletsEnd);
+    header.indexDataOffset  = AlignUp(header.vertexDataOffset + verticesSize);
+
+    // Write to a temporary file then rename it, so a half-written file is never loaded
+    std::string tempFileName = cookedFileName + ".tmp";
+    {
+        std::ofstream file(tempFileName, std::ios::binary | std::ios::trunc);
+        if (!file)  return false;
+
+        const char padding[COOKED_MESH_ALIGNMENT] = {};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(CookedMeshHeader));
+        file.write(reinterpret_cast<const char*>(elements.data()), elements.size() * sizeof(CookedVertexElement));
+        file.write(reinterpret_cast<const char*>(data.subMeshes.data()), data.subMeshes.size() * sizeof(SubMesh));
+        file.write(reinterpret_cast<const char*>(data.lods.data()), data.lods.size() * sizeof(MeshLOD));
+        file.write(reinterpret_cast<const char*>(data.meshlets.data()), data.meshlets.size() * sizeof(Meshlet));
+        file.write(padding, header.vertexDataOffset - meshletsEnd);
+        file.write(reinterpret_cast<const char*>(data.vertices), verticesSize);
+        file.write(padding, header.indexDataOffset - (header.vertexDataOffset + verticesSize));
+        file.write(static_cast<const char*>(data.indices), static_cast<std::streamsize>(data.numIndices) * data.indexSize);
+        if (!file)
+        {
+            file.close();
+            DeleteFileA(tempFileName.c_str());
+            return false;
+        }
+    }
+    if (!MoveFileExA(tempFileName.c_str(), cookedFileName.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileA(tempFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+// Name of the cooked file used for the given mesh file and options. Each vertex format gets its own file
+std::string CookedMeshFileName(const std::string& fileName, bool requireTangents, const VertexFormat& format)
+{
+    // The default format keeps the plain name so existing cooked files are still used
+    std::string name = fileName + (requireTangents ? ".tangents" : "");
+    if (format != VertexFormat())  name += "." + VertexFormatName(format);
+    return name + ".mesh";
+}
+
+
+// Short text identifying a vertex format, e.g. "p1n1u2", used in cooked file names and cache keys
+std::string VertexFormatName(const VertexFormat& format)
+{
+    return "p" + std::to_string(static_cast<int>(format.position)) +
+           "n" + std::to_string(static_cast<int>(format.normal)) +
+           "u" + std::to_string(static_cast<int>(format.uv));
+}
+
+
+// Model space positions of all the vertices, turning compact positions back into floats the same way the vertex
+// shaders do. Used for work on the CPU such as ray casts. Returns an empty vector if the vertices have no positions
+std::vector<CVector3> DecodePositions(const MeshData& data)
+{
+    std::vector<CVector3> positions;
+    for (auto& element : data.vertexElements)
+    {
+        if (std::strcmp(element.SemanticName, "Position") != 0)  continue;
+
+        positions.resize(data.numVertices);
+        const unsigned char* vertex = data.vertices + element.AlignedByteOffset;
+        for (unsigned int v = 0; v < data.numVertices; ++v, vertex += data.vertexSize)
+        {
+            if (element.Format == DXGI_FORMAT_R16G16B16A16_UNORM)
+            {
+                uint16_t quantised[3];
+                std::memcpy(quantised, vertex, sizeof(quantised));
+                const VertexDecoding& decoding = data.decoding;
+                positions[v] = { quantised[0] / 65535.0f * decoding.positionScale.x + decoding.positionOffset.x,
+                                 quantised[1] / 65535.0f * decoding.positionScale.y + decoding.positionOffset.y,
+                                 quantised[2] / 65535.0f * decoding.positionScale.z + decoding.positionOffset.z };
+            }
+            else
+            {
+                std::memcpy(&positions[v], vertex, sizeof(CVector3));
+            }
+        }
+        break;
+    }
+    return positions;
+}
@@ -0,0 +1,181 @@
+//--------------------------------------------------------------------------------------
+// Loading mesh data from files, ready to create GPU buffers
+//--------------------------------------------------------------------------------------
+// Importing a mesh with assimp is slow - it parses the file and runs many processing steps. So the first time a mesh
+// is imported, the final vertex and index data is saved in a "cooked" file next to the original (e.g. Teapot.x.mesh).
+// Later loads memory map the cooked file and use its data as is, with no parsing or copying. The cooked file is
+// imported again if the original file is newer than it. A cooked file can be used without the original file.
+//
+// Cooked file layout (all little-endian, offsets from the start of the file):
+//   CookedMeshHeader
+//   CookedVertexElement for each element in a vertex
+//   SubMesh for each sub-mesh
+//   MeshLOD for each level of detail
+//   Meshlet for each meshlet of the full detail mesh
+//   Vertex data, 16-byte aligned
+//   Index data (16-bit if there are fewer than 65536 vertices, otherwise 32-bit), 16-byte aligned
+//
+// Vertices are stored in compact formats by default (see VertexFormat below), which takes around half the memory and
+// bandwidth of storing everything as floats. The vertex shaders turn the compact values back into floats using the
+// VertexDecoding values, which Mesh::Render passes to them in a constant buffer (see DecodePosition etc. in Common.hlsli)
+
+#include "Common.h"
+#include "Bounds.h"
+#include "Meshlets.h"
+#include "MappedFile.h"
+#include "CVector2.h"
+#include "CVector3.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#ifndef _MESH_DATA_H_INCLUDED_
+#define _MESH_DATA_H_INCLUDED_
+
+
+// Formats that each part of a vertex can be stored in
+enum class PositionFormat
+{
+    Float32, // 12 bytes
+    UNorm16, // 8 bytes, 16 bits per axis relative to the bounding box
+};
+
+enum class NormalFormat
+{
+    Float32,      // 12 bytes
+    Octahedral16, // 4 bytes, the unit sphere is folded onto an octahedron then flattened, giving two 16-bit values
+};
+
+enum class UVFormat
+{
+    Float32, // 8 bytes
+    Float16, // 4 bytes, half floats. Precision drops as UVs get further from 0, so only suitable for UVs close to 0-1
+    UNorm16, // 4 bytes, 16 bits per axis relative to the range of UVs in the mesh
+};
+
+// Formats to use for a mesh's vertices. Normals and tangents share a format
+struct VertexFormat
+{
+    PositionFormat position = PositionFormat::UNorm16;
+    NormalFormat   normal   = NormalFormat::Octahedral16;
+    UVFormat       uv       = UVFormat::UNorm16;
+};
+
+inline bool operator==(const VertexFormat& f1, const VertexFormat& f2)
+{
+    return f1.position == f2.position && f1.normal == f2.normal && f1.uv == f2.uv;
+}
+inline bool operator!=(const VertexFormat& f1, const VertexFormat& f2)  { return !(f1 == f2); }
+
+// How the vertex shaders turn compact vertex data back into model space values:
+//   position = stored position * positionScale + positionOffset, uv = stored uv * uvScale + uvOffset
+// Scales are 1 and offsets 0 for float formats
+struct VertexDecoding
+{
+    CVector3 positionScale     = { 1, 1, 1 };
+    CVector3 positionOffset    = { 0, 0, 0 };
+    CVector2 uvScale           = { 1, 1 };
+    CVector2 uvOffset          = { 0, 0 };
+    uint32_t octahedralNormals = 0; // 1 if normals and tangents are octahedral encoded
+};
+
+
+// One part of a mesh, from a separate mesh in the imported file. Sub-meshes share the vertices and indices of the whole
+// mesh, each using a range of them. Indices refer to vertices of the whole mesh, not from the start of the sub-mesh
+struct SubMesh
+{
+    uint32_t vertexStart;
+    uint32_t numVertices;
+    uint32_t indexStart;
+    uint32_t numIndices;
+
+    // Bounds of the sub-mesh's vertices in model space
+    AABB   boundingBox;
+    Sphere boundingSphere;
+};
+
+
+// A level of detail: a simplified version of the whole mesh, using a range of the indices (see MeshSimplifier.h)
+// Simplified triangles use the same vertices as the full detail mesh
+struct MeshLOD
+{
+    uint32_t indexStart;
+    uint32_t numIndices;
+    float    error; // Roughly how far the surface has moved from the full detail mesh, in model space units
+};
+
+
+// Vertex and index data for a mesh held on the CPU. Can be moved but not copied
+struct MeshData
+{
+    // Description of the data in a single vertex. Semantic names point into the file or at string constants
+    std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
+    unsigned int vertexSize  = 0; // Size in bytes of a single vertex
+    unsigned int numVertices = 0;
+    unsigned int numIndices  = 0; // 3 per triangle, includes the triangles of all LODs
+    unsigned int indexSize   = 4; // 2 or 4 bytes, 2 is used when there are fewer than 65536 vertices
+
+    const unsigned char* vertices = nullptr; // numVertices * vertexSize bytes
+    const void*          indices  = nullptr; // numIndices * indexSize bytes, use Index() to read them
+
+    VertexFormat   format;
+    VertexDecoding decoding;
+
+    // Ranges of the vertices and indices used by each part of the full detail mesh, in order and covering them all
+    std::vector<SubMesh> subMeshes;
+
+    // Levels of detail, from the full detail mesh (the first indices, covering all sub-meshes) to the simplest
+    std::vector<MeshLOD> lods;
+
+    // Small clusters of the full detail mesh's triangles that can be culled separately (see Meshlets.h). Each sub-mesh
+    // is split separately, so meshlets never cross sub-meshes
+    std::vector<Meshlet> meshlets;
+
+    // Bounds of all the vertices in model space
+    AABB   boundingBox;
+    Sphere boundingSphere;
+
+    // Where the vertices and indices are held, either memory allocated when importing or a mapped cooked file
+    std::unique_ptr<unsigned char[]> storage;
+    MappedFile                       file;
+
+
+    // Read an index whatever its size
+    uint32_t Index(std::size_t i) const
+    {
+        return indexSize == 2 ? static_cast<const uint16_t*>(indices)[i] : static_cast<const uint32_t*>(indices)[i];
+    }
+};
+
+
+// Load the mesh in the given file, from its cooked file if there is an up-to-date one, otherwise importing it with
+// assimp and saving a cooked file for next time. Optionally request tangents to be calculated (for normal mapping)
+// and the formats to store vertices in
+// Will throw a std::runtime_error exception on failure. Does not use DirectX, so can be called on any thread
+MeshData LoadMeshData(const std::string& fileName, bool requireTangents = false, const VertexFormat& format = VertexFormat());
+
+// Import the mesh in the given file with assimp (http://www.assimp.org/), which supports many file types
+// Will throw a std::runtime_error exception on failure
+MeshData ImportMeshData(const std::string& fileName, bool requireTangents = false, const VertexFormat& format = VertexFormat());
+
+// Memory map the given cooked mesh file. Returns false if the file doesn't exist, is not a valid cooked mesh or
+// doesn't have the required tangents and vertex format
+bool LoadCookedMeshData(const std::string& cookedFileName, bool requireTangents, const VertexFormat& format, MeshData& data);
+
+// Save mesh data as a cooked mesh file. Returns false on failure
+bool SaveCookedMeshData(const MeshData& data, const std::string& cookedFileName);
+
+// Name of the cooked file used for the given mesh file and options. Each vertex format gets its own file
+std::string CookedMeshFileName(const std::string& fileName, bool requireTangents, const VertexFormat& format);
+
+// Short text identifying a vertex format, e.g. "p1n1u2", used in cooked file names and cache keys
+std::string VertexFormatName(const VertexFormat& format);
+
+// Model space positions of all the vertices, turning compact positions back into floats the same way the vertex
+// shaders do. Used for work on the CPU such as ray casts. Returns an empty vector if the vertices have no positions
+std::vector<CVector3> DecodePositions(const MeshData& data);
+
+
+#endif //_MESH_DATA_H_INCLUDED_
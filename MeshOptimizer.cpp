@@ -0,0 +1,444 @@
+//--------------------------------------------------------------------------------------
+// Reordering triangle lists so the GPU processes them faster, and measuring the result
+//--------------------------------------------------------------------------------------
+
+#include "MeshOptimizer.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
+
+namespace
+{
+    const float* Position(const unsigned char* vertices, unsigned int vertexSize, uint32_t index)
+    {
+        return reinterpret_cast<const float*>(vertices + static_cast<std::size_t>(index) * vertexSize);
+    }
+
+
+    // FIFO model of the post-transform vertex cache. A vertex is in the cache if fewer than cacheSize vertices have
+    // been added since it was
+    class VertexCache
+    {
+    public:
+        VertexCache(std::size_t numVertices, unsigned int cacheSize)
+            : mTimestamps(numVertices, 0), mCacheSize(cacheSize), mTime(cacheSize + 1) {}
+
+        // Use a vertex, returns true if it was a miss (i.e. the vertex shader has to run)
+        bool Use(uint32_t vertex)
+        {
+            if (mTime - mTimestamps[vertex] <= mCacheSize)  return false;
+            mTimestamps[vertex] = mTime++;
+            return true;
+        }
+
+        // Use the vertices of a triangle, returns the number of misses
+        unsigned int Use(const uint32_t* triangle)
+        {
+            return Use(triangle[0]) + Use(triangle[1]) + Use(triangle[2]);
+        }
+
+        // Empty the cache
+        void Clear()
+        {
+            mTime += mCacheSize + 1;
+        }
+
+    private:
+        std::vector<unsigned int> mTimestamps;
+        unsigned int mCacheSize;
+        unsigned int mTime;
+    };
+
+
+    // Triangles using each vertex, stored in one array with an offset for each vertex
+    struct VertexTriangles
+    {
+        std::vector<uint32_t> offsets;   // numVertices + 1 entries
+        std::vector<uint32_t> triangles;
+
+        VertexTriangles(const uint32_t* indices, std::size_t numIndices, std::size_t numVertices)
+            : offsets(numVertices + 1, 0), triangles(numIndices)
+        {
+            for (std::size_t i = 0; i < numIndices; ++i)  ++offsets[indices[i] + 1];
+            for (std::size_t v = 0; v < numVertices; ++v)  offsets[v + 1] += offsets[v];
+
+            std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+            for (std::size_t i = 0; i < numIndices; ++i)  triangles[next[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    };
+
+
+    /*-----------------------------------------------------------------------------------------
+        Overdraw measurement
+    -----------------------------------------------------------------------------------------*/
+
+    const int OVERDRAW_GRID = 256;
+
+    struct Overdraw
+    {
+        std::size_t covered = 0; // Pixels with at least one triangle
+        std::size_t shaded  = 0; // Pixels that passed the depth test when drawn
+    };
+
+    // Draw every triangle facing towards the viewer with a depth test, looking along one axis in one direction.
+    // Front faces are clockwise as seen by the viewer, the same as DirectX
+    void RasteriseView(const std::vector<float>& points, std::size_t numTriangles, int axis, bool reverse, Overdraw& result)
+    {
+        int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        std::vector<float> depth(OVERDRAW_GRID * OVERDRAW_GRID, FLT_MAX);
+
+        for (std::size_t t = 0; t < numTriangles; ++t)
+        {
+            const float* p[3] = { &points[t * 9], &points[t * 9 + 3], &points[t * 9 + 6] };
+            float area = (p[1][u] - p[0][u]) * (p[2][v] - p[0][v]) - (p[2][u] - p[0][u]) * (p[1][v] - p[0][v]);
+            if (reverse ? area <= 0 : area >= 0)  continue; // Back facing or edge on
+
+            float minU = std::min(p[0][u], std::min(p[1][u], p[2][u])), maxU = std::max(p[0][u], std::max(p[1][u], p[2][u]));
+            float minV = std::min(p[0][v], std::min(p[1][v], p[2][v])), maxV = std::max(p[0][v], std::max(p[1][v], p[2][v]));
+            int x0 = std::max(static_cast<int>(std::ceil(minU - 0.5f)), 0), x1 = std::min(static_cast<int>(std::floor(maxU - 0.5f)), OVERDRAW_GRID - 1);
+            int y0 = std::max(static_cast<int>(std::ceil(minV - 0.5f)), 0), y1 = std::min(static_cast<int>(std::floor(maxV - 0.5f)), OVERDRAW_GRID - 1);
+
+            for (int y = y0; y <= y1; ++y)
+            {
+                for (int x = x0; x <= x1; ++x)
+                {
+                    // Barycentric coordinates of the pixel centre, all positive inside the triangle
+                    float pu = x + 0.5f, pv = y + 0.5f;
+                    float w0 = ((p[1][u] - pu) * (p[2][v] - pv) - (p[2][u] - pu) * (p[1][v] - pv)) / area;
+                    float w1 = ((p[2][u] - pu) * (p[0][v] - pv) - (p[0][u] - pu) * (p[2][v] - pv)) / area;
+                    float w2 = 1.0f - w0 - w1;
+                    if (w0 < 0 || w1 < 0 || w2 < 0)  continue;
+
+                    float z = w0 * p[0][axis] + w1 * p[1][axis] + w2 * p[2][axis];
+                    if (reverse)  z = -z;
+                    float& pixelDepth = depth[y * OVERDRAW_GRID + x];
+                    if (z < pixelDepth)
+                    {
+                        if (pixelDepth == FLT_MAX)  ++result.covered;
+                        pixelDepth = z;
+                        ++result.shaded;
+                    }
+                }
+            }
+        }
+    }
+
+    float AnalyseOverdraw(const uint32_t* indices, std::size_t numIndices, const unsigned char* vertices, unsigned int vertexSize,
+                          std::size_t numVertices)
+    {
+        if (numIndices == 0 || numVertices == 0)  return 1.0f;
+
+        // Scale the mesh to fit the grid
+        float minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (std::size_t i = 0; i < numIndices; ++i)
+        {
+            const float* position = Position(vertices, vertexSize, indices[i]);
+            for (int c = 0; c < 3; ++c)
+            {
+                minimum[c] = std::min(minimum[c], position[c]);
+                maximum[c] = std::max(maximum[c], position[c]);
+            }
+        }
+        float extent = std::max(maximum[0] - minimum[0], std::max(maximum[1] - minimum[1], maximum[2] - minimum[2]));
+        float scale = extent > 0 ? OVERDRAW_GRID / extent : 0.0f;
+
+        std::vector<float> points(numIndices * 3);
+        for (std::size_t i = 0; i < numIndices; ++i)
+        {
+            const float* position = Position(vertices, vertexSize, indices[i]);
+            for (int c = 0; c < 3; ++c)  points[i * 3 + c] = (position[c] - minimum[c]) * scale;
+        }
+
+        Overdraw overdraw;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            RasteriseView(points, numIndices / 3, axis, false, overdraw);
+            RasteriseView(points, numIndices / 3, axis, true,  overdraw);
+        }
+        return overdraw.covered > 0 ? static_cast<float>(overdraw.shaded) / overdraw.covered : 1.0f;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Vertex cache
+-----------------------------------------------------------------------------------------*/
+
+// Reorder triangles to make best use of the vertex cache. Triangles are left alone if they are already in a better order
+void OptimizeVertexCache(uint32_t* indices, std::size_t numIndices, std::size_t numVertices, unsigned int cacheSize /*= VERTEX_CACHE_SIZE*/)
+{
+    std::size_t numTriangles = numIndices / 3;
+    if (numTriangles == 0)  return;
+
+    VertexTriangles adjacency(indices, numIndices, numVertices);
+    std::vector<uint32_t> liveTriangles(numVertices);
+    for (std::size_t v = 0; v < numVertices; ++v)  liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+
+    std::vector<unsigned int> cacheTime(numVertices, 0);
+    unsigned int time = cacheSize + 1;
+    std::vector<bool> emitted(numTriangles, false);
+    std::vector<uint32_t> deadEnd;    // Recently used vertices, to restart from when there is no good next vertex
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(numIndices);
+
+    std::size_t nextScan = 0; // Next vertex to try when all recent vertices are finished
+    int64_t fan = 0;          // Vertex whose triangles are being output
+    while (fan >= 0)
+    {
+        // Output all remaining triangles around the current vertex
+        candidates.clear();
+        for (uint32_t i = adjacency.offsets[fan]; i < adjacency.offsets[fan + 1]; ++i)
+        {
+            uint32_t triangle = adjacency.triangles[i];
+            if (emitted[triangle])  continue;
+            emitted[triangle] = true;
+
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                uint32_t vertex = indices[triangle * 3 + corner];
+                output.push_back(vertex);
+                deadEnd.push_back(vertex);
+                candidates.push_back(vertex);
+                --liveTriangles[vertex];
+                if (time - cacheTime[vertex] > cacheSize)  cacheTime[vertex] = time++;
+            }
+        }
+
+        // Next vertex is the one used by these triangles that will stay in the cache longest while its remaining
+        // triangles are output
+        fan = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t vertex : candidates)
+        {
+            if (liveTriangles[vertex] == 0)  continue;
+            int64_t priority = 0;
+            if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= cacheSize)  priority = time - cacheTime[vertex];
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                fan = vertex;
+            }
+        }
+
+        // Otherwise go back to a recently used vertex that has triangles left, or else any vertex with triangles left
+        while (fan < 0 && !deadEnd.empty())
+        {
+            uint32_t vertex = deadEnd.back();
+            deadEnd.pop_back();
+            if (liveTriangles[vertex] > 0)  fan = vertex;
+        }
+        while (fan < 0 && nextScan < numVertices)
+        {
+            if (liveTriangles[nextScan] > 0)  fan = nextScan;
+            ++nextScan;
+        }
+    }
+
+    // Tipsify is very good but not perfect, keep the original order if it was already better (e.g. strip-like)
+    VertexCache originalCache(numVertices, cacheSize), optimisedCache(numVertices, cacheSize);
+    std::size_t originalMisses = 0, optimisedMisses = 0;
+    for (std::size_t t = 0; t < numTriangles; ++t)
+    {
+        originalMisses  += originalCache.Use(&indices[t * 3]);
+        optimisedMisses += optimisedCache.Use(&output[t * 3]);
+    }
+    if (optimisedMisses < originalMisses)  std::copy(output.begin(), output.end(), indices);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Overdraw
+-----------------------------------------------------------------------------------------*/
+
+// Reorder triangles to reduce overdraw, best used after OptimizeVertexCache. Clusters of triangles are kept together
+// so the ACMR doesn't rise above threshold times its current value (so 1.05 allows ACMR to get 5% worse). Triangles
+// are left alone if the new order doesn't reduce overdraw
+void OptimizeOverdraw(uint32_t* indices, std::size_t numIndices, const unsigned char* vertices, unsigned int vertexSize,
+                      std::size_t numVertices, float threshold /*= 1.05f*/, unsigned int cacheSize /*= VERTEX_CACHE_SIZE*/)
+{
+    std::size_t numTriangles = numIndices / 3;
+    if (numTriangles == 0)  return;
+
+    // Hard boundaries are where the cache has nothing useful in it (all three vertices of a triangle miss), so
+    // starting a cluster there costs nothing
+    std::vector<std::size_t> hardBoundaries;
+    VertexCache cache(numVertices, cacheSize);
+    for (std::size_t t = 0; t < numTriangles; ++t)
+    {
+        if (cache.Use(&indices[t * 3]) == 3)  hardBoundaries.push_back(t);
+    }
+    if (hardBoundaries.empty() || hardBoundaries[0] != 0)  hardBoundaries.insert(hardBoundaries.begin(), 0);
+    hardBoundaries.push_back(numTriangles);
+
+    // Split further wherever the cache misses so far are within the threshold of the hard cluster as a whole, the
+    // cache is cleared at each split since clusters will be drawn in a different order
+    std::vector<std::size_t> clusters;
+    for (std::size_t h = 0; h + 1 < hardBoundaries.size(); ++h)
+    {
+        std::size_t start = hardBoundaries[h], end = hardBoundaries[h + 1];
+        cache.Clear();
+        unsigned int hardMisses = 0;
+        for (std::size_t t = start; t < end; ++t)  hardMisses += cache.Use(&indices[t * 3]);
+        float maxACMR = threshold * hardMisses / (end - start);
+
+        cache.Clear();
+        unsigned int misses = 0;
+        std::size_t clusterStart = start;
+        clusters.push_back(start);
+        for (std::size_t t = start; t < end; ++t)
+        {
+            misses += cache.Use(&indices[t * 3]);
+            if (t + 1 < end && static_cast<float>(misses) / (t + 1 - clusterStart) <= maxACMR)
+            {
+                clusterStart = t + 1;
+                clusters.push_back(clusterStart);
+                cache.Clear();
+                misses = 0;
+            }
+        }
+    }
+    clusters.push_back(numTriangles);
+
+    // Sort clusters by how much they face outwards from the centre of the mesh. Outward facing clusters tend to be in
+    // front of others, so are drawn first
+    float meshCentre[3] = {};
+    for (std::size_t v = 0; v < numVertices; ++v)
+    {
+        const float* position = Position(vertices, vertexSize, static_cast<uint32_t>(v));
+        for (int c = 0; c < 3; ++c)  meshCentre[c] += position[c] / numVertices;
+    }
+
+    std::size_t numClusters = clusters.size() - 1;
+    std::vector<float> sortKeys(numClusters);
+    for (std::size_t cluster = 0; cluster < numClusters; ++cluster)
+    {
+        float centre[3] = {}, normal[3] = {}, totalArea = 0.0f;
+        for (std::size_t t = clusters[cluster]; t < clusters[cluster + 1]; ++t)
+        {
+            const float* p0 = Position(vertices, vertexSize, indices[t * 3]);
+            const float* p1 = Position(vertices, vertexSize, indices[t * 3 + 1]);
+            const float* p2 = Position(vertices, vertexSize, indices[t * 3 + 2]);
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+            for (int c = 0; c < 3; ++c)
+            {
+                centre[c] += (p0[c] + p1[c] + p2[c]) * (area / 3);
+                normal[c] += n[c]; // Length of the cross product is proportional to area, so this is area weighted
+            }
+            totalArea += area;
+        }
+
+        float normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        float key = 0.0f;
+        if (totalArea > 0 && normalLength > 0)
+        {
+            for (int c = 0; c < 3; ++c)  key += (centre[c] / totalArea - meshCentre[c]) * normal[c] / normalLength;
+        }
+        sortKeys[cluster] = key;
+    }
+
+    std::vector<std::size_t> order(numClusters);
+    for (std::size_t i = 0; i < numClusters; ++i)  order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> output;
+    output.reserve(numTriangles * 3);
+    for (std::size_t cluster : order)
+    {
+        output.insert(output.end(), indices + clusters[cluster] * 3, indices + clusters[cluster + 1] * 3);
+    }
+
+    // Sorting is a heuristic, so check it helped
+    if (AnalyseOverdraw(output.data(), numIndices, vertices, vertexSize, numVertices) <
+        AnalyseOverdraw(indices, numIndices, vertices, vertexSize, numVertices))
+    {
+        std::copy(output.begin(), output.end(), indices);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Vertex fetch
+-----------------------------------------------------------------------------------------*/
+
+// Renumber vertices in the order the triangles first use them, moving the vertex data to match. Unused vertices
+// are removed. Returns the new number of vertices
+std::size_t OptimizeVertexFetch(unsigned char* vertices, unsigned int vertexSize, std::size_t numVertices,
+                                uint32_t* indices, std::size_t numIndices)
+{
+    const uint32_t UNUSED = ~0u;
+    std::vector<uint32_t> remap(numVertices, UNUSED);
+    std::vector<unsigned char> reordered(numVertices * vertexSize);
+
+    uint32_t newVertices = 0;
+    for (std::size_t i = 0; i < numIndices; ++i)
+    {
+        uint32_t& newIndex = remap[indices[i]];
+        if (newIndex == UNUSED)
+        {
+            newIndex = newVertices++;
+            std::memcpy(&reordered[static_cast<std::size_t>(newIndex) * vertexSize],
+                        vertices + static_cast<std::size_t>(indices[i]) * vertexSize, vertexSize);
+        }
+        indices[i] = newIndex;
+    }
+
+    std::memcpy(vertices, reordered.data(), static_cast<std::size_t>(newVertices) * vertexSize);
+    return newVertices;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Measurement
+-----------------------------------------------------------------------------------------*/
+
+// Measure a triangle list (see MeshOptimizer.h)
+MeshStats AnalyseMesh(const uint32_t* indices, std::size_t numIndices, const unsigned char* vertices, unsigned int vertexSize,
+                      std::size_t numVertices, unsigned int cacheSize /*= VERTEX_CACHE_SIZE*/)
+{
+    // Vertex fetch is modelled with a direct mapped cache of 64 byte lines, only vertices that miss the
+    // post-transform cache are fetched
+    const std::size_t LINE_SIZE = 64, NUM_LINES = 256;
+    std::vector<std::size_t> lines(NUM_LINES, ~std::size_t(0));
+
+    VertexCache cache(numVertices, cacheSize);
+    std::vector<bool> used(numVertices, false);
+    std::size_t misses = 0, usedVertices = 0, bytesFetched = 0;
+    for (std::size_t i = 0; i < numIndices; ++i)
+    {
+        uint32_t vertex = indices[i];
+        if (!used[vertex])
+        {
+            used[vertex] = true;
+            ++usedVertices;
+        }
+        if (!cache.Use(vertex))  continue;
+        ++misses;
+
+        std::size_t start = static_cast<std::size_t>(vertex) * vertexSize;
+        for (std::size_t line = start / LINE_SIZE; line <= (start + vertexSize - 1) / LINE_SIZE; ++line)
+        {
+            if (lines[line % NUM_LINES] != line)
+            {
+                lines[line % NUM_LINES] = line;
+                bytesFetched += LINE_SIZE;
+            }
+        }
+    }
+
+    MeshStats stats;
+    std::size_t numTriangles = numIndices / 3;
+    stats.acmr      = numTriangles > 0 ? static_cast<float>(misses) / numTriangles : 0.0f;
+    stats.atvr      = usedVertices > 0 ? static_cast<float>(misses) / usedVertices : 0.0f;
+    stats.overfetch = usedVertices > 0 ? static_cast<float>(bytesFetched) / (usedVertices * vertexSize) : 0.0f;
+    stats.overdraw  = AnalyseOverdraw(indices, numIndices, vertices, vertexSize, numVertices);
+    return stats;
+}
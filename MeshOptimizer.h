@@ -0,0 +1,66 @@
+//--------------------------------------------------------------------------------------
+// Reordering triangle lists so the GPU processes them faster, and measuring the result
+//--------------------------------------------------------------------------------------
+// Three separate optimisations, normally applied in this order:
+// - Vertex cache: the GPU keeps recently transformed vertices in a small cache. Ordering triangles so they reuse
+//   vertices that are still in the cache means fewer vertex shader runs. Uses the Tipsify algorithm (Sander, Nehab &
+//   Barczak 2007), which is linear time and models the cache as a FIFO
+// - Overdraw: triangles are grouped into clusters that keep most of the cache benefit, and the clusters are sorted
+//   so those facing outwards from the middle of the mesh are drawn first. More pixels are then rejected by the
+//   depth test before the pixel shader runs
+// - Vertex fetch: vertices are renumbered in the order they are first used, so vertex data is read from memory
+//   in order rather than jumping around
+//
+// Measurements:
+// - ACMR (average cache miss ratio): vertex shader runs per triangle. 3 is the worst, around 0.5-0.7 is the best
+//   possible for typical meshes
+// - ATVR (average transformed vertex ratio): vertex shader runs per vertex. 1 is the best possible
+// - Overdraw: pixels shaded per pixel covered, measured with a small software rasteriser looking at the mesh from
+//   six directions. 1 is the best possible
+// - Overfetch: bytes of vertex data read from memory per byte of vertex data. 1 is the best possible
+//
+// These functions don't use DirectX so can be used on any thread (see MeshData.cpp). Positions are read as three
+// floats at the start of each vertex.
+
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _MESH_OPTIMIZER_H_INCLUDED_
+#define _MESH_OPTIMIZER_H_INCLUDED_
+
+
+// Number of vertices assumed to fit in the GPU's post-transform vertex cache
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// Measurements of how efficiently a triangle list will be processed, see above
+struct MeshStats
+{
+    float acmr;
+    float atvr;
+    float overdraw;
+    float overfetch;
+};
+
+
+// Reorder triangles to make best use of the vertex cache. Triangles are left alone if they are already in a better order
+void OptimizeVertexCache(uint32_t* indices, std::size_t numIndices, std::size_t numVertices,
+                         unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorder triangles to reduce overdraw, best used after OptimizeVertexCache. Clusters of triangles are kept together
+// so the ACMR doesn't rise above threshold times its current value (so 1.05 allows ACMR to get 5% worse). Triangles
+// are left alone if the new order doesn't reduce overdraw
+void OptimizeOverdraw(uint32_t* indices, std::size_t numIndices, const unsigned char* vertices, unsigned int vertexSize,
+                      std::size_t numVertices, float threshold = 1.05f, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// Renumber vertices in the order the triangles first use them, moving the vertex data to match. Unused vertices
+// are removed. Returns the new number of vertices
+std::size_t OptimizeVertexFetch(unsigned char* vertices, unsigned int vertexSize, std::size_t numVertices,
+                                uint32_t* indices, std::size_t numIndices);
+
+
+// Measure a triangle list (see the top of this file)
+MeshStats AnalyseMesh(const uint32_t* indices, std::size_t numIndices, const unsigned char* vertices, unsigned int vertexSize,
+                      std::size_t numVertices, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+
+#endif //_MESH_OPTIMIZER_H_INCLUDED_
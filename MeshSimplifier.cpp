@@ -0,0 +1,353 @@
+//--------------------------------------------------------------------------------------
+// Simplifying triangle lists to build levels of detail (LODs)
+//--------------------------------------------------------------------------------------
+
+#include "MeshSimplifier.h"
+#include "CVector3.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+
+namespace
+{
+    // Open edges get an extra plane at right angles to the surface so they stay straight. Its weight is this times
+    // the squared length of the edge (the triangle planes are weighted by area)
+    const double BORDER_WEIGHT = 10.0;
+
+
+    CVector3 Position(const unsigned char* vertices, unsigned int vertexSize, uint32_t index)
+    {
+        CVector3 position;
+        std::memcpy(&position, vertices + static_cast<std::size_t>(index) * vertexSize, sizeof(CVector3));
+        return position;
+    }
+
+    uint64_t EdgeKey(uint32_t from, uint32_t to)
+    {
+        return (static_cast<uint64_t>(from) << 32) | to;
+    }
+
+
+    // Sum of the squared distance functions of a set of weighted planes (see MeshSimplifier.h)
+    struct Quadric
+    {
+        double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0; // Symmetric 3x3 matrix
+        double b0 = 0, b1 = 0, b2 = 0;
+        double c = 0;
+        double weight = 0;
+
+        // Add the plane with the given unit normal passing through the given point
+        void AddPlane(const CVector3& normal, const CVector3& point, double planeWeight)
+        {
+            double x = normal.x, y = normal.y, z = normal.z;
+            double d = -(x * point.x + y * point.y + z * point.z);
+            a00 += planeWeight * x * x;  a11 += planeWeight * y * y;  a22 += planeWeight * z * z;
+            a01 += planeWeight * x * y;  a02 += planeWeight * x * z;  a12 += planeWeight * y * z;
+            b0  += planeWeight * x * d;  b1  += planeWeight * y * d;  b2  += planeWeight * z * d;
+            c   += planeWeight * d * d;
+            weight += planeWeight;
+        }
+
+        void Add(const Quadric& q)
+        {
+            a00 += q.a00;  a11 += q.a11;  a22 += q.a22;  a01 += q.a01;  a02 += q.a02;  a12 += q.a12;
+            b0  += q.b0;   b1  += q.b1;   b2  += q.b2;   c   += q.c;    weight += q.weight;
+        }
+
+        // Mean squared distance of the given point from the planes
+        double Error(const CVector3& p) const
+        {
+            if (weight <= 0)  return 0;
+            double x = p.x, y = p.y, z = p.z;
+            double error = a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                           2 * (b0 * x + b1 * y + b2 * z) + c;
+            return std::max(error, 0.0) / weight;
+        }
+    };
+
+
+    // How each vertex may move. Vertex kinds are per position (see PositionIds)
+    enum class VertexKind : uint8_t
+    {
+        Manifold, // Inside a simple sheet of triangles, can collapse along any edge
+        Border,   // On an open edge, can only collapse along that edge
+        Locked,   // Never moves
+    };
+
+    // Vertices at exactly the same position are given the same id, the lowest index of those vertices.
+    // Also counts how many vertices share each id
+    std::vector<uint32_t> PositionIds(const unsigned char* vertices, unsigned int vertexSize, std::size_t numVertices,
+                                      std::vector<uint32_t>& idCounts)
+    {
+        std::vector<uint32_t> order(numVertices);
+        for (std::size_t v = 0; v < numVertices; ++v)  order[v] = static_cast<uint32_t>(v);
+
+        auto less = [&](uint32_t a, uint32_t b)
+        {
+            CVector3 pa = Position(vertices, vertexSize, a), pb = Position(vertices, vertexSize, b);
+            if (pa.x != pb.x)  return pa.x < pb.x;
+            if (pa.y != pb.y)  return pa.y < pb.y;
+            if (pa.z != pb.z)  return pa.z < pb.z;
+            return a < b; // So the lowest index comes first
+        };
+        std::sort(order.begin(), order.end(), less);
+
+        std::vector<uint32_t> ids(numVertices);
+        idCounts.assign(numVertices, 0);
+        for (std::size_t i = 0; i < numVertices; )
+        {
+            CVector3 p = Position(vertices, vertexSize, order[i]);
+            std::size_t end = i + 1;
+            while (end < numVertices)
+            {
+                CVector3 q = Position(vertices, vertexSize, order[end]);
+                if (q.x != p.x || q.y != p.y || q.z != p.z)  break;
+                ++end;
+            }
+            for (std::size_t j = i; j < end; ++j)  ids[order[j]] = order[i];
+            idCounts[order[i]] = static_cast<uint32_t>(end - i);
+            i = end;
+        }
+        return ids;
+    }
+
+
+    // Count the directed edges of a triangle list, between position ids
+    void CountEdges(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& ids,
+                    std::unordered_map<uint64_t, uint32_t>& edges)
+    {
+        edges.clear();
+        edges.reserve(indices.size());
+        for (std::size_t i = 0; i < indices.size(); i += 3)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                ++edges[EdgeKey(ids[indices[i + k]], ids[indices[i + (k + 1) % 3]])];
+            }
+        }
+    }
+
+    bool HasEdge(const std::unordered_map<uint64_t, uint32_t>& edges, uint32_t from, uint32_t to)
+    {
+        return edges.find(EdgeKey(from, to)) != edges.end();
+    }
+
+
+    // Triangles using each vertex, stored in one array with an offset for each vertex
+    struct VertexTriangles
+    {
+        std::vector<uint32_t> offsets;   // numVertices + 1 entries
+        std::vector<uint32_t> triangles;
+
+        VertexTriangles(const std::vector<uint32_t>& indices, std::size_t numVertices)
+            : offsets(numVertices + 1, 0), triangles(indices.size())
+        {
+            for (std::size_t i = 0; i < indices.size(); ++i)  ++offsets[indices[i] + 1];
+            for (std::size_t v = 0; v < numVertices; ++v)  offsets[v + 1] += offsets[v];
+
+            std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+            for (std::size_t i = 0; i < indices.size(); ++i)  triangles[next[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    };
+
+
+    struct Collapse
+    {
+        uint32_t from;  // Vertex indices
+        uint32_t to;
+        double   error; // Mean squared distance
+    };
+}
+
+
+// Simplify a triangle list, writing the new list to destination, which must have room for numIndices indices. Stops
+// when there are no more than targetIndexCount indices, or when the next collapse would move the surface further
+// than targetError (in model space units). The error reached is written to resultError if given.
+// Returns the number of indices written to destination
+std::size_t SimplifyMesh(uint32_t* destination, const uint32_t* indices, std::size_t numIndices,
+                         const unsigned char* vertices, unsigned int vertexSize, std::size_t numVertices,
+                         std::size_t targetIndexCount, float targetError, float* resultError /*= nullptr*/)
+{
+    std::vector<uint32_t> current(indices, indices + numIndices);
+    std::vector<uint32_t> idCounts;
+    std::vector<uint32_t> ids = PositionIds(vertices, vertexSize, numVertices, idCounts);
+
+    std::unordered_map<uint64_t, uint32_t> edges;
+    CountEdges(current, ids, edges);
+
+
+    // Classify each position. An edge used twice in the same direction means more than two triangles meet there or
+    // the winding is inconsistent, so lock both ends. An edge with no matching edge in the other direction is open
+    std::vector<VertexKind> kinds(numVertices, VertexKind::Manifold);
+    std::vector<uint32_t> openOut(numVertices, 0), openIn(numVertices, 0);
+    std::vector<bool> nonManifold(numVertices, false);
+    for (const auto& edge : edges)
+    {
+        uint32_t from = static_cast<uint32_t>(edge.first >> 32), to = static_cast<uint32_t>(edge.first);
+        if (edge.second > 1)  nonManifold[from] = nonManifold[to] = true;
+        if (!HasEdge(edges, to, from))
+        {
+            ++openOut[from];
+            ++openIn[to];
+        }
+    }
+    for (std::size_t v = 0; v < numVertices; ++v)
+    {
+        if (ids[v] != v)  continue;
+        if (idCounts[v] > 1 || nonManifold[v])          kinds[v] = VertexKind::Locked;
+        else if (openOut[v] == 0 && openIn[v] == 0)     kinds[v] = VertexKind::Manifold;
+        else if (openOut[v] == 1 && openIn[v] == 1)     kinds[v] = VertexKind::Border;
+        else                                            kinds[v] = VertexKind::Locked;
+    }
+
+
+    // Quadrics for each position: the plane of each triangle weighted by its area, plus planes along open edges
+    std::vector<Quadric> quadrics(numVertices);
+    for (std::size_t i = 0; i < current.size(); i += 3)
+    {
+        uint32_t id[3] = { ids[current[i]], ids[current[i + 1]], ids[current[i + 2]] };
+        CVector3 p[3] = { Position(vertices, vertexSize, id[0]), Position(vertices, vertexSize, id[1]), Position(vertices, vertexSize, id[2]) };
+        CVector3 normal = Cross(p[1] - p[0], p[2] - p[0]);
+        float length = Length(normal);
+        if (length == 0.0f)  continue;
+        normal = normal * (1.0f / length);
+
+        for (int k = 0; k < 3; ++k)  quadrics[id[k]].AddPlane(normal, p[0], length * 0.5);
+
+        for (int k = 0; k < 3; ++k)
+        {
+            int next = (k + 1) % 3;
+            if (HasEdge(edges, id[next], id[k]))  continue;
+            CVector3 edge = p[next] - p[k];
+            float edgeLength = Length(edge);
+            if (edgeLength == 0.0f)  continue;
+            CVector3 borderNormal = Normalise(Cross(edge, normal));
+            double borderWeight = BORDER_WEIGHT * edgeLength * edgeLength;
+            quadrics[id[k]]   .AddPlane(borderNormal, p[k], borderWeight);
+            quadrics[id[next]].AddPlane(borderNormal, p[k], borderWeight);
+        }
+    }
+
+
+    // Collapse edges in passes. Each pass finds every possible collapse, then makes the cheapest ones that don't
+    // involve vertices near to a collapse already made in this pass, so the checks below stay correct
+    double maxError = static_cast<double>(targetError) * targetError;
+    double reachedError = 0;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> collapseTo(numVertices);
+    std::vector<bool>     passLocked(numVertices);
+    bool errorLimitReached = false;
+    bool firstPass = true;
+    while (current.size() > targetIndexCount && !errorLimitReached)
+    {
+        if (!firstPass)  CountEdges(current, ids, edges); // Already counted above for the first pass
+        firstPass = false;
+
+        // Find possible collapses along each edge, in both directions
+        collapses.clear();
+        for (std::size_t i = 0; i < current.size(); i += 3)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t ends[2] = { current[i + k], current[i + (k + 1) % 3] };
+                for (int direction = 0; direction < 2; ++direction)
+                {
+                    uint32_t from = ends[direction], to = ends[1 - direction];
+                    uint32_t fromId = ids[from], toId = ids[to];
+                    if (fromId == toId || kinds[fromId] == VertexKind::Locked)  continue;
+
+                    // Border vertices can only move along open edges (which only have one direction)
+                    if (kinds[fromId] == VertexKind::Border && HasEdge(edges, fromId, toId) && HasEdge(edges, toId, fromId))  continue;
+
+                    Quadric combined = quadrics[fromId];
+                    combined.Add(quadrics[toId]);
+                    collapses.push_back({ from, to, combined.Error(Position(vertices, vertexSize, to)) });
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+
+        // Make collapses, cheapest first, until enough triangles have been removed
+        VertexTriangles vertexTriangles(current, numVertices);
+        for (std::size_t v = 0; v < numVertices; ++v)  collapseTo[v] = static_cast<uint32_t>(v);
+        std::fill(passLocked.begin(), passLocked.end(), false);
+
+        std::size_t trianglesToRemove = (current.size() - targetIndexCount + 2) / 3;
+        std::size_t trianglesRemoved  = 0;
+        std::size_t numCollapses      = 0;
+        for (const auto& collapse : collapses)
+        {
+            if (trianglesRemoved >= trianglesToRemove)  break;
+            if (collapse.error > maxError)
+            {
+                errorLimitReached = true;
+                break;
+            }
+
+            uint32_t fromId = ids[collapse.from], toId = ids[collapse.to];
+            if (passLocked[fromId] || passLocked[toId])  continue;
+
+            // Triangles around the moving vertex that share the edge disappear, the rest must not flip over
+            // Moving vertices are never seams so all their triangles use the same index
+            CVector3 newPosition = Position(vertices, vertexSize, collapse.to);
+            bool flips = false;
+            std::size_t removes = 0;
+            for (uint32_t t = vertexTriangles.offsets[collapse.from]; t < vertexTriangles.offsets[collapse.from + 1] && !flips; ++t)
+            {
+                const uint32_t* triangle = &current[vertexTriangles.triangles[t] * 3];
+                if (ids[triangle[0]] == toId || ids[triangle[1]] == toId || ids[triangle[2]] == toId)
+                {
+                    ++removes;
+                    continue;
+                }
+
+                CVector3 p[3], moved[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    p[k] = Position(vertices, vertexSize, triangle[k]);
+                    moved[k] = triangle[k] == collapse.from ? newPosition : p[k];
+                }
+                CVector3 before = Cross(p[1] - p[0], p[2] - p[0]);
+                CVector3 after  = Cross(moved[1] - moved[0], moved[2] - moved[0]);
+                if (Dot(before, after) <= 0.0f)  flips = true;
+            }
+            if (flips)  continue;
+
+            collapseTo[collapse.from] = collapse.to;
+            quadrics[toId].Add(quadrics[fromId]);
+            reachedError = std::max(reachedError, collapse.error);
+            trianglesRemoved += removes;
+            ++numCollapses;
+
+            // Vertices around this collapse can't be used again in this pass
+            for (uint32_t t = vertexTriangles.offsets[collapse.from]; t < vertexTriangles.offsets[collapse.from + 1]; ++t)
+            {
+                const uint32_t* triangle = &current[vertexTriangles.triangles[t] * 3];
+                for (int k = 0; k < 3; ++k)  passLocked[ids[triangle[k]]] = true;
+            }
+        }
+        if (numCollapses == 0)  break;
+
+
+        // Apply the collapses and remove triangles that now have two corners in the same place
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < current.size(); i += 3)
+        {
+            uint32_t a = collapseTo[current[i]], b = collapseTo[current[i + 1]], c = collapseTo[current[i + 2]];
+            if (ids[a] == ids[b] || ids[b] == ids[c] || ids[c] == ids[a])  continue;
+            current[count++] = a;
+            current[count++] = b;
+            current[count++] = c;
+        }
+        current.resize(count);
+    }
+
+    std::copy(current.begin(), current.end(), destination);
+    if (resultError != nullptr)  *resultError = static_cast<float>(std::sqrt(reachedError));
+    return current.size();
+}
@@ -0,0 +1,37 @@
+//--------------------------------------------------------------------------------------
+// Simplifying triangle lists to build levels of detail (LODs)
+//--------------------------------------------------------------------------------------
+// Edges are collapsed a batch at a time, cheapest first, where the cost is how far the collapse moves the surface.
+// This is measured with quadric error metrics (Garland & Heckbert 1997): each vertex keeps the sum of the squared
+// distance functions of the planes of the triangles around it, and the error of moving it is the mean squared
+// distance from those planes at the new position. When vertices are merged their quadrics are added together, so
+// the error is always measured against the original surface.
+//
+// Vertices are only ever moved onto another vertex, never to a new position. So simplified triangle lists use the
+// original vertex data and a chain of LODs can share one vertex buffer (see MeshData.h).
+//
+// Restrictions that keep the result looking right:
+// - Vertices in the same place as another vertex (seams where normals or UVs change) are locked, as are vertices
+//   where the surface isn't a simple sheet
+// - Vertices on an open edge of the mesh can only slide along that edge, which is also kept straight
+// - Collapses that would flip a triangle over are skipped
+//
+// Positions are read as three floats at the start of each vertex. Doesn't use DirectX so can be used on any thread
+
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _MESH_SIMPLIFIER_H_INCLUDED_
+#define _MESH_SIMPLIFIER_H_INCLUDED_
+
+
+// Simplify a triangle list, writing the new list to destination, which must have room for numIndices indices. Stops
+// when there are no more than targetIndexCount indices, or when the next collapse would move the surface further
+// than targetError (in model space units). The error reached is written to resultError if given.
+// Returns the number of indices written to destination
+std::size_t SimplifyMesh(uint32_t* destination, const uint32_t* indices, std::size_t numIndices,
+                         const unsigned char* vertices, unsigned int vertexSize, std::size_t numVertices,
+                         std::size_t targetIndexCount, float targetError, float* resultError = nullptr);
+
+
+#endif //_MESH_SIMPLIFIER_H_INCLUDED_
@@ -0,0 +1,286 @@
+//--------------------------------------------------------------------------------------
+// Splitting meshes into meshlets (small clusters of triangles) and culling them
+//--------------------------------------------------------------------------------------
+
+#include "Meshlets.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+
+namespace
+{
+    // Normal cones wider than this (dot product of the axis with the furthest normal) can almost never be culled,
+    // so they are given a cutoff that always fails rather than cost a test
+    const float MIN_CONE_DOT = 0.1f;
+
+    // Cutoff that is never reached, see Meshlet in Meshlets.h
+    const float NO_CONE_CULLING = 2.0f;
+
+
+    CVector3 Position(const unsigned char* vertices, unsigned int vertexSize, uint32_t index)
+    {
+        CVector3 position;
+        std::memcpy(&position, vertices + static_cast<std::size_t>(index) * vertexSize, sizeof(CVector3));
+        return position;
+    }
+
+    CVector3 TransformPoint(const CVector3& p, const CMatrix4x4& m)
+    {
+        return { p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30,
+                 p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31,
+                 p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32 };
+    }
+
+
+    // Bounding sphere and normal cone of the triangles in a meshlet (see Meshlets.h)
+    void CalculateMeshletBounds(Meshlet& meshlet, const uint32_t* indices, const unsigned char* vertices, unsigned int vertexSize)
+    {
+        // Sphere centred on the box around the triangles
+        CVector3 minPoint = Position(vertices, vertexSize, indices[0]);
+        CVector3 maxPoint = minPoint;
+        for (uint32_t i = 1; i < meshlet.numIndices; ++i)
+        {
+            CVector3 p = Position(vertices, vertexSize, indices[i]);
+            minPoint = { std::min(minPoint.x, p.x), std::min(minPoint.y, p.y), std::min(minPoint.z, p.z) };
+            maxPoint = { std::max(maxPoint.x, p.x), std::max(maxPoint.y, p.y), std::max(maxPoint.z, p.z) };
+        }
+        CVector3 centre = (minPoint + maxPoint) * 0.5f;
+        float radiusSq = 0.0f;
+        for (uint32_t i = 0; i < meshlet.numIndices; ++i)
+        {
+            CVector3 offset = Position(vertices, vertexSize, indices[i]) - centre;
+            radiusSq = std::max(radiusSq, Dot(offset, offset));
+        }
+        meshlet.boundingSphere = { centre, std::sqrt(radiusSq) };
+
+        // Cone axis is the average of the triangle normals. Degenerate triangles can't be seen so are ignored
+        CVector3 normals[MESHLET_MAX_TRIANGLES];
+        CVector3 points[MESHLET_MAX_TRIANGLES];
+        unsigned int numNormals = 0;
+        CVector3 axis = { 0, 0, 0 };
+        for (uint32_t i = 0; i < meshlet.numIndices && numNormals < MESHLET_MAX_TRIANGLES; i += 3)
+        {
+            CVector3 p0 = Position(vertices, vertexSize, indices[i]);
+            CVector3 normal = Cross(Position(vertices, vertexSize, indices[i + 1]) - p0, Position(vertices, vertexSize, indices[i + 2]) - p0);
+            float length = Length(normal);
+            if (length <= 0.0f)  continue;
+
+            normals[numNormals] = normal * (1.0f / length);
+            points[numNormals] = p0;
+            axis += normals[numNormals];
+            ++numNormals;
+        }
+
+        meshlet.coneApex   = centre;
+        meshlet.coneAxis   = { 0, 0, 1 };
+        meshlet.coneCutoff = NO_CONE_CULLING;
+        float axisLength = Length(axis);
+        if (numNormals == 0 || axisLength <= 0.0f)  return;
+        axis = axis * (1.0f / axisLength);
+        meshlet.coneAxis = axis;
+
+        float minDot = 1.0f;
+        for (unsigned int t = 0; t < numNormals; ++t)  minDot = std::min(minDot, Dot(normals[t], axis));
+        if (minDot <= MIN_CONE_DOT)  return;
+
+        // Move the apex back along the axis until it is behind the plane of every triangle. A viewer in the cone
+        // beyond the apex is then behind all the planes
+        float maxT = 0.0f;
+        for (unsigned int t = 0; t < numNormals; ++t)
+        {
+            float t1 = Dot(centre - points[t], normals[t]) / Dot(axis, normals[t]);
+            maxT = std::max(maxT, t1);
+        }
+        meshlet.coneApex = centre - axis * maxT;
+
+        // Viewing directions within 90 degrees minus the cone's half angle of the axis see every triangle from behind
+        meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+}
+
+
+// Reorder the triangles in the given range of a triangle list into meshlets, adding them to the meshlets list.
+// Triangles are grouped with the neighbours that add the fewest new vertices, then each meshlet is reordered for the
+// vertex cache. indexStart and numIndices select the range of the indices to split, meshlet index starts are from the
+// start of the whole list
+void BuildMeshlets(uint32_t* indices, std::size_t indexStart, std::size_t numIndices,
+                   const unsigned char* vertices, unsigned int vertexSize, std::size_t numVertices,
+                   std::vector<Meshlet>& meshlets,
+                   unsigned int maxVertices /*= MESHLET_MAX_VERTICES*/, unsigned int maxTriangles /*= MESHLET_MAX_TRIANGLES*/)
+{
+    uint32_t* triangles = indices + indexStart;
+    std::size_t numTriangles = numIndices / 3;
+    if (numTriangles == 0)  return;
+    maxTriangles = std::min(maxTriangles, MESHLET_MAX_TRIANGLES);
+
+    // Triangles using each vertex: those of vertex v are vertexTriangles[offsets[v]] to vertexTriangles[offsets[v+1]-1]
+    std::vector<uint32_t> offsets(numVertices + 1, 0);
+    for (std::size_t i = 0; i < numTriangles * 3; ++i)  ++offsets[triangles[i] + 1];
+    for (std::size_t v = 0; v < numVertices; ++v)  offsets[v + 1] += offsets[v];
+    std::vector<uint32_t> vertexTriangles(numTriangles * 3);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < numTriangles * 3; ++i)  vertexTriangles[fill[triangles[i]]++] = static_cast<uint32_t>(i / 3);
+
+    // Grow each meshlet from the first unused triangle. Starting points follow the existing order, which is already
+    // good for the vertex cache, so neighbouring meshlets are mostly close together
+    std::vector<bool>     used(numTriangles, false);
+    std::vector<int>      localVertex(numVertices, -1); // Position of each vertex in the current meshlet, -1 if not in it
+    std::vector<uint32_t> meshletVertices;
+    std::vector<uint32_t> newOrder;
+    std::vector<uint32_t> meshletSizes;
+    newOrder.reserve(numTriangles);
+
+    std::size_t nextSeed = 0;
+    while (newOrder.size() < numTriangles)
+    {
+        while (used[nextSeed])  ++nextSeed;
+        std::size_t meshletStart = newOrder.size();
+        meshletVertices.clear();
+
+        CVector3 positionSum = { 0, 0, 0 };
+        std::size_t triangle = nextSeed;
+        while (true)
+        {
+            used[triangle] = true;
+            newOrder.push_back(static_cast<uint32_t>(triangle));
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                uint32_t vertex = triangles[triangle * 3 + corner];
+                if (localVertex[vertex] >= 0)  continue;
+                localVertex[vertex] = static_cast<int>(meshletVertices.size());
+                meshletVertices.push_back(vertex);
+                positionSum += Position(vertices, vertexSize, vertex);
+            }
+            CVector3 meshletCentre = positionSum * (1.0f / meshletVertices.size());
+            if (newOrder.size() - meshletStart >= maxTriangles)  break;
+
+            // Next is the unused triangle touching the meshlet that adds the fewest vertices. Ties go to the triangle
+            // closest to the middle of the meshlet, keeping meshlets round so their bounds are tight. A meshlet stops
+            // when it has no neighbours that fit
+            std::size_t best = numTriangles;
+            unsigned int bestNewVertices = 4;
+            float bestDistance = 0.0f;
+            for (uint32_t vertex : meshletVertices)
+            {
+                for (uint32_t i = offsets[vertex]; i < offsets[vertex + 1]; ++i)
+                {
+                    uint32_t candidate = vertexTriangles[i];
+                    if (used[candidate])  continue;
+
+                    unsigned int newVertices = 0;
+                    for (int corner = 0; corner < 3; ++corner)
+                    {
+                        if (localVertex[triangles[candidate * 3 + corner]] < 0)  ++newVertices;
+                    }
+                    if (meshletVertices.size() + newVertices > maxVertices)  continue;
+                    if (newVertices > bestNewVertices)  continue;
+                    CVector3 offset = Position(vertices, vertexSize, triangles[candidate * 3]) +
+                                      Position(vertices, vertexSize, triangles[candidate * 3 + 1]) +
+                                      Position(vertices, vertexSize, triangles[candidate * 3 + 2]) - meshletCentre * 3.0f;
+                    float distance = Dot(offset, offset);
+                    if (newVertices < bestNewVertices || distance < bestDistance)
+                    {
+                        best = candidate;
+                        bestNewVertices = newVertices;
+                        bestDistance = distance;
+                    }
+                }
+            }
+            if (best == numTriangles)  break;
+            triangle = best;
+        }
+
+        for (uint32_t vertex : meshletVertices)  localVertex[vertex] = -1;
+        meshletSizes.push_back(static_cast<uint32_t>(newOrder.size() - meshletStart));
+    }
+
+    // Write the triangles in their new order
+    std::vector<uint32_t> oldTriangles(triangles, triangles + numTriangles * 3);
+    for (std::size_t t = 0; t < numTriangles; ++t)
+    {
+        std::memcpy(triangles + t * 3, oldTriangles.data() + newOrder[t] * 3, 3 * sizeof(uint32_t));
+    }
+
+    // Reorder each meshlet for the vertex cache. Vertices are numbered within the meshlet while doing so, which keeps
+    // the optimiser's work proportional to the size of the meshlet rather than the whole mesh
+    std::vector<uint32_t> localIndices(maxTriangles * 3);
+    uint32_t meshletIndexStart = static_cast<uint32_t>(indexStart);
+    for (uint32_t size : meshletSizes)
+    {
+        uint32_t* meshletIndices = indices + meshletIndexStart;
+        meshletVertices.clear();
+        for (uint32_t i = 0; i < size * 3; ++i)
+        {
+            uint32_t vertex = meshletIndices[i];
+            if (localVertex[vertex] < 0)
+            {
+                localVertex[vertex] = static_cast<int>(meshletVertices.size());
+                meshletVertices.push_back(vertex);
+            }
+            localIndices[i] = localVertex[vertex];
+        }
+        OptimizeVertexCache(localIndices.data(), size * 3, meshletVertices.size());
+        for (uint32_t i = 0; i < size * 3; ++i)  meshletIndices[i] = meshletVertices[localIndices[i]];
+        for (uint32_t vertex : meshletVertices)  localVertex[vertex] = -1;
+
+        Meshlet meshlet = {};
+        meshlet.indexStart = meshletIndexStart;
+        meshlet.numIndices = size * 3;
+        CalculateMeshletBounds(meshlet, meshletIndices, vertices, vertexSize);
+        meshlets.push_back(meshlet);
+
+        meshletIndexStart += size * 3;
+    }
+}
+
+
+// Find which of a mesh's meshlets may be visible to a viewer at viewPosition with the given frustum (both in world
+// space), when the mesh is drawn with the given world matrix. Visible meshlets are written to ranges (which is
+// cleared first) as index ranges, merged where possible. Set cullBackFaces to false for meshes drawn without back
+// face culling. The back face test is also skipped if the world matrix has non-uniform scaling.
+// Returns the number of meshlets culled
+std::size_t CullMeshlets(const Meshlet* meshlets, std::size_t numMeshlets, const CMatrix4x4& worldMatrix,
+                         const Frustum& frustum, const CVector3& viewPosition, bool cullBackFaces,
+                         std::vector<IndexRange>& ranges)
+{
+    ranges.clear();
+
+    // Cones are tested in model space, which only gives the same answer as world space if the world matrix keeps
+    // angles the same and doesn't mirror (which would turn triangles around)
+    CVector3 scale = worldMatrix.GetScale();
+    float maxScale = std::max(std::max(scale.x, scale.y), scale.z);
+    float minScale = std::min(std::min(scale.x, scale.y), scale.z);
+    bool mirrored = Dot(Cross(worldMatrix.GetXAxis(), worldMatrix.GetYAxis()), worldMatrix.GetZAxis()) < 0.0f;
+    bool testCones = cullBackFaces && maxScale - minScale <= maxScale * 0.001f && !mirrored;
+    CVector3 modelViewPosition = testCones ? TransformPoint(viewPosition, InverseAffine(worldMatrix)) : viewPosition;
+
+    std::size_t numCulled = 0;
+    for (std::size_t i = 0; i < numMeshlets; ++i)
+    {
+        const Meshlet& meshlet = meshlets[i];
+        if (testCones && meshlet.coneCutoff <= 1.0f &&
+            Dot(Normalise(meshlet.coneApex - modelViewPosition), meshlet.coneAxis) >= meshlet.coneCutoff)
+        {
+            ++numCulled;
+            continue;
+        }
+        if (!IsVisible(frustum, TransformBoundingSphere(meshlet.boundingSphere, worldMatrix)))
+        {
+            ++numCulled;
+            continue;
+        }
+
+        if (!ranges.empty() && ranges.back().indexStart + ranges.back().numIndices == meshlet.indexStart)
+        {
+            ranges.back().numIndices += meshlet.numIndices;
+        }
+        else
+        {
+            ranges.push_back({ meshlet.indexStart, meshlet.numIndices });
+        }
+    }
+    return numCulled;
+}
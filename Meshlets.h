@@ -0,0 +1,78 @@
+//--------------------------------------------------------------------------------------
+// Splitting meshes into meshlets (small clusters of triangles) and culling them
+//--------------------------------------------------------------------------------------
+// A whole mesh is culled if its bounding sphere is outside the view, but a large mesh that is partly in view (e.g.
+// the ground) is drawn in full. Splitting each mesh into meshlets of up to 64 vertices and 124 triangles, each with
+// its own bounds, lets the parts that can't be seen be skipped:
+// - Meshlets whose bounding sphere is outside the view frustum
+// - Meshlets where every triangle faces away from the viewer. Each meshlet has a normal cone that contains the
+//   normals of all its triangles, placed so that from any point inside the cone behind its apex all the triangles
+//   are seen from behind (method from Kapoulkine's meshoptimizer)
+//
+// The triangles of each meshlet are contiguous in the index buffer, so the meshlets left after culling are drawn
+// as ranges of indices. Meshlets next to each other in the index buffer are merged into a single range.
+//
+// Positions are read as three floats at the start of each vertex. Doesn't use DirectX so can be used on any thread
+
+#include "Bounds.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _MESHLETS_H_INCLUDED_
+#define _MESHLETS_H_INCLUDED_
+
+
+// Limits on the size of a meshlet. Chosen to suit mesh shaders, which are a likely future use, and to make meshlets
+// small enough to cull usefully but large enough that drawing the ranges doesn't cost much more than a whole mesh
+const unsigned int MESHLET_MAX_VERTICES  = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+
+// A cluster of triangles using a range of a mesh's indices, with bounds in model space
+struct Meshlet
+{
+    uint32_t indexStart;
+    uint32_t numIndices;
+
+    Sphere boundingSphere;
+
+    // Normal cone. All triangles face away from a viewer at point p if
+    //   Dot(Normalise(coneApex - p), coneAxis) >= coneCutoff
+    // coneCutoff is greater than 1 if the triangles face too many ways for the test to ever pass
+    CVector3 coneApex;
+    CVector3 coneAxis;
+    float    coneCutoff;
+};
+
+// A range of indices to draw
+struct IndexRange
+{
+    uint32_t indexStart;
+    uint32_t numIndices;
+};
+
+
+// Reorder the triangles in the given range of a triangle list into meshlets, adding them to the meshlets list.
+// Triangles are grouped with the neighbours that add the fewest new vertices, then each meshlet is reordered for the
+// vertex cache. indexStart and numIndices select the range of the indices to split, meshlet index starts are from the
+// start of the whole list
+void BuildMeshlets(uint32_t* indices, std::size_t indexStart, std::size_t numIndices,
+                   const unsigned char* vertices, unsigned int vertexSize, std::size_t numVertices,
+                   std::vector<Meshlet>& meshlets,
+                   unsigned int maxVertices = MESHLET_MAX_VERTICES, unsigned int maxTriangles = MESHLET_MAX_TRIANGLES);
+
+// Find which of a mesh's meshlets may be visible to a viewer at viewPosition with the given frustum (both in world
+// space), when the mesh is drawn with the given world matrix. Visible meshlets are written to ranges (which is
+// cleared first) as index ranges, merged where possible. Set cullBackFaces to false for meshes drawn without back
+// face culling. The back face test is also skipped if the world matrix has non-uniform scaling.
+// Returns the number of meshlets culled
+std::size_t CullMeshlets(const Meshlet* meshlets, std::size_t numMeshlets, const CMatrix4x4& worldMatrix,
+                         const Frustum& frustum, const CVector3& viewPosition, bool cullBackFaces,
+                         std::vector<IndexRange>& ranges);
+
+
+#endif //_MESHLETS_H_INCLUDED_
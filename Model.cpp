@@ -1,80 +1,249 @@
 //--------------------------------------------------------------------------------------
 // Class encapsulating a model
 //--------------------------------------------------------------------------------------
-// Holds a pointer to a mesh as well as position, rotation and scaling, which are converted to a world matrix when required
+// Holds a pointer to a mesh and a handle to the model's position, rotation and scaling, which are kept in the global
+// TransformStorage (gTransforms) and converted to a world matrix when required
 // This is more of a convenience class, the Mesh class does most of the difficult work.
+// The world matrix is only rebuilt when the position, rotation or scale has changed since it was last built.
+// Code that needs to know if a model has moved compares gTransforms.WorldVersion with the version it last saw
 
 #include "Model.h"
 
 #include "Common.h"
 #include "GraphicsHelpers.h"
 #include "Mesh.h"
+#include "RenderQueue.h"
+#include "StateCache.h"
+
+#include <algorithm>
+
+
+// Constant buffer ranges used by RenderModels
+std::vector<ConstantBufferRange> Model::mConstantRanges;
+
+// Largest error, in pixels, allowed for the LOD chosen by SelectLOD. A simpler LOD must have an error below this times
+// LOD_HYSTERESIS before it is chosen
+const float LOD_PIXEL_ERROR = 1.0f;
+const float LOD_HYSTERESIS  = 0.75f;
+
+
+Model::~Model()
+{
+    gTransforms.Destroy(mTransform);
+}
+
 
 void Model::Render()
 {
-    UpdateWorldMatrix();
+    if (!mVisible)  return;
 
-    gPerModelConstants.worldMatrix = mWorldMatrix; // Update C++ side constant buffer
+    gPerModelConstants.worldMatrix  = gTransforms.WorldMatrix(mTransform); // Update C++ side constant buffer
+    gPerModelConstants.objectColour = mColour;
     UpdateConstantBuffer(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
 
     // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(1, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
-    gD3DContext->PSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
+    gStateCache.VSSetConstantBuffers(1, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
+    gStateCache.PSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
 
-    mMesh->Render();
+    RenderMesh();
 }
 
 
+// As above, but using per-model constants already written to a constant buffer by WriteConstants, which avoids
+// updating a constant buffer for every model. Uses the version above if the range has no buffer
+void Model::Render(const ConstantBufferRange& constants)
+{
+    if (!mVisible)  return;
+    if (constants.buffer == nullptr)
+    {
+        Render();
+        return;
+    }
+
+    // Bind just this model's part of the buffer
+    gStateCache.VSSetConstantBuffers1(1, 1, &constants.buffer, &constants.firstConstant, &constants.numConstants);
+    gStateCache.PSSetConstantBuffers1(1, 1, &constants.buffer, &constants.firstConstant, &constants.numConstants);
+
+    RenderMesh();
+}
+
+
+// Write this model's per-model constants into the allocator's current batch, for use by Render above. Returns
+// false if the model is not visible or the constants could not be written, leaving range.buffer as nullptr
+bool Model::WriteConstants(ConstantBufferAllocator& allocator, ConstantBufferRange& range)
+{
+    range.buffer = nullptr;
+    if (!mVisible)  return false;
+
+    // Start from the global per-model constants so values shared by all models (e.g. wiggle) are kept
+    PerModelConstants constants = gPerModelConstants;
+    constants.worldMatrix  = gTransforms.WorldMatrix(mTransform);
+    constants.objectColour = mColour;
+    return allocator.Write(constants, range);
+}
+
+
+// Fill in this model's world matrix and colour for an instanced draw of its mesh (see InstanceBuffer.h)
+void Model::WriteInstance(InstanceData& instance)
+{
+    instance.worldMatrix  = gTransforms.WorldMatrix(mTransform);
+    instance.objectColour = mColour;
+    instance.padding      = 0;
+}
+
+
+// Render each of the given models with the current GPU settings, as Render above. The per-model constants for all
+// the models are written in one batch first (see ConstantBufferAllocator.h), rather than updated for each model
+void Model::RenderModels(Model* const* models, std::size_t count)
+{
+    mConstantRanges.assign(count, ConstantBufferRange());
+    if (gPerModelConstantAllocator.Map())
+    {
+        for (std::size_t i = 0; i < count; ++i)  models[i]->WriteConstants(gPerModelConstantAllocator, mConstantRanges[i]);
+        gPerModelConstantAllocator.Unmap();
+    }
+
+    for (std::size_t i = 0; i < count; ++i)  models[i]->Render(mConstantRanges[i]);
+}
+
+
+// Shaders, textures and states used to draw the model through a RenderQueue (see RenderQueue.h). Models without a
+// material are not added to render queues. The material is not owned by the model and must outlive it
+void Model::SetMaterial(const Material* material)
+{
+    mMaterial = material;
+    if (material != nullptr)  mBackFaceCulling = material->cullBackFaces;
+}
+
+
+// Choose the level of detail used by Render (see Mesh::NumLODs) for a camera at the given position. pixelsPerUnit
+// is the width in pixels of something 1 unit across and 1 unit away, which depends on the camera's FOV and the
+// viewport size. The simplest LOD whose error would cover less than a pixel on screen is chosen. To stop models
+// switching back and forth a simpler LOD is only chosen once its error is well under a pixel
+void Model::SelectLOD(const CVector3& cameraPosition, float pixelsPerUnit)
+{
+    unsigned int numLODs = static_cast<unsigned int>(mMesh->NumLODs());
+    mLOD = std::min(mLOD, numLODs - 1);
+    if (numLODs == 1)  return;
+
+    // Errors are in model space so scale them into world space. Use the nearest point of the bounding sphere so the
+    // error is never underestimated, the camera being inside the sphere means full detail
+    Sphere sphere = WorldBoundingSphere();
+    float meshRadius = mMesh->BoundingSphere().radius;
+    float distance = Length(sphere.centre - cameraPosition) - sphere.radius;
+    if (distance <= 0.0f || meshRadius <= 0.0f)
+    {
+        mLOD = 0;
+        return;
+    }
+    float pixelsPerError = pixelsPerUnit * (sphere.radius / meshRadius) / distance;
+
+    while (mLOD > 0 && mMesh->LODError(mLOD) * pixelsPerError > LOD_PIXEL_ERROR)  --mLOD;
+    while (mLOD + 1 < numLODs && mMesh->LODError(mLOD + 1) * pixelsPerError < LOD_PIXEL_ERROR * LOD_HYSTERESIS)  ++mLOD;
+}
+
+
+// Cull the mesh's meshlets (see Meshlets.h) for a view with the given frustum and viewer position, both in world
+// space, so Render only draws the meshlets that may be visible. Call after the model has been culled as a whole
+// and its LOD chosen. Only the full detail mesh has meshlets, so does nothing at other LODs.
+// Returns the number of meshlets culled
+std::size_t Model::CullMeshlets(const Frustum& frustum, const CVector3& viewPosition)
+{
+    mMeshletsCulled = false;
+    const std::vector<Meshlet>& meshlets = mMesh->Meshlets();
+    if (!mVisible || mLOD != 0 || meshlets.size() < 2)  return 0; // A single meshlet was already culled with the model
+
+    std::size_t numCulled = ::CullMeshlets(meshlets.data(), meshlets.size(), gTransforms.WorldMatrix(mTransform),
+                                           frustum, viewPosition, mBackFaceCulling, mMeshletRanges);
+    mMeshletsCulled = true;
+    return numCulled;
+}
+
+
+// Bounding sphere of the model's mesh in world space
+Sphere Model::WorldBoundingSphere()
+{
+    return TransformBoundingSphere(mMesh->BoundingSphere(), gTransforms.WorldMatrix(mTransform));
+}
+
+// Box containing the model's mesh in world space (aligned to the world axes)
+AABB Model::WorldBoundingBox()
+{
+    return TransformBoundingBox(mMesh->BoundingBox(), gTransforms.WorldMatrix(mTransform));
+}
+
 
 // Control the model's position and rotation using keys provided. Amount of motion performed depends on frame time
 void Model::Control(float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode turnLeft, KeyCode turnRight,
                                      KeyCode turnCW, KeyCode turnCCW, KeyCode moveForward, KeyCode moveBackward)
 {
-    UpdateWorldMatrix();
+    // Work on local copies of the transform, written back at the end if anything changed
+    CMatrix4x4  worldMatrix = gTransforms.WorldMatrix(mTransform);
+    CVector3    position    = gTransforms.Position(mTransform);
+    CQuaternion rotation    = gTransforms.Rotation(mTransform);
 
+	// Keys pressed this frame - the world matrix only needs rebuilding if one of them was held
+	bool rotated = false, moved = false;
+
+	// Rotations are applied around the model's local X and Z axes and the world Y axis, the same as changing
+	// the Euler angles used to do. Local rotations go before the current rotation, world rotations after it
 	if (KeyHeld( turnDown ))
 	{
-		mRotation.x += ROTATION_SPEED * frameTime;
+		rotation = QuaternionRotationX(ROTATION_SPEED * frameTime) * rotation;
+		rotated = true;
 	}
 	if (KeyHeld( turnUp ))
 	{
-		mRotation.x -= ROTATION_SPEED * frameTime;
+		rotation = QuaternionRotationX(-ROTATION_SPEED * frameTime) * rotation;
+		rotated = true;
 	}
 	if (KeyHeld( turnRight ))
 	{
-		mRotation.y += ROTATION_SPEED * frameTime;
+		rotation *= QuaternionRotationY(ROTATION_SPEED * frameTime);
+		rotated = true;
 	}
 	if (KeyHeld( turnLeft ))
 	{
-		mRotation.y -= ROTATION_SPEED * frameTime;
+		rotation *= QuaternionRotationY(-ROTATION_SPEED * frameTime);
+		rotated = true;
 	}
 	if (KeyHeld( turnCW ))
 	{
-		mRotation.z += ROTATION_SPEED * frameTime;
+		rotation = QuaternionRotationZ(ROTATION_SPEED * frameTime) * rotation;
+		rotated = true;
 	}
 	if (KeyHeld( turnCCW ))
 	{
-		mRotation.z -= ROTATION_SPEED * frameTime;
+		rotation = QuaternionRotationZ(-ROTATION_SPEED * frameTime) * rotation;
+		rotated = true;
 	}
+	if (rotated)  rotation = Normalise(rotation); // Prevent rounding errors building up over many frames
 
 	// Local Z movement - move in the direction of the Z axis, get axis from world matrix
-    CVector3 localZDir = Normalise({ mWorldMatrix.e20, mWorldMatrix.e21, mWorldMatrix.e22 }); // normalise axis in case world matrix has scaling
+    CVector3 localZDir = Normalise({ worldMatrix.e20, worldMatrix.e21, worldMatrix.e22 }); // normalise axis in case world matrix has scaling
 	if (KeyHeld( moveForward ))
 	{
-		mPosition.x += localZDir.x * MOVEMENT_SPEED * frameTime;
-		mPosition.y += localZDir.y * MOVEMENT_SPEED * frameTime;
-		mPosition.z += localZDir.z * MOVEMENT_SPEED * frameTime;
+		position.x += localZDir.x * MOVEMENT_SPEED * frameTime;
+		position.y += localZDir.y * MOVEMENT_SPEED * frameTime;
+		position.z += localZDir.z * MOVEMENT_SPEED * frameTime;
+		moved = true;
 	}
 	if (KeyHeld( moveBackward ))
 	{
-		mPosition.x -= localZDir.x * MOVEMENT_SPEED * frameTime;
-		mPosition.y -= localZDir.y * MOVEMENT_SPEED * frameTime;
-		mPosition.z -= localZDir.z * MOVEMENT_SPEED * frameTime;
+		position.x -= localZDir.x * MOVEMENT_SPEED * frameTime;
+		position.y -= localZDir.y * MOVEMENT_SPEED * frameTime;
+		position.z -= localZDir.z * MOVEMENT_SPEED * frameTime;
+		moved = true;
 	}
+
+	if (rotated)  gTransforms.SetRotation(mTransform, rotation);
+	if (moved)    gTransforms.SetPosition(mTransform, position);
 }
 
 
-void Model::UpdateWorldMatrix()
+// Draw the mesh at the chosen LOD, or just the meshlets left by CullMeshlets
+void Model::RenderMesh()
 {
-    mWorldMatrix = MatrixScaling(mScale) * MatrixRotationZ(mRotation.z) * MatrixRotationX(mRotation.x) * MatrixRotationY(mRotation.y) * MatrixTranslation(mPosition);
-}
\ No newline at end of file
+    if (mMeshletsCulled && mLOD == 0)  mMesh->RenderRanges(mMeshletRanges);
+    else                               mMesh->Render(mLOD);
+}
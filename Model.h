@@ -1,18 +1,28 @@
 //--------------------------------------------------------------------------------------
 // Class encapsulating a model
 //--------------------------------------------------------------------------------------
-// Holds a pointer to a mesh as well as position, rotation and scaling, which are converted to a world matrix when required
+// Holds a pointer to a mesh and a handle to the model's position, rotation and scaling, which are kept in the global
+// TransformStorage (gTransforms) and converted to a world matrix when required
 // This is more of a convenience class, the Mesh class does most of the difficult work.
+// The world matrix is only rebuilt when the position, rotation or scale has changed since it was last built.
+// Code that needs to know if a model has moved compares gTransforms.WorldVersion with the version it last saw
 
 #include "Common.h"
 #include "CVector3.h"
 #include "CMatrix4x4.h"
+#include "CQuaternion.h"
+#include "TransformStorage.h"
+#include "Bounds.h"
+#include "Meshlets.h"
 #include "Input.h"
+#include "ConstantBufferAllocator.h"
+#include <vector>
 
 #ifndef _MODEL_H_INCLUDED_
 #define _MODEL_H_INCLUDED_
 
 class Mesh;
+struct Material;
 
 class Model
 {
@@ -22,15 +32,74 @@ public:
 	//-------------------------------------
 
     Model(Mesh* mesh, CVector3 position = { 0,0,0 }, CVector3 rotation = { 0,0,0 }, float scale = 1)
-        : mMesh(mesh), mPosition(position), mRotation(rotation), mScale({ scale, scale, scale })
+        : mMesh(mesh), mTransform(gTransforms.Create(position, QuaternionFromEuler(rotation), { scale, scale, scale }))
     {
     }
 
+    // Models own their transform so cannot be copied
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    ~Model();
+
     // The render function sets the world matrix in the per-frame constant buffer and makes that buffer available
     // to vertex & pixel shader. Then it calls Mesh:Render, which renders the geometry with current GPU settings.
     // So all other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
+    // Does nothing if the model has been culled (see SetVisible)
     void Render();
 
+    // As above, but using per-model constants already written to a constant buffer by WriteConstants, which avoids
+    // updating a constant buffer for every model. Uses the version above if the range has no buffer
+    void Render(const ConstantBufferRange& constants);
+
+    // Write this model's per-model constants into the allocator's current batch, for use by Render above. Returns
+    // false if the model is not visible or the constants could not be written, leaving range.buffer as nullptr
+    bool WriteConstants(ConstantBufferAllocator& allocator, ConstantBufferRange& range);
+
+    // Fill in this model's world matrix and colour for an instanced draw of its mesh (see InstanceBuffer.h)
+    void WriteInstance(InstanceData& instance);
+
+    // Render each of the given models with the current GPU settings, as Render above. The per-model constants for all
+    // the models are written in one batch first (see ConstantBufferAllocator.h), rather than updated for each model
+    static void RenderModels(Model* const* models, std::size_t count);
+
+
+	// Choose the level of detail used by Render (see Mesh::NumLODs) for a camera at the given position. pixelsPerUnit
+	// is the width in pixels of something 1 unit across and 1 unit away, which depends on the camera's FOV and the
+	// viewport size. The simplest LOD whose error would cover less than a pixel on screen is chosen. To stop models
+	// switching back and forth a simpler LOD is only chosen once its error is well under a pixel
+	void SelectLOD(const CVector3& cameraPosition, float pixelsPerUnit);
+
+	// Level of detail chosen by SelectLOD
+	unsigned int LOD()  { return mLOD; }
+
+
+	// Cull the mesh's meshlets (see Meshlets.h) for a view with the given frustum and viewer position, both in world
+	// space, so Render only draws the meshlets that may be visible. Call after the model has been culled as a whole
+	// and its LOD chosen. Only the full detail mesh has meshlets, so does nothing at other LODs.
+	// Returns the number of meshlets culled
+	std::size_t CullMeshlets(const Frustum& frustum, const CVector3& viewPosition);
+
+	// Models rendered without back face culling (e.g. blended models) must not have meshlets facing away culled
+	// Set automatically by SetMaterial
+	void SetBackFaceCulling( bool backFaceCulling )  { mBackFaceCulling = backFaceCulling; }
+
+
+	// Shaders, textures and states used to draw the model through a RenderQueue (see RenderQueue.h). Models without a
+	// material are not added to render queues. The material is not owned by the model and must outlive it
+	const Material* GetMaterial()  { return mMaterial; }
+	void SetMaterial( const Material* material );
+
+	// Colour passed to the shaders as objectColour, e.g. to tint light models to match their light
+	CVector3 Colour()                    { return mColour;   }
+	void     SetColour( CVector3 colour )  { mColour = colour; }
+
+
+	// Occluders are large solid models drawn into the occlusion buffer to hide the models behind them (see
+	// OcclusionCulling.h). Occluders themselves are never culled by occlusion
+	bool IsOccluder()                  { return mOccluder;     }
+	void SetOccluder( bool occluder )  { mOccluder = occluder; }
+
 
 	// Control the model's position and rotation using keys provided. Amount of motion performed depends on frame time
 	void Control( float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode turnLeft, KeyCode turnRight,  
@@ -39,9 +108,21 @@ public:
 
     void FaceTarget(CVector3 target)
     {
-        UpdateWorldMatrix();
-        mWorldMatrix.FaceTarget(target);
-        mRotation = mWorldMatrix.GetEulerAngles();
+        CMatrix4x4 worldMatrix = WorldMatrix();
+        worldMatrix.FaceTarget(target);
+
+        // If attached to a parent, remove the parent's transform to get the rotation relative to it
+        TransformHandle parent = gTransforms.Parent(mTransform);
+        if (gTransforms.IsValid(parent))  worldMatrix = worldMatrix * InverseAffine(gTransforms.WorldMatrix(parent));
+        SetOrientation(QuaternionFromMatrix(worldMatrix));
+    }
+
+
+    // Attach this model to another so it moves, rotates and scales with it. This model's position, rotation and scale
+    // become relative to the parent. Pass nullptr to detach. Returns false if the parent is attached to this model
+    bool SetParent(Model* parent)
+    {
+        return gTransforms.SetParent(mTransform, parent != nullptr ? parent->mTransform : TransformHandle{});
     }
 
 
@@ -49,37 +130,71 @@ public:
 	// Data access
 	//-------------------------------------
 
-	// Getters / setters
-	CVector3 Position()  { return mPosition; }
-	CVector3 Rotation()  { return mRotation; }
-	CVector3 Scale()     { return mScale;    }
+	// Getters / setters - relative to the parent model if there is one (see SetParent)
+	CVector3 Position()  { return gTransforms.Position(mTransform); }
+	CVector3 Rotation()  { return ToEulerAngles(gTransforms.Rotation(mTransform)); } // Euler angles (Z, then X, then Y) converted from the stored quaternion
+	CVector3 Scale()     { return gTransforms.Scale(mTransform);    }
+
+	void SetPosition( CVector3 position )  { gTransforms.SetPosition(mTransform, position); }
+	void SetRotation( CVector3 rotation )  { gTransforms.SetRotation(mTransform, QuaternionFromEuler(rotation)); }
 
-	void SetPosition( CVector3 position )  { mPosition = position; }
-	void SetRotation( CVector3 rotation )  { mRotation = rotation; }
+	// Rotation as a quaternion - this is how the rotation is stored, so no conversion is needed
+	CQuaternion Orientation()                     { return gTransforms.Rotation(mTransform); }
+	void SetOrientation( CQuaternion orientation )  { gTransforms.SetRotation(mTransform, orientation); }
 
 	// Two ways to set scale: x,y,z separately, or all to the same value
-	void SetScale   ( CVector3 scale    )  { mScale = scale;       } 
-	void SetScale   ( float scale       )  { mScale = { scale, scale, scale };}
+	void SetScale   ( CVector3 scale    )  { gTransforms.SetScale(mTransform, scale); }
+	void SetScale   ( float scale       )  { gTransforms.SetScale(mTransform, { scale, scale, scale }); }
+
+	// Read only access to model world matrix, rebuilt on request if the model has changed
+	CMatrix4x4 WorldMatrix()  { return gTransforms.WorldMatrix(mTransform); }
+
+	// Handle to this model's transform in gTransforms
+	TransformHandle Transform()  { return mTransform; }
 
-	// Read only access to model world matrix, updated on request
-	CMatrix4x4 WorldMatrix()  { UpdateWorldMatrix();  return mWorldMatrix; }
+	// Mesh used by this model
+	Mesh* GetMesh()  { return mMesh; }
+
+	// Bounding sphere of the model's mesh in world space
+	Sphere WorldBoundingSphere();
+
+	// Box containing the model's mesh in world space (aligned to the world axes)
+	AABB WorldBoundingBox();
+
+	// Visibility is set by culling (see Culling.h) before rendering a view, Render does nothing for models not visible
+	// Setting visibility also clears any meshlet culling from a previous view, so the whole mesh is drawn
+	bool IsVisible()                 { return mVisible;    }
+	void SetVisible( bool visible )  { mVisible = visible;  mMeshletsCulled = false; }
 
 
 	//-------------------------------------
 	// Private data / members
 	//-------------------------------------
 private:
-    void UpdateWorldMatrix();
+    // Draw the mesh at the chosen LOD, or just the meshlets left by CullMeshlets
+    void RenderMesh();
 
     Mesh* mMesh;
 
-	// Position, rotation and scaling for the model
-	CVector3 mPosition;
-	CVector3 mRotation;
-	CVector3 mScale;
+	// Position, rotation, scaling and world matrix for the model are held in gTransforms
+	TransformHandle mTransform;
+
+	bool mVisible = true;
+
+	unsigned int mLOD = 0;
+
+	// Ranges of indices of the meshlets left by CullMeshlets, used by Render if mMeshletsCulled is set
+	std::vector<IndexRange> mMeshletRanges;
+	bool mMeshletsCulled  = false;
+	bool mBackFaceCulling = true;
+
+	bool mOccluder = false;
+
+	const Material* mMaterial = nullptr;
+	CVector3        mColour   = { 1, 1, 1 };
 
-	// World matrix for the model - built from the above
-	CMatrix4x4 mWorldMatrix;
+	// Constant buffer ranges used by RenderModels, kept to avoid allocating each time
+	static std::vector<ConstantBufferRange> mConstantRanges;
 };
 
 
@@ -14,7 +14,7 @@
 // Note that textures are often called maps (because texture mapping describes wrapping a texture round a mesh).
 // Get used to people using the word "texture" and "map" interchangably.
 Texture2D DiffuseSpecularMap : register(t0); // Diffuse map (main colour) in rgb and specular map (shininess level) in gAlpha - C++ must load this into slot 0
-Texture2D NormalMap          : register(t1); // Normal map in rgb - C++ must load this into slot 1
+Texture2D NormalMap          : register(t1); // Normal map in rgb (or rg for BC5) - C++ must load this into slot 1
 
 Texture2D DiffuseSpecularMap2 : register(t2);
 Texture2D NormalMap2		  : register(t3);
@@ -44,10 +44,10 @@ float4 main(NormalMappingPixelShaderInput input) : SV_Target
 	float3 modelBiTangent = cross(modelNormal, modelTangent);
 	float3x3 invTangentMatrix = float3x3(modelTangent, modelBiTangent, modelNormal);
 
-	// Get the texture normal from the normal map. The r,g,b pixel values actually store x,y,z components of a normal. However, r,g,b
-	// values are stored in the range 0->1, whereas the x, y & z components should be in the range -1->1. So some scaling is needed
-	float3 textureNormal = 2.0f * NormalMap.Sample(TexSampler, input.uv).rgb - 1.0f; // Scale from 0->1 to -1->1
-	float3 textureNormal2 = 2.0f * NormalMap2.Sample(TexSampler, input.uv).rgb - 1.0f; // Scale from 0->1 to -1->1
+	// Get the texture normal from the normal map. The r,g pixel values store the x,y components of a normal, scaled to the range
+	// 0->1, and z is rebuilt from them. So both rgb and BC5 (red and green only) normal maps can be used
+	float3 textureNormal = DecodeNormalMap(NormalMap.Sample(TexSampler, input.uv).rg);
+	float3 textureNormal2 = DecodeNormalMap(NormalMap2.Sample(TexSampler, input.uv).rg);
 
 	
 	// Now convert the texture normal into model space using the inverse tangent matrix, and then convert into world space using the world
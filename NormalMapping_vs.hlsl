@@ -14,7 +14,7 @@ NormalMappingPixelShaderInput main(TangentVertex modelVertex)
 {
     NormalMappingPixelShaderInput output; // This is the data the pixel shader requires from this vertex shader
     
-    float4 modelPosition = float4(modelVertex.position, 1);
+    float4 modelPosition = float4(DecodePosition(modelVertex.position), 1); // Decode compact vertex data (see Common.hlsli)
     
     float4 worldPosition = mul(gWorldMatrix, modelPosition);
     float4 viewPosition = mul(gViewMatrix, worldPosition);
@@ -23,11 +23,11 @@ NormalMappingPixelShaderInput main(TangentVertex modelVertex)
     output.worldPosition = worldPosition.xyz; // Also pass world position to pixel shader for lighting
 
     // Unlike the position, send the model's normal and tangent untransformed (in model space). The pixel shader will do the matrix work on normals
-    output.modelNormal = modelVertex.normal;
-    output.modelTangent = modelVertex.tangent;
+    output.modelNormal = DecodeNormal(modelVertex.normal);
+    output.modelTangent = DecodeNormal(modelVertex.tangent);
 
     // Pass texture coordinates (UVs) on to the pixel shader, the vertex shader doesn't need them
-    output.uv = modelVertex.uv;
+    output.uv = DecodeUV(modelVertex.uv);
 
     return output; // Ouput data sent down the pipeline (to the pixel shader)
 }
@@ -0,0 +1,423 @@
+//--------------------------------------------------------------------------------------
+// Occlusion culling - skipping models hidden behind other models
+//--------------------------------------------------------------------------------------
+// Occluder triangles are clipped against the near plane and a guard band a little larger than the view, so the
+// pixel coordinates of the pieces stay small enough for accurate float edge equations. Triangles are then drawn
+// using edge equations evaluated at pixel centres, which are stepped along each row four pixels at a time.
+
+#include "OcclusionCulling.h"
+#include "BatchTransform.h"
+#include "MathSIMD.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cfloat>
+#include <cmath>
+
+
+namespace
+{
+    // Triangles are clipped where they reach this multiple of the view's width or height from its centre
+    const float GUARD_BAND = 2.0f;
+
+    // Clipping planes used on occluder triangles: the near plane and the four sides of the guard band
+    const int NUM_CLIP_PLANES = 5;
+
+    // Clipping a triangle against each plane adds at most one vertex
+    const int MAX_CLIPPED_VERTICES = 3 + NUM_CLIP_PLANES;
+
+    // Signed distance of a clip space point (x, y, z, w) from a clipping plane, positive on the inside
+    float ClipDistance(int plane, const float* v)
+    {
+        switch (plane)
+        {
+            case 0:  return v[2];
+            case 1:  return GUARD_BAND * v[3] - v[0];
+            case 2:  return GUARD_BAND * v[3] + v[0];
+            case 3:  return GUARD_BAND * v[3] - v[1];
+            default: return GUARD_BAND * v[3] + v[1];
+        }
+    }
+
+    // Bits for the sides of the view frustum a clip space point is outside. A triangle with all its corners outside
+    // the same side cannot be seen
+    unsigned int FrustumOutCode(const float* v)
+    {
+        return (v[0] < -v[3] ?  1u : 0u) | (v[0] > v[3] ?  2u : 0u) |
+               (v[1] < -v[3] ?  4u : 0u) | (v[1] > v[3] ?  8u : 0u) |
+               (v[2] <  0    ? 16u : 0u) | (v[2] > v[3] ? 32u : 0u);
+    }
+
+    // True if a clip space point is outside the near plane or guard band, so the triangle must be clipped
+    bool NeedsClipping(const float* v)
+    {
+        float guard = GUARD_BAND * v[3];
+        return v[2] < 0 || v[0] < -guard || v[0] > guard || v[1] < -guard || v[1] > guard;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Construction / Usage
+-----------------------------------------------------------------------------------------*/
+
+// Width and height of the buffer in pixels are rounded up to whole tiles. It need not have the same aspect ratio
+// as the viewport, the whole view is squeezed into the buffer. Set numThreads to 0 to use every CPU core
+OcclusionBuffer::OcclusionBuffer(int width /*= 256*/, int height /*= 128*/, int numThreads /*= 0*/)
+{
+    mTilesX = std::max((width  + TILE_WIDTH  - 1) / TILE_WIDTH,  1);
+    mTilesY = std::max((height + TILE_HEIGHT - 1) / TILE_HEIGHT, 1);
+    mWidth  = mTilesX * TILE_WIDTH;
+    mHeight = mTilesY * TILE_HEIGHT;
+
+    if (numThreads <= 0)  numThreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    mNumThreads = numThreads;
+
+    mDepths.resize(mWidth * mHeight, 1.0f);
+    mTileMaxDepths.resize(mTilesX * mTilesY, 1.0f);
+    mTileTriangles.resize(mTilesX * mTilesY);
+    mViewProjectionMatrix = MatrixIdentity();
+}
+
+
+// Empty the buffer and remove all occluders, ready for a view with the given view-projection matrix
+void OcclusionBuffer::Clear(const CMatrix4x4& viewProjectionMatrix)
+{
+    mViewProjectionMatrix = viewProjectionMatrix;
+
+    std::fill(mDepths.begin(), mDepths.end(), 1.0f);
+    std::fill(mTileMaxDepths.begin(), mTileMaxDepths.end(), 1.0f);
+    mTriangles.clear();
+    for (auto& tileTriangles : mTileTriangles)  tileTriangles.clear();
+}
+
+
+// Add the triangles of an occluder, which has the given world matrix. Indices refer to the positions array,
+// which are in model space. Triangles are transformed, clipped and sorted into tiles straight away, so the arrays
+// are not needed afterwards. Occluders should not be larger than the model they are for or they will hide
+// models that can be seen
+void OcclusionBuffer::AddOccluder(const CVector3* positions, std::size_t numPositions,
+                                  const uint32_t* indices, std::size_t numIndices, const CMatrix4x4& worldMatrix)
+{
+    // Transform positions to clip space, stored as x, y, z, w
+    mClipPositions.resize(numPositions * 4);
+    float* clip = mClipPositions.data();
+    TransformPointsHomogeneous(worldMatrix * mViewProjectionMatrix, positions, clip, numPositions);
+
+    for (std::size_t i = 0; i + 2 < numIndices; i += 3)
+    {
+        AddClippedTriangle(clip + indices[i] * 4, clip + indices[i + 1] * 4, clip + indices[i + 2] * 4);
+    }
+}
+
+
+// Clip a triangle in clip space (x, y, z, w each) to the near plane and guard band, then add the pieces
+void OcclusionBuffer::AddClippedTriangle(const float* v0, const float* v1, const float* v2)
+{
+    // Skip triangles entirely outside one side of the view
+    if (FrustumOutCode(v0) & FrustumOutCode(v1) & FrustumOutCode(v2))  return;
+
+    // Clip the triangle as a polygon against each plane in turn (Sutherland-Hodgman)
+    float polygons[2][MAX_CLIPPED_VERTICES][4];
+    int numVertices = 3;
+    std::copy(v0, v0 + 4, polygons[0][0]);
+    std::copy(v1, v1 + 4, polygons[0][1]);
+    std::copy(v2, v2 + 4, polygons[0][2]);
+    int current = 0;
+
+    if (NeedsClipping(v0) || NeedsClipping(v1) || NeedsClipping(v2))
+    {
+        for (int plane = 0; plane < NUM_CLIP_PLANES && numVertices >= 3; ++plane)
+        {
+            const float (*in)[4] = polygons[current];
+            float (*out)[4] = polygons[1 - current];
+            int numOut = 0;
+
+            for (int i = 0; i < numVertices; ++i)
+            {
+                const float* a = in[i];
+                const float* b = in[(i + 1) % numVertices];
+                float distanceA = ClipDistance(plane, a);
+                float distanceB = ClipDistance(plane, b);
+
+                if (distanceA >= 0)  std::copy(a, a + 4, out[numOut++]);
+                if ((distanceA >= 0) != (distanceB >= 0))
+                {
+                    float t = distanceA / (distanceA - distanceB);
+                    for (int c = 0; c < 4; ++c)  out[numOut][c] = a[c] + t * (b[c] - a[c]);
+                    ++numOut;
+                }
+            }
+
+            numVertices = numOut;
+            current = 1 - current;
+        }
+        if (numVertices < 3)  return;
+    }
+
+    // Convert to pixel coordinates and depth then add as a fan of triangles. w is positive after clipping to the
+    // near plane
+    float screen[MAX_CLIPPED_VERTICES][3];
+    for (int i = 0; i < numVertices; ++i)
+    {
+        const float* v = polygons[current][i];
+        float invW = 1.0f / v[3];
+        screen[i][0] = (v[0] * invW *  0.5f + 0.5f) * mWidth;
+        screen[i][1] = (v[1] * invW * -0.5f + 0.5f) * mHeight;
+        screen[i][2] = v[2] * invW;
+    }
+    for (int i = 2; i < numVertices; ++i)
+    {
+        AddScreenTriangle(screen[0], screen[i - 1], screen[i]);
+    }
+}
+
+
+// Set up a triangle in pixel coordinates and add it to the lists of the tiles it touches
+void OcclusionBuffer::AddScreenTriangle(const float* p0, const float* p1, const float* p2)
+{
+    // Twice the triangle's area in pixels, negative if the triangle faces the other way
+    float area = (p1[0] - p0[0]) * (p2[1] - p0[1]) - (p2[0] - p0[0]) * (p1[1] - p0[1]);
+    if (std::abs(area) < 1e-6f)  return;
+
+    // Pixels whose centres may be inside the triangle, limited to the buffer
+    float minX = std::min({ p0[0], p1[0], p2[0] });
+    float maxX = std::max({ p0[0], p1[0], p2[0] });
+    float minY = std::min({ p0[1], p1[1], p2[1] });
+    float maxY = std::max({ p0[1], p1[1], p2[1] });
+
+    ScreenTriangle triangle;
+    triangle.minX = std::max(static_cast<int>(std::ceil (minX - 0.5f)), 0);
+    triangle.maxX = std::min(static_cast<int>(std::floor(maxX - 0.5f)), mWidth - 1);
+    triangle.minY = std::max(static_cast<int>(std::ceil (minY - 0.5f)), 0);
+    triangle.maxY = std::min(static_cast<int>(std::floor(maxY - 0.5f)), mHeight - 1);
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)  return;
+
+    // Edge equations, flipped for triangles facing the other way so the inside is always positive. Moved by half a
+    // pixel so they can be evaluated at integer coordinates
+    float sign = area > 0 ? 1.0f : -1.0f;
+    const float* p[3] = { p0, p1, p2 };
+    for (int i = 0; i < 3; ++i)
+    {
+        const float* a = p[i];
+        const float* b = p[(i + 1) % 3];
+        float edgeA = sign * (a[1] - b[1]);
+        float edgeB = sign * (b[0] - a[0]);
+        float edgeC = sign * (a[0] * b[1] - b[0] * a[1]);
+        triangle.edgeA[i] = edgeA;
+        triangle.edgeB[i] = edgeB;
+        triangle.edgeC[i] = edgeC + 0.5f * (edgeA + edgeB);
+    }
+
+    // Depth plane through the three corners
+    float invArea = 1.0f / area;
+    float dz1 = p1[2] - p0[2];
+    float dz2 = p2[2] - p0[2];
+    triangle.depthA = (dz1 * (p2[1] - p0[1]) - dz2 * (p1[1] - p0[1])) * invArea;
+    triangle.depthB = (dz2 * (p1[0] - p0[0]) - dz1 * (p2[0] - p0[0])) * invArea;
+    triangle.depthC = p0[2] - triangle.depthA * p0[0] - triangle.depthB * p0[1] + 0.5f * (triangle.depthA + triangle.depthB);
+
+    // The plane is clamped to the corners' depths, it can stray outside them at pixel centres near the edges
+    triangle.minDepth = std::min({ p0[2], p1[2], p2[2] });
+    triangle.maxDepth = std::max({ p0[2], p1[2], p2[2] });
+
+    uint32_t index = static_cast<uint32_t>(mTriangles.size());
+    mTriangles.push_back(triangle);
+    for (int tileY = triangle.minY / TILE_HEIGHT; tileY <= triangle.maxY / TILE_HEIGHT; ++tileY)
+    {
+        for (int tileX = triangle.minX / TILE_WIDTH; tileX <= triangle.maxX / TILE_WIDTH; ++tileX)
+        {
+            mTileTriangles[tileY * mTilesX + tileX].push_back(index);
+        }
+    }
+}
+
+
+// Draw the occluders added since Clear into the buffer, using several threads. Call before the tests below
+void OcclusionBuffer::Rasterise()
+{
+    if (mTriangles.empty())  return;
+
+    // Tiles don't share pixels so each thread (including this one) takes the next tile until there are none left
+    int numTiles = mTilesX * mTilesY;
+    std::atomic<int> nextTile(0);
+    auto worker = [&]()
+    {
+        for (int tile = nextTile++; tile < numTiles; tile = nextTile++)
+        {
+            RasteriseTile(tile);
+        }
+    };
+
+    // Very few triangles are quicker to draw than to start a thread for
+    const std::size_t minTrianglesPerThread = 256;
+    std::size_t numThreads = std::min<std::size_t>(mNumThreads, mTriangles.size() / minTrianglesPerThread + 1);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < numThreads; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+
+// Draw all the triangles in a tile's list then update the tile's furthest depth
+void OcclusionBuffer::RasteriseTile(int tile)
+{
+    const auto& tileTriangles = mTileTriangles[tile];
+    if (tileTriangles.empty())  return;
+
+    int tileMinX = (tile % mTilesX) * TILE_WIDTH;
+    int tileMinY = (tile / mTilesX) * TILE_HEIGHT;
+    int tileMaxX = tileMinX + TILE_WIDTH  - 1;
+    int tileMaxY = tileMinY + TILE_HEIGHT - 1;
+
+    for (auto index : tileTriangles)
+    {
+        const ScreenTriangle& t = mTriangles[index];
+
+        // Part of the triangle's bounds in this tile. Rows start on a multiple of four pixels, the edge tests reject
+        // the extra pixels. Tiles are a multiple of four pixels wide so groups never cross into the next tile
+        int minX = std::max(t.minX, tileMinX) & ~3;
+        int maxX = std::min(t.maxX, tileMaxX);
+        int minY = std::max(t.minY, tileMinY);
+        int maxY = std::min(t.maxY, tileMaxY);
+        if (minX > maxX || minY > maxY)  continue;
+
+#if defined(MATH_SSE)
+        __m128 offsets  = _mm_setr_ps(0, 1, 2, 3);
+        __m128 zero     = _mm_setzero_ps();
+        __m128 minDepth = _mm_set1_ps(t.minDepth);
+        __m128 maxDepth = _mm_set1_ps(t.maxDepth);
+        __m128 step0 = _mm_set1_ps(4 * t.edgeA[0]);
+        __m128 step1 = _mm_set1_ps(4 * t.edgeA[1]);
+        __m128 step2 = _mm_set1_ps(4 * t.edgeA[2]);
+        __m128 depthStep = _mm_set1_ps(4 * t.depthA);
+        __m128 startX = _mm_add_ps(_mm_set1_ps(static_cast<float>(minX)), offsets);
+
+        for (int y = minY; y <= maxY; ++y)
+        {
+            float* row = &mDepths[y * mWidth];
+            float fy = static_cast<float>(y);
+            __m128 edge0 = MulAdd(_mm_set1_ps(t.edgeA[0]), startX, _mm_set1_ps(t.edgeB[0] * fy + t.edgeC[0]));
+            __m128 edge1 = MulAdd(_mm_set1_ps(t.edgeA[1]), startX, _mm_set1_ps(t.edgeB[1] * fy + t.edgeC[1]));
+            __m128 edge2 = MulAdd(_mm_set1_ps(t.edgeA[2]), startX, _mm_set1_ps(t.edgeB[2] * fy + t.edgeC[2]));
+            __m128 depth = MulAdd(_mm_set1_ps(t.depthA),   startX, _mm_set1_ps(t.depthB    * fy + t.depthC));
+
+            for (int x = minX; x <= maxX; x += 4)
+            {
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_cmpge_ps(edge1, zero)),
+                                           _mm_cmpge_ps(edge2, zero));
+                if (_mm_movemask_ps(inside))
+                {
+                    __m128 oldDepth = _mm_loadu_ps(row + x);
+                    __m128 newDepth = _mm_min_ps(oldDepth, _mm_min_ps(_mm_max_ps(depth, minDepth), maxDepth));
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, newDepth), _mm_andnot_ps(inside, oldDepth)));
+                }
+                edge0 = _mm_add_ps(edge0, step0);
+                edge1 = _mm_add_ps(edge1, step1);
+                edge2 = _mm_add_ps(edge2, step2);
+                depth = _mm_add_ps(depth, depthStep);
+            }
+        }
+#else
+        for (int y = minY; y <= maxY; ++y)
+        {
+            float* row = &mDepths[y * mWidth];
+            float fy = static_cast<float>(y);
+            for (int x = minX; x <= maxX; ++x)
+            {
+                float fx = static_cast<float>(x);
+                if (t.edgeA[0] * fx + t.edgeB[0] * fy + t.edgeC[0] >= 0 &&
+                    t.edgeA[1] * fx + t.edgeB[1] * fy + t.edgeC[1] >= 0 &&
+                    t.edgeA[2] * fx + t.edgeB[2] * fy + t.edgeC[2] >= 0)
+                {
+                    float depth = std::min(std::max(t.depthA * fx + t.depthB * fy + t.depthC, t.minDepth), t.maxDepth);
+                    row[x] = std::min(row[x], depth);
+                }
+            }
+        }
+#endif
+    }
+
+    // Furthest depth in the tile, lets IsVisible skip whole tiles
+    float maxDepth = 0.0f;
+    for (int y = tileMinY; y <= tileMaxY; ++y)
+    {
+        const float* row = &mDepths[y * mWidth];
+        maxDepth = std::max(maxDepth, *std::max_element(row + tileMinX, row + tileMaxX + 1));
+    }
+    mTileMaxDepths[tile] = maxDepth;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Queries
+-----------------------------------------------------------------------------------------*/
+
+// Test if any part of the box (in world space) may be seen past the occluders. Returns false if the box is
+// hidden, or is outside the view
+bool OcclusionBuffer::IsVisible(const AABB& worldBox) const
+{
+    // Screen rectangle and nearest depth of the box's corners
+    const CMatrix4x4& m = mViewProjectionMatrix;
+    float minX = FLT_MAX, maxX = -FLT_MAX;
+    float minY = FLT_MAX, maxY = -FLT_MAX;
+    float minDepth = FLT_MAX;
+    for (int i = 0; i < 8; ++i)
+    {
+        CVector3 p = { (i & 1) ? worldBox.maxPoint.x : worldBox.minPoint.x,
+                       (i & 2) ? worldBox.maxPoint.y : worldBox.minPoint.y,
+                       (i & 4) ? worldBox.maxPoint.z : worldBox.minPoint.z };
+        float x = p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30;
+        float y = p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31;
+        float z = p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32;
+        float w = p.x * m.e03 + p.y * m.e13 + p.z * m.e23 + m.e33;
+
+        // Boxes crossing the near plane are nearer than anything drawn in the buffer
+        if (z < 0 || w <= 0)  return true;
+
+        float invW = 1.0f / w;
+        float screenX = (x * invW *  0.5f + 0.5f) * mWidth;
+        float screenY = (y * invW * -0.5f + 0.5f) * mHeight;
+        minX = std::min(minX, screenX);  maxX = std::max(maxX, screenX);
+        minY = std::min(minY, screenY);  maxY = std::max(maxY, screenY);
+        minDepth = std::min(minDepth, z * invW);
+    }
+    if (maxX < 0 || minX >= mWidth || maxY < 0 || minY >= mHeight)  return false;
+
+    // Every pixel the rectangle touches
+    int pixelMinX = static_cast<int>(std::max(minX, 0.0f));
+    int pixelMaxX = static_cast<int>(std::min(maxX, mWidth  - 1.0f));
+    int pixelMinY = static_cast<int>(std::max(minY, 0.0f));
+    int pixelMaxY = static_cast<int>(std::min(maxY, mHeight - 1.0f));
+
+    // The box is hidden if every pixel is nearer than the box. Whole tiles are skipped if even their furthest
+    // pixel is nearer
+    for (int tileY = pixelMinY / TILE_HEIGHT; tileY <= pixelMaxY / TILE_HEIGHT; ++tileY)
+    {
+        for (int tileX = pixelMinX / TILE_WIDTH; tileX <= pixelMaxX / TILE_WIDTH; ++tileX)
+        {
+            if (mTileMaxDepths[tileY * mTilesX + tileX] < minDepth)  continue;
+
+            int x0 = std::max(pixelMinX, tileX * TILE_WIDTH);
+            int x1 = std::min(pixelMaxX, tileX * TILE_WIDTH + TILE_WIDTH - 1);
+            int y0 = std::max(pixelMinY, tileY * TILE_HEIGHT);
+            int y1 = std::min(pixelMaxY, tileY * TILE_HEIGHT + TILE_HEIGHT - 1);
+            for (int y = y0; y <= y1; ++y)
+            {
+                const float* row = &mDepths[y * mWidth];
+                for (int x = x0; x <= x1; ++x)
+                {
+                    if (row[x] >= minDepth)  return true;
+                }
+            }
+        }
+    }
+    return false;
+}
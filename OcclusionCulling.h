@@ -0,0 +1,122 @@
+//--------------------------------------------------------------------------------------
+// Occlusion culling - skipping models hidden behind other models
+//--------------------------------------------------------------------------------------
+// Frustum culling keeps every model in view, even those completely hidden behind the hills or another large model.
+// The OcclusionBuffer finds these on the CPU, before any draw calls are made, in the style of masked occlusion
+// culling (Hasselgren, Andersson & Akenine-Moller):
+// - A few large models are chosen as occluders and their triangles are drawn into a small depth buffer (a few
+//   hundred pixels across). The buffer is split into tiles, each triangle is added to the list of every tile it
+//   touches, then the tiles are drawn on several threads at once. Four pixels are drawn at a time with SIMD
+//   instructions
+// - Each tile also keeps its furthest depth, so most tests against the buffer only need to read one value per tile
+// - A model is hidden if the screen rectangle around its bounding box is behind the buffer everywhere. The nearest
+//   depth of the box is used for the whole rectangle, so the test never hides a model that can be seen, other than
+//   through gaps in the occluders smaller than a buffer pixel
+//
+// Depths are post-projection z / w, from 0 at the near clip plane to 1 at the far clip plane. Occluder triangles
+// are drawn from either side so open meshes such as the ground work when seen from below.
+//
+// Doesn't use DirectX so can be used and tested on any thread without a GPU. See CullOccludedModels in Culling.h
+// for use with models
+
+#include "Bounds.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _OCCLUSION_CULLING_H_INCLUDED_
+#define _OCCLUSION_CULLING_H_INCLUDED_
+
+
+class OcclusionBuffer
+{
+public:
+    //-------------------------------------
+    // Construction / Usage
+    //-------------------------------------
+
+    // Width and height of the buffer in pixels are rounded up to whole tiles. It need not have the same aspect ratio
+    // as the viewport, the whole view is squeezed into the buffer. Set numThreads to 0 to use every CPU core
+    OcclusionBuffer(int width = 256, int height = 128, int numThreads = 0);
+
+    // Empty the buffer and remove all occluders, ready for a view with the given view-projection matrix
+    void Clear(const CMatrix4x4& viewProjectionMatrix);
+
+    // Add the triangles of an occluder, which has the given world matrix. Indices refer to the positions array,
+    // which are in model space. Triangles are transformed, clipped and sorted into tiles straight away, so the arrays
+    // are not needed afterwards. Occluders should not be larger than the model they are for or they will hide
+    // models that can be seen
+    void AddOccluder(const CVector3* positions, std::size_t numPositions, const uint32_t* indices, std::size_t numIndices,
+                     const CMatrix4x4& worldMatrix);
+
+    // Draw the occluders added since Clear into the buffer, using several threads. Call before the tests below
+    void Rasterise();
+
+
+    //-------------------------------------
+    // Queries
+    //-------------------------------------
+
+    // Test if any part of the box (in world space) may be seen past the occluders. Returns false if the box is
+    // hidden, or is outside the view
+    bool IsVisible(const AABB& worldBox) const;
+
+    // Size of the buffer in pixels
+    int Width()   const  { return mWidth;  }
+    int Height()  const  { return mHeight; }
+
+    // Depth of each pixel in rows from the top left, for debugging. 1 where no occluder has been drawn
+    const float* Depths() const  { return mDepths.data(); }
+
+    // Number of occluder triangles being drawn, after clipping
+    std::size_t NumTriangles() const  { return mTriangles.size(); }
+
+
+    //-------------------------------------
+    // Private data / members
+    //-------------------------------------
+private:
+    // Size of a tile in pixels. The width must be a multiple of 4 for the SIMD code
+    static const int TILE_WIDTH  = 32;
+    static const int TILE_HEIGHT = 16;
+
+    // A triangle ready for drawing. Each edge is a line equation a * x + b * y + c that is positive on the inside of
+    // the triangle, and the depth is the plane a * x + b * y + c. Both are for integer pixel coordinates, i.e. they
+    // include the offset to pixel centres
+    struct ScreenTriangle
+    {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float depthA, depthB, depthC;
+        float minDepth, maxDepth;
+        int   minX, minY, maxX, maxY; // Pixels that may be covered, within the buffer
+    };
+
+    // Clip a triangle in clip space (x, y, z, w each) to the near plane and guard band, then add the pieces
+    void AddClippedTriangle(const float* v0, const float* v1, const float* v2);
+
+    // Set up a triangle in pixel coordinates and add it to the lists of the tiles it touches
+    void AddScreenTriangle(const float* p0, const float* p1, const float* p2);
+
+    // Draw all the triangles in a tile's list then update the tile's furthest depth
+    void RasteriseTile(int tile);
+
+    int mWidth, mHeight;
+    int mTilesX, mTilesY;
+    int mNumThreads;
+
+    CMatrix4x4 mViewProjectionMatrix;
+
+    std::vector<float> mDepths;        // mWidth * mHeight pixels
+    std::vector<float> mTileMaxDepths; // Furthest depth in each tile
+
+    std::vector<ScreenTriangle>        mTriangles;
+    std::vector<std::vector<uint32_t>> mTileTriangles; // Triangles touching each tile
+
+    std::vector<float> mClipPositions; // Working space for AddOccluder, kept to avoid allocating memory every frame
+};
+
+
+#endif //_OCCLUSION_CULLING_H_INCLUDED_
@@ -0,0 +1,373 @@
+//--------------------------------------------------------------------------------------
+// Render queue - drawing visible models in a good order with few state changes
+//--------------------------------------------------------------------------------------
+// Keys are sorted with a least significant digit (LSD) radix sort, eight bits at a time. Each pass is a stable
+// counting sort, so after sorting by each digit from the lowest to the highest the keys are fully sorted. The counts
+// for all eight digits are gathered in one pass over the keys first, which also shows which digits are the same
+// in every key (e.g. the pass bits when there are no blended draws) so their sorting passes can be skipped.
+
+#include "RenderQueue.h"
+
+#include "Model.h"
+#include "ConstantBufferAllocator.h"
+#include "InstanceBuffer.h"
+#include "GraphicsHelpers.h"
+#include "Mesh.h"
+#include "State.h"
+#include "StateCache.h"
+
+#include <algorithm>
+
+
+namespace
+{
+    // Widths of the parts of the sort key (see RenderQueue.h). They add up to 64
+    const int PASS_BITS        = 2;
+    const int DEPTH_BITS       = 24;
+    const int BLEND_BITS       = 2;
+    const int SHADER_PAIR_BITS = 10;
+    const int MATERIAL_BITS    = 12;
+    const int MESH_BITS        = 14;
+
+    // Width of the state part of the key - blend mode, shader pair, material and mesh
+    const int STATE_BITS = BLEND_BITS + SHADER_PAIR_BITS + MATERIAL_BITS + MESH_BITS;
+
+    const uint64_t MAX_DEPTH = (1ull << DEPTH_BITS) - 1;
+
+    // Passes, in the order they are drawn
+    const uint64_t OPAQUE_PASS      = 0;
+    const uint64_t TRANSPARENT_PASS = 1;
+
+    // Fewest draws worth drawing as an instanced batch
+    const uint32_t MIN_INSTANCES = 2;
+
+
+    // Sort items by key using an LSD radix sort. temp is working space, the result is left in items
+    template <typename Item>
+    void RadixSort(std::vector<Item>& items, std::vector<Item>& temp)
+    {
+        const int DIGITS = 8;
+        std::size_t counts[DIGITS][256] = {};
+        for (const auto& item : items)
+        {
+            for (int digit = 0; digit < DIGITS; ++digit)  ++counts[digit][(item.key >> (digit * 8)) & 0xff];
+        }
+
+        temp.resize(items.size());
+        Item* source = items.data();
+        Item* destination = temp.data();
+        for (int digit = 0; digit < DIGITS; ++digit)
+        {
+            // Skip digits that are the same for every item
+            std::size_t* digitCounts = counts[digit];
+            if (digitCounts[(source[0].key >> (digit * 8)) & 0xff] == items.size())  continue;
+
+            // Turn counts into the position of the first item with each digit value
+            std::size_t offsets[256];
+            std::size_t total = 0;
+            for (int value = 0; value < 256; ++value)
+            {
+                offsets[value] = total;
+                total += digitCounts[value];
+            }
+
+            for (std::size_t i = 0; i < items.size(); ++i)
+            {
+                destination[offsets[(source[i].key >> (digit * 8)) & 0xff]++] = source[i];
+            }
+            std::swap(source, destination);
+        }
+
+        if (source != items.data())  items.swap(temp);
+    }
+
+
+    // GPU states for blend modes
+    ID3D11BlendState* BlendState(BlendMode blendMode)
+    {
+        switch (blendMode)
+        {
+            case BlendMode::Additive:       return gAdditiveBlendingState;
+            case BlendMode::Multiplicative: return gMultiplicativeBlendingState;
+            case BlendMode::Alpha:          return gAlphaBlendingState;
+            default:                        return gNoBlendingState;
+        }
+    }
+
+    ID3D11DepthStencilState* DepthStencilState(BlendMode blendMode)
+    {
+        return blendMode == BlendMode::Opaque ? gUseDepthBufferState : gDepthReadOnlyState;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Usage
+-----------------------------------------------------------------------------------------*/
+
+// Remove all draws, ready for a view with the given view matrix. Draws are sorted by the depth of their model's
+// bounding sphere in the view, up to maxDepth (usually the camera's far clip distance)
+void RenderQueue::Clear(const CMatrix4x4& viewMatrix, float maxDepth)
+{
+    mViewMatrix = viewMatrix;
+    mMaxDepth = maxDepth;
+    mDraws.clear();
+    mSortItems.clear();
+}
+
+
+// Add a draw of a model with its material. Does nothing if the model is not visible or has no material
+void RenderQueue::Add(Model* model)
+{
+    const Material* material = model->GetMaterial();
+    if (!model->IsVisible() || material == nullptr)  return;
+
+    // Mesh numbers are given out in the order meshes are first seen, wrapping if there are too many
+    auto meshId = mMeshIds.emplace(model->GetMesh(), static_cast<uint32_t>(mMeshIds.size())).first->second;
+    uint64_t stateKey = (MaterialKey(material) << MESH_BITS) | (meshId & ((1u << MESH_BITS) - 1));
+
+    // Depth of the centre of the bounding sphere in the view, scaled to the range of the key's depth bits
+    const CMatrix4x4& m = mViewMatrix;
+    CVector3 centre = model->WorldBoundingSphere().centre;
+    float viewZ = centre.x * m.e02 + centre.y * m.e12 + centre.z * m.e22 + m.e32;
+    float depth = std::min(std::max(viewZ / mMaxDepth, 0.0f), 1.0f);
+    uint64_t depthKey = static_cast<uint64_t>(depth * MAX_DEPTH);
+
+    uint64_t key;
+    if (material->blendMode == BlendMode::Opaque)
+    {
+        key = (OPAQUE_PASS << (64 - PASS_BITS)) | (stateKey << DEPTH_BITS) | depthKey;
+    }
+    else
+    {
+        key = (TRANSPARENT_PASS << (64 - PASS_BITS)) | ((MAX_DEPTH - depthKey) << STATE_BITS) | stateKey;
+    }
+
+    mSortItems.push_back({ key, static_cast<uint32_t>(mDraws.size()) });
+    mDraws.push_back({ model, material });
+}
+
+
+// Add draws of each of the given models, as above
+void RenderQueue::Add(Model* const* models, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i)  Add(models[i]);
+}
+
+
+// Sort the draws, call before Render
+void RenderQueue::Sort()
+{
+    if (mSortItems.size() > 1)  RadixSort(mSortItems, mSortTemp);
+}
+
+
+// Draw everything in the queue in sorted order. Shaders, textures, sampler and blend, depth and rasterizer states
+// are changed as needed, all other GPU settings (e.g. per-frame constants) must have been set up already. The
+// per-model constants for all draws are written in one batch with gPerModelConstantAllocator
+void RenderQueue::Render()
+{
+    mNumStateChanges = 0;
+    mBatches.clear();
+    if (mSortItems.empty())  return;
+
+    BuildBatches();
+
+    // States set by the previous draw. The first draw sets everything
+    const Material*     previous = nullptr;
+    ID3D11VertexShader* previousVertexShader = nullptr;
+
+    for (const auto& batch : mBatches)
+    {
+        const Draw& draw = mDraws[mSortItems[batch.firstItem].draw];
+        const Material* material = draw.material;
+
+        // Instanced batches use a different vertex shader from single models with the same material
+        ID3D11VertexShader* vertexShader = batch.instanced ? material->instancedVertexShader : material->vertexShader;
+        if (previous == nullptr || vertexShader != previousVertexShader)
+        {
+            gStateCache.VSSetShader(vertexShader, nullptr, 0);
+            previousVertexShader = vertexShader;
+            ++mNumStateChanges;
+        }
+
+        if (material != previous)
+        {
+            if (previous == nullptr || material->pixelShader != previous->pixelShader)
+            {
+                gStateCache.PSSetShader(material->pixelShader, nullptr, 0);
+                ++mNumStateChanges;
+            }
+
+            // Set the range of texture slots from the first to the last that changed in one call
+            unsigned int firstSlot = MAX_MATERIAL_TEXTURES, lastSlot = 0;
+            for (unsigned int slot = 0; slot < MAX_MATERIAL_TEXTURES; ++slot)
+            {
+                if (previous == nullptr || material->textures[slot] != previous->textures[slot])
+                {
+                    firstSlot = std::min(firstSlot, slot);
+                    lastSlot  = slot;
+                    ++mNumStateChanges;
+                }
+            }
+            if (firstSlot < MAX_MATERIAL_TEXTURES)
+            {
+                gStateCache.PSSetShaderResources(firstSlot, lastSlot - firstSlot + 1, &material->textures[firstSlot]);
+            }
+
+            if (previous == nullptr || material->sampler != previous->sampler)
+            {
+                gStateCache.PSSetSamplers(0, 1, &material->sampler);
+                ++mNumStateChanges;
+            }
+
+            if (previous == nullptr || material->blendMode != previous->blendMode)
+            {
+                gStateCache.OMSetBlendState(BlendState(material->blendMode), nullptr, 0xffffff);
+                ++mNumStateChanges;
+                if (previous == nullptr || DepthStencilState(material->blendMode) != DepthStencilState(previous->blendMode))
+                {
+                    gStateCache.OMSetDepthStencilState(DepthStencilState(material->blendMode), 0);
+                    ++mNumStateChanges;
+                }
+            }
+
+            if (previous == nullptr || material->cullBackFaces != previous->cullBackFaces)
+            {
+                gStateCache.RSSetState(material->cullBackFaces ? gCullBackState : gCullNoneState);
+                ++mNumStateChanges;
+            }
+
+            previous = material;
+        }
+
+        if (batch.instanced)
+        {
+            SetBatchConstants(batch);
+            ID3D11ShaderResourceView* instances = gInstanceBuffer.SRV();
+            gStateCache.VSSetShaderResources(0, 1, &instances);
+            draw.model->GetMesh()->RenderInstanced(draw.model->LOD(), batch.numItems);
+        }
+        else
+        {
+            draw.model->Render(batch.constants);
+        }
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Private members
+-----------------------------------------------------------------------------------------*/
+
+// Key bits for a material (blend mode, shader pair and material number), before they are shifted into place.
+// Built from the material's current settings, so materials can be changed between frames
+uint64_t RenderQueue::MaterialKey(const Material* material)
+{
+    const void* vertexShader = material->vertexShader;
+    const void* pixelShader  = material->pixelShader;
+
+    // Material numbers are given out in the order materials are first seen. The shader pair number is kept with them
+    // and only looked up again when the material is new or its shaders have changed
+    MaterialIds newIds = { static_cast<uint32_t>(mMaterialIds.size()), 0, nullptr, nullptr };
+    auto found = mMaterialIds.emplace(material, newIds);
+    MaterialIds& ids = found.first->second;
+    if (found.second || ids.vertexShader != vertexShader || ids.pixelShader != pixelShader)
+    {
+        auto shaderPair = std::make_pair(vertexShader, pixelShader);
+        ids.shaderPair   = mShaderPairIds.emplace(shaderPair, static_cast<uint32_t>(mShaderPairIds.size())).first->second;
+        ids.vertexShader = vertexShader;
+        ids.pixelShader  = pixelShader;
+    }
+
+    return (static_cast<uint64_t>(material->blendMode) << (SHADER_PAIR_BITS + MATERIAL_BITS)) |
+           (static_cast<uint64_t>(ids.shaderPair & ((1u << SHADER_PAIR_BITS) - 1)) << MATERIAL_BITS) |
+           (ids.material & ((1u << MATERIAL_BITS) - 1));
+}
+
+
+// Group the sorted draws into batches, writing the instance data and per-model constants for all of them. Both are
+// written in one go before anything is drawn, so each buffer is only mapped once. Draws that can't be written (e.g.
+// no Direct3D 11.1, or a buffer is full) are still drawn, updating the per-model constant buffer as they go
+void RenderQueue::BuildBatches()
+{
+    bool haveConstants = gPerModelConstantAllocator.Map();
+    bool haveInstances = gInstanceBuffer.Map();
+
+    uint32_t numItems = static_cast<uint32_t>(mSortItems.size());
+    uint32_t first = 0;
+    while (first < numItems)
+    {
+        Model*          model    = mDraws[mSortItems[first].draw].model;
+        const Material* material = mDraws[mSortItems[first].draw].material;
+
+        // Extend the batch over following draws with the same material, mesh and level of detail
+        uint32_t end = first + 1;
+        if (material->instancedVertexShader != nullptr)
+        {
+            while (end < numItems)
+            {
+                const Draw& next = mDraws[mSortItems[end].draw];
+                if (next.material != material || next.model->GetMesh() != model->GetMesh() ||
+                    next.model->LOD() != model->LOD())  break;
+                ++end;
+            }
+        }
+
+        Batch batch = { first, end - first, false, 0, {} };
+        InstanceData* instances = nullptr;
+        if (batch.numItems >= MIN_INSTANCES && haveInstances)
+        {
+            instances = gInstanceBuffer.Allocate(batch.numItems, batch.firstInstance);
+        }
+
+        if (instances != nullptr)
+        {
+            for (uint32_t i = 0; i < batch.numItems; ++i)
+            {
+                mDraws[mSortItems[first + i].draw].model->WriteInstance(instances[i]);
+            }
+            batch.instanced = true;
+            if (haveConstants)
+            {
+                PerModelConstants constants = gPerModelConstants;
+                constants.firstInstance = batch.firstInstance;
+                gPerModelConstantAllocator.Write(constants, batch.constants);
+            }
+            mBatches.push_back(batch);
+        }
+        else
+        {
+            // Draw each model on its own
+            for (uint32_t i = first; i < end; ++i)
+            {
+                Batch single = { i, 1, false, 0, {} };
+                if (haveConstants)  mDraws[mSortItems[i].draw].model->WriteConstants(gPerModelConstantAllocator, single.constants);
+                mBatches.push_back(single);
+            }
+        }
+
+        first = end;
+    }
+
+    if (haveInstances)  gInstanceBuffer.Unmap();
+    if (haveConstants)  gPerModelConstantAllocator.Unmap();
+}
+
+
+// Set the per-model constants for an instanced batch, which give the batch's place in gInstanceBuffer
+void RenderQueue::SetBatchConstants(const Batch& batch)
+{
+    const ConstantBufferRange& range = batch.constants;
+    if (range.buffer != nullptr)
+    {
+        gStateCache.VSSetConstantBuffers1(1, 1, &range.buffer, &range.firstConstant, &range.numConstants);
+        gStateCache.PSSetConstantBuffers1(1, 1, &range.buffer, &range.firstConstant, &range.numConstants);
+        return;
+    }
+
+    gPerModelConstants.firstInstance = batch.firstInstance;
+    UpdateConstantBuffer(gPerModelConstantBuffer, gPerModelConstants);
+    gStateCache.VSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
+    gStateCache.PSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
+}
@@ -0,0 +1,177 @@
+//--------------------------------------------------------------------------------------
+// Render queue - drawing visible models in a good order with few state changes
+//--------------------------------------------------------------------------------------
+// Each model has a material holding the shaders, textures, sampler and blending it is drawn with. Rather than
+// drawing models in a fixed order and setting every state by hand before each one, visible models are added to a
+// queue each frame. Each draw gets a 64-bit sort key and the queue is sorted by key with a radix sort, then drawn in
+// order, only changing the states that differ from the previous draw.
+//
+// The key packs the following, most significant first, so draws that share states end up next to each other:
+//   Opaque draws:      pass | blend mode | shader pair | material | mesh | depth
+//   Transparent draws: pass | inverted depth | blend mode | shader pair | material | mesh
+// All opaque draws come before blended draws. Opaque draws are grouped by state and then drawn nearest first within
+// each group, so the depth buffer rejects more hidden pixels. Blended draws must be drawn furthest first to blend
+// correctly, so depth comes before the states for them.
+//
+// Shader pairs, materials and meshes are numbered in the order they are first seen. The numbers only affect the
+// grouping, states are set by comparing the actual objects, so running out of numbers never draws anything wrongly
+//
+// Draws next to each other in sorted order with the same material, mesh and level of detail are drawn together as one
+// instanced draw if the material has an instanced vertex shader, with each model's world matrix and colour written
+// to gInstanceBuffer (see InstanceBuffer.h). Instanced models are drawn whole, ignoring any meshlet culling
+
+#include "Common.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "ConstantBufferAllocator.h"
+
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _RENDER_QUEUE_H_INCLUDED_
+#define _RENDER_QUEUE_H_INCLUDED_
+
+class Model;
+class Mesh;
+
+
+// How a material is blended with what has already been drawn. Blended materials use a read-only depth buffer
+enum class BlendMode : uint8_t
+{
+    Opaque,
+    Additive,
+    Multiplicative,
+    Alpha,
+};
+
+// Number of pixel shader texture slots a material sets, starting at slot 0
+const unsigned int MAX_MATERIAL_TEXTURES = 4;
+
+// Everything about how a model is drawn, apart from its geometry and transform (see Model::SetMaterial)
+// Textures are set in pixel shader slots 0 onwards, unused slots should be nullptr. The sampler is set in slot 0
+// Materials with an instanced vertex shader (one that reads gInstances, see InstanceBuffer.h) use it to draw batches
+// of models sharing a mesh in one draw. The pixel shader must work with both vertex shaders
+struct Material
+{
+    ID3D11VertexShader*       vertexShader;
+    ID3D11PixelShader*        pixelShader;
+    ID3D11ShaderResourceView* textures[MAX_MATERIAL_TEXTURES];
+    ID3D11SamplerState*       sampler;
+    BlendMode                 blendMode;
+    bool                      cullBackFaces;
+    ID3D11VertexShader*       instancedVertexShader; // nullptr (or left out) to always draw models one at a time
+};
+
+
+class RenderQueue
+{
+public:
+    //-------------------------------------
+    // Usage
+    //-------------------------------------
+
+    // Remove all draws, ready for a view with the given view matrix. Draws are sorted by the depth of their model's
+    // bounding sphere in the view, up to maxDepth (usually the camera's far clip distance)
+    void Clear(const CMatrix4x4& viewMatrix, float maxDepth);
+
+    // Add a draw of a model with its material. Does nothing if the model is not visible or has no material
+    void Add(Model* model);
+
+    // Add draws of each of the given models, as above
+    void Add(Model* const* models, std::size_t count);
+
+    // Sort the draws, call before Render
+    void Sort();
+
+    // Draw everything in the queue in sorted order. Shaders, textures, sampler and blend, depth and rasterizer states
+    // are changed as needed, all other GPU settings (e.g. per-frame constants) must have been set up already. The
+    // per-model constants for all draws are written in one batch with gPerModelConstantAllocator, and models that
+    // can be instanced are drawn in batches using gInstanceBuffer
+    void Render();
+
+
+    //-------------------------------------
+    // Statistics
+    //-------------------------------------
+
+    // Number of draws in the queue
+    std::size_t NumDraws() const  { return mDraws.size(); }
+
+    // Number of states set by the last call to Render, each texture slot counting as one state
+    std::size_t NumStateChanges() const  { return mNumStateChanges; }
+
+    // Number of separate draws made by the last call to Render, each instanced batch counting as one
+    std::size_t NumBatches() const  { return mBatches.size(); }
+
+
+    //-------------------------------------
+    // Private data / members
+    //-------------------------------------
+private:
+    struct Draw
+    {
+        Model*          model;
+        const Material* material;
+    };
+
+    // Key for sorting and index into mDraws
+    struct SortItem
+    {
+        uint64_t key;
+        uint32_t draw;
+    };
+
+    // Sorted draws drawn together, either a single model or an instanced batch of models sharing a material, mesh and
+    // level of detail. A null constant buffer range means the per-model constants are updated when it is drawn
+    struct Batch
+    {
+        uint32_t            firstItem;     // Index in mSortItems of the first draw
+        uint32_t            numItems;
+        bool                instanced;
+        UINT                firstInstance; // Index in gInstanceBuffer of the first instance, for instanced batches
+        ConstantBufferRange constants;
+    };
+
+    // Key bits for a material (blend mode, shader pair and material number), before they are shifted into place.
+    // Built from the material's current settings, so materials can be changed between frames
+    uint64_t MaterialKey(const Material* material);
+
+    // Group the sorted draws into batches, writing the instance data and per-model constants for all of them
+    void BuildBatches();
+
+    // Set the per-model constants for an instanced batch, which give the batch's place in gInstanceBuffer
+    void SetBatchConstants(const Batch& batch);
+
+    CMatrix4x4 mViewMatrix;
+    float      mMaxDepth = 1.0f;
+
+    std::vector<Draw>     mDraws;
+    std::vector<SortItem> mSortItems;
+    std::vector<SortItem> mSortTemp; // Working space for the radix sort
+
+    std::vector<Batch> mBatches; // Batches drawn by the last call to Render, in order
+
+    // Numbers given to each material seen so far, along with the number of the shader pair it used when last seen. The
+    // shader pair number is only looked up again if the material's shaders change
+    struct MaterialIds
+    {
+        uint32_t    material;
+        uint32_t    shaderPair;
+        const void* vertexShader;
+        const void* pixelShader;
+    };
+
+    // Numbers given to each shader pair, material and mesh seen so far, kept between frames
+    std::map<std::pair<const void*, const void*>, uint32_t> mShaderPairIds;
+    std::unordered_map<const Material*, MaterialIds>       mMaterialIds;
+    std::unordered_map<const Mesh*, uint32_t>              mMeshIds;
+
+    std::size_t mNumStateChanges = 0;
+};
+
+
+#endif //_RENDER_QUEUE_H_INCLUDED_
@@ -5,9 +5,20 @@
 
 #include "Scene.h"
 #include "Mesh.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+#include "AssetLoader.h"
 #include "Model.h"
+#include "TransformStorage.h"
+#include "SceneBVH.h"
+#include "Culling.h"
+#include "OcclusionCulling.h"
+#include "RenderQueue.h"
 #include "Camera.h"
 #include "State.h"
+#include "StateCache.h"
+#include "ConstantBufferAllocator.h"
+#include "InstanceBuffer.h"
 #include "Shader.h"
 #include "Input.h"
 #include "Common.h"
@@ -22,6 +33,8 @@
 
 #include <sstream>
 #include <memory>
+#include <vector>
+#include <cmath>
 
 
 //--------------------------------------------------------------------------------------
@@ -71,6 +84,57 @@ struct Light
 Light gLights[NUM_LIGHTS]; 
 
 
+// All models in the scene (including lights) in a tree for culling and other spatial queries, filled in InitScene
+SceneBVH gSceneBVH;
+
+// Layers that models are added to gSceneBVH with
+const uint32_t MAIN_LAYER          = 1; // Rendered in the main view
+const uint32_t SHADOW_CASTER_LAYER = 2; // Rendered into shadow maps
+
+// Shadow casters found for the light being rendered, kept to avoid allocating memory every frame
+std::vector<Model*> gShadowCasters;
+
+// Models visible in the main view, also kept to avoid allocating memory every frame
+std::vector<Model*> gVisibleModels;
+
+// Frustum of the main camera this frame, shadow casters are skipped if their shadow cannot reach it
+Frustum gCameraFrustum;
+
+// Number of models visible / culled in the main view last frame, shown in the window title
+std::size_t gNumVisibleModels = 0;
+std::size_t gNumCulledModels  = 0;
+
+// Number of meshlets culled from visible models in the main view last frame (see Meshlets.h), also shown in the title
+std::size_t gNumCulledMeshlets = 0;
+
+// Small depth buffer drawn on the CPU to find models hidden behind the ground and other occluders (see OcclusionCulling.h)
+OcclusionBuffer gOcclusionBuffer;
+
+// Number of models in the camera's frustum but hidden by occluders last frame, shown in the window title
+std::size_t gNumOccludedModels = 0;
+
+// Materials for the models in the main view, set up in InitScene. Models are drawn through gRenderQueue, which sorts
+// them to reduce state changes (see RenderQueue.h)
+Material gGroundMaterial;
+Material gSphereMaterial;
+Material gTeapotMaterial;
+Material gCubeMaterial;
+Material gTechMaterial;
+Material gNormMapFadeCubeMaterial;
+Material gLightMaterial;
+Material gGlassCubeMaterial;
+Material gSmokeMaterial;
+
+RenderQueue gRenderQueue;
+
+// Draws made by gRenderQueue last frame, each instanced batch counting as one, shown in the window title
+std::size_t gNumRenderQueueDraws = 0;
+
+// State change calls passed on to DirectX and dropped as redundant by gStateCache last frame, shown in the window title
+std::size_t gNumStateCallsIssued   = 0;
+std::size_t gNumStateCallsFiltered = 0;
+
+
 // Additional light information
 CVector3 gAmbientColour = { 0.2f, 0.2f, 0.3f }; // Background level of light (slightly bluish to match the far background, which is dark blue)
 float    gSpecularPower = 256; // Specular power controls shininess - same for all models in this app
@@ -83,6 +147,7 @@ const float gLightOrbitSpeed = 0.7f;
 
 // Spotlight data - using spotlights in this lab because shadow mapping needs to treat each light as a camera, which is easy with spotlights
 float gSpotlightConeAngle = 90.0f; // Spot light cone angle (degrees), like the FOV (field-of-view) of the spot light
+float gSpotlightRange = 10000.0f;  // Furthest distance lit by a spotlight, the far clip distance when rendering shadow maps
 
 // Lock FPS to monitor refresh rate, which will typically set it to 60fps. Press 'p' to toggle to full fps
 bool lockFPS = true;
@@ -120,56 +185,42 @@ ID3D11Buffer*     gPerFrameConstantBuffer; // The GPU buffer that will recieve t
 PerModelConstants gPerModelConstants;      // As above, but constant that change per-model (e.g. world matrix)
 ID3D11Buffer*     gPerModelConstantBuffer; // --"--
 
+// Per-model constants for all the models in a pass are written to this in one go, so each model only binds its part
+// rather than updating gPerModelConstantBuffer (see ConstantBufferAllocator.h). Room for 16384 models per pass
+ConstantBufferAllocator gPerModelConstantAllocator;
+const std::size_t PER_MODEL_CONSTANT_ALLOCATOR_SIZE = 16384 * 256;
+
+// World matrices and colours of models drawn as instanced batches by gRenderQueue (see InstanceBuffer.h)
+InstanceBuffer gInstanceBuffer;
+const std::size_t MAX_INSTANCES = 16384;
+
 
 
 //--------------------------------------------------------------------------------------
 // Textures
 //--------------------------------------------------------------------------------------
 
-// DirectX objects controlling textures used in this lab
-ID3D11Resource*           gSphereDiffuseSpecularMap     = nullptr; // This object represents the memory used by the texture on the GPU
-ID3D11ShaderResourceView* gSphereDiffuseSpecularMapSRV  = nullptr; // This object is used to give shaders access to the texture above (SRV = shader resource view)
-
-ID3D11Resource*           gTeapotDiffuseSpecularMap     = nullptr;
+// Shader resource views for the textures used in this lab (SRV = shader resource view), which give shaders access to
+// the texture memory on the GPU. They come from gTextureCache (see TextureCache.h), which shares textures loaded from
+// the same file, so release them with gTextureCache.Release rather than directly
+ID3D11ShaderResourceView* gSphereDiffuseSpecularMapSRV  = nullptr;
 ID3D11ShaderResourceView* gTeapotDiffuseSpecularMapSRV  = nullptr;
-
-ID3D11Resource*           gGroundDiffuseSpecularMap     = nullptr;
 ID3D11ShaderResourceView* gGroundDiffuseSpecularMapSRV  = nullptr;
-
-ID3D11Resource*           gLightDiffuseMap              = nullptr;
 ID3D11ShaderResourceView* gLightDiffuseMapSRV           = nullptr;
-
-ID3D11Resource*           gCubeTexture1Map              = nullptr;
 ID3D11ShaderResourceView* gCubeTexture1MapSRV           = nullptr;
-                           
-ID3D11Resource*           gCubeTexture2Map              = nullptr;
 ID3D11ShaderResourceView* gCubeTexture2MapSRV           = nullptr;
-
-ID3D11Resource*           gGlassCubeTextureMap          = nullptr;
 ID3D11ShaderResourceView* gGlassCubeTextureMapSRV       = nullptr;
-
-ID3D11Resource*           gSmokeMap                     = nullptr;
 ID3D11ShaderResourceView* gSmokeMapSRV                  = nullptr;
 
-ID3D11Resource*           gTrollDiffuseMap              = nullptr;
-ID3D11ShaderResourceView* gTrollDiffuseMapSRV           = nullptr;
-
 // Fade NormalMapping
-ID3D11Resource* gCubeDiffuseSpecularMap                 = nullptr; 
-ID3D11ShaderResourceView* gCubeDiffuseSpecularMapSRV    = nullptr; 
-ID3D11Resource* gCubeNormalMap                          = nullptr;
+ID3D11ShaderResourceView* gCubeDiffuseSpecularMapSRV    = nullptr;
 ID3D11ShaderResourceView* gCubeNormalMapSRV             = nullptr;
-
-ID3D11Resource* gCubeDiffuseSpecularMap2                = nullptr;
 ID3D11ShaderResourceView* gCubeDiffuseSpecularMapSRV2   = nullptr;
-ID3D11Resource* gCubeNormalMap2                         = nullptr;
 ID3D11ShaderResourceView* gCubeNormalMapSRV2            = nullptr;
 
 // Parallax Mapping
-ID3D11Resource*             gTechDiffuseSpecularMap      = nullptr;
-ID3D11ShaderResourceView*   gTechDiffuseSpecularMapSRV   = nullptr;
-ID3D11Resource*             gTechNormalHeightMap         = nullptr;
-ID3D11ShaderResourceView*   gTechNormalHeightMapSRV      = nullptr;
+ID3D11ShaderResourceView* gTechDiffuseSpecularMapSRV    = nullptr;
+ID3D11ShaderResourceView* gTechNormalHeightMapSRV       = nullptr;
 
 // Get "camera-like" view matrix for a spotlight
 CMatrix4x4 CalculateLightViewMatrix(int lightIndex)
@@ -180,7 +231,7 @@ CMatrix4x4 CalculateLightViewMatrix(int lightIndex)
 // Get "camera-like" projection matrix for a spotlight
 CMatrix4x4 CalculateLightProjectionMatrix(int lightIndex)
 {
-    return MakeProjectionMatrix(1.0f, ToRadians(gSpotlightConeAngle)); // Helper function in Utility\GraphicsHelpers.cpp
+    return MakeProjectionMatrix(1.0f, ToRadians(gSpotlightConeAngle), 0.1f, gSpotlightRange); // Helper function in Utility\GraphicsHelpers.cpp
 }
 
 
@@ -193,26 +244,45 @@ CMatrix4x4 CalculateLightProjectionMatrix(int lightIndex)
 bool InitGeometry()
 {
     // Load mesh geometry data, just like TL-Engine this doesn't create anything in the scene. Create a Model for that.
-    // IMPORTANT NOTE: Will only keep the first object from the mesh - multipart objects will have parts missing - see later lab for more robust loader
-    try 
-    {
-        gSphereMesh = new Mesh("Sphere.x");
-        gTeapotMesh = new Mesh("Teapot.x");
-        gGroundMesh = new Mesh("Hills.x");
-        gLightMesh  = new Mesh("Light.x");
-        gCubeMesh   = new Mesh("Cube.x");
+    // Multipart meshes keep every part as a sub-mesh, all drawn together (see Mesh.h)
+    // Meshes come from the mesh cache, so the cubes below share the same GPU data (one copy with tangents, one without)
+    // Meshes and textures are all requested first then loaded together on several threads (see AssetLoader.h)
+    AssetLoader loader;
+    loader.AddMesh("Sphere.x", false, &gSphereMesh);
+    loader.AddMesh("Teapot.x", false, &gTeapotMesh);
+    loader.AddMesh("Hills.x",  false, &gGroundMesh);
+    loader.AddMesh("Light.x",  false, &gLightMesh);
+    loader.AddMesh("Cube.x",   false, &gCubeMesh);
 
-        gGlassCubeMesh = new Mesh("Cube.x");
-        gSmokeMesh     = new Mesh("Portal.x");
+    loader.AddMesh("Cube.x",   false, &gGlassCubeMesh);
+    loader.AddMesh("Portal.x", false, &gSmokeMesh);
+
+    loader.AddMesh("Cube.x",   true,  &gNormMapFadeCubeMesh);
+    loader.AddMesh("Cube.x",   true,  &gTechMesh);
 
-        gNormMapFadeCubeMesh     = new Mesh("Cube.x", true);
-        gTechMesh                = new Mesh("Cube.x", true);
-    }
-    catch (std::runtime_error e)  // Constructors cannot return error messages so use exceptions to catch mesh errors (fairly standard approach this)
-    {
-        gLastError = e.what(); // This picks up the error message put in the exception (see Mesh.cpp)
-        return false;
-    }
+
+    //// Load / prepare textures on the GPU ////
+
+    // Load textures and create DirectX objects for them
+    // AddTexture requires you to pass a ID3D11ShaderResourceView* (e.g. &gCubeDiffuseMapSRV), which allows us to use the
+    // texture in shaders. The loader will fill in this pointer with usable data. The variables used here are globals found
+    // near the top of the file. Files used more than once (e.g. StoneDiffuseSpecular.dds) are only loaded once
+    loader.AddTexture("StoneDiffuseSpecular.dds",   &gSphereDiffuseSpecularMapSRV);
+    loader.AddTexture("CargoA.dds",                 &gTeapotDiffuseSpecularMapSRV);
+    loader.AddTexture("GrassDiffuseSpecular.dds",   &gGroundDiffuseSpecularMapSRV);
+    loader.AddTexture("Flare.jpg",                  &gLightDiffuseMapSRV);
+    loader.AddTexture("StoneDiffuseSpecular.dds",   &gCubeTexture1MapSRV);
+    loader.AddTexture("WoodDiffuseSpecular.dds",    &gCubeTexture2MapSRV);
+    loader.AddTexture("Glass.jpg",                  &gGlassCubeTextureMapSRV);
+    loader.AddTexture("Smoke.png",                  &gSmokeMapSRV);
+    loader.AddTexture("PatternDiffuseSpecular.dds", &gCubeDiffuseSpecularMapSRV);
+    loader.AddTexture("PatternNormal.dds",          &gCubeNormalMapSRV);
+    loader.AddTexture("WoodDiffuseSpecular.dds",    &gCubeDiffuseSpecularMapSRV2);
+    loader.AddTexture("WoodNormal.dds",             &gCubeNormalMapSRV2);
+    loader.AddTexture("TechDiffuseSpecular.dds",    &gTechDiffuseSpecularMapSRV);
+    loader.AddTexture("TechNormalHeight.dds",       &gTechNormalHeightMapSRV);
+
+    if (!loader.Load())  return false; // gLastError is set by the loader
 
 
     // Load the shaders required for the geometry we will use (see Shader.cpp / .h)
@@ -233,32 +303,8 @@ bool InitGeometry()
         gLastError = "Error creating constant buffers";
         return false;
     }
-
-
-    //// Load / prepare textures on the GPU ////
-
-    // Load textures and create DirectX objects for them
-    // The LoadTexture function requires you to pass a ID3D11Resource* (e.g. &gCubeDiffuseMap), which manages the GPU memory for the
-    // texture and also a ID3D11ShaderResourceView* (e.g. &gCubeDiffuseMapSRV), which allows us to use the texture in shaders
-    // The function will fill in these pointers with usable data. The variables used here are globals found near the top of the file.
-    if (!LoadTexture("StoneDiffuseSpecular.dds",    &gSphereDiffuseSpecularMap,     &gSphereDiffuseSpecularMapSRV)    ||
-        !LoadTexture("CargoA.dds",                  &gTeapotDiffuseSpecularMap,     &gTeapotDiffuseSpecularMapSRV)    ||
-        !LoadTexture("GrassDiffuseSpecular.dds",    &gGroundDiffuseSpecularMap,     &gGroundDiffuseSpecularMapSRV)    ||
-        !LoadTexture("Flare.jpg",                   &gLightDiffuseMap,              &gLightDiffuseMapSRV)             ||
-        !LoadTexture("StoneDiffuseSpecular.dds",    &gCubeTexture1Map,              &gCubeTexture1MapSRV)             || 
-        !LoadTexture("WoodDiffuseSpecular.dds",     &gCubeTexture2Map,              &gCubeTexture2MapSRV)             ||
-		!LoadTexture("Glass.jpg",                   &gGlassCubeTextureMap,          &gGlassCubeTextureMapSRV)         ||
-        !LoadTexture("Smoke.png",                   &gSmokeMap,                     &gSmokeMapSRV)                    ||
-        !LoadTexture("PatternDiffuseSpecular.dds",  &gCubeDiffuseSpecularMap,       &gCubeDiffuseSpecularMapSRV)      ||
-        !LoadTexture("PatternNormal.dds",           &gCubeNormalMap,                &gCubeNormalMapSRV)               ||
-        !LoadTexture("WoodDiffuseSpecular.dds",     &gCubeDiffuseSpecularMap2,      &gCubeDiffuseSpecularMapSRV2)     ||
-        !LoadTexture("WoodNormal.dds",              &gCubeNormalMap2,               &gCubeNormalMapSRV2)              ||
-		!LoadTexture("TechDiffuseSpecular.dds",     &gTechDiffuseSpecularMap,       &gTechDiffuseSpecularMapSRV)      ||
-        !LoadTexture("TechNormalHeight.dds",        &gTechNormalHeightMap,          &gTechNormalHeightMapSRV))
-    {
-        gLastError = "Error loading textures";
-        return false;
-    }
+    if (!gPerModelConstantAllocator.Create(PER_MODEL_CONSTANT_ALLOCATOR_SIZE))  return false;
+    if (!gInstanceBuffer.Create(MAX_INSTANCES))  return false;
 
 
 
@@ -338,6 +384,43 @@ bool InitScene()
     gSmoke = new Model(gSmokeMesh);
     gTech = new Model(gTechMesh);
     gNormMapFadeCube = new Model(gNormMapFadeCubeMesh);
+
+    // Materials - shaders, textures and blending for each model. Models that use the shadow map have it in slot 1
+    gGroundMaterial  = { gPixelLightingVertexShader, gPointLightPixelShader,    { gGroundDiffuseSpecularMapSRV, gShadowMap1SRV },
+                         gAnisotropic4xSampler, BlendMode::Opaque, true };
+    gSphereMaterial  = { gPixelLightingVertexShader, gWigglePixelShader,        { gSphereDiffuseSpecularMapSRV, gShadowMap1SRV },
+                         gAnisotropic4xSampler, BlendMode::Opaque, true };
+    gTeapotMaterial  = { gPixelLightingVertexShader, gPixelLightingPixelShader, { gTeapotDiffuseSpecularMapSRV, gShadowMap1SRV },
+                         gAnisotropic4xSampler, BlendMode::Opaque, true };
+    gCubeMaterial    = { gPixelLightingVertexShader, gFadeTexturePixelShader,   { gCubeTexture1MapSRV, gShadowMap1SRV, gCubeTexture2MapSRV },
+                         gAnisotropic4xSampler, BlendMode::Opaque, true };
+    gTechMaterial    = { gNormalMappingVertexShader, gParallaxMappingPixelShader, { gTechDiffuseSpecularMapSRV, gTechNormalHeightMapSRV },
+                         gAnisotropic4xSampler, BlendMode::Opaque, true };
+    gNormMapFadeCubeMaterial = { gNormalMappingVertexShader, gNormalMappingPixelShader,
+                                 { gCubeDiffuseSpecularMapSRV, gCubeNormalMapSRV, gCubeDiffuseSpecularMapSRV2, gCubeNormalMapSRV2 },
+                                 gAnisotropic4xSampler, BlendMode::Opaque, true };
+
+    // Blended models are drawn after opaque ones with a read-only depth buffer. Lights and smoke are seen from both sides
+    // Light models all share a mesh, so can be drawn as one instanced batch
+    gLightMaterial     = { gBasicTransformVertexShader, gLightModelPixelShader,    { gLightDiffuseMapSRV },
+                           gAnisotropic4xSampler, BlendMode::Additive, false, gBasicTransformInstancedVertexShader };
+    gGlassCubeMaterial = { gPixelLightingVertexShader,  gPixelLightingPixelShader, { gGlassCubeTextureMapSRV, gShadowMap1SRV },
+                           gAnisotropic4xSampler, BlendMode::Multiplicative, true };
+    gSmokeMaterial     = { gPixelLightingVertexShader,  gPixelLightingPixelShader, { gSmokeMapSRV, gShadowMap1SRV },
+                           gAnisotropic4xSampler, BlendMode::Alpha, false };
+
+    gGround->SetMaterial(&gGroundMaterial);
+    gSphere->SetMaterial(&gSphereMaterial);
+    gTeapot->SetMaterial(&gTeapotMaterial);
+    gCube->SetMaterial(&gCubeMaterial);
+    gTech->SetMaterial(&gTechMaterial);
+    gNormMapFadeCube->SetMaterial(&gNormMapFadeCubeMaterial);
+    gGlassCube->SetMaterial(&gGlassCubeMaterial);
+    gSmoke->SetMaterial(&gSmokeMaterial);
+
+    // Large solid models that hide the models behind them in the main view
+    gGround->SetOccluder(true);
+    gTeapot->SetOccluder(true);
 	
 	// Initial positions
 	gSphere->SetPosition({ 15, 5, 0 });
@@ -375,12 +458,17 @@ bool InitScene()
     for (int i = 0; i < NUM_LIGHTS; ++i)
     {
         gLights[i].model = new Model(gLightMesh);
+        gLights[i].model->SetMaterial(&gLightMaterial);
     }
 
+    // The first light orbits the sphere, so is attached to it. Its position and scale are then relative to the sphere, so
+    // are divided by the sphere's scale to keep the light the same size and orbit distance in the world
     gLights[0].colour = { 0.8f, 0.8f, 1.0f };
     gLights[0].strength = 10;
-    gLights[0].model->SetPosition({ 30, 20, 0 });
-    gLights[0].model->SetScale(pow(gLights[0].strength, 0.7f)); // Convert light strength into a nice value for the scale of the light - equation is ad-hoc.
+    float sphereScale = gSphere->Scale().x;
+    gLights[0].model->SetParent(gSphere);
+    gLights[0].model->SetPosition(CVector3{ gLightOrbit, 10, 0 } * (1 / sphereScale));
+    gLights[0].model->SetScale(pow(gLights[0].strength, 0.7f) / sphereScale); // Convert light strength into a nice value for the scale of the light - equation is ad-hoc.
 	gLights[0].model->FaceTarget(gSphere->Position());
 
     gLights[1].colour = { 1.0f, 0.8f, 0.2f };
@@ -395,6 +483,19 @@ bool InitScene()
     gLights[2].model->SetScale(pow(gLights[2].strength, 0.7f));
     gLights[2].model->FaceTarget({ gSphere->Position() });
 
+    for (auto model : { gGround, gSphere, gTeapot })
+    {
+        gSceneBVH.Add(model, MAIN_LAYER | SHADOW_CASTER_LAYER);
+    }
+    for (auto model : { gCube, gGlassCube, gSmoke, gTech, gNormMapFadeCube })
+    {
+        gSceneBVH.Add(model, MAIN_LAYER);
+    }
+    for (int i = 0; i < NUM_LIGHTS; ++i)
+    {
+        gSceneBVH.Add(gLights[i].model, MAIN_LAYER);
+    }
+
     //// Set up camera ////
 
     gCamera = new Camera();
@@ -414,21 +515,32 @@ void ReleaseResources()
     if (gShadowMap1SRV)           gShadowMap1SRV->Release();
     if (gShadowMap1Texture)       gShadowMap1Texture->Release();
 
-    if (gLightDiffuseMapSRV)             gLightDiffuseMapSRV->Release();
-    if (gLightDiffuseMap)                gLightDiffuseMap->Release();
-    if (gGroundDiffuseSpecularMapSRV)    gGroundDiffuseSpecularMapSRV->Release();
-    if (gGroundDiffuseSpecularMap)       gGroundDiffuseSpecularMap->Release();
-    if (gTeapotDiffuseSpecularMapSRV)     gTeapotDiffuseSpecularMapSRV->Release();
-    if (gTeapotDiffuseSpecularMap)        gTeapotDiffuseSpecularMap->Release();
-    if (gSphereDiffuseSpecularMapSRV) gSphereDiffuseSpecularMapSRV->Release();
-    if (gSphereDiffuseSpecularMap)    gSphereDiffuseSpecularMap->Release();
-
+    gTextureCache.Release(gLightDiffuseMapSRV);             gLightDiffuseMapSRV             = nullptr;
+    gTextureCache.Release(gGroundDiffuseSpecularMapSRV);    gGroundDiffuseSpecularMapSRV    = nullptr;
+    gTextureCache.Release(gTeapotDiffuseSpecularMapSRV);    gTeapotDiffuseSpecularMapSRV    = nullptr;
+    gTextureCache.Release(gSphereDiffuseSpecularMapSRV);    gSphereDiffuseSpecularMapSRV    = nullptr;
+    gTextureCache.Release(gCubeTexture1MapSRV);             gCubeTexture1MapSRV             = nullptr;
+    gTextureCache.Release(gCubeTexture2MapSRV);             gCubeTexture2MapSRV             = nullptr;
+    gTextureCache.Release(gGlassCubeTextureMapSRV);         gGlassCubeTextureMapSRV         = nullptr;
+    gTextureCache.Release(gSmokeMapSRV);                    gSmokeMapSRV                    = nullptr;
+    gTextureCache.Release(gCubeDiffuseSpecularMapSRV);      gCubeDiffuseSpecularMapSRV      = nullptr;
+    gTextureCache.Release(gCubeNormalMapSRV);               gCubeNormalMapSRV               = nullptr;
+    gTextureCache.Release(gCubeDiffuseSpecularMapSRV2);     gCubeDiffuseSpecularMapSRV2     = nullptr;
+    gTextureCache.Release(gCubeNormalMapSRV2);              gCubeNormalMapSRV2              = nullptr;
+    gTextureCache.Release(gTechDiffuseSpecularMapSRV);      gTechDiffuseSpecularMapSRV      = nullptr;
+    gTextureCache.Release(gTechNormalHeightMapSRV);         gTechNormalHeightMapSRV         = nullptr;
+
+    gInstanceBuffer.Release();
+    gPerModelConstantAllocator.Release();
     if (gPerModelConstantBuffer)  gPerModelConstantBuffer->Release();
     if (gPerFrameConstantBuffer)  gPerFrameConstantBuffer->Release();
 
     ReleaseShaders();
 
     // See note in InitGeometry about why we're not using unique_ptr and having to manually delete
+    gSceneBVH.Clear();
+    gShadowCasters.clear();
+    gVisibleModels.clear();
     for (int i = 0; i < NUM_LIGHTS; ++i)
     {
         delete gLights[i].model;  gLights[i].model = nullptr;
@@ -443,15 +555,15 @@ void ReleaseResources()
     delete gTech;               gTech               = nullptr;
     delete gNormMapFadeCube;    gNormMapFadeCube    = nullptr;
 	
-    delete gLightMesh;              gLightMesh              = nullptr;
-    delete gGroundMesh;             gGroundMesh             = nullptr;
-    delete gTeapotMesh;             gTeapotMesh             = nullptr;
-    delete gSphereMesh;             gSphereMesh             = nullptr;
-    delete gCubeMesh;               gCubeMesh               = nullptr;
-    delete gGlassCubeMesh;          gGlassCubeMesh          = nullptr;
-    delete gSmokeMesh;              gSmokeMesh              = nullptr;
-    delete gTechMesh;               gTechMesh               = nullptr;
-    delete gNormMapFadeCubeMesh;    gNormMapFadeCubeMesh    = nullptr;
+    gMeshCache.Release(gLightMesh);             gLightMesh              = nullptr;
+    gMeshCache.Release(gGroundMesh);            gGroundMesh             = nullptr;
+    gMeshCache.Release(gTeapotMesh);            gTeapotMesh             = nullptr;
+    gMeshCache.Release(gSphereMesh);            gSphereMesh             = nullptr;
+    gMeshCache.Release(gCubeMesh);              gCubeMesh               = nullptr;
+    gMeshCache.Release(gGlassCubeMesh);         gGlassCubeMesh          = nullptr;
+    gMeshCache.Release(gSmokeMesh);             gSmokeMesh              = nullptr;
+    gMeshCache.Release(gTechMesh);              gTechMesh               = nullptr;
+    gMeshCache.Release(gNormMapFadeCubeMesh);   gNormMapFadeCubeMesh    = nullptr;
 }
 
 
@@ -470,25 +582,32 @@ void RenderDepthBufferFromLight(int lightIndex)
     UpdateConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
 
     // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
-    gD3DContext->PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
+    gStateCache.VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
+    gStateCache.PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
+
+    // Skip casters outside the light's frustum and cone, or whose shadows cannot reach the camera's view
+    const CMatrix4x4& lightMatrix = gLights[lightIndex].model->WorldMatrix();
+    Cone lightCone = { lightMatrix.GetPosition(), Normalise(lightMatrix.GetZAxis()), ToRadians(gSpotlightConeAngle / 2), gSpotlightRange };
+    Frustum lightFrustum = FrustumFromMatrix(gPerFrameConstants.viewProjectionMatrix);
+    CullShadowCasters(lightFrustum, lightCone, gCameraFrustum, gSceneBVH, SHADOW_CASTER_LAYER, gShadowCasters);
+
+    // Then skip the parts of casters outside the light's frustum or facing away from the light
+    CullMeshlets(lightFrustum, lightCone.apex, gShadowCasters.data(), gShadowCasters.size());
 
 
     //// Only render models that cast shadows ////
 
     // Use special depth-only rendering shaders
-    gD3DContext->VSSetShader(gBasicTransformVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gDepthOnlyPixelShader,       nullptr, 0);
+    gStateCache.VSSetShader(gBasicTransformVertexShader, nullptr, 0);
+    gStateCache.PSSetShader(gDepthOnlyPixelShader,       nullptr, 0);
     
     // States - no blending, normal depth buffer and culling
-    gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-    gD3DContext->RSSetState(gCullBackState);
+    gStateCache.OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
+    gStateCache.OMSetDepthStencilState(gUseDepthBufferState, 0);
+    gStateCache.RSSetState(gCullBackState);
 
     // Render models - no state changes required between each object in this situation (no textures used in this step)
-    gGround->Render();
-    gSphere->Render();
-    gTeapot->Render();
+    Model::RenderModels(gShadowCasters.data(), gShadowCasters.size());
 }
 
 
@@ -505,111 +624,45 @@ void RenderSceneFromCamera(Camera* camera)
     UpdateConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
 
     // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
-    gD3DContext->PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
-
-
-    //// Render lit models ////
-
-    // Select which shaders to use next
-    gD3DContext->VSSetShader(gPixelLightingVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gPointLightPixelShader, nullptr, 0);
-
-    // States - no blending, normal depth buffer and culling
-    gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-    gD3DContext->RSSetState(gCullBackState);
-
-    // Select the approriate textures and sampler to use in the pixel shader
-    gD3DContext->PSSetShaderResources(0, 1, &gGroundDiffuseSpecularMapSRV); // First parameter must match texture slot number in the shader
-    gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);
-
-    // Render model - it will update the model's world matrix and send it to the GPU in a constant buffer, then it will call
-    // the Mesh render function, which will set up vertex & index buffer before finally calling Draw on the GPU
-    gGround->Render();
-
-	// Direction light to only lit up the side of the object that are facing the light source
-    gD3DContext->VSSetShader(gPixelLightingVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gWigglePixelShader, nullptr, 0);
-	
-    // Render other lit models, only change textures for each onee
-    gD3DContext->PSSetShaderResources(0, 1, &gSphereDiffuseSpecularMapSRV); 
-    gSphere->Render();
-
-    gD3DContext->VSSetShader(gPixelLightingVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gPixelLightingPixelShader, nullptr, 0);
-	
-    gD3DContext->PSSetShaderResources(0, 1, &gTeapotDiffuseSpecularMapSRV);
-    gTeapot->Render();
-
-    gD3DContext->PSSetShader(gFadeTexturePixelShader, nullptr, 0);
-	
-    gD3DContext->PSSetShaderResources(0, 1, &gCubeTexture1MapSRV);
-    gD3DContext->PSSetShaderResources(2, 1, &gCubeTexture2MapSRV);
-    gCube->Render();
-    
-    gD3DContext->VSSetShader(gNormalMappingVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gParallaxMappingPixelShader, nullptr, 0);
-
-    gD3DContext->PSSetShaderResources(0, 1, &gTechDiffuseSpecularMapSRV);
-    gD3DContext->PSSetShaderResources(1, 1, &gTechNormalHeightMapSRV);
-    gTech->Render();
-    
-    gD3DContext->VSSetShader(gNormalMappingVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gNormalMappingPixelShader, nullptr, 0);
-
-	
-    //gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);
-    gD3DContext->PSSetShaderResources(0, 1, &gCubeDiffuseSpecularMapSRV);
-    gD3DContext->PSSetShaderResources(1, 1, &gCubeNormalMapSRV);
-    gD3DContext->PSSetShaderResources(2, 1, &gCubeDiffuseSpecularMapSRV2);
-    gD3DContext->PSSetShaderResources(3, 1, &gCubeNormalMapSRV2);
-    gNormMapFadeCube->Render();
-	
-    //// Render lights ////
+    gStateCache.VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
+    gStateCache.PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
+
+    // Skip models outside the camera's view - Model::Render does nothing for culled models
+    Frustum frustum = FrustumFromMatrix(gPerFrameConstants.viewProjectionMatrix);
+    gNumVisibleModels = CullModels(frustum, gSceneBVH, gVisibleModels);
+    gNumCulledModels  = gSceneBVH.Models().size() - gNumVisibleModels;
+
+    // Skip models in the view that are hidden behind the ground and other occluders
+    gNumOccludedModels = CullOccludedModels(gOcclusionBuffer, gPerFrameConstants.viewProjectionMatrix,
+                                            gSceneBVH.Models().data(), gSceneBVH.Models().size());
+    gNumVisibleModels -= gNumOccludedModels;
+
+    // Choose simpler versions of visible models that are far away (see Model::SelectLOD)
+    float pixelsPerUnit = gViewportWidth / (2 * std::tan(camera->FOV() / 2));
+    for (auto model : gSceneBVH.Models())
+    {
+        if (model->IsVisible())  model->SelectLOD(camera->Position(), pixelsPerUnit);
+    }
 
-    // Select which shaders to use next
-    gD3DContext->VSSetShader(gBasicTransformVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gLightModelPixelShader,      nullptr, 0);
+    // Skip the parts of visible models at full detail that are outside the view or facing away (see Meshlets.h)
+    gNumCulledMeshlets = CullMeshlets(frustum, camera->Position(), gSceneBVH.Models().data(), gSceneBVH.Models().size());
 
-    // Select the texture and sampler to use in the pixel shader
-    gD3DContext->PSSetShaderResources(0, 1, &gLightDiffuseMapSRV); // First parameter must match texture slot number in the shader
-    gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);
 
-    // States - additive blending, read-only depth buffer and no culling (standard set-up for blending
-    gD3DContext->OMSetBlendState(gAdditiveBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gDepthReadOnlyState, 0);
-    gD3DContext->RSSetState(gCullNoneState);
+    //// Render models ////
 
-    // Render all the lights in the array
+    // Light models are tinted to match the colour of their light
     for (int i = 0; i < NUM_LIGHTS; ++i)
     {
-        gPerModelConstants.objectColour = gLights[i].colour; // Set any per-model constants apart from the world matrix just before calling render (light colour here)
-        gLights[i].model->Render();
+        gLights[i].model->SetColour(gLights[i].colour);
     }
 
-	
-    gD3DContext->OMSetBlendState(gMultiplicativeBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gDepthReadOnlyState, 0);
-    gD3DContext->RSSetState(gCullNoneState);
-
-    gD3DContext->VSSetShader(gPixelLightingVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gPixelLightingPixelShader, nullptr, 0);
-	
-    gD3DContext->PSSetShaderResources(0, 1, &gGlassCubeTextureMapSRV);
-    gD3DContext->RSSetState(gCullBackState);
-    gGlassCube->Render();
-
-
-    gD3DContext->OMSetBlendState(gAlphaBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gDepthReadOnlyState, 0);
-    gD3DContext->RSSetState(gCullNoneState);
-
-    gD3DContext->VSSetShader(gPixelLightingVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gPixelLightingPixelShader, nullptr, 0);
-
-    gD3DContext->PSSetShaderResources(0, 1, &gSmokeMapSRV);
-    gSmoke->Render();
+    // Visible models are drawn in an order that reduces state changes, nearest first for opaque models and furthest
+    // first for blended models. Each model's material sets its shaders, textures and states (see RenderQueue.h)
+    gRenderQueue.Clear(gPerFrameConstants.viewMatrix, camera->FarClip());
+    gRenderQueue.Add(gSceneBVH.Models().data(), gSceneBVH.Models().size());
+    gRenderQueue.Sort();
+    gRenderQueue.Render();
+    gNumRenderQueueDraws = gRenderQueue.NumBatches();
 }
 
 
@@ -619,12 +672,17 @@ void RenderSceneFromCamera(Camera* camera)
 // Then it renders the main scene using the portal texture on a model.
 void RenderScene()
 {
+    // Rebuild the world matrices of all models that moved this frame in one batch, then fit the scene tree around them
+    gTransforms.UpdateWorldMatrices();
+    gSceneBVH.Update();
+
+
     //// Common settings ////
 
     // Set up the light information in the constant buffer
     // Don't send to the GPU yet, the function RenderSceneFromCamera will do that
     gPerFrameConstants.light1Colour   = gLights[0].colour * gLights[0].strength;
-    gPerFrameConstants.light1Position = gLights[0].model->Position();
+    gPerFrameConstants.light1Position = gLights[0].model->WorldMatrix().GetPosition(); // Position() is relative to the sphere it is attached to
     gPerFrameConstants.light1Facing   = Normalise(gLights[0].model->WorldMatrix().GetZAxis());    // Additional lighting information for spotlights
     gPerFrameConstants.light1CosHalfAngle = cos(ToRadians(gSpotlightConeAngle / 2)); // --"--
     gPerFrameConstants.light1ViewMatrix       = CalculateLightViewMatrix(0);         // Calculate camera-like matrices for...
@@ -649,6 +707,9 @@ void RenderScene()
     gPerFrameConstants.cameraPosition = gCamera->Position();
    
     gPerFrameConstants.parallaxDepth = 0.1f;
+
+    // Shadow passes need the camera's frustum before the camera's view is rendered
+    gCameraFrustum = FrustumFromMatrix(gCamera->ViewProjectionMatrix());
 	
     //***************************************//
     //// Render from light's point of view ////
@@ -667,7 +728,7 @@ void RenderScene()
 
     // Select the shadow map texture as the current depth buffer. We will not be rendering any pixel colours
     // Also clear the the shadow map depth buffer to the far distance
-    gD3DContext->OMSetRenderTargets(0, nullptr, gShadowMap1DepthStencil);
+    gStateCache.OMSetRenderTargets(0, nullptr, gShadowMap1DepthStencil);
     gD3DContext->ClearDepthStencilView(gShadowMap1DepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
 
     // Render the scene from the point of view of light 1 (only depth values written)
@@ -681,7 +742,7 @@ void RenderScene()
 
     // Set the back buffer as the target for rendering and select the main depth buffer.
     // When finished the back buffer is sent to the "front buffer" - which is the monitor.
-    gD3DContext->OMSetRenderTargets(1, &gBackBufferRenderTarget, gDepthStencil);
+    gStateCache.OMSetRenderTargets(1, &gBackBufferRenderTarget, gDepthStencil);
 
     // Clear the back buffer to a fixed colour and the depth buffer to the far distance
     gD3DContext->ClearRenderTargetView(gBackBufferRenderTarget, &gBackgroundColor.r);
@@ -696,19 +757,17 @@ void RenderScene()
     vp.TopLeftY = 0;
     gD3DContext->RSSetViewports(1, &vp);
 
-    // Set shadow maps in shaders
-    // First parameter is the "slot", must match the Texture2D declaration in the HLSL code
-    // In this app the diffuse map uses slot 0, the shadow maps use slots 1 onwards. If we were using other maps (e.g. normal map) then
-    // we might arrange things differently
-    gD3DContext->PSSetShaderResources(1, 1, &gShadowMap1SRV);
-    gD3DContext->PSSetSamplers(1, 1, &gPointSampler);
+    // Set the shadow map sampler in shaders
+    // First parameter is the "slot", must match the SamplerState declaration in the HLSL code
+    // The shadow map itself is in slot 1 of each material whose shader uses it (see InitScene), the render queue sets it
+    gStateCache.PSSetSamplers(1, 1, &gPointSampler);
 
     // Render the scene for the main window
     RenderSceneFromCamera(gCamera);
 
     // Unbind shadow maps from shaders - prevents warnings from DirectX when we try to render to the shadow maps again next frame
     ID3D11ShaderResourceView* nullView = nullptr;
-    gD3DContext->PSSetShaderResources(1, 1, &nullView);
+    gStateCache.PSSetShaderResources(1, 1, &nullView);
 
 
     //*****************************//
@@ -724,6 +783,11 @@ void RenderScene()
     // When drawing to the off-screen back buffer is complete, we "present" the image to the front buffer (the screen)
     // Set first parameter to 1 to lock to vsync (typically 60fps)
     gSwapChain->Present(lockFPS ? 1 : 0, 0);
+
+    // Keep this frame's state change counts for display and start counting again
+    gNumStateCallsIssued   = gStateCache.NumIssued();
+    gNumStateCallsFiltered = gStateCache.NumFiltered();
+    gStateCache.ResetCounts();
 }
 
 
@@ -752,9 +816,10 @@ void UpdateScene(float frameTime)
 	gSphere->Control(frameTime, Key_I, Key_K, Key_J, Key_L, Key_U, Key_O, Key_Period, Key_Comma );
 
     // Orbit the light - a bit of a cheat with the static variable [ask the tutor if you want to know what this is]
+    // The light is attached to the sphere (see InitScene), so it follows the sphere and only its orbit is set here
 	static float rotate = 0.0f;
     static bool go = true;
-	gLights[0].model->SetPosition( gSphere->Position() + CVector3{ cos(rotate) * gLightOrbit, 10, sin(rotate) * gLightOrbit } );
+	gLights[0].model->SetPosition( CVector3{ cos(rotate) * gLightOrbit, 10, sin(rotate) * gLightOrbit } * (1 / gSphere->Scale().x) );
 	gLights[0].model->FaceTarget(gSphere->Position());
     if (go)  rotate -= gLightOrbitSpeed * frameTime;
     if (KeyHit(Key_1))  go = !go;
@@ -780,7 +845,14 @@ void UpdateScene(float frameTime)
         frameTimeMs.precision(2);
         frameTimeMs << std::fixed << avgFrameTime * 1000;
         std::string windowTitle = "CO2409 Week 20: Shadow Mapping - Frame Time: " + frameTimeMs.str() +
-                                  "ms, FPS: " + std::to_string(static_cast<int>(1 / avgFrameTime + 0.5f));
+                                  "ms, FPS: " + std::to_string(static_cast<int>(1 / avgFrameTime + 0.5f)) +
+                                  ", Models visible: " + std::to_string(gNumVisibleModels) +
+                                  ", culled: " + std::to_string(gNumCulledModels) +
+                                  ", occluded: " + std::to_string(gNumOccludedModels) +
+                                  ", Meshlets culled: " + std::to_string(gNumCulledMeshlets) +
+                                  ", Draws: " + std::to_string(gNumRenderQueueDraws) +
+                                  ", State calls: " + std::to_string(gNumStateCallsIssued) +
+                                  ", filtered: " + std::to_string(gNumStateCallsFiltered);
         SetWindowTextA(gHWnd, windowTitle.c_str());
         totalFrameTime = 0;
         frameCount = 0;
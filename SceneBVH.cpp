@@ -0,0 +1,492 @@
+//--------------------------------------------------------------------------------------
+// Bounding volume hierarchy (BVH) over the models in a scene, used for spatial queries
+//--------------------------------------------------------------------------------------
+// The tree is built top-down, splitting each group of models in half along the longest axis of their centres.
+// Nodes are stored in one array with children after their parents, so refitting can work back through the
+// array and always update children before their parent.
+
+#include "SceneBVH.h"
+#include "Model.h"
+#include "Mesh.h"
+
+#include <algorithm>
+
+
+namespace
+{
+    // Most models in a leaf. Fewer makes queries test more nodes, more makes them test more models
+    const uint32_t MAX_LEAF_MODELS = 4;
+
+    // Rebuild the tree when refitting has made the total node surface area this much larger than when it was built
+    const float REBUILD_COST_RATIO = 1.5f;
+
+    // Deepest tree that queries can search. The tree is balanced, so this allows far more models than can be used
+    const int MAX_DEPTH = 64;
+
+
+    // Move a ray into the space of a model given the inverse of its world matrix. The direction is not normalised, so
+    // any point on the ray is the same distance along it in both spaces
+    Ray TransformRay(const Ray& ray, const CMatrix4x4& m)
+    {
+        const CVector3& o = ray.origin;
+        const CVector3& d = ray.direction;
+        return { { o.x * m.e00 + o.y * m.e10 + o.z * m.e20 + m.e30,
+                   o.x * m.e01 + o.y * m.e11 + o.z * m.e21 + m.e31,
+                   o.x * m.e02 + o.y * m.e12 + o.z * m.e22 + m.e32 },
+                 { d.x * m.e00 + d.y * m.e10 + d.z * m.e20,
+                   d.x * m.e01 + d.y * m.e11 + d.z * m.e21,
+                   d.x * m.e02 + d.y * m.e12 + d.z * m.e22 } };
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Construction / Usage
+-----------------------------------------------------------------------------------------*/
+
+// Add a model to the tree, with layer bits that can be used to limit queries. The tree is rebuilt on the next
+// Update, queries will not find the model until then
+void SceneBVH::Add(Model* model, uint32_t layers)
+{
+    auto found = mModelIndices.find(model);
+    if (found != mModelIndices.end())
+    {
+        mLayers[found->second] = layers;
+    }
+    else
+    {
+        mModelIndices[model] = static_cast<uint32_t>(mModels.size());
+        mModels.push_back(model);
+        mBoxes.push_back({});
+        mVersions.push_back(0);
+        mLayers.push_back(layers);
+        mLeaves.push_back(0);
+    }
+    mRebuild = true;
+}
+
+
+// Remove a model from the tree, the tree is rebuilt immediately. Use Clear to remove everything
+void SceneBVH::Remove(Model* model)
+{
+    auto found = mModelIndices.find(model);
+    if (found == mModelIndices.end())  return;
+
+    // Move the last model into the removed one's place
+    uint32_t i    = found->second;
+    uint32_t last = static_cast<uint32_t>(mModels.size() - 1);
+    mModelIndices.erase(found);
+    if (i != last)
+    {
+        mModels[i]   = mModels[last];
+        mBoxes[i]    = mBoxes[last];
+        mVersions[i] = mVersions[last];
+        mLayers[i]   = mLayers[last];
+        mModelIndices[mModels[i]] = i;
+    }
+    mModels.pop_back();
+    mBoxes.pop_back();
+    mVersions.pop_back();
+    mLayers.pop_back();
+    mLeaves.pop_back();
+
+    // Model indexes in the tree are now wrong
+    Rebuild();
+}
+
+
+// Remove all models
+void SceneBVH::Clear()
+{
+    mModels.clear();
+    mBoxes.clear();
+    mVersions.clear();
+    mLayers.clear();
+    mLeaves.clear();
+    mModelIndices.clear();
+    mNodes.clear();
+    mItemOrder.clear();
+    mNodeChanged.clear();
+    mRebuild = false;
+    mBuiltCost = mCost = 0.0f;
+}
+
+
+// Bring the tree up to date with models that have moved, call once per frame after gTransforms.UpdateWorldMatrices
+// Rebuilds the tree if models have been added or removed or it has become too untidy
+void SceneBVH::Update()
+{
+    if (mRebuild)
+    {
+        Rebuild();
+        return;
+    }
+
+    // Update the boxes of models whose world matrix has changed, and flag their leaves
+    bool changed = false;
+    for (std::size_t i = 0; i < mModels.size(); ++i)
+    {
+        uint32_t version = gTransforms.WorldVersion(mModels[i]->Transform());
+        if (version != mVersions[i])
+        {
+            mBoxes[i] = mModels[i]->WorldBoundingBox();
+            mVersions[i] = version;
+            mNodeChanged[mLeaves[i]] = 1;
+            changed = true;
+        }
+    }
+    if (!changed)  return;
+
+    // Refit flagged nodes, working backwards so children are done before parents. Each flags its parent in turn
+    for (std::size_t n = mNodes.size(); n-- > 0; )
+    {
+        if (!mNodeChanged[n])  continue;
+        mNodeChanged[n] = 0;
+
+        Node& node = mNodes[n];
+        float oldArea = SurfaceArea(node.box);
+        if (node.count > 0)
+        {
+            node.box = mBoxes[mItemOrder[node.first]];
+            for (uint32_t i = 1; i < node.count; ++i)  node.box = MergeBoxes(node.box, mBoxes[mItemOrder[node.first + i]]);
+        }
+        else
+        {
+            node.box = MergeBoxes(mNodes[node.first].box, mNodes[node.first + 1].box);
+        }
+        mCost += SurfaceArea(node.box) - oldArea;
+
+        if (node.parent != UINT32_MAX)  mNodeChanged[node.parent] = 1;
+    }
+
+    // Models that have moved far apart make large boxes that many queries will enter, a fresh tree groups them better
+    if (mCost > mBuiltCost * REBUILD_COST_RATIO)  Build();
+}
+
+
+// Recalculate the bounding boxes of all models and build the whole tree from scratch
+void SceneBVH::Rebuild()
+{
+    for (std::size_t i = 0; i < mModels.size(); ++i)
+    {
+        mBoxes[i] = mModels[i]->WorldBoundingBox(); // Brings the world matrix up to date, so get the version after
+        mVersions[i] = gTransforms.WorldVersion(mModels[i]->Transform());
+    }
+    Build();
+}
+
+
+// Build the whole tree from scratch using the current bounding boxes
+void SceneBVH::Build()
+{
+    mRebuild = false;
+    mNodes.clear();
+    mItemOrder.resize(mModels.size());
+    for (uint32_t i = 0; i < mItemOrder.size(); ++i)  mItemOrder[i] = i;
+
+    if (!mModels.empty())
+    {
+        mNodes.reserve(2 * mModels.size()); // Upper limit on the number of nodes
+        mNodes.push_back({ {}, 0, 0, UINT32_MAX, 0 });
+        BuildNode(0, 0, static_cast<uint32_t>(mModels.size()));
+    }
+    mNodeChanged.assign(mNodes.size(), 0);
+
+    mCost = 0.0f;
+    for (auto& node : mNodes)  mCost += SurfaceArea(node.box);
+    mBuiltCost = mCost;
+}
+
+
+// Create nodes for the items in mItemOrder[first] to mItemOrder[first + count - 1] below the given node
+void SceneBVH::BuildNode(uint32_t node, uint32_t first, uint32_t count)
+{
+    // Box and layers of all the models, and a box around their centres to choose a split
+    AABB box = mBoxes[mItemOrder[first]];
+    CVector3 centre = (box.minPoint + box.maxPoint) * 0.5f;
+    AABB centres = { centre, centre };
+    uint32_t layers = 0;
+    for (uint32_t i = first; i < first + count; ++i)
+    {
+        const AABB& itemBox = mBoxes[mItemOrder[i]];
+        box = MergeBoxes(box, itemBox);
+        centre = (itemBox.minPoint + itemBox.maxPoint) * 0.5f;
+        centres = MergeBoxes(centres, { centre, centre });
+        layers |= mLayers[mItemOrder[i]];
+    }
+    mNodes[node].box = box;
+    mNodes[node].layers = layers;
+
+    if (count <= MAX_LEAF_MODELS)
+    {
+        mNodes[node].first = first;
+        mNodes[node].count = count;
+        for (uint32_t i = first; i < first + count; ++i)  mLeaves[mItemOrder[i]] = node;
+        return;
+    }
+
+    // Split the models in half along the longest axis of their centres
+    CVector3 size = centres.maxPoint - centres.minPoint;
+    int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+    uint32_t half = count / 2;
+    auto itemOrder = mItemOrder.begin() + first;
+    std::nth_element(itemOrder, itemOrder + half, itemOrder + count, [&](uint32_t a, uint32_t b)
+    {
+        return (&mBoxes[a].minPoint.x)[axis] + (&mBoxes[a].maxPoint.x)[axis] <
+               (&mBoxes[b].minPoint.x)[axis] + (&mBoxes[b].maxPoint.x)[axis];
+    });
+
+    uint32_t children = static_cast<uint32_t>(mNodes.size());
+    mNodes[node].first = children;
+    mNodes[node].count = 0;
+    mNodes.push_back({ {}, 0, 0, node, 0 });
+    mNodes.push_back({ {}, 0, 0, node, 0 });
+    BuildNode(children,     first,        half);
+    BuildNode(children + 1, first + half, count - half);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Queries
+-----------------------------------------------------------------------------------------*/
+
+// Models partly or wholly inside the frustum
+void SceneBVH::QueryFrustum(const Frustum& frustum, std::vector<Model*>& results, uint32_t layers) const
+{
+    results.clear();
+    if (mNodes.empty())  return;
+
+    // Each node on the stack has a bit for each frustum plane its box is crossing. Planes that a node is wholly
+    // in front of don't need testing for its children. When no planes are left the whole node is inside
+    struct Entry { uint32_t node; uint32_t planes; };
+    Entry stack[MAX_DEPTH * 2];
+    int top = 0;
+    stack[top++] = { 0, 0x3f };
+    while (top > 0)
+    {
+        Entry entry = stack[--top];
+        const Node& node = mNodes[entry.node];
+        if ((node.layers & layers) == 0)  continue;
+
+        bool outside = false;
+        for (int p = 0; p < 6 && !outside; ++p)
+        {
+            if ((entry.planes & (1 << p)) == 0)  continue;
+
+            // Test the corners of the box furthest forward and back along the plane normal
+            const Plane& plane = frustum.planes[p];
+            CVector3 front = { plane.normal.x >= 0 ? node.box.maxPoint.x : node.box.minPoint.x,
+                               plane.normal.y >= 0 ? node.box.maxPoint.y : node.box.minPoint.y,
+                               plane.normal.z >= 0 ? node.box.maxPoint.z : node.box.minPoint.z };
+            CVector3 back  = { plane.normal.x >= 0 ? node.box.minPoint.x : node.box.maxPoint.x,
+                               plane.normal.y >= 0 ? node.box.minPoint.y : node.box.maxPoint.y,
+                               plane.normal.z >= 0 ? node.box.minPoint.z : node.box.maxPoint.z };
+            if      (Dot(plane.normal, front) + plane.d < 0)  outside = true;
+            else if (Dot(plane.normal, back)  + plane.d >= 0) entry.planes &= ~(1 << p);
+        }
+        if (outside)  continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+            {
+                uint32_t item = mItemOrder[i];
+                if ((mLayers[item] & layers) != 0 && (entry.planes == 0 || IsVisible(frustum, mBoxes[item])))
+                {
+                    results.push_back(mModels[item]);
+                }
+            }
+        }
+        else
+        {
+            stack[top++] = { node.first + 1, entry.planes };
+            stack[top++] = { node.first,     entry.planes };
+        }
+    }
+}
+
+
+// Models partly or wholly inside the sphere
+void SceneBVH::QuerySphere(const Sphere& sphere, std::vector<Model*>& results, uint32_t layers) const
+{
+    results.clear();
+    if (mNodes.empty())  return;
+
+    uint32_t stack[MAX_DEPTH * 2];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const Node& node = mNodes[stack[--top]];
+        if ((node.layers & layers) == 0 || !Overlaps(sphere, node.box))  continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+            {
+                uint32_t item = mItemOrder[i];
+                if ((mLayers[item] & layers) != 0 && Overlaps(sphere, mBoxes[item]))  results.push_back(mModels[item]);
+            }
+        }
+        else
+        {
+            stack[top++] = node.first + 1;
+            stack[top++] = node.first;
+        }
+    }
+}
+
+
+// Models partly or wholly inside the box
+void SceneBVH::QueryBox(const AABB& box, std::vector<Model*>& results, uint32_t layers) const
+{
+    results.clear();
+    if (mNodes.empty())  return;
+
+    uint32_t stack[MAX_DEPTH * 2];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const Node& node = mNodes[stack[--top]];
+        if ((node.layers & layers) == 0 || !Overlaps(box, node.box))  continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+            {
+                uint32_t item = mItemOrder[i];
+                if ((mLayers[item] & layers) != 0 && Overlaps(box, mBoxes[item]))  results.push_back(mModels[item]);
+            }
+        }
+        else
+        {
+            stack[top++] = node.first + 1;
+            stack[top++] = node.first;
+        }
+    }
+}
+
+
+// Nearest model whose bounding box is hit by the ray no further than maxDistance along it, or nullptr if none.
+// If distance is not null it is set to the distance to the hit (see RayIntersects in Bounds.h)
+Model* SceneBVH::RayCast(const Ray& ray, float maxDistance, float* distance, uint32_t layers) const
+{
+    if (mNodes.empty())  return nullptr;
+
+    Model* nearestModel = nullptr;
+    float  nearest = maxDistance;
+
+    // Stack holds nodes and where the ray enters them. The nearer child is visited first so the nearest hit so
+    // far can be used to skip nodes further away
+    struct Entry { uint32_t node; float distance; };
+    Entry stack[MAX_DEPTH * 2];
+    int top = 0;
+    float rootDistance;
+    if (!RayIntersects(ray, mNodes[0].box, maxDistance, rootDistance))  return nullptr;
+    stack[top++] = { 0, rootDistance };
+    while (top > 0)
+    {
+        Entry entry = stack[--top];
+        if (entry.distance > nearest)  continue;
+        const Node& node = mNodes[entry.node];
+        if ((node.layers & layers) == 0)  continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+            {
+                uint32_t item = mItemOrder[i];
+                float hitDistance;
+                if ((mLayers[item] & layers) != 0 && RayIntersects(ray, mBoxes[item], nearest, hitDistance))
+                {
+                    nearest = hitDistance;
+                    nearestModel = mModels[item];
+                }
+            }
+        }
+        else
+        {
+            float distance0, distance1;
+            bool hit0 = RayIntersects(ray, mNodes[node.first].box,     nearest, distance0);
+            bool hit1 = RayIntersects(ray, mNodes[node.first + 1].box, nearest, distance1);
+            if (hit0 && hit1 && distance1 < distance0)
+            {
+                stack[top++] = { node.first,     distance0 };
+                stack[top++] = { node.first + 1, distance1 };
+            }
+            else
+            {
+                if (hit1)  stack[top++] = { node.first + 1, distance1 };
+                if (hit0)  stack[top++] = { node.first,     distance0 };
+            }
+        }
+    }
+
+    if (nearestModel != nullptr && distance != nullptr)  *distance = nearest;
+    return nearestModel;
+}
+
+
+// Nearest model triangle hit by the ray no further than maxDistance along it, e.g. for picking. The tree finds
+// models whose bounding box is hit, then the ray is moved into each model's space and cast against its mesh's
+// triangles (see TriangleBVH.h). Returns false if nothing was hit, otherwise fills in hit
+bool SceneBVH::RayCastTriangles(const Ray& ray, float maxDistance, RayHit& hit, uint32_t layers) const
+{
+    if (mNodes.empty())  return false;
+
+    float nearest = maxDistance;
+    bool  found = false;
+
+    // Same traversal as RayCast, but a model's box being hit only means its triangles need testing
+    struct Entry { uint32_t node; float distance; };
+    Entry stack[MAX_DEPTH * 2];
+    int top = 0;
+    float rootDistance;
+    if (!RayIntersects(ray, mNodes[0].box, maxDistance, rootDistance))  return false;
+    stack[top++] = { 0, rootDistance };
+    while (top > 0)
+    {
+        Entry entry = stack[--top];
+        if (entry.distance > nearest)  continue;
+        const Node& node = mNodes[entry.node];
+        if ((node.layers & layers) == 0)  continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i)
+            {
+                uint32_t item = mItemOrder[i];
+                float boxDistance;
+                if ((mLayers[item] & layers) == 0 || !RayIntersects(ray, mBoxes[item], nearest, boxDistance))  continue;
+
+                Model* model = mModels[item];
+                Ray modelRay = TransformRay(ray, InverseAffine(model->WorldMatrix()));
+                TriangleHit triangleHit;
+                if (model->GetMesh()->Triangles().RayCast(modelRay, nearest, triangleHit))
+                {
+                    nearest = triangleHit.distance;
+                    hit = { model, triangleHit.triangle, triangleHit.distance, triangleHit.u, triangleHit.v };
+                    found = true;
+                }
+            }
+        }
+        else
+        {
+            float distance0, distance1;
+            bool hit0 = RayIntersects(ray, mNodes[node.first].box,     nearest, distance0);
+            bool hit1 = RayIntersects(ray, mNodes[node.first + 1].box, nearest, distance1);
+            if (hit0 && hit1 && distance1 < distance0)
+            {
+                stack[top++] = { node.first,     distance0 };
+                stack[top++] = { node.first + 1, distance1 };
+            }
+            else
+            {
+                if (hit1)  stack[top++] = { node.first + 1, distance1 };
+                if (hit0)  stack[top++] = { node.first,     distance0 };
+            }
+        }
+    }
+    return found;
+}
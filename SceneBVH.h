@@ -0,0 +1,133 @@
+//--------------------------------------------------------------------------------------
+// Bounding volume hierarchy (BVH) over the models in a scene, used for spatial queries
+//--------------------------------------------------------------------------------------
+// Models are grouped into a tree of axis-aligned boxes. Each leaf holds a few models and its box contains their
+// world space bounding boxes, each other node has two children and a box containing both. Queries (which models
+// are in a frustum, near a point, hit by a ray etc.) start at the root and skip any part of the tree whose box
+// does not pass the test, so they only touch a small part of a large scene.
+//
+// Call Update once per frame after gTransforms.UpdateWorldMatrices. Models that moved have their box updated
+// and the boxes above them are grown or shrunk to fit ("refit"), which is quick but leaves the tree less tidy
+// the more things move. When the tree becomes too untidy, or models are added or removed, it is rebuilt.
+//
+// Models can be given layer bits when added (e.g. shadow casters), queries can then be limited to some layers.
+// Models must be removed before they are deleted.
+
+#include "Bounds.h"
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#ifndef _SCENE_BVH_H_INCLUDED_
+#define _SCENE_BVH_H_INCLUDED_
+
+class Model;
+
+// Use as the layers parameter to include all models
+const uint32_t ALL_LAYERS = 0xffffffff;
+
+// Where a ray hit the triangles of a model (see SceneBVH::RayCastTriangles)
+struct RayHit
+{
+    Model*   model;
+    uint32_t triangle; // Triangle of the model's full detail mesh (see Mesh::Triangles)
+    float    distance; // Along the ray in multiples of the ray direction's length, as for RayCast
+    float    u, v;     // Barycentric coordinates of the hit point on the triangle (see TriangleHit in TriangleBVH.h)
+};
+
+
+class SceneBVH
+{
+public:
+    //-------------------------------------
+    // Construction / Usage
+    //-------------------------------------
+
+    // Add a model to the tree, with layer bits that can be used to limit queries. The tree is rebuilt on the next
+    // Update, queries will not find the model until then
+    void Add(Model* model, uint32_t layers = ALL_LAYERS);
+
+    // Remove a model from the tree, the tree is rebuilt immediately. Use Clear to remove everything
+    void Remove(Model* model);
+
+    // Remove all models
+    void Clear();
+
+    // All models in the tree, in no particular order
+    const std::vector<Model*>& Models() const  { return mModels; }
+
+    // Bring the tree up to date with models that have moved, call once per frame after gTransforms.UpdateWorldMatrices
+    // Rebuilds the tree if models have been added or removed or it has become too untidy
+    void Update();
+
+
+    //-------------------------------------
+    // Queries
+    //-------------------------------------
+    // Results replace the contents of the given vector, which can be kept between calls to avoid allocations.
+    // Tests use the models' world space bounding boxes, so may include models that are just outside the area
+
+    // Models partly or wholly inside the frustum
+    void QueryFrustum(const Frustum& frustum, std::vector<Model*>& results, uint32_t layers = ALL_LAYERS) const;
+
+    // Models partly or wholly inside the sphere
+    void QuerySphere(const Sphere& sphere, std::vector<Model*>& results, uint32_t layers = ALL_LAYERS) const;
+
+    // Models partly or wholly inside the box
+    void QueryBox(const AABB& box, std::vector<Model*>& results, uint32_t layers = ALL_LAYERS) const;
+
+    // Nearest model whose bounding box is hit by the ray no further than maxDistance along it, or nullptr if none.
+    // If distance is not null it is set to the distance to the hit (see RayIntersects in Bounds.h)
+    Model* RayCast(const Ray& ray, float maxDistance, float* distance = nullptr, uint32_t layers = ALL_LAYERS) const;
+
+    // Nearest model triangle hit by the ray no further than maxDistance along it, e.g. for picking. The tree finds
+    // models whose bounding box is hit, then the ray is moved into each model's space and cast against its mesh's
+    // triangles (see TriangleBVH.h). Returns false if nothing was hit, otherwise fills in hit
+    bool RayCastTriangles(const Ray& ray, float maxDistance, RayHit& hit, uint32_t layers = ALL_LAYERS) const;
+
+
+    //-------------------------------------
+    // Private data / members
+    //-------------------------------------
+private:
+    // A node is a leaf if count is non-zero, it holds mItemOrder[first] to mItemOrder[first + count - 1]. Otherwise
+    // its two children are nodes first and first + 1. Children always come after their parent in mNodes
+    struct Node
+    {
+        AABB     box;
+        uint32_t first;
+        uint32_t count;
+        uint32_t parent; // UINT32_MAX for the root
+        uint32_t layers; // Combined layer bits of all models below this node
+    };
+
+    // Recalculate the bounding boxes of all models and build the whole tree from scratch
+    void Rebuild();
+
+    // Build the whole tree from scratch using the current bounding boxes
+    void Build();
+
+    // Create nodes for the items in mItemOrder[first] to mItemOrder[first + count - 1] below the given node
+    void BuildNode(uint32_t node, uint32_t first, uint32_t count);
+
+    // Each of these are one per model, in the same order
+    std::vector<Model*>   mModels;
+    std::vector<AABB>     mBoxes;        // World space bounding box of each model
+    std::vector<uint32_t> mVersions;     // World version of each model's transform when its box was calculated
+    std::vector<uint32_t> mLayers;
+    std::vector<uint32_t> mLeaves;       // Node each model is in
+
+    std::unordered_map<Model*, uint32_t> mModelIndices; // Position of each model in the arrays above
+
+    std::vector<Node>     mNodes;
+    std::vector<uint32_t> mItemOrder;    // Model indexes sorted so each leaf's models are together
+    std::vector<uint8_t>  mNodeChanged;  // Used during Update, marks nodes whose box needs refitting
+
+    bool  mRebuild = false;   // Set when models are added
+    float mBuiltCost = 0.0f;  // Sum of the surface areas of all nodes when the tree was last built...
+    float mCost = 0.0f;       // ...and now. Larger values mean queries will visit more nodes
+};
+
+
+#endif //_SCENE_BVH_H_INCLUDED_
@@ -18,6 +18,7 @@
 ID3D11VertexShader* gPixelLightingVertexShader = nullptr;
 ID3D11VertexShader* gBasicTransformVertexShader = nullptr; // Used before light model and depth-only pixel shader
 ID3D11VertexShader* gNormalMappingVertexShader = nullptr;
+ID3D11VertexShader* gBasicTransformInstancedVertexShader = nullptr; // Instanced version of gBasicTransformVertexShader
 
 ID3D11PixelShader*  gPixelLightingPixelShader  = nullptr;
 ID3D11PixelShader*  gLightModelPixelShader  = nullptr;
@@ -40,6 +41,7 @@ bool LoadShaders()
     gPixelLightingVertexShader  = LoadVertexShader("ShadowMapping_vs"); // Note how the shader files are named to show what type they are
     gBasicTransformVertexShader = LoadVertexShader("BasicTransform_vs");
     gNormalMappingVertexShader  = LoadVertexShader("NormalMapping_vs");
+    gBasicTransformInstancedVertexShader = LoadVertexShader("BasicTransformInstanced_vs");
 	
     gPixelLightingPixelShader   = LoadPixelShader ("ShadowMapping_ps");
     gLightModelPixelShader      = LoadPixelShader ("LightModel_ps");
@@ -55,7 +57,7 @@ bool LoadShaders()
         gDepthOnlyPixelShader       == nullptr || gPointLightPixelShader      == nullptr ||
         gWigglePixelShader          == nullptr || gFadeTexturePixelShader     == nullptr ||
         gNormalMappingPixelShader   == nullptr || gNormalMappingVertexShader  == nullptr ||
-        gParallaxMappingPixelShader == nullptr)
+        gParallaxMappingPixelShader == nullptr || gBasicTransformInstancedVertexShader == nullptr)
     {
         gLastError = "Error loading shaders";
         return false;
@@ -78,6 +80,7 @@ void ReleaseShaders()
     if (gNormalMappingPixelShader)    gNormalMappingPixelShader->Release();
     if (gNormalMappingVertexShader)   gNormalMappingVertexShader->Release();
     if (gParallaxMappingPixelShader)  gParallaxMappingPixelShader->Release();
+    if (gBasicTransformInstancedVertexShader)  gBasicTransformInstancedVertexShader->Release();
 }
 
 
@@ -160,11 +163,16 @@ ID3DBlob* CreateSignatureForVertexLayout(const D3D11_INPUT_ELEMENT_DESC vertexLa
     for (int elt = 0; elt < numElements; ++elt)
     {
         auto& format = vertexLayout[elt].Format;
-        // This list should be more complete for production use
+        // This list should be more complete for production use. The 16-bit formats are the compact vertex formats
+        // used by meshes (see MeshData.h), the GPU converts them to floats
         if      (format == DXGI_FORMAT_R32G32B32A32_FLOAT) shaderSource += "float4";
         else if (format == DXGI_FORMAT_R32G32B32_FLOAT)    shaderSource += "float3";
         else if (format == DXGI_FORMAT_R32G32_FLOAT)       shaderSource += "float2";
         else if (format == DXGI_FORMAT_R32_FLOAT)          shaderSource += "float";
+        else if (format == DXGI_FORMAT_R16G16B16A16_UNORM) shaderSource += "float4";
+        else if (format == DXGI_FORMAT_R16G16_FLOAT)       shaderSource += "float2";
+        else if (format == DXGI_FORMAT_R16G16_UNORM)       shaderSource += "float2";
+        else if (format == DXGI_FORMAT_R16G16_SNORM)       shaderSource += "float2";
         else return nullptr; // Unsupported type in layout
 
         uint8_t index = static_cast<uint8_t>(vertexLayout[elt].SemanticIndex);
@@ -18,6 +18,7 @@
 extern ID3D11VertexShader* gPixelLightingVertexShader;
 extern ID3D11VertexShader* gBasicTransformVertexShader;
 extern ID3D11VertexShader* gNormalMappingVertexShader;
+extern ID3D11VertexShader* gBasicTransformInstancedVertexShader;
 
 extern ID3D11PixelShader*  gPixelLightingPixelShader;
 extern ID3D11PixelShader*  gLightModelPixelShader;
@@ -0,0 +1,318 @@
+//--------------------------------------------------------------------------------------
+// State cache - dropping redundant state changes before they reach DirectX
+//--------------------------------------------------------------------------------------
+
+#include "StateCache.h"
+
+#include <algorithm>
+#include <iterator>
+#include <climits>
+
+
+//--------------------------------------------------------------------------------------
+// Global Variables
+//--------------------------------------------------------------------------------------
+
+StateCache gStateCache;
+
+
+/*-----------------------------------------------------------------------------------------
+    Construction / Usage
+-----------------------------------------------------------------------------------------*/
+
+// Forget everything that is set so the next call of each kind is always passed on
+void StateCache::Invalidate()
+{
+    mVertexShaderKnown      = false;
+    mPixelShaderKnown       = false;
+    mInputLayoutKnown       = false;
+    mIndexBufferKnown       = false;
+    mTopologyKnown          = false;
+    mBlendStateKnown        = false;
+    mDepthStencilStateKnown = false;
+    mRasterizerStateKnown   = false;
+
+    std::fill(std::begin(mVSConstantBuffers.known), std::end(mVSConstantBuffers.known), false);
+    std::fill(std::begin(mPSConstantBuffers.known), std::end(mPSConstantBuffers.known), false);
+    std::fill(std::begin(mVSShaderResources.known), std::end(mVSShaderResources.known), false);
+    std::fill(std::begin(mPSShaderResources.known), std::end(mPSShaderResources.known), false);
+    std::fill(std::begin(mPSSamplers.known),        std::end(mPSSamplers.known),        false);
+    std::fill(std::begin(mVertexBuffers.known),     std::end(mVertexBuffers.known),     false);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    State changes
+-----------------------------------------------------------------------------------------*/
+
+void StateCache::VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT numClassInstances)
+{
+    if (Count(!mVertexShaderKnown || shader != mVertexShader))
+    {
+        gD3DContext->VSSetShader(shader, classInstances, numClassInstances);
+        mVertexShader = shader;
+        mVertexShaderKnown = true;
+    }
+}
+
+void StateCache::PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT numClassInstances)
+{
+    if (Count(!mPixelShaderKnown || shader != mPixelShader))
+    {
+        gD3DContext->PSSetShader(shader, classInstances, numClassInstances);
+        mPixelShader = shader;
+        mPixelShaderKnown = true;
+    }
+}
+
+
+void StateCache::VSSetConstantBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* buffers)
+{
+    const UINT* firstConstants = nullptr;
+    const UINT* numConstants   = nullptr;
+    if (Count(UpdateConstantBufferSlots(mVSConstantBuffers, startSlot, numBuffers, buffers, firstConstants, numConstants)))
+    {
+        gD3DContext->VSSetConstantBuffers(startSlot, numBuffers, buffers);
+    }
+}
+
+void StateCache::PSSetConstantBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* buffers)
+{
+    const UINT* firstConstants = nullptr;
+    const UINT* numConstants   = nullptr;
+    if (Count(UpdateConstantBufferSlots(mPSConstantBuffers, startSlot, numBuffers, buffers, firstConstants, numConstants)))
+    {
+        gD3DContext->PSSetConstantBuffers(startSlot, numBuffers, buffers);
+    }
+}
+
+void StateCache::VSSetConstantBuffers1(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* buffers,
+                                       const UINT* firstConstants, const UINT* numConstants)
+{
+    if (Count(UpdateConstantBufferSlots(mVSConstantBuffers, startSlot, numBuffers, buffers, firstConstants, numConstants)))
+    {
+        gD3DContext1->VSSetConstantBuffers1(startSlot, numBuffers, buffers, firstConstants, numConstants);
+    }
+}
+
+void StateCache::PSSetConstantBuffers1(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* buffers,
+                                       const UINT* firstConstants, const UINT* numConstants)
+{
+    if (Count(UpdateConstantBufferSlots(mPSConstantBuffers, startSlot, numBuffers, buffers, firstConstants, numConstants)))
+    {
+        gD3DContext1->PSSetConstantBuffers1(startSlot, numBuffers, buffers, firstConstants, numConstants);
+    }
+}
+
+void StateCache::VSSetShaderResources(UINT startSlot, UINT numViews, ID3D11ShaderResourceView* const* views)
+{
+    if (Count(UpdateSlots(mVSShaderResources, startSlot, numViews, views)))
+    {
+        gD3DContext->VSSetShaderResources(startSlot, numViews, views);
+    }
+}
+
+void StateCache::PSSetShaderResources(UINT startSlot, UINT numViews, ID3D11ShaderResourceView* const* views)
+{
+    if (Count(UpdateSlots(mPSShaderResources, startSlot, numViews, views)))
+    {
+        gD3DContext->PSSetShaderResources(startSlot, numViews, views);
+    }
+}
+
+void StateCache::PSSetSamplers(UINT startSlot, UINT numSamplers, ID3D11SamplerState* const* samplers)
+{
+    if (Count(UpdateSlots(mPSSamplers, startSlot, numSamplers, samplers)))
+    {
+        gD3DContext->PSSetSamplers(startSlot, numSamplers, samplers);
+    }
+}
+
+
+void StateCache::IASetInputLayout(ID3D11InputLayout* inputLayout)
+{
+    if (Count(!mInputLayoutKnown || inputLayout != mInputLayout))
+    {
+        gD3DContext->IASetInputLayout(inputLayout);
+        mInputLayout = inputLayout;
+        mInputLayoutKnown = true;
+    }
+}
+
+void StateCache::IASetVertexBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* buffers,
+                                    const UINT* strides, const UINT* offsets)
+{
+    // Strides and offsets are part of each slot, so are compared along with the buffers
+    UINT first = UINT_MAX, last = 0;
+    for (UINT i = 0; i < numBuffers; ++i)
+    {
+        UINT slot = startSlot + i;
+        if (slot >= STATE_CACHE_SLOTS || !mVertexBuffers.known[slot] || mVertexBuffers.items[slot] != buffers[i] ||
+            mVertexStrides[slot] != strides[i] || mVertexOffsets[slot] != offsets[i])
+        {
+            if (first == UINT_MAX)  first = i;
+            last = i;
+            if (slot < STATE_CACHE_SLOTS)
+            {
+                mVertexBuffers.items[slot] = buffers[i];
+                mVertexBuffers.known[slot] = true;
+                mVertexStrides[slot] = strides[i];
+                mVertexOffsets[slot] = offsets[i];
+            }
+        }
+    }
+
+    if (Count(first != UINT_MAX))
+    {
+        gD3DContext->IASetVertexBuffers(startSlot + first, last - first + 1, buffers + first, strides + first, offsets + first);
+    }
+}
+
+void StateCache::IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+{
+    if (Count(!mIndexBufferKnown || buffer != mIndexBuffer || format != mIndexFormat || offset != mIndexOffset))
+    {
+        gD3DContext->IASetIndexBuffer(buffer, format, offset);
+        mIndexBuffer = buffer;
+        mIndexFormat = format;
+        mIndexOffset = offset;
+        mIndexBufferKnown = true;
+    }
+}
+
+void StateCache::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+    if (Count(!mTopologyKnown || topology != mTopology))
+    {
+        gD3DContext->IASetPrimitiveTopology(topology);
+        mTopology = topology;
+        mTopologyKnown = true;
+    }
+}
+
+
+void StateCache::OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask)
+{
+    // DirectX uses a blend factor of 1 if none is given
+    const FLOAT defaultBlendFactor[4] = { 1, 1, 1, 1 };
+    if (blendFactor == nullptr)  blendFactor = defaultBlendFactor;
+
+    if (Count(!mBlendStateKnown || blendState != mBlendState || sampleMask != mSampleMask ||
+              !std::equal(blendFactor, blendFactor + 4, mBlendFactor)))
+    {
+        gD3DContext->OMSetBlendState(blendState, blendFactor, sampleMask);
+        mBlendState = blendState;
+        std::copy(blendFactor, blendFactor + 4, mBlendFactor);
+        mSampleMask = sampleMask;
+        mBlendStateKnown = true;
+    }
+}
+
+void StateCache::OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef)
+{
+    if (Count(!mDepthStencilStateKnown || depthStencilState != mDepthStencilState || stencilRef != mStencilRef))
+    {
+        gD3DContext->OMSetDepthStencilState(depthStencilState, stencilRef);
+        mDepthStencilState = depthStencilState;
+        mStencilRef = stencilRef;
+        mDepthStencilStateKnown = true;
+    }
+}
+
+void StateCache::RSSetState(ID3D11RasterizerState* rasterizerState)
+{
+    if (Count(!mRasterizerStateKnown || rasterizerState != mRasterizerState))
+    {
+        gD3DContext->RSSetState(rasterizerState);
+        mRasterizerState = rasterizerState;
+        mRasterizerStateKnown = true;
+    }
+}
+
+
+// Always passed on. Textures are forgotten as DirectX unbinds any that are used as the new targets
+void StateCache::OMSetRenderTargets(UINT numViews, ID3D11RenderTargetView* const* renderTargetViews,
+                                    ID3D11DepthStencilView* depthStencilView)
+{
+    Count(true);
+    gD3DContext->OMSetRenderTargets(numViews, renderTargetViews, depthStencilView);
+    std::fill(std::begin(mVSShaderResources.known), std::end(mVSShaderResources.known), false);
+    std::fill(std::begin(mPSShaderResources.known), std::end(mPSShaderResources.known), false);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Private members
+-----------------------------------------------------------------------------------------*/
+
+// Compare the given slots with what is set, recording the new values. The range is cut down to the slots that
+// changed. Returns false if nothing changed
+template <typename T>
+bool StateCache::UpdateSlots(Slots<T>& slots, UINT& startSlot, UINT& numItems, T* const*& items)
+{
+    UINT first = UINT_MAX, last = 0;
+    for (UINT i = 0; i < numItems; ++i)
+    {
+        UINT slot = startSlot + i;
+        if (slot >= STATE_CACHE_SLOTS || !slots.known[slot] || slots.items[slot] != items[i])
+        {
+            if (first == UINT_MAX)  first = i;
+            last = i;
+            if (slot < STATE_CACHE_SLOTS)
+            {
+                slots.items[slot] = items[i];
+                slots.known[slot] = true;
+            }
+        }
+    }
+    if (first == UINT_MAX)  return false;
+
+    startSlot += first;
+    items     += first;
+    numItems   = last - first + 1;
+    return true;
+}
+
+
+// As UpdateSlots, also comparing the part of each buffer. Null firstConstants and numConstants mean whole buffers
+bool StateCache::UpdateConstantBufferSlots(ConstantBufferSlots& slots, UINT& startSlot, UINT& numBuffers, ID3D11Buffer* const*& buffers,
+                                           const UINT*& firstConstants, const UINT*& numConstants)
+{
+    UINT first = UINT_MAX, last = 0;
+    for (UINT i = 0; i < numBuffers; ++i)
+    {
+        UINT slot = startSlot + i;
+        UINT firstConstant = firstConstants != nullptr ? firstConstants[i] : 0;
+        UINT constantCount = numConstants   != nullptr ? numConstants[i]   : 0;
+        if (slot >= STATE_CACHE_SLOTS || !slots.known[slot] || slots.items[slot] != buffers[i] ||
+            slots.firstConstants[slot] != firstConstant || slots.numConstants[slot] != constantCount)
+        {
+            if (first == UINT_MAX)  first = i;
+            last = i;
+            if (slot < STATE_CACHE_SLOTS)
+            {
+                slots.items[slot] = buffers[i];
+                slots.known[slot] = true;
+                slots.firstConstants[slot] = firstConstant;
+                slots.numConstants[slot]   = constantCount;
+            }
+        }
+    }
+    if (first == UINT_MAX)  return false;
+
+    startSlot += first;
+    buffers   += first;
+    if (firstConstants != nullptr)  firstConstants += first;
+    if (numConstants   != nullptr)  numConstants   += first;
+    numBuffers = last - first + 1;
+    return true;
+}
+
+
+// Count a call that is passed on if changed is true, or dropped otherwise. Returns changed
+bool StateCache::Count(bool changed)
+{
+    if (changed)  ++mNumIssued;
+    else          ++mNumFiltered;
+    return changed;
+}
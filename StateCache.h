@@ -0,0 +1,164 @@
+//--------------------------------------------------------------------------------------
+// State cache - dropping redundant state changes before they reach DirectX
+//--------------------------------------------------------------------------------------
+// Every call to set a shader, buffer, texture or state costs CPU time in the DirectX runtime and driver, even when
+// the same thing is already set. Drawing many models sets the same things over and over (e.g. the same topology
+// and constant buffers for every model), so all state changes go through gStateCache instead of gD3DContext. It
+// remembers what is currently set and only passes on calls that change something. Calls setting a range of slots
+// are cut down to the slots that changed.
+//
+// The functions have the same names and parameters as the ID3D11DeviceContext functions they replace (shader class
+// instances are not supported). Counts of calls issued and filtered are kept to measure the saving. The "1" versions
+// of the constant buffer functions are from ID3D11DeviceContext1 and can only be used if gD3DContext1 is available.
+//
+// The cache can only be trusted if everything goes through it. Call Invalidate after anything changes state on
+// the context directly. Setting render targets also goes through the cache, as DirectX unbinds textures that become
+// render targets.
+
+#include "Common.h"
+
+#include <cstddef>
+
+#ifndef _STATE_CACHE_H_INCLUDED_
+#define _STATE_CACHE_H_INCLUDED_
+
+
+// Slots tracked for each kind of constant buffer, texture, sampler and vertex buffer. Calls for higher slots are
+// always passed on
+const unsigned int STATE_CACHE_SLOTS = 16;
+
+
+class StateCache
+{
+public:
+    //-------------------------------------
+    // Construction / Usage
+    //-------------------------------------
+
+    StateCache()  { Invalidate(); }
+
+    // Forget everything that is set so the next call of each kind is always passed on
+    void Invalidate();
+
+
+    //-------------------------------------
+    // State changes
+    //-------------------------------------
+
+    void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT numClassInstances);
+    void PSSetShader(ID3D11PixelShader*  shader, ID3D11ClassInstance* const* classInstances, UINT numClassInstances);
+
+    void VSSetConstantBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* buffers);
+    void PSSetConstantBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* buffers);
+    void VSSetConstantBuffers1(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* numConstants);
+    void PSSetConstantBuffers1(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* numConstants);
+    void VSSetShaderResources(UINT startSlot, UINT numViews,   ID3D11ShaderResourceView* const* views);
+    void PSSetShaderResources(UINT startSlot, UINT numViews,   ID3D11ShaderResourceView* const* views);
+    void PSSetSamplers       (UINT startSlot, UINT numSamplers, ID3D11SamplerState* const* samplers);
+
+    void IASetInputLayout(ID3D11InputLayout* inputLayout);
+    void IASetVertexBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets);
+    void IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset);
+    void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+
+    void OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask);
+    void OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef);
+    void RSSetState(ID3D11RasterizerState* rasterizerState);
+
+    // Always passed on. Textures are forgotten as DirectX unbinds any that are used as the new targets
+    void OMSetRenderTargets(UINT numViews, ID3D11RenderTargetView* const* renderTargetViews, ID3D11DepthStencilView* depthStencilView);
+
+
+    //-------------------------------------
+    // Statistics
+    //-------------------------------------
+
+    // Number of calls passed on to DirectX and dropped since the counts were last reset
+    std::size_t NumIssued()   const  { return mNumIssued;   }
+    std::size_t NumFiltered() const  { return mNumFiltered; }
+
+    void ResetCounts()  { mNumIssued = 0;  mNumFiltered = 0; }
+
+
+    //-------------------------------------
+    // Private data / members
+    //-------------------------------------
+private:
+    // What is set in a range of slots, and whether it is known (it isn't after Invalidate)
+    template <typename T>
+    struct Slots
+    {
+        T*   items[STATE_CACHE_SLOTS];
+        bool known[STATE_CACHE_SLOTS];
+    };
+
+    // Compare the given slots with what is set, recording the new values. The range is cut down to the slots that
+    // changed. Returns false if nothing changed
+    template <typename T>
+    bool UpdateSlots(Slots<T>& slots, UINT& startSlot, UINT& numItems, T* const*& items);
+
+    // Constant buffer slots also record the part of each buffer that is bound. Whole buffers are recorded as 0 constants
+    struct ConstantBufferSlots : Slots<ID3D11Buffer>
+    {
+        UINT firstConstants[STATE_CACHE_SLOTS];
+        UINT numConstants[STATE_CACHE_SLOTS];
+    };
+
+    // As UpdateSlots, also comparing the part of each buffer. Null firstConstants and numConstants mean whole buffers
+    bool UpdateConstantBufferSlots(ConstantBufferSlots& slots, UINT& startSlot, UINT& numBuffers, ID3D11Buffer* const*& buffers,
+                                   const UINT*& firstConstants, const UINT*& numConstants);
+
+    // Count a call that is passed on if changed is true, or dropped otherwise. Returns changed
+    bool Count(bool changed);
+
+    ID3D11VertexShader* mVertexShader;
+    ID3D11PixelShader*  mPixelShader;
+    bool mVertexShaderKnown, mPixelShaderKnown;
+
+    ConstantBufferSlots             mVSConstantBuffers;
+    ConstantBufferSlots             mPSConstantBuffers;
+    Slots<ID3D11ShaderResourceView> mVSShaderResources;
+    Slots<ID3D11ShaderResourceView> mPSShaderResources;
+    Slots<ID3D11SamplerState>       mPSSamplers;
+
+    ID3D11InputLayout* mInputLayout;
+    bool mInputLayoutKnown;
+
+    Slots<ID3D11Buffer> mVertexBuffers;
+    UINT mVertexStrides[STATE_CACHE_SLOTS];
+    UINT mVertexOffsets[STATE_CACHE_SLOTS];
+
+    ID3D11Buffer* mIndexBuffer;
+    DXGI_FORMAT   mIndexFormat;
+    UINT          mIndexOffset;
+    bool mIndexBufferKnown;
+
+    D3D11_PRIMITIVE_TOPOLOGY mTopology;
+    bool mTopologyKnown;
+
+    ID3D11BlendState* mBlendState;
+    FLOAT             mBlendFactor[4];
+    UINT              mSampleMask;
+    bool mBlendStateKnown;
+
+    ID3D11DepthStencilState* mDepthStencilState;
+    UINT                     mStencilRef;
+    bool mDepthStencilStateKnown;
+
+    ID3D11RasterizerState* mRasterizerState;
+    bool mRasterizerStateKnown;
+
+    std::size_t mNumIssued   = 0;
+    std::size_t mNumFiltered = 0;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Global Variables
+//--------------------------------------------------------------------------------------
+
+// All state changes on gD3DContext go through this
+extern StateCache gStateCache;
+
+
+#endif //_STATE_CACHE_H_INCLUDED_
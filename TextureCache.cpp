@@ -0,0 +1,103 @@
+//--------------------------------------------------------------------------------------
+// Cache of loaded textures so each texture file is only loaded once
+//--------------------------------------------------------------------------------------
+
+#include "TextureCache.h"
+#include "GraphicsHelpers.h"
+
+#include <algorithm>
+#include <cctype>
+
+
+// Textures used by the app
+TextureCache gTextureCache;
+
+
+// Return a shader resource view for the given texture file, loading it if it is not already loaded
+// (see LoadTexture in GraphicsHelpers.h). Returns nullptr on failure
+ID3D11ShaderResourceView* TextureCache::Acquire(const std::string& fileName)
+{
+    std::string key = MakeKey(fileName);
+    auto found = mEntries.find(key);
+    if (found != mEntries.end())
+    {
+        ++found->second.refCount;
+        return found->second.textureSRV;
+    }
+
+    ID3D11Resource*           texture    = nullptr;
+    ID3D11ShaderResourceView* textureSRV = nullptr;
+    if (!LoadTexture(fileName, &texture, &textureSRV))  return nullptr;
+    return Add(key, texture, textureSRV);
+}
+
+
+// As above, but if the texture is not already loaded it is created from the given file contents. Used when
+// texture files are read on other threads
+ID3D11ShaderResourceView* TextureCache::Acquire(const std::string& fileName, const uint8_t* data, std::size_t size)
+{
+    std::string key = MakeKey(fileName);
+    auto found = mEntries.find(key);
+    if (found != mEntries.end())
+    {
+        ++found->second.refCount;
+        return found->second.textureSRV;
+    }
+
+    ID3D11Resource*           texture    = nullptr;
+    ID3D11ShaderResourceView* textureSRV = nullptr;
+    if (!LoadTextureFromMemory(data, size, &texture, &textureSRV))  return nullptr;
+    return Add(key, texture, textureSRV);
+}
+
+
+// Returns true if the texture for the given file is currently loaded
+bool TextureCache::IsLoaded(const std::string& fileName) const
+{
+    return mEntries.find(MakeKey(fileName)) != mEntries.end();
+}
+
+
+// Add a reference to a texture returned by Acquire, so it needs an extra Release
+void TextureCache::AddRef(ID3D11ShaderResourceView* textureSRV)
+{
+    auto key = mKeys.find(textureSRV);
+    if (key == mKeys.end())  return;
+    ++mEntries[key->second].refCount;
+}
+
+
+// Release a reference to a texture returned by Acquire, freeing the texture if it was the last one. Nullptr is ignored
+void TextureCache::Release(ID3D11ShaderResourceView* textureSRV)
+{
+    auto key = mKeys.find(textureSRV);
+    if (key == mKeys.end())  return;
+
+    auto entry = mEntries.find(key->second);
+    if (--entry->second.refCount == 0)
+    {
+        entry->second.textureSRV->Release();
+        entry->second.texture->Release();
+        mEntries.erase(entry);
+        mKeys.erase(key);
+    }
+}
+
+
+// Key identifying a file, names that refer to the same file (differing in case or slashes) get the same key
+// File names are not case sensitive on Windows and may use either slash
+std::string TextureCache::MakeKey(const std::string& fileName)
+{
+    std::string key = fileName;
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return c == '\\' ? '/' : static_cast<char>(std::tolower(c)); });
+    return key;
+}
+
+
+// Add a newly loaded texture to the cache and return its view
+ID3D11ShaderResourceView* TextureCache::Add(const std::string& key, ID3D11Resource* texture, ID3D11ShaderResourceView* textureSRV)
+{
+    mEntries[key] = { texture, textureSRV, 1 };
+    mKeys[textureSRV] = key;
+    return textureSRV;
+}
@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// Cache of loaded textures so each texture file is only loaded once
+//--------------------------------------------------------------------------------------
+// Asking for a texture that has already been loaded returns the same shader resource view, sharing its GPU memory.
+// Works like the mesh cache (see MeshCache.h): each Acquire (or AddRef) must be matched by a Release, and the
+// texture is freed by the last Release. Don't call Release on the returned views directly.
+
+#include "Common.h"
+
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _TEXTURE_CACHE_H_INCLUDED_
+#define _TEXTURE_CACHE_H_INCLUDED_
+
+
+class TextureCache
+{
+public:
+    // Return a shader resource view for the given texture file, loading it if it is not already loaded
+    // (see LoadTexture in GraphicsHelpers.h). Returns nullptr on failure
+    ID3D11ShaderResourceView* Acquire(const std::string& fileName);
+
+    // As above, but if the texture is not already loaded it is created from the given file contents. Used when
+    // texture files are read on other threads
+    ID3D11ShaderResourceView* Acquire(const std::string& fileName, const uint8_t* data, std::size_t size);
+
+    // Returns true if the texture for the given file is currently loaded
+    bool IsLoaded(const std::string& fileName) const;
+
+    // Add a reference to a texture returned by Acquire, so it needs an extra Release
+    void AddRef(ID3D11ShaderResourceView* textureSRV);
+
+    // Release a reference to a texture returned by Acquire, freeing the texture if it was the last one. Nullptr is ignored
+    void Release(ID3D11ShaderResourceView* textureSRV);
+
+    // Number of different textures currently loaded
+    std::size_t Count() const  { return mEntries.size(); }
+
+    // Key identifying a file, names that refer to the same file (differing in case or slashes) get the same key
+    static std::string MakeKey(const std::string& fileName);
+
+
+private:
+    // Add a newly loaded texture to the cache and return its view
+    ID3D11ShaderResourceView* Add(const std::string& key, ID3D11Resource* texture, ID3D11ShaderResourceView* textureSRV);
+
+    struct Entry
+    {
+        ID3D11Resource*           texture;
+        ID3D11ShaderResourceView* textureSRV;
+        int                       refCount;
+    };
+    std::unordered_map<std::string, Entry>                    mEntries;
+    std::unordered_map<ID3D11ShaderResourceView*, std::string> mKeys;    // Key for each loaded texture, used when releasing
+};
+
+
+// Textures used by the app
+extern TextureCache gTextureCache;
+
+
+#endif //_TEXTURE_CACHE_H_INCLUDED_
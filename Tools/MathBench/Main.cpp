@@ -0,0 +1,154 @@
+//--------------------------------------------------------------------------------------
+// Maths benchmark - times the CMatrix4x4 functions that have SIMD versions
+//--------------------------------------------------------------------------------------
+// The instruction set used by the maths classes is chosen when they are compiled (see MathSIMD.h), so this program is
+// built once for each version and each build reports its own timings. build.sh builds and runs all three:
+//     scalar    -DMATH_NO_SIMD (with auto-vectorisation turned off so it really is scalar)
+//     SSE       the default for x86-64
+//     AVX2      -mavx2 -mfma
+// Each build also checks its results against a plain C++ reference so a faster but wrong version shows up.
+//
+// Plain C++14 with no dependencies, e.g.
+//     g++ -O2 -std=c++14 -I../../Math Main.cpp ../../Math/CMatrix4x4.cpp ../../Math/CVector3.cpp -o MathBench
+
+#include "CMatrix4x4.h"
+#include "MathSIMD.h"
+
+#include <chrono>
+#include <vector>
+#include <random>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+
+
+namespace
+{
+    // Matrices per test and times round the whole set. Enough matrices to be realistic without leaving the L1 cache
+    const int NUM_MATRICES = 1024;
+    const int REPEATS      = 2000;
+
+
+    const char* VersionName()
+    {
+#if defined(MATH_AVX)
+        return "AVX2";
+#elif defined(MATH_SSE)
+        return "SSE";
+#else
+        return "scalar";
+#endif
+    }
+
+
+    // Random scale, rotation and translation matrices, as a scene's world matrices would be
+    std::vector<CMatrix4x4> RandomMatrices(std::mt19937& random)
+    {
+        std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f);
+        std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+        std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+
+        std::vector<CMatrix4x4> matrices(NUM_MATRICES);
+        for (auto& m : matrices)
+        {
+            m = MatrixScaling(CVector3(scale(random), scale(random), scale(random))) *
+                MatrixRotationZ(angle(random)) * MatrixRotationX(angle(random)) * MatrixRotationY(angle(random)) *
+                MatrixTranslation(CVector3(position(random), position(random), position(random)));
+        }
+        return matrices;
+    }
+
+
+    // Plain multiply to check results against
+    CMatrix4x4 ReferenceMultiply(const CMatrix4x4& m1, const CMatrix4x4& m2)
+    {
+        const float* a = &m1.e00;
+        const float* b = &m2.e00;
+        CMatrix4x4 out;
+        float* o = &out.e00;
+        for (int row = 0; row < 4; ++row)
+        {
+            for (int col = 0; col < 4; ++col)
+            {
+                o[row * 4 + col] = a[row * 4 + 0] * b[0 + col] + a[row * 4 + 1] * b[4 + col] +
+                                   a[row * 4 + 2] * b[8 + col] + a[row * 4 + 3] * b[12 + col];
+            }
+        }
+        return out;
+    }
+
+    // Largest difference between two matrices
+    float MaxDifference(const CMatrix4x4& m1, const CMatrix4x4& m2)
+    {
+        float difference = 0;
+        for (int i = 0; i < 16; ++i)  difference = std::max(difference, std::abs((&m1.e00)[i] - (&m2.e00)[i]));
+        return difference;
+    }
+
+
+    // Run a test over all the matrices REPEATS times and return the time per call in nanoseconds. The test returns a
+    // value that is summed so the compiler cannot remove the work
+    template <typename Test>
+    double Time(Test test, float& checksum)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int repeat = 0; repeat < REPEATS; ++repeat)
+        {
+            for (int i = 0; i < NUM_MATRICES; ++i)  checksum += test(i);
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / (double(REPEATS) * NUM_MATRICES);
+    }
+
+
+    void Report(const char* name, double nanoseconds, float error)
+    {
+        std::cout << "  " << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(8) << nanoseconds << " ns    max error " << std::scientific << std::setprecision(1)
+                  << error << "\n";
+    }
+}
+
+
+int main()
+{
+    std::mt19937 random(1234);
+    std::vector<CMatrix4x4> a = RandomMatrices(random);
+    std::vector<CMatrix4x4> b = RandomMatrices(random);
+    std::vector<CMatrix4x4> out(NUM_MATRICES);
+    float checksum = 0;
+
+    std::cout << "CMatrix4x4 (" << VersionName() << "), " << NUM_MATRICES << " matrices x " << REPEATS << "\n";
+
+    // operator*
+    double time = Time([&](int i) { out[i] = a[i] * b[i];  return out[i].e00; }, checksum);
+    float error = 0;
+    for (int i = 0; i < NUM_MATRICES; ++i)  error = std::max(error, MaxDifference(a[i] * b[i], ReferenceMultiply(a[i], b[i])));
+    Report("operator*", time, error);
+
+    // operator*=, multiplying a copy so the matrices don't change between repeats
+    time = Time([&](int i) { out[i] = a[i];  out[i] *= b[i];  return out[i].e00; }, checksum);
+    error = 0;
+    for (int i = 0; i < NUM_MATRICES; ++i)
+    {
+        CMatrix4x4 m = a[i];
+        m *= b[i];
+        error = std::max(error, MaxDifference(m, ReferenceMultiply(a[i], b[i])));
+    }
+    Report("operator*=", time, error);
+
+    // Inverses are checked by how close M * inverse(M) is to the identity
+    time = Time([&](int i) { out[i] = InverseAffine(a[i]);  return out[i].e00; }, checksum);
+    error = 0;
+    for (int i = 0; i < NUM_MATRICES; ++i)  error = std::max(error, MaxDifference(ReferenceMultiply(a[i], InverseAffine(a[i])), MatrixIdentity()));
+    Report("InverseAffine", time, error);
+
+    time = Time([&](int i) { out[i] = Inverse(a[i]);  return out[i].e00; }, checksum);
+    error = 0;
+    for (int i = 0; i < NUM_MATRICES; ++i)  error = std::max(error, MaxDifference(ReferenceMultiply(a[i], Inverse(a[i])), MatrixIdentity()));
+    Report("Inverse", time, error);
+
+    // Printing the checksum keeps the timed work from being optimised away
+    std::cout << "  (checksum " << std::defaultfloat << checksum << ")\n";
+    return 0;
+}
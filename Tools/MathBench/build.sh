@@ -0,0 +1,17 @@
+#!/bin/sh
+# Build the maths benchmark once for each instruction set (see Main.cpp) and run each build
+# Usage: ./build.sh [compiler], run from this folder. Needs an x86-64 CPU with AVX2 for the last build
+set -e
+CXX=${1:-g++}
+MATH=../../Math
+SOURCES="Main.cpp $MATH/CMatrix4x4.cpp $MATH/CVector3.cpp"
+# -Wno-narrowing: GetEulerAngles returns doubles from atan2 as floats, which is intended
+FLAGS="-O2 -std=c++14 -Wall -Wno-narrowing -I$MATH"
+
+$CXX $FLAGS -DMATH_NO_SIMD -fno-tree-vectorize $SOURCES -o MathBench_scalar
+$CXX $FLAGS                                    $SOURCES -o MathBench_sse
+$CXX $FLAGS -mavx2 -mfma                       $SOURCES -o MathBench_avx2
+
+./MathBench_scalar
+./MathBench_sse
+./MathBench_avx2
@@ -0,0 +1,465 @@
+//--------------------------------------------------------------------------------------
+// BC1/BC3/BC5 block compression for the texture cooker
+//--------------------------------------------------------------------------------------
+
+#include "BlockCompression.h"
+#include "MathSIMD.h"
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+
+namespace
+{
+    /*-----------------------------------------------------------------------------------------
+        Finding the best palette entry for each pixel
+    -----------------------------------------------------------------------------------------*/
+
+    // Pixels of one block, each channel stored separately (0->255) so four pixels can be processed at once
+    struct BlockPoints
+    {
+        alignas(16) float channel[3][16];
+        alignas(16) float weight[16]; // 0 for pixels that don't count towards the error (e.g. transparent pixels in BC1)
+    };
+
+    // Choose the nearest palette entry for each pixel, using the first numChannels channels. Returns the total
+    // squared error of the weighted pixels
+    float FindIndices(const BlockPoints& points, int numChannels, const float (*palette)[3], int numPalette, uint8_t indices[16])
+    {
+        float totalError = 0.0f;
+
+#if defined(MATH_SSE)
+        __m128 error = _mm_setzero_ps();
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m128 best = _mm_set1_ps(FLT_MAX);
+            __m128i bestIndex = _mm_setzero_si128();
+            for (int p = 0; p < numPalette; ++p)
+            {
+                __m128 distance = _mm_setzero_ps();
+                for (int c = 0; c < numChannels; ++c)
+                {
+                    __m128 d = _mm_sub_ps(_mm_load_ps(&points.channel[c][i]), _mm_set1_ps(palette[p][c]));
+                    distance = MulAdd(d, d, distance);
+                }
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+                best = _mm_min_ps(distance, best);
+                bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, bestIndex));
+            }
+            error = MulAdd(best, _mm_load_ps(&points.weight[i]), error);
+
+            alignas(16) int32_t blockIndices[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(blockIndices), bestIndex);
+            for (int j = 0; j < 4; ++j)  indices[i + j] = static_cast<uint8_t>(blockIndices[j]);
+        }
+        alignas(16) float errors[4];
+        _mm_store_ps(errors, error);
+        totalError = (errors[0] + errors[1]) + (errors[2] + errors[3]);
+#else
+        for (int i = 0; i < 16; ++i)
+        {
+            float best = FLT_MAX;
+            for (int p = 0; p < numPalette; ++p)
+            {
+                float distance = 0.0f;
+                for (int c = 0; c < numChannels; ++c)
+                {
+                    float d = points.channel[c][i] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < best)
+                {
+                    best = distance;
+                    indices[i] = static_cast<uint8_t>(p);
+                }
+            }
+            totalError += best * points.weight[i];
+        }
+#endif
+        return totalError;
+    }
+
+
+    /*-----------------------------------------------------------------------------------------
+        BC1 colour blocks
+    -----------------------------------------------------------------------------------------*/
+
+    // A 565 colour and its expansion back to 8 bits per channel, as the GPU will see it
+    struct Colour565
+    {
+        uint16_t packed;
+        float    rgb[3];
+    };
+
+    Colour565 Quantise565(const float rgb[3])
+    {
+        int r = static_cast<int>(std::min(std::max(rgb[0], 0.0f), 255.0f) * 31 / 255 + 0.5f);
+        int g = static_cast<int>(std::min(std::max(rgb[1], 0.0f), 255.0f) * 63 / 255 + 0.5f);
+        int b = static_cast<int>(std::min(std::max(rgb[2], 0.0f), 255.0f) * 31 / 255 + 0.5f);
+        Colour565 colour;
+        colour.packed = static_cast<uint16_t>((r << 11) | (g << 5) | b);
+        colour.rgb[0] = static_cast<float>((r << 3) | (r >> 2));
+        colour.rgb[1] = static_cast<float>((g << 2) | (g >> 4));
+        colour.rgb[2] = static_cast<float>((b << 3) | (b >> 2));
+        return colour;
+    }
+
+    // Fraction of the first endpoint in each palette entry, for 4 colour mode and 3 colour mode
+    const float PALETTE_WEIGHTS_4[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    const float PALETTE_WEIGHTS_3[3] = { 1.0f, 0.0f, 0.5f };
+
+    struct ColourFit
+    {
+        Colour565 endpoint[2];
+        uint8_t   indices[16];
+        float     error;
+    };
+
+    ColourFit EvaluateColours(const BlockPoints& points, const float start[3], const float end[3], bool threeColour)
+    {
+        ColourFit fit;
+        fit.endpoint[0] = Quantise565(start);
+        fit.endpoint[1] = Quantise565(end);
+
+        const float* weights = threeColour ? PALETTE_WEIGHTS_3 : PALETTE_WEIGHTS_4;
+        int numColours = threeColour ? 3 : 4;
+        float palette[4][3];
+        for (int p = 0; p < numColours; ++p)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                palette[p][c] = fit.endpoint[0].rgb[c] * weights[p] + fit.endpoint[1].rgb[c] * (1.0f - weights[p]);
+            }
+        }
+        fit.error = FindIndices(points, 3, palette, numColours, fit.indices);
+        return fit;
+    }
+
+    // Least squares fit of the two endpoints that best reproduce the pixels with the given indices. Returns false if
+    // the indices don't give a solvable system (e.g. all pixels use the same index)
+    bool RefineEndpoints(const BlockPoints& points, const uint8_t indices[16], bool threeColour, float start[3], float end[3])
+    {
+        const float* weights = threeColour ? PALETTE_WEIGHTS_3 : PALETTE_WEIGHTS_4;
+        float aa = 0, bb = 0, ab = 0, ax[3] = {}, bx[3] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            if (points.weight[i] == 0.0f)  continue;
+            float a = weights[indices[i]], b = 1.0f - a;
+            aa += a * a;  bb += b * b;  ab += a * b;
+            for (int c = 0; c < 3; ++c)
+            {
+                ax[c] += a * points.channel[c][i];
+                bx[c] += b * points.channel[c][i];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if (std::abs(determinant) < 1e-6f)  return false;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            start[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+            end[c]   = (bx[c] * aa - ax[c] * ab) / determinant;
+        }
+        return true;
+    }
+
+    // Compress the colours of a block to 8 bytes. In three colour mode pixels with zero weight are made transparent
+    void CompressColourBlock(const BlockPoints& points, bool threeColour, uint8_t* block)
+    {
+        // Find the principal axis of the colours: the mean plus the main eigenvector of the covariance matrix
+        float mean[3] = {}, total = 0.0f;
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int c = 0; c < 3; ++c)  mean[c] += points.channel[c][i] * points.weight[i];
+            total += points.weight[i];
+        }
+
+        ColourFit best;
+        if (total == 0.0f) // All pixels transparent
+        {
+            best.endpoint[0] = best.endpoint[1] = Quantise565(mean);
+            std::fill(best.indices, best.indices + 16, uint8_t(3));
+        }
+        else
+        {
+            for (int c = 0; c < 3; ++c)  mean[c] /= total;
+
+            float covariance[6] = {}; // rr, rg, rb, gg, gb, bb
+            float minimum[3] = { 255, 255, 255 }, maximum[3] = { 0, 0, 0 };
+            for (int i = 0; i < 16; ++i)
+            {
+                if (points.weight[i] == 0.0f)  continue;
+                float d[3];
+                for (int c = 0; c < 3; ++c)
+                {
+                    d[c] = points.channel[c][i] - mean[c];
+                    minimum[c] = std::min(minimum[c], points.channel[c][i]);
+                    maximum[c] = std::max(maximum[c], points.channel[c][i]);
+                }
+                covariance[0] += d[0] * d[0];  covariance[1] += d[0] * d[1];  covariance[2] += d[0] * d[2];
+                covariance[3] += d[1] * d[1];  covariance[4] += d[1] * d[2];  covariance[5] += d[2] * d[2];
+            }
+
+            float axis[3] = { maximum[0] - minimum[0], maximum[1] - minimum[1], maximum[2] - minimum[2] };
+            for (int iteration = 0; iteration < 8; ++iteration) // Power iteration
+            {
+                float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+                float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+                float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+                float largest = std::max(std::abs(x), std::max(std::abs(y), std::abs(z)));
+                if (largest == 0.0f)  break;
+                axis[0] = x / largest;  axis[1] = y / largest;  axis[2] = z / largest;
+            }
+            float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+            if (length > 0.0f)
+            {
+                for (int c = 0; c < 3; ++c)  axis[c] /= length;
+            }
+
+            // Endpoints at the extremes of the colours along the axis, pulled in slightly since the extremes are
+            // usually outliers
+            float low = FLT_MAX, high = -FLT_MAX;
+            for (int i = 0; i < 16; ++i)
+            {
+                if (points.weight[i] == 0.0f)  continue;
+                float t = (points.channel[0][i] - mean[0]) * axis[0] + (points.channel[1][i] - mean[1]) * axis[1] +
+                          (points.channel[2][i] - mean[2]) * axis[2];
+                low = std::min(low, t);
+                high = std::max(high, t);
+            }
+            float inset = (high - low) / 16;
+            float start[3], end[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                start[c] = mean[c] + axis[c] * (high - inset);
+                end[c]   = mean[c] + axis[c] * (low  + inset);
+            }
+            best = EvaluateColours(points, start, end, threeColour);
+
+            // Improve the endpoints to suit the chosen indices, which may in turn choose better indices
+            for (int iteration = 0; iteration < 2 && best.error > 0.0f; ++iteration)
+            {
+                if (!RefineEndpoints(points, best.indices, threeColour, start, end))  break;
+                ColourFit refined = EvaluateColours(points, start, end, threeColour);
+                if (refined.error >= best.error)  break;
+                best = refined;
+            }
+
+            if (threeColour)
+            {
+                for (int i = 0; i < 16; ++i)
+                {
+                    if (points.weight[i] == 0.0f)  best.indices[i] = 3;
+                }
+            }
+        }
+
+        // The order of the endpoints selects the mode: 4 colours if the first is larger, otherwise 3 colours and
+        // transparent. Swap the endpoints if needed, which swaps indices 0 and 1 (and 2 and 3 for 4 colours)
+        uint16_t colour0 = best.endpoint[0].packed, colour1 = best.endpoint[1].packed;
+        if (threeColour ? colour0 > colour1 : colour0 < colour1)
+        {
+            std::swap(colour0, colour1);
+            for (auto& index : best.indices)
+            {
+                if (!threeColour || index < 2)  index ^= 1;
+            }
+        }
+        else if (!threeColour && colour0 == colour1)
+        {
+            std::fill(best.indices, best.indices + 16, uint8_t(0)); // Would be 3 colour mode, only the first entry is safe
+        }
+
+        uint32_t bits = 0;
+        for (int i = 15; i >= 0; --i)  bits = (bits << 2) | best.indices[i];
+        block[0] = static_cast<uint8_t>(colour0);  block[1] = static_cast<uint8_t>(colour0 >> 8);
+        block[2] = static_cast<uint8_t>(colour1);  block[3] = static_cast<uint8_t>(colour1 >> 8);
+        for (int i = 0; i < 4; ++i)  block[4 + i] = static_cast<uint8_t>(bits >> (i * 8));
+    }
+
+
+    /*-----------------------------------------------------------------------------------------
+        BC4 single channel blocks (BC3 alpha, BC5 red and green)
+    -----------------------------------------------------------------------------------------*/
+
+    struct ChannelFit
+    {
+        uint8_t endpoint[2];
+        uint8_t indices[16];
+        float   error;
+    };
+
+    // Try a pair of endpoints. If the first is larger there are 6 values between them, otherwise 4 values plus 0 and 255
+    ChannelFit EvaluateChannel(const BlockPoints& points, int endpoint0, int endpoint1)
+    {
+        ChannelFit fit;
+        fit.endpoint[0] = static_cast<uint8_t>(endpoint0);
+        fit.endpoint[1] = static_cast<uint8_t>(endpoint1);
+
+        float palette[8][3] = {};
+        palette[0][0] = static_cast<float>(endpoint0);
+        palette[1][0] = static_cast<float>(endpoint1);
+        if (endpoint0 > endpoint1)
+        {
+            for (int p = 1; p < 7; ++p)  palette[p + 1][0] = static_cast<float>(((7 - p) * endpoint0 + p * endpoint1) / 7);
+        }
+        else
+        {
+            for (int p = 1; p < 5; ++p)  palette[p + 1][0] = static_cast<float>(((5 - p) * endpoint0 + p * endpoint1) / 5);
+            palette[6][0] = 0.0f;
+            palette[7][0] = 255.0f;
+        }
+        fit.error = FindIndices(points, 1, palette, 8, fit.indices);
+        return fit;
+    }
+
+    // Compress the first channel of the points to 8 bytes
+    void CompressChannelBlock(const BlockPoints& points, uint8_t* block)
+    {
+        int minimum = 255, maximum = 0;          // Range of all values
+        int innerMinimum = 255, innerMaximum = 0; // Range ignoring 0 and 255, which 6 value mode can represent exactly
+        for (int i = 0; i < 16; ++i)
+        {
+            int value = static_cast<int>(points.channel[0][i]);
+            minimum = std::min(minimum, value);
+            maximum = std::max(maximum, value);
+            if (value != 0 && value != 255)
+            {
+                innerMinimum = std::min(innerMinimum, value);
+                innerMaximum = std::max(innerMaximum, value);
+            }
+        }
+
+        ChannelFit best = EvaluateChannel(points, maximum, minimum);
+        if (best.error > 0.0f && (minimum == 0 || maximum == 255))
+        {
+            if (innerMinimum > innerMaximum)  innerMinimum = innerMaximum = 0; // Only 0s and 255s
+            ChannelFit sixValues = EvaluateChannel(points, innerMinimum, innerMaximum);
+            if (sixValues.error < best.error)  best = sixValues;
+        }
+
+        block[0] = best.endpoint[0];
+        block[1] = best.endpoint[1];
+        uint64_t bits = 0;
+        for (int i = 15; i >= 0; --i)  bits = (bits << 3) | best.indices[i];
+        for (int i = 0; i < 6; ++i)  block[2 + i] = static_cast<uint8_t>(bits >> (i * 8));
+    }
+
+
+    /*-----------------------------------------------------------------------------------------
+        Whole images
+    -----------------------------------------------------------------------------------------*/
+
+    // Read a 4x4 block of the image, repeating edge pixels for partial blocks. Values are rounded to 8 bits first
+    // so the compressor sees exactly what the uncompressed texture would have held
+    void ReadBlock(const Image& image, int blockX, int blockY, float pixels[16][4])
+    {
+        for (int y = 0; y < 4; ++y)
+        {
+            for (int x = 0; x < 4; ++x)
+            {
+                const float* pixel = image.Pixel(std::min(blockX * 4 + x, image.width - 1), std::min(blockY * 4 + y, image.height - 1));
+                for (int c = 0; c < 4; ++c)
+                {
+                    pixels[y * 4 + x][c] = std::floor(std::min(std::max(pixel[c], 0.0f), 1.0f) * 255 + 0.5f);
+                }
+            }
+        }
+    }
+
+    void CompressBlock(const Image& image, BlockFormat format, int blockX, int blockY, uint8_t* block)
+    {
+        float pixels[16][4];
+        ReadBlock(image, blockX, blockY, pixels);
+
+        BlockPoints points;
+        if (format == BlockFormat::BC5)
+        {
+            for (int channel = 0; channel < 2; ++channel)
+            {
+                for (int i = 0; i < 16; ++i)
+                {
+                    points.channel[0][i] = pixels[i][channel];
+                    points.weight[i] = 1.0f;
+                }
+                CompressChannelBlock(points, block + channel * 8);
+            }
+            return;
+        }
+
+        // Alpha block first for BC3. BC1 uses its 3 colour mode for blocks with any pixels less than half opaque. The
+        // colour of fully transparent pixels is not seen, so they are left out of the colour fit
+        bool threeColour = false;
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int c = 0; c < 3; ++c)  points.channel[c][i] = pixels[i][c];
+            points.weight[i] = pixels[i][3] > 0 ? 1.0f : 0.0f;
+            if (format == BlockFormat::BC1 && pixels[i][3] < 128)
+            {
+                points.weight[i] = 0.0f;
+                threeColour = true;
+            }
+        }
+        if (format == BlockFormat::BC3)
+        {
+            BlockPoints alpha;
+            for (int i = 0; i < 16; ++i)
+            {
+                alpha.channel[0][i] = pixels[i][3];
+                alpha.weight[i] = 1.0f;
+            }
+            CompressChannelBlock(alpha, block);
+            block += 8;
+        }
+        CompressColourBlock(points, threeColour, block);
+    }
+}
+
+
+// Size in bytes of each compressed 4x4 block
+int BlockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+
+// Compress an image, appending the blocks to output. Blocks are stored in rows top to bottom, partial blocks at the
+// right and bottom edges repeat the edge pixels. Uses up to numThreads threads (0 = one per CPU core)
+void CompressImage(const Image& image, BlockFormat format, int numThreads, std::vector<uint8_t>& output)
+{
+    int blocksWide = (image.width  + 3) / 4;
+    int blocksHigh = (image.height + 3) / 4;
+    std::size_t rowBytes = static_cast<std::size_t>(blocksWide) * BlockBytes(format);
+    std::size_t start = output.size();
+    output.resize(start + rowBytes * blocksHigh);
+    uint8_t* blocks = output.data() + start;
+
+    // Each thread (including this one) compresses the next row of blocks until there are none left
+    std::atomic<int> nextRow(0);
+    auto worker = [&]()
+    {
+        for (int row = nextRow++; row < blocksHigh; row = nextRow++)
+        {
+            for (int column = 0; column < blocksWide; ++column)
+            {
+                CompressBlock(image, format, column, row, blocks + row * rowBytes + column * BlockBytes(format));
+            }
+        }
+    };
+
+    if (numThreads <= 0)  numThreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    numThreads = std::min(numThreads, blocksHigh);
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numThreads; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
@@ -0,0 +1,38 @@
+//--------------------------------------------------------------------------------------
+// BC1/BC3/BC5 block compression for the texture cooker
+//--------------------------------------------------------------------------------------
+// Each 4x4 block of pixels is compressed to a fixed size, which the GPU decompresses as it samples the texture:
+// - BC1: RGB at 4 bits per pixel (8 bytes per block), optional 1-bit alpha
+// - BC3: RGBA at 8 bits per pixel (16 bytes per block), BC1 colours plus a separate alpha block
+// - BC5: two channels (RG) at 8 bits per pixel, each stored like BC3's alpha. Used for normal maps, with NormalMapping_ps
+//        rebuilding z from x and y (DecodeNormalMap in Common.hlsli). Normal maps with height in alpha, as used for
+//        parallax mapping, need BC3 instead
+// Colour endpoints are fitted along the principal axis of each block then refined with a least squares fit. The
+// search for the best palette entry for each pixel uses SSE where available (see MathSIMD.h). Blocks are shared
+// between several threads.
+
+#include "Image.h"
+
+#include <vector>
+#include <cstdint>
+
+#ifndef _BLOCK_COMPRESSION_H_INCLUDED_
+#define _BLOCK_COMPRESSION_H_INCLUDED_
+
+
+enum class BlockFormat
+{
+    BC1,
+    BC3,
+    BC5,
+};
+
+// Size in bytes of each compressed 4x4 block
+int BlockBytes(BlockFormat format);
+
+// Compress an image, appending the blocks to output. Blocks are stored in rows top to bottom, partial blocks at the
+// right and bottom edges repeat the edge pixels. Uses up to numThreads threads (0 = one per CPU core)
+void CompressImage(const Image& image, BlockFormat format, int numThreads, std::vector<uint8_t>& output);
+
+
+#endif //_BLOCK_COMPRESSION_H_INCLUDED_
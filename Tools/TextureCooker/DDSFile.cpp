@@ -0,0 +1,110 @@
+//--------------------------------------------------------------------------------------
+// Writing block compressed textures to DDS files
+//--------------------------------------------------------------------------------------
+
+#include "DDSFile.h"
+
+#include <fstream>
+#include <cstdio>
+
+
+namespace
+{
+    // Layout of the DDS header, see "DDS_HEADER" and "DDS_HEADER_DXT10" in the DirectX documentation
+    struct DDSPixelFormat
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t fourCC;
+        uint32_t rgbBitCount;
+        uint32_t rBitMask, gBitMask, bBitMask, aBitMask;
+    };
+
+    struct DDSHeader
+    {
+        uint32_t       size;
+        uint32_t       flags;
+        uint32_t       height;
+        uint32_t       width;
+        uint32_t       pitchOrLinearSize;
+        uint32_t       depth;
+        uint32_t       mipMapCount;
+        uint32_t       reserved1[11];
+        DDSPixelFormat pixelFormat;
+        uint32_t       caps, caps2, caps3, caps4;
+        uint32_t       reserved2;
+    };
+
+    struct DDSHeaderDX10
+    {
+        uint32_t dxgiFormat;
+        uint32_t resourceDimension;
+        uint32_t miscFlag;
+        uint32_t arraySize;
+        uint32_t miscFlags2;
+    };
+
+    const uint32_t DDS_MAGIC              = 0x20534444; // "DDS "
+    const uint32_t DDSD_CAPS              = 0x1;
+    const uint32_t DDSD_HEIGHT            = 0x2;
+    const uint32_t DDSD_WIDTH             = 0x4;
+    const uint32_t DDSD_PIXELFORMAT       = 0x1000;
+    const uint32_t DDSD_MIPMAPCOUNT       = 0x20000;
+    const uint32_t DDSD_LINEARSIZE        = 0x80000;
+    const uint32_t DDPF_FOURCC            = 0x4;
+    const uint32_t DDSCAPS_COMPLEX        = 0x8;
+    const uint32_t DDSCAPS_TEXTURE        = 0x1000;
+    const uint32_t DDSCAPS_MIPMAP         = 0x400000;
+    const uint32_t FOURCC_DX10            = 0x30315844; // "DX10"
+    const uint32_t DIMENSION_TEXTURE2D    = 3;
+
+    // DXGI_FORMAT values, not using the DirectX headers so the cooker builds on any platform
+    const uint32_t DXGI_FORMAT_BC1_UNORM      = 71;
+    const uint32_t DXGI_FORMAT_BC1_UNORM_SRGB = 72;
+    const uint32_t DXGI_FORMAT_BC3_UNORM      = 77;
+    const uint32_t DXGI_FORMAT_BC3_UNORM_SRGB = 78;
+    const uint32_t DXGI_FORMAT_BC5_UNORM      = 83;
+}
+
+
+// Save a compressed texture as a DDS file. Returns false on failure
+bool SaveDDS(const CompressedTexture& texture, const std::string& fileName)
+{
+    DDSHeader header = {};
+    header.size   = sizeof(DDSHeader);
+    header.flags  = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header.height = texture.height;
+    header.width  = texture.width;
+    header.pitchOrLinearSize = ((texture.width + 3) / 4) * ((texture.height + 3) / 4) * BlockBytes(texture.format);
+    header.mipMapCount = texture.mipLevels;
+    header.pixelFormat.size   = sizeof(DDSPixelFormat);
+    header.pixelFormat.flags  = DDPF_FOURCC;
+    header.pixelFormat.fourCC = FOURCC_DX10;
+    header.caps = DDSCAPS_TEXTURE | (texture.mipLevels > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+    DDSHeaderDX10 headerDX10 = {};
+    headerDX10.dxgiFormat = texture.format == BlockFormat::BC1 ? (texture.srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM) :
+                            texture.format == BlockFormat::BC3 ? (texture.srgb ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM) :
+                                                                 DXGI_FORMAT_BC5_UNORM;
+    headerDX10.resourceDimension = DIMENSION_TEXTURE2D;
+    headerDX10.arraySize = 1;
+
+    // Write to a temporary file first so an interrupted cook never leaves a partial file for the app to load
+    std::string tempFileName = fileName + ".tmp";
+    {
+        std::ofstream file(tempFileName, std::ios::binary);
+        if (!file)  return false;
+        file.write(reinterpret_cast<const char*>(&DDS_MAGIC), sizeof(DDS_MAGIC));
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(&headerDX10), sizeof(headerDX10));
+        file.write(reinterpret_cast<const char*>(texture.data.data()), texture.data.size());
+        if (!file)
+        {
+            file.close();
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+    }
+    std::remove(fileName.c_str()); // rename won't replace an existing file on Windows
+    return std::rename(tempFileName.c_str(), fileName.c_str()) == 0;
+}
@@ -0,0 +1,33 @@
+//--------------------------------------------------------------------------------------
+// Writing block compressed textures to DDS files
+//--------------------------------------------------------------------------------------
+// Files use the DX10 header extension, so they hold the exact DXGI format (including sRGB) and are loaded
+// as-is by DirectX::CreateDDSTextureFromFile/Memory (see LoadTexture in GraphicsHelpers.h).
+
+#include "BlockCompression.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#ifndef _DDS_FILE_H_INCLUDED_
+#define _DDS_FILE_H_INCLUDED_
+
+
+// A compressed 2D texture with all its mip-maps
+struct CompressedTexture
+{
+    int         width     = 0;
+    int         height    = 0;
+    int         mipLevels = 0;
+    BlockFormat format    = BlockFormat::BC1;
+    bool        srgb      = false;    // Colours are sRGB encoded (BC1/BC3 only)
+    std::vector<uint8_t> data;        // Blocks for each mip-map in turn, largest first
+};
+
+
+// Save a compressed texture as a DDS file. Returns false on failure
+bool SaveDDS(const CompressedTexture& texture, const std::string& fileName);
+
+
+#endif //_DDS_FILE_H_INCLUDED_
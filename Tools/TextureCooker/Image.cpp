@@ -0,0 +1,497 @@
+//--------------------------------------------------------------------------------------
+// Images used by the texture cooker, and loading them from PNG and TGA files
+//--------------------------------------------------------------------------------------
+
+#include "Image.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+
+namespace
+{
+    bool ReadFile(const std::string& fileName, std::vector<uint8_t>& data)
+    {
+        std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+        if (!file)  return false;
+        data.resize(static_cast<std::size_t>(file.tellg()));
+        file.seekg(0);
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), data.size()));
+    }
+
+    uint32_t ReadBigEndian32(const uint8_t* p)
+    {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+    }
+
+    uint32_t ReadLittleEndian16(const uint8_t* p)
+    {
+        return p[0] | (uint32_t(p[1]) << 8);
+    }
+
+
+    /*-----------------------------------------------------------------------------------------
+        Inflate (zlib decompression, RFC 1950/1951) used by PNG files
+    -----------------------------------------------------------------------------------------*/
+    // A straightforward decoder that reads Huffman codes a bit at a time, which is plenty fast enough for textures
+
+    const int MAX_CODE_BITS = 15;
+
+    // Canonical Huffman code: number of codes of each length and the symbols in code order
+    struct Huffman
+    {
+        int count[MAX_CODE_BITS + 1];
+        std::vector<int> symbols;
+
+        // Build from the code length of each symbol (0 = symbol not used). Returns false if the lengths are invalid
+        bool Build(const uint8_t* lengths, int numSymbols)
+        {
+            std::fill(count, count + MAX_CODE_BITS + 1, 0);
+            for (int s = 0; s < numSymbols; ++s)  ++count[lengths[s]];
+
+            int left = 1; // Check the code is not over-subscribed
+            for (int len = 1; len <= MAX_CODE_BITS; ++len)
+            {
+                left = (left << 1) - count[len];
+                if (left < 0)  return false;
+            }
+
+            int offsets[MAX_CODE_BITS + 2] = {};
+            for (int len = 1; len <= MAX_CODE_BITS; ++len)  offsets[len + 1] = offsets[len] + count[len];
+            symbols.assign(numSymbols, 0);
+            for (int s = 0; s < numSymbols; ++s)
+            {
+                if (lengths[s] != 0)  symbols[offsets[lengths[s]]++] = s;
+            }
+            return true;
+        }
+    };
+
+    class Inflater
+    {
+    public:
+        Inflater(const uint8_t* data, std::size_t size) : mData(data), mSize(size) {}
+
+        // Decompress a zlib stream, appending to output. Returns false if the data is invalid
+        bool Inflate(std::vector<uint8_t>& output)
+        {
+            if (mSize < 2 || (mData[0] & 0x0f) != 8 || (mData[0] * 256 + mData[1]) % 31 != 0 || (mData[1] & 0x20))  return false;
+            mPos = 2;
+
+            bool lastBlock = false;
+            while (!lastBlock)
+            {
+                lastBlock = Bits(1) != 0;
+                int type = Bits(2);
+                bool ok = type == 0 ? StoredBlock(output) :
+                          type == 1 ? FixedBlock(output) :
+                          type == 2 ? DynamicBlock(output) : false;
+                if (!ok || mOverrun)  return false;
+            }
+            return true;
+        }
+
+    private:
+        int Bits(int num)
+        {
+            uint32_t value = mBitBuffer;
+            while (mBitCount < num)
+            {
+                if (mPos == mSize)  { mOverrun = true;  return 0; }
+                value |= uint32_t(mData[mPos++]) << mBitCount;
+                mBitCount += 8;
+            }
+            mBitBuffer = value >> num;
+            mBitCount -= num;
+            return static_cast<int>(value & ((1u << num) - 1));
+        }
+
+        int Decode(const Huffman& huffman)
+        {
+            int code = 0, first = 0, index = 0;
+            for (int len = 1; len <= MAX_CODE_BITS; ++len)
+            {
+                code |= Bits(1);
+                int count = huffman.count[len];
+                if (code - count < first)  return huffman.symbols[index + (code - first)];
+                index += count;
+                first = (first + count) << 1;
+                code <<= 1;
+            }
+            mOverrun = true; // Not a valid code
+            return 0;
+        }
+
+        bool StoredBlock(std::vector<uint8_t>& output)
+        {
+            mBitBuffer = 0;
+            mBitCount = 0;
+            if (mPos + 4 > mSize)  return false;
+            uint32_t length = ReadLittleEndian16(mData + mPos);
+            if ((length ^ 0xffff) != ReadLittleEndian16(mData + mPos + 2))  return false;
+            mPos += 4;
+            if (mPos + length > mSize)  return false;
+            output.insert(output.end(), mData + mPos, mData + mPos + length);
+            mPos += length;
+            return true;
+        }
+
+        bool FixedBlock(std::vector<uint8_t>& output)
+        {
+            uint8_t lengths[288 + 30];
+            std::fill(lengths,       lengths + 144, uint8_t(8));
+            std::fill(lengths + 144, lengths + 256, uint8_t(9));
+            std::fill(lengths + 256, lengths + 280, uint8_t(7));
+            std::fill(lengths + 280, lengths + 288, uint8_t(8));
+            std::fill(lengths + 288, lengths + 318, uint8_t(5));
+            Huffman literals, distances;
+            literals.Build(lengths, 288);
+            distances.Build(lengths + 288, 30);
+            return Codes(output, literals, distances);
+        }
+
+        bool DynamicBlock(std::vector<uint8_t>& output)
+        {
+            static const uint8_t ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+            int numLiterals  = Bits(5) + 257;
+            int numDistances = Bits(5) + 1;
+            int numCodes     = Bits(4) + 4;
+            if (numLiterals > 286 || numDistances > 30)  return false;
+
+            uint8_t lengths[286 + 30] = {};
+            for (int i = 0; i < numCodes; ++i)  lengths[ORDER[i]] = static_cast<uint8_t>(Bits(3));
+            Huffman lengthCode;
+            if (!lengthCode.Build(lengths, 19))  return false;
+
+            int index = 0;
+            while (index < numLiterals + numDistances)
+            {
+                int symbol = Decode(lengthCode);
+                if (mOverrun)  return false;
+                if (symbol < 16)
+                {
+                    lengths[index++] = static_cast<uint8_t>(symbol);
+                    continue;
+                }
+
+                uint8_t length = 0;
+                int repeat;
+                if (symbol == 16)
+                {
+                    if (index == 0)  return false;
+                    length = lengths[index - 1];
+                    repeat = 3 + Bits(2);
+                }
+                else if (symbol == 17)  repeat = 3 + Bits(3);
+                else                    repeat = 11 + Bits(7);
+                if (index + repeat > numLiterals + numDistances)  return false;
+                while (repeat--)  lengths[index++] = length;
+            }
+            if (lengths[256] == 0)  return false; // Must have an end of block code
+
+            Huffman literals, distances;
+            if (!literals.Build(lengths, numLiterals) || !distances.Build(lengths + numLiterals, numDistances))  return false;
+            return Codes(output, literals, distances);
+        }
+
+        bool Codes(std::vector<uint8_t>& output, const Huffman& literals, const Huffman& distances)
+        {
+            static const uint16_t LENGTH_BASE[29]  = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                       35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+            static const uint8_t  LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                       3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+            static const uint16_t DIST_BASE[30]    = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                                       513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+            static const uint8_t  DIST_EXTRA[30]   = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+                                                       8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+            for (;;)
+            {
+                int symbol = Decode(literals);
+                if (mOverrun)  return false;
+                if (symbol < 256)
+                {
+                    output.push_back(static_cast<uint8_t>(symbol));
+                }
+                else if (symbol == 256)
+                {
+                    return true;
+                }
+                else
+                {
+                    symbol -= 257;
+                    if (symbol >= 29)  return false;
+                    int length = LENGTH_BASE[symbol] + Bits(LENGTH_EXTRA[symbol]);
+
+                    symbol = Decode(distances);
+                    if (mOverrun || symbol >= 30)  return false;
+                    std::size_t distance = DIST_BASE[symbol] + Bits(DIST_EXTRA[symbol]);
+                    if (distance > output.size())  return false;
+
+                    std::size_t from = output.size() - distance; // Copies may overlap what they are writing
+                    while (length--)  output.push_back(output[from++]);
+                }
+            }
+        }
+
+        const uint8_t* mData;
+        std::size_t    mSize;
+        std::size_t    mPos = 0;
+        uint32_t       mBitBuffer = 0;
+        int            mBitCount  = 0;
+        bool           mOverrun   = false; // Ran off the end of the data or found an invalid code
+    };
+
+
+    /*-----------------------------------------------------------------------------------------
+        PNG
+    -----------------------------------------------------------------------------------------*/
+
+    int Paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+    }
+
+    bool LoadPNG(const std::vector<uint8_t>& file, Image& image, std::string& error)
+    {
+        static const uint8_t SIGNATURE[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+        if (file.size() < 8 || std::memcmp(file.data(), SIGNATURE, 8) != 0)  { error = "not a PNG file";  return false; }
+
+        uint32_t width = 0, height = 0;
+        int bitDepth = 0, colourType = -1;
+        std::vector<uint8_t> compressed;
+        std::vector<uint8_t> palette;            // RGBA
+        int transparentKey[3] = { -1, -1, -1 }; // Colour treated as transparent in grey / RGB images
+
+        std::size_t pos = 8;
+        while (pos + 12 <= file.size())
+        {
+            uint32_t length = ReadBigEndian32(&file[pos]);
+            const char* type = reinterpret_cast<const char*>(&file[pos + 4]);
+            const uint8_t* data = &file[pos + 8];
+            if (length > file.size() - pos - 12)  { error = "truncated PNG file";  return false; }
+
+            if (std::memcmp(type, "IHDR", 4) == 0 && length >= 13)
+            {
+                width = ReadBigEndian32(data);
+                height = ReadBigEndian32(data + 4);
+                bitDepth = data[8];
+                colourType = data[9];
+                if (data[12] != 0)  { error = "interlaced PNG files are not supported";  return false; }
+            }
+            else if (std::memcmp(type, "PLTE", 4) == 0)
+            {
+                for (uint32_t i = 0; i + 2 < length; i += 3)
+                {
+                    palette.insert(palette.end(), { data[i], data[i + 1], data[i + 2], 255 });
+                }
+            }
+            else if (std::memcmp(type, "tRNS", 4) == 0)
+            {
+                if (colourType == 3)
+                {
+                    for (uint32_t i = 0; i < length && i * 4 < palette.size(); ++i)  palette[i * 4 + 3] = data[i];
+                }
+                else if (colourType == 0 && length >= 2)
+                {
+                    transparentKey[0] = transparentKey[1] = transparentKey[2] = (data[0] << 8) | data[1];
+                }
+                else if (colourType == 2 && length >= 6)
+                {
+                    for (int c = 0; c < 3; ++c)  transparentKey[c] = (data[c * 2] << 8) | data[c * 2 + 1];
+                }
+            }
+            else if (std::memcmp(type, "IDAT", 4) == 0)
+            {
+                compressed.insert(compressed.end(), data, data + length);
+            }
+            else if (std::memcmp(type, "IEND", 4) == 0)
+            {
+                break;
+            }
+            pos += length + 12;
+        }
+
+        int channels = colourType == 0 ? 1 : colourType == 2 ? 3 : colourType == 3 ? 1 : colourType == 4 ? 2 : colourType == 6 ? 4 : 0;
+        bool validDepth = bitDepth == 8 || (bitDepth == 16 && colourType != 3) ||
+                          ((bitDepth == 1 || bitDepth == 2 || bitDepth == 4) && (colourType == 0 || colourType == 3));
+        if (width == 0 || height == 0 || width > 16384 || height > 16384 || channels == 0 || !validDepth)
+        {
+            error = "unsupported PNG format";
+            return false;
+        }
+        if (colourType == 3 && palette.empty())  { error = "PNG file has no palette";  return false; }
+
+        std::vector<uint8_t> raw;
+        if (!Inflater(compressed.data(), compressed.size()).Inflate(raw))  { error = "corrupt PNG data";  return false; }
+
+        // Undo the filter applied to each row
+        std::size_t rowBytes = (static_cast<std::size_t>(width) * channels * bitDepth + 7) / 8;
+        std::size_t pixelBytes = std::max(1, channels * bitDepth / 8);
+        if (raw.size() < (rowBytes + 1) * height)  { error = "truncated PNG data";  return false; }
+
+        std::vector<uint8_t> rows(rowBytes * height);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            int filter = raw[y * (rowBytes + 1)];
+            const uint8_t* in = &raw[y * (rowBytes + 1) + 1];
+            uint8_t* row = &rows[y * rowBytes];
+            const uint8_t* prior = y > 0 ? row - rowBytes : nullptr;
+            if (filter > 4)  { error = "corrupt PNG data";  return false; }
+            for (std::size_t i = 0; i < rowBytes; ++i)
+            {
+                int a = i >= pixelBytes ? row[i - pixelBytes] : 0;
+                int b = prior ? prior[i] : 0;
+                int c = prior && i >= pixelBytes ? prior[i - pixelBytes] : 0;
+                int predicted = filter == 1 ? a : filter == 2 ? b : filter == 3 ? (a + b) / 2 : filter == 4 ? Paeth(a, b, c) : 0;
+                row[i] = static_cast<uint8_t>(in[i] + predicted);
+            }
+        }
+
+        // Convert to RGBA
+        auto sample = [&](const uint8_t* row, uint32_t x, int channel) -> int
+        {
+            std::size_t index = static_cast<std::size_t>(x) * channels + channel;
+            if (bitDepth == 8)   return row[index];
+            if (bitDepth == 16)  return (row[index * 2] << 8) | row[index * 2 + 1];
+            int bit = static_cast<int>(index * bitDepth);
+            return (row[bit / 8] >> (8 - bitDepth - bit % 8)) & ((1 << bitDepth) - 1);
+        };
+        float scale = 1.0f / ((1 << bitDepth) - 1);
+
+        image = Image(width, height);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            const uint8_t* row = &rows[y * rowBytes];
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                float* pixel = image.Pixel(x, y);
+                if (colourType == 3)
+                {
+                    std::size_t entry = sample(row, x, 0) * 4u;
+                    if (entry >= palette.size())  entry = 0;
+                    for (int c = 0; c < 4; ++c)  pixel[c] = palette[entry + c] / 255.0f;
+                    continue;
+                }
+
+                int values[4];
+                for (int c = 0; c < channels; ++c)  values[c] = sample(row, x, c);
+                bool grey = colourType == 0 || colourType == 4;
+                for (int c = 0; c < 3; ++c)  pixel[c] = values[grey ? 0 : c] * scale;
+                pixel[3] = (colourType == 4 || colourType == 6) ? values[channels - 1] * scale : 1.0f;
+
+                if (transparentKey[0] >= 0 && values[0] == transparentKey[0] &&
+                    (grey || (values[1] == transparentKey[1] && values[2] == transparentKey[2])))
+                {
+                    pixel[3] = 0.0f;
+                }
+            }
+        }
+        return true;
+    }
+
+
+    /*-----------------------------------------------------------------------------------------
+        TGA
+    -----------------------------------------------------------------------------------------*/
+
+    bool LoadTGA(const std::vector<uint8_t>& file, Image& image, std::string& error)
+    {
+        if (file.size() < 18)  { error = "not a TGA file";  return false; }
+        int idLength   = file[0];
+        int mapType    = file[1];
+        int imageType  = file[2];
+        int width      = ReadLittleEndian16(&file[12]);
+        int height     = ReadLittleEndian16(&file[14]);
+        int bitsPerPixel = file[16];
+        bool topDown   = (file[17] & 0x20) != 0;
+
+        bool rle  = imageType == 10 || imageType == 11;
+        bool grey = imageType == 3 || imageType == 11;
+        int bytesPerPixel = bitsPerPixel / 8;
+        if (mapType != 0 || width == 0 || height == 0 || !(imageType == 2 || imageType == 3 || rle) ||
+            (grey ? bitsPerPixel != 8 : (bitsPerPixel != 24 && bitsPerPixel != 32)))
+        {
+            error = "unsupported TGA format";
+            return false;
+        }
+
+        // Expand RLE packets so both kinds of file can be read in the same way
+        std::size_t pos = 18 + idLength;
+        std::size_t numBytes = static_cast<std::size_t>(width) * height * bytesPerPixel;
+        std::vector<uint8_t> data;
+        data.reserve(numBytes);
+        while (data.size() < numBytes)
+        {
+            if (!rle)
+            {
+                if (pos + numBytes > file.size())  { error = "truncated TGA file";  return false; }
+                data.assign(file.begin() + pos, file.begin() + pos + numBytes);
+                break;
+            }
+            if (pos >= file.size())  { error = "truncated TGA file";  return false; }
+            int header = file[pos++];
+            int count = (header & 0x7f) + 1;
+            std::size_t packetBytes = (header & 0x80) ? bytesPerPixel : static_cast<std::size_t>(count) * bytesPerPixel;
+            if (pos + packetBytes > file.size())  { error = "truncated TGA file";  return false; }
+            for (int i = 0; i < ((header & 0x80) ? count : 1); ++i)
+            {
+                data.insert(data.end(), file.begin() + pos, file.begin() + pos + packetBytes);
+            }
+            pos += packetBytes;
+        }
+        data.resize(numBytes);
+
+        image = Image(width, height);
+        for (int y = 0; y < height; ++y)
+        {
+            const uint8_t* row = &data[static_cast<std::size_t>(topDown ? y : height - 1 - y) * width * bytesPerPixel];
+            for (int x = 0; x < width; ++x)
+            {
+                const uint8_t* in = row + x * bytesPerPixel;
+                float* pixel = image.Pixel(x, y);
+                pixel[0] = in[grey ? 0 : 2] / 255.0f; // Stored as BGRA
+                pixel[1] = in[grey ? 0 : 1] / 255.0f;
+                pixel[2] = in[0] / 255.0f;
+                pixel[3] = bytesPerPixel == 4 ? in[3] / 255.0f : 1.0f;
+            }
+        }
+        return true;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Public functions
+-----------------------------------------------------------------------------------------*/
+
+// Load a PNG (non-interlaced) or TGA (uncompressed or RLE) file, chosen by the file extension. Images without alpha
+// get an alpha of 1. Returns false on failure and sets error to the reason
+bool LoadImage(const std::string& fileName, Image& image, std::string& error)
+{
+    std::string extension = fileName.substr(fileName.find_last_of('.') + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    std::vector<uint8_t> file;
+    if (extension != "png" && extension != "tga")  { error = "unsupported file type (use PNG or TGA)";  return false; }
+    if (!ReadFile(fileName, file))                 { error = "cannot read file";  return false; }
+
+    return extension == "png" ? LoadPNG(file, image, error) : LoadTGA(file, image, error);
+}
+
+
+// Returns true if any pixel in the image has an alpha value less than 1
+bool HasAlpha(const Image& image)
+{
+    for (std::size_t i = 3; i < image.pixels.size(); i += 4)
+    {
+        if (image.pixels[i] < 1.0f)  return true;
+    }
+    return false;
+}
@@ -0,0 +1,37 @@
+//--------------------------------------------------------------------------------------
+// Images used by the texture cooker, and loading them from PNG and TGA files
+//--------------------------------------------------------------------------------------
+// Pixels are held as floats so mip-maps can be filtered without losing precision. The loaders are plain C++ with
+// no platform or library dependencies so the cooker can run on any build machine.
+
+#include <vector>
+#include <string>
+
+#ifndef _IMAGE_H_INCLUDED_
+#define _IMAGE_H_INCLUDED_
+
+
+// An RGBA image, 4 floats per pixel in the range 0->1, rows stored top to bottom
+struct Image
+{
+    int width  = 0;
+    int height = 0;
+    std::vector<float> pixels;
+
+    Image() = default;
+    Image(int w, int h) : width(w), height(h), pixels(static_cast<std::size_t>(w) * h * 4) {}
+
+    float*       Pixel(int x, int y)        { return &pixels[(static_cast<std::size_t>(y) * width + x) * 4]; }
+    const float* Pixel(int x, int y) const  { return &pixels[(static_cast<std::size_t>(y) * width + x) * 4]; }
+};
+
+
+// Load a PNG (non-interlaced) or TGA (uncompressed or RLE) file, chosen by the file extension. Images without alpha
+// get an alpha of 1. Returns false on failure and sets error to the reason
+bool LoadImage(const std::string& fileName, Image& image, std::string& error);
+
+// Returns true if any pixel in the image has an alpha value less than 1
+bool HasAlpha(const Image& image);
+
+
+#endif //_IMAGE_H_INCLUDED_
@@ -0,0 +1,129 @@
+//--------------------------------------------------------------------------------------
+// Texture cooker - converts PNG/TGA images into block compressed DDS files with mip-maps
+//--------------------------------------------------------------------------------------
+// JPG and PNG textures are decoded by WIC every time the app starts and uploaded as uncompressed RGBA. Cooking them
+// offline into BC1/BC3/BC5 DDS files means the app just copies the file to the GPU, and the texture uses a quarter
+// (BC3/BC5) or an eighth (BC1) of the memory and bandwidth. LoadTexture picks up the cooked file automatically, e.g.
+// Smoke.png.dds is used in place of Smoke.png when it is at least as new.
+//
+// The cooker is plain C++14 with no dependencies so it can run in a build pipeline on Windows or Linux. build.sh
+// builds it with g++ (or the compiler given), which is just
+//     g++ -O2 -std=c++14 -pthread -I../../Math *.cpp -o TextureCooker
+//     ./TextureCooker --wrap ../../Smoke.png
+//
+// JPG files are not read, convert them to PNG first (any lossless conversion will do).
+
+#include "Image.h"
+#include "Mipmaps.h"
+#include "BlockCompression.h"
+#include "DDSFile.h"
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+
+namespace
+{
+    void PrintUsage()
+    {
+        std::cout <<
+            "Usage: TextureCooker [options] input.png|input.tga [output.dds]\n"
+            "Output defaults to the input file name with .dds added, which LoadTexture looks for\n"
+            "Options:\n"
+            "  --format bc1|bc3|bc5  Compressed format. Default is bc3 for images with alpha, bc1 otherwise, bc5 for normal maps without alpha\n"
+            "  --filter box|kaiser   Mip-map filter, default kaiser\n"
+            "  --srgb                Colours are sRGB, filter in linear space and store as an sRGB format\n"
+            "  --normal              Image is a normal map, renormalise mip-maps\n"
+            "  --wrap                Texture tiles, filter mip-maps across the edges\n"
+            "  --no-mips             Only store the full size image\n"
+            "  --threads N           Number of threads to use, default is one per CPU core\n";
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    MipOptions mipOptions;
+    bool formatGiven = false, mips = true;
+    BlockFormat format = BlockFormat::BC1;
+    int numThreads = 0;
+    std::string inputFileName, outputFileName;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--format" && hasValue)
+        {
+            std::string value = argv[++i];
+            formatGiven = true;
+            if      (value == "bc1")  format = BlockFormat::BC1;
+            else if (value == "bc3")  format = BlockFormat::BC3;
+            else if (value == "bc5")  format = BlockFormat::BC5;
+            else  { PrintUsage();  return 1; }
+        }
+        else if (arg == "--filter" && hasValue)
+        {
+            std::string value = argv[++i];
+            if      (value == "box")     mipOptions.filter = MipFilter::Box;
+            else if (value == "kaiser")  mipOptions.filter = MipFilter::Kaiser;
+            else  { PrintUsage();  return 1; }
+        }
+        else if (arg == "--threads" && hasValue)  numThreads = std::atoi(argv[++i]);
+        else if (arg == "--srgb")                 mipOptions.srgb = true;
+        else if (arg == "--normal")               mipOptions.normalMap = true;
+        else if (arg == "--wrap")                 mipOptions.wrap = true;
+        else if (arg == "--no-mips")              mips = false;
+        else if (arg[0] != '-' && inputFileName.empty())   inputFileName = arg;
+        else if (arg[0] != '-' && outputFileName.empty())  outputFileName = arg;
+        else  { PrintUsage();  return 1; }
+    }
+    if (inputFileName.empty())  { PrintUsage();  return 1; }
+    if (outputFileName.empty())  outputFileName = inputFileName + ".dds";
+
+    Image image;
+    std::string error;
+    if (!LoadImage(inputFileName, image, error))
+    {
+        std::cerr << inputFileName << ": " << error << "\n";
+        return 1;
+    }
+
+    if (!formatGiven)
+    {
+        format = HasAlpha(image) ? BlockFormat::BC3 : mipOptions.normalMap ? BlockFormat::BC5 : BlockFormat::BC1;
+    }
+    if (format == BlockFormat::BC5 && mipOptions.srgb)
+    {
+        std::cerr << "BC5 has no sRGB format\n";
+        return 1;
+    }
+
+    std::vector<Image> levels;
+    if (mips)  levels = GenerateMipChain(image, mipOptions);
+    else       levels.push_back(image);
+
+    CompressedTexture texture;
+    texture.width     = image.width;
+    texture.height    = image.height;
+    texture.mipLevels = static_cast<int>(levels.size());
+    texture.format    = format;
+    texture.srgb      = mipOptions.srgb;
+    for (const auto& level : levels)
+    {
+        CompressImage(level, format, numThreads, texture.data);
+    }
+
+    if (!SaveDDS(texture, outputFileName))
+    {
+        std::cerr << outputFileName << ": cannot write file\n";
+        return 1;
+    }
+
+    static const char* FORMAT_NAMES[] = { "BC1", "BC3", "BC5" };
+    std::cout << inputFileName << " -> " << outputFileName << " (" << image.width << "x" << image.height << ", "
+              << FORMAT_NAMES[static_cast<int>(format)] << (texture.srgb ? " sRGB" : "") << ", "
+              << texture.mipLevels << " mip levels, " << texture.data.size() << " bytes)\n";
+    return 0;
+}
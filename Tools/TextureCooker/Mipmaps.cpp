@@ -0,0 +1,164 @@
+//--------------------------------------------------------------------------------------
+// Building mip-map chains for the texture cooker
+//--------------------------------------------------------------------------------------
+
+#include "Mipmaps.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace
+{
+    // Kaiser filter settings, the usual defaults for mip-map generation
+    const float KAISER_WIDTH = 3.0f; // Radius of the filter in destination pixels
+    const float KAISER_ALPHA = 4.0f; // Shape of the window, higher values reduce ringing but blur more
+
+    // Zeroth order modified Bessel function, used by the Kaiser window
+    float BesselI0(float x)
+    {
+        float sum = 1.0f, term = 1.0f;
+        for (int k = 1; k < 20; ++k)
+        {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    float Kaiser(float x)
+    {
+        if (std::abs(x) >= KAISER_WIDTH)  return 0.0f;
+        const float PI = 3.14159265f;
+        float sinc = x == 0.0f ? 1.0f : std::sin(PI * x) / (PI * x);
+        float t = x / KAISER_WIDTH;
+        return sinc * BesselI0(KAISER_ALPHA * std::sqrt(1.0f - t * t)) / BesselI0(KAISER_ALPHA);
+    }
+
+    float SRGBToLinear(float c)
+    {
+        return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    float LinearToSRGB(float c)
+    {
+        return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+    }
+
+
+    // Source pixels and weights that make up each destination pixel when resizing along one axis
+    struct Tap
+    {
+        int   source;
+        float weight;
+    };
+    using Taps = std::vector<std::vector<Tap>>;
+
+    Taps CalculateTaps(int sourceSize, int destSize, const MipOptions& options)
+    {
+        Taps taps(destSize);
+        float scale = static_cast<float>(sourceSize) / destSize;
+        for (int d = 0; d < destSize; ++d)
+        {
+            float start = d * scale, end = start + scale, centre = start + scale * 0.5f;
+            float radius = options.filter == MipFilter::Box ? scale * 0.5f : KAISER_WIDTH * scale;
+
+            float total = 0.0f;
+            for (int s = static_cast<int>(std::floor(centre - radius)); s < static_cast<int>(std::ceil(centre + radius)); ++s)
+            {
+                // Box weight is how much of the source pixel is covered, Kaiser weight is sampled at the pixel centre
+                float weight = options.filter == MipFilter::Box ? std::min(end, s + 1.0f) - std::max(start, static_cast<float>(s))
+                                                                : Kaiser((s + 0.5f - centre) / scale);
+                if (weight == 0.0f)  continue;
+
+                int source = options.wrap ? ((s % sourceSize) + sourceSize) % sourceSize : std::min(std::max(s, 0), sourceSize - 1);
+                taps[d].push_back({ source, weight });
+                total += weight;
+            }
+            for (auto& tap : taps[d])  tap.weight /= total;
+        }
+        return taps;
+    }
+
+
+    // Halve the size of an image (each side stops at 1), filtering horizontally then vertically
+    Image Downsample(const Image& source, const MipOptions& options)
+    {
+        int width  = std::max(source.width  / 2, 1);
+        int height = std::max(source.height / 2, 1);
+        Taps horizontal = CalculateTaps(source.width,  width,  options);
+        Taps vertical   = CalculateTaps(source.height, height, options);
+
+        Image wide(width, source.height);
+        for (int y = 0; y < source.height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                float* out = wide.Pixel(x, y);
+                for (const auto& tap : horizontal[x])
+                {
+                    const float* in = source.Pixel(tap.source, y);
+                    for (int c = 0; c < 4; ++c)  out[c] += in[c] * tap.weight;
+                }
+            }
+        }
+
+        Image result(width, height);
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                float* out = result.Pixel(x, y);
+                for (const auto& tap : vertical[y])
+                {
+                    const float* in = wide.Pixel(x, tap.source);
+                    for (int c = 0; c < 4; ++c)  out[c] += in[c] * tap.weight;
+                }
+                for (int c = 0; c < 4; ++c)  out[c] = std::min(std::max(out[c], 0.0f), 1.0f); // Kaiser filter can overshoot
+
+                if (options.normalMap)
+                {
+                    float n[3] = { out[0] * 2 - 1, out[1] * 2 - 1, out[2] * 2 - 1 };
+                    float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    if (length > 0.0f)
+                    {
+                        for (int c = 0; c < 3; ++c)  out[c] = n[c] / length * 0.5f + 0.5f;
+                    }
+                }
+            }
+        }
+        return result;
+    }
+}
+
+
+// Build the full chain of mip-maps for an image, down to 1x1. The first entry is the image itself
+std::vector<Image> GenerateMipChain(const Image& image, const MipOptions& options)
+{
+    std::vector<Image> mips;
+    mips.push_back(image);
+
+    Image level = image;
+    if (options.srgb)
+    {
+        for (std::size_t i = 0; i < level.pixels.size(); ++i)
+        {
+            if (i % 4 != 3)  level.pixels[i] = SRGBToLinear(level.pixels[i]);
+        }
+    }
+
+    while (level.width > 1 || level.height > 1)
+    {
+        level = Downsample(level, options);
+        mips.push_back(level);
+        if (options.srgb)
+        {
+            auto& pixels = mips.back().pixels;
+            for (std::size_t i = 0; i < pixels.size(); ++i)
+            {
+                if (i % 4 != 3)  pixels[i] = LinearToSRGB(pixels[i]);
+            }
+        }
+    }
+    return mips;
+}
@@ -0,0 +1,32 @@
+//--------------------------------------------------------------------------------------
+// Building mip-map chains for the texture cooker
+//--------------------------------------------------------------------------------------
+
+#include "Image.h"
+
+#include <vector>
+
+#ifndef _MIPMAPS_H_INCLUDED_
+#define _MIPMAPS_H_INCLUDED_
+
+
+enum class MipFilter
+{
+    Box,    // Average of each 2x2 square, fast but slightly blurry and prone to aliasing
+    Kaiser, // Windowed sinc, keeps mip-maps sharper. Same filter as used by most texture tools
+};
+
+struct MipOptions
+{
+    MipFilter filter    = MipFilter::Kaiser;
+    bool      srgb      = false; // Colours are sRGB encoded, filter them in linear space (alpha is always linear)
+    bool      normalMap = false; // RGB holds a normal packed into 0->1, renormalise the normals in each mip-map
+    bool      wrap      = false; // Texture tiles, so filter across the edges rather than clamping at them
+};
+
+
+// Build the full chain of mip-maps for an image, down to 1x1. The first entry is the image itself
+std::vector<Image> GenerateMipChain(const Image& image, const MipOptions& options);
+
+
+#endif //_MIPMAPS_H_INCLUDED_
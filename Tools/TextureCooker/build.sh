@@ -0,0 +1,6 @@
+#!/bin/sh
+# Build the texture cooker (see Main.cpp for usage)
+# Usage: ./build.sh [compiler], run from this folder. On Windows the same sources build with any C++14 compiler
+set -e
+CXX=${1:-g++}
+$CXX -O2 -std=c++14 -Wall -pthread -I../../Math *.cpp -o TextureCooker
@@ -0,0 +1,487 @@
+//--------------------------------------------------------------------------------------
+// Storage for the positions, rotations, scales and world matrices of all models
+//--------------------------------------------------------------------------------------
+// Rather than each model holding its own transform, all transforms are kept together in arrays. Each
+// component has its own array (x positions, y positions etc.) so world matrices can be built for several
+// models at once with SIMD instructions, and updating thousands of models walks through memory in order
+// rather than jumping between separately allocated objects.
+// Transforms can be attached to a parent transform, the packed arrays are kept sorted so parents always come
+// before their children.
+
+#include "TransformStorage.h"
+#include "MathSIMD.h"
+
+#include <cstring>
+#include <type_traits>
+
+
+// Transforms for all the models in the app
+TransformStorage gTransforms;
+
+
+/*-----------------------------------------------------------------------------------------
+    SIMD helpers
+-----------------------------------------------------------------------------------------*/
+// The local matrix calculation is written once as a template and used with 4-wide (SSE) and 8-wide (AVX)
+// registers. Each register holds the same value for several transforms, so the maths is exactly that of
+// MatrixTransform in CQuaternion.cpp, just done for several transforms at a time
+#if defined(MATH_SSE)
+namespace
+{
+    inline __m128 Load (const float* p, __m128)  { return _mm_loadu_ps(p); }
+    inline __m128 Set  (float f, __m128)         { return _mm_set1_ps(f); }
+    inline __m128 Add  (__m128 a, __m128 b)      { return _mm_add_ps(a, b); }
+    inline __m128 Sub  (__m128 a, __m128 b)      { return _mm_sub_ps(a, b); }
+    inline __m128 Mul  (__m128 a, __m128 b)      { return _mm_mul_ps(a, b); }
+
+    // Transpose four registers holding one matrix row's elements for 4 transforms, and write that row into
+    // each of the 4 matrices
+    inline void StoreRow(__m128 a, __m128 b, __m128 c, __m128 d, CMatrix4x4* matrices, int row)
+    {
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+        _mm_storeu_ps(&matrices[0].e00 + row * 4, a);
+        _mm_storeu_ps(&matrices[1].e00 + row * 4, b);
+        _mm_storeu_ps(&matrices[2].e00 + row * 4, c);
+        _mm_storeu_ps(&matrices[3].e00 + row * 4, d);
+    }
+
+#if defined(MATH_AVX)
+    inline __m256 Load (const float* p, __m256)  { return _mm256_loadu_ps(p); }
+    inline __m256 Set  (float f, __m256)         { return _mm256_set1_ps(f); }
+    inline __m256 Add  (__m256 a, __m256 b)      { return _mm256_add_ps(a, b); }
+    inline __m256 Sub  (__m256 a, __m256 b)      { return _mm256_sub_ps(a, b); }
+    inline __m256 Mul  (__m256 a, __m256 b)      { return _mm256_mul_ps(a, b); }
+
+    // As above for 8 transforms. The 256-bit shuffles work on each 128-bit half separately, so the low half
+    // of each result is a row for transforms 0-3 and the high half is the row for transforms 4-7
+    inline void StoreRow(__m256 a, __m256 b, __m256 c, __m256 d, CMatrix4x4* matrices, int row)
+    {
+        __m256 t0 = _mm256_unpacklo_ps(a, b);
+        __m256 t1 = _mm256_unpackhi_ps(a, b);
+        __m256 t2 = _mm256_unpacklo_ps(c, d);
+        __m256 t3 = _mm256_unpackhi_ps(c, d);
+        __m256 r0 = _mm256_shuffle_ps(t0, t2, MATH_SHUFFLE(0, 1, 0, 1));
+        __m256 r1 = _mm256_shuffle_ps(t0, t2, MATH_SHUFFLE(2, 3, 2, 3));
+        __m256 r2 = _mm256_shuffle_ps(t1, t3, MATH_SHUFFLE(0, 1, 0, 1));
+        __m256 r3 = _mm256_shuffle_ps(t1, t3, MATH_SHUFFLE(2, 3, 2, 3));
+        _mm_storeu_ps(&matrices[0].e00 + row * 4, _mm256_castps256_ps128(r0));
+        _mm_storeu_ps(&matrices[1].e00 + row * 4, _mm256_castps256_ps128(r1));
+        _mm_storeu_ps(&matrices[2].e00 + row * 4, _mm256_castps256_ps128(r2));
+        _mm_storeu_ps(&matrices[3].e00 + row * 4, _mm256_castps256_ps128(r3));
+        _mm_storeu_ps(&matrices[4].e00 + row * 4, _mm256_extractf128_ps(r0, 1));
+        _mm_storeu_ps(&matrices[5].e00 + row * 4, _mm256_extractf128_ps(r1, 1));
+        _mm_storeu_ps(&matrices[6].e00 + row * 4, _mm256_extractf128_ps(r2, 1));
+        _mm_storeu_ps(&matrices[7].e00 + row * 4, _mm256_extractf128_ps(r3, 1));
+    }
+#endif
+
+    // Build local matrices for as many transforms as fit in a Reg, reading from the given index in each array
+    template <typename Reg>
+    inline void BuildBlock(const float* px, const float* py, const float* pz,
+                           const float* qx, const float* qy, const float* qz, const float* qw,
+                           const float* sx, const float* sy, const float* sz, CMatrix4x4* matrices)
+    {
+        Reg x = Load(qx, Reg{}), y = Load(qy, Reg{}), z = Load(qz, Reg{}), w = Load(qw, Reg{});
+        Reg one = Set(1.0f, Reg{}), zero = Set(0.0f, Reg{});
+
+        // Double x, y, z once rather than doubling each product
+        Reg x2 = Add(x, x), y2 = Add(y, y), z2 = Add(z, z);
+        Reg xx = Mul(x, x2), yy = Mul(y, y2), zz = Mul(z, z2);
+        Reg xy = Mul(x, y2), xz = Mul(x, z2), yz = Mul(y, z2);
+        Reg wx = Mul(w, x2), wy = Mul(w, y2), wz = Mul(w, z2);
+
+        Reg scaleX = Load(sx, Reg{}), scaleY = Load(sy, Reg{}), scaleZ = Load(sz, Reg{});
+        StoreRow(Mul(scaleX, Sub(one, Add(yy, zz))), Mul(scaleX, Add(xy, wz)), Mul(scaleX, Sub(xz, wy)), zero, matrices, 0);
+        StoreRow(Mul(scaleY, Sub(xy, wz)), Mul(scaleY, Sub(one, Add(xx, zz))), Mul(scaleY, Add(yz, wx)), zero, matrices, 1);
+        StoreRow(Mul(scaleZ, Add(xz, wy)), Mul(scaleZ, Sub(yz, wx)), Mul(scaleZ, Sub(one, Add(xx, yy))), zero, matrices, 2);
+        StoreRow(Load(px, Reg{}), Load(py, Reg{}), Load(pz, Reg{}), one, matrices, 3);
+    }
+}
+#endif
+
+
+/*-----------------------------------------------------------------------------------------
+    Construction / Usage
+-----------------------------------------------------------------------------------------*/
+
+// Add a new transform, returns handle used to access it
+TransformHandle TransformStorage::Create(CVector3 position, CQuaternion rotation, CVector3 scale)
+{
+    // Reuse a lookup table entry if there is one free
+    TransformHandle handle;
+    if (!mFreeList.empty())
+    {
+        handle.index = mFreeList.back();
+        mFreeList.pop_back();
+    }
+    else
+    {
+        handle.index = static_cast<uint32_t>(mSparseToDense.size());
+        mSparseToDense.push_back(0);
+        mGenerations.push_back(0);
+    }
+    handle.generation = mGenerations[handle.index];
+
+    // New transform goes on the end of the packed arrays - it has no parent so the order is still correct
+    mSparseToDense[handle.index] = static_cast<uint32_t>(mDenseToSparse.size());
+    mDenseToSparse.push_back(handle.index);
+
+    mPositionX.push_back(position.x);  mPositionY.push_back(position.y);  mPositionZ.push_back(position.z);
+    mRotationX.push_back(rotation.x);  mRotationY.push_back(rotation.y);  mRotationZ.push_back(rotation.z);  mRotationW.push_back(rotation.w);
+    mScaleX.push_back(scale.x);        mScaleY.push_back(scale.y);        mScaleZ.push_back(scale.z);
+    mLocalMatrices.push_back(MatrixIdentity());
+    mWorldMatrices.push_back(MatrixIdentity());
+    mLocalDirty.push_back(1);
+    mWorldDirty.push_back(1);
+    mWorldVersions.push_back(0);
+    mParentVersions.push_back(0);
+    mParents.push_back(UINT32_MAX);
+    mChildCounts.push_back(0);
+
+    return handle;
+}
+
+
+// Remove a transform, the handle (and any copies of it) will no longer be valid. Any transforms attached
+// to it become unattached, keeping their current position, rotation and scale relative to the world
+void TransformStorage::Destroy(TransformHandle handle)
+{
+    if (!IsValid(handle))  return;
+
+    uint32_t dense = mSparseToDense[handle.index];
+
+    // Detach children, their world matrix becomes their new local transform
+    if (mChildCounts[dense] > 0)
+    {
+        for (uint32_t i = 0; i < Count(); ++i)
+        {
+            if (mParents[i] != handle.index)  continue;
+
+            CMatrix4x4 worldMatrix = UpdateWorldMatrix(i);
+            CVector3    position = worldMatrix.GetPosition();
+            CQuaternion rotation = QuaternionFromMatrix(worldMatrix);
+            CVector3    scale    = worldMatrix.GetScale();
+            mPositionX[i] = position.x;  mPositionY[i] = position.y;  mPositionZ[i] = position.z;
+            mRotationX[i] = rotation.x;  mRotationY[i] = rotation.y;  mRotationZ[i] = rotation.z;  mRotationW[i] = rotation.w;
+            mScaleX[i] = scale.x;        mScaleY[i] = scale.y;        mScaleZ[i] = scale.z;
+            mParents[i] = UINT32_MAX;
+            mLocalDirty[i] = mWorldDirty[i] = 1;
+        }
+    }
+    if (mParents[dense] != UINT32_MAX)  --mChildCounts[mSparseToDense[mParents[dense]]];
+
+    // Move the last transform in the packed arrays into the space left by the removed one
+    uint32_t last = static_cast<uint32_t>(Count() - 1);
+    if (dense != last)
+    {
+        ForEachPackedArray([=](auto& a) { a[dense] = a[last]; });
+        mSparseToDense[mDenseToSparse[dense]] = dense;
+
+        // The moved transform may now be before its parent
+        if (mParents[dense] != UINT32_MAX && mSparseToDense[mParents[dense]] > dense)  mOrderDirty = true;
+    }
+    ForEachPackedArray([](auto& a) { a.pop_back(); });
+
+    // Changing the generation invalidates existing handles to this lookup entry
+    ++mGenerations[handle.index];
+    mFreeList.push_back(handle.index);
+}
+
+
+// Returns true if the handle refers to a transform that has not been destroyed
+bool TransformStorage::IsValid(TransformHandle handle) const
+{
+    return handle.index < mGenerations.size() && mGenerations[handle.index] == handle.generation;
+}
+
+
+// Attach a transform to a parent, pass a default constructed handle as the parent to detach it. The
+// transform's position, rotation and scale are used as is, but are now relative to the parent.
+// Returns false if the handles are not valid or if the parent is attached below the child
+bool TransformStorage::SetParent(TransformHandle child, TransformHandle parent)
+{
+    if (!IsValid(child))  return false;
+    bool detach = (parent.index == UINT32_MAX);
+    if (!detach && !IsValid(parent))  return false;
+
+    // Check the child is not the parent or one of the parent's parents, which would make a loop
+    if (!detach)
+    {
+        for (uint32_t ancestor = parent.index; ancestor != UINT32_MAX; ancestor = mParents[mSparseToDense[ancestor]])
+        {
+            if (ancestor == child.index)  return false;
+        }
+    }
+
+    uint32_t dense = mSparseToDense[child.index];
+    if (mParents[dense] != UINT32_MAX)  --mChildCounts[mSparseToDense[mParents[dense]]];
+    mParents[dense] = parent.index;
+    mWorldDirty[dense] = 1;
+    if (!detach)
+    {
+        uint32_t parentDense = mSparseToDense[parent.index];
+        ++mChildCounts[parentDense];
+        if (parentDense > dense)  mOrderDirty = true;
+    }
+    return true;
+}
+
+
+// Parent of the transform, or a default constructed handle if it has none
+TransformHandle TransformStorage::Parent(TransformHandle handle) const
+{
+    TransformHandle parent;
+    uint32_t parentIndex = mParents[mSparseToDense[handle.index]];
+    if (parentIndex != UINT32_MAX)
+    {
+        parent.index = parentIndex;
+        parent.generation = mGenerations[parentIndex];
+    }
+    return parent;
+}
+
+
+// Rebuild the world matrices of all transforms that have changed since their matrix was last built
+void TransformStorage::UpdateWorldMatrices()
+{
+    if (mOrderDirty)  SortByDepth();
+
+    // First rebuild local matrices. Work in blocks the width of the SIMD registers, skipping blocks where nothing
+    // has changed. Building the whole block is as cheap as building one matrix, and unchanged transforms give the
+    // same matrix
+#if defined(MATH_AVX)
+    const std::size_t blockSize = 8;
+    uint64_t blockDirty;
+#else
+    const std::size_t blockSize = 4;
+    uint32_t blockDirty;
+#endif
+
+    std::size_t count = Count();
+    std::size_t i = 0;
+    for (; i + blockSize <= count; i += blockSize)
+    {
+        std::memcpy(&blockDirty, &mLocalDirty[i], blockSize);
+        if (blockDirty != 0)
+        {
+            BuildLocalMatrices(i, blockSize);
+            std::memset(&mLocalDirty[i], 0, blockSize);
+        }
+    }
+    for (; i < count; ++i)
+    {
+        if (mLocalDirty[i])
+        {
+            BuildLocalMatrices(i, 1);
+            mLocalDirty[i] = 0;
+        }
+    }
+
+    // Then world matrices in a single pass - parents come before children so a parent's world matrix is always
+    // up to date when its children are reached. Children are only rebuilt if they changed or their parent did
+    for (i = 0; i < count; ++i)
+    {
+        uint32_t parent = mParents[i];
+        if (parent == UINT32_MAX)
+        {
+            if (mWorldDirty[i])
+            {
+                mWorldMatrices[i] = mLocalMatrices[i];
+                ++mWorldVersions[i];
+                mWorldDirty[i] = 0;
+            }
+        }
+        else
+        {
+            uint32_t parentDense = mSparseToDense[parent];
+            if (mWorldDirty[i] || mParentVersions[i] != mWorldVersions[parentDense])
+            {
+                mWorldMatrices[i] = mLocalMatrices[i] * mWorldMatrices[parentDense];
+                mParentVersions[i] = mWorldVersions[parentDense];
+                ++mWorldVersions[i];
+                mWorldDirty[i] = 0;
+            }
+        }
+    }
+}
+
+
+// Build local matrices (from position, rotation and scale only) for count transforms starting at the given
+// index in the packed arrays
+void TransformStorage::BuildLocalMatrices(std::size_t first, std::size_t count)
+{
+    std::size_t i = first, end = first + count;
+
+#if defined(MATH_AVX)
+    for (; i + 8 <= end; i += 8)
+    {
+        BuildBlock<__m256>(&mPositionX[i], &mPositionY[i], &mPositionZ[i], &mRotationX[i], &mRotationY[i], &mRotationZ[i],
+                           &mRotationW[i], &mScaleX[i], &mScaleY[i], &mScaleZ[i], &mLocalMatrices[i]);
+    }
+#endif
+#if defined(MATH_SSE)
+    for (; i + 4 <= end; i += 4)
+    {
+        BuildBlock<__m128>(&mPositionX[i], &mPositionY[i], &mPositionZ[i], &mRotationX[i], &mRotationY[i], &mRotationZ[i],
+                           &mRotationW[i], &mScaleX[i], &mScaleY[i], &mScaleZ[i], &mLocalMatrices[i]);
+    }
+#endif
+    for (; i < end; ++i)
+    {
+        mLocalMatrices[i] = MatrixTransform({ mPositionX[i], mPositionY[i], mPositionZ[i] },
+                                            { mRotationX[i], mRotationY[i], mRotationZ[i], mRotationW[i] },
+                                            { mScaleX[i], mScaleY[i], mScaleZ[i] });
+    }
+}
+
+
+// Bring the world matrix at the given index in the packed arrays up to date, updating its parents first
+const CMatrix4x4& TransformStorage::UpdateWorldMatrix(uint32_t i)
+{
+    if (mLocalDirty[i])
+    {
+        BuildLocalMatrices(i, 1);
+        mLocalDirty[i] = 0;
+    }
+
+    uint32_t parent = mParents[i];
+    if (parent == UINT32_MAX)
+    {
+        if (mWorldDirty[i])
+        {
+            mWorldMatrices[i] = mLocalMatrices[i];
+            ++mWorldVersions[i];
+            mWorldDirty[i] = 0;
+        }
+    }
+    else
+    {
+        uint32_t parentDense = mSparseToDense[parent];
+        const CMatrix4x4& parentMatrix = UpdateWorldMatrix(parentDense);
+        if (mWorldDirty[i] || mParentVersions[i] != mWorldVersions[parentDense])
+        {
+            mWorldMatrices[i] = mLocalMatrices[i] * parentMatrix;
+            mParentVersions[i] = mWorldVersions[parentDense];
+            ++mWorldVersions[i];
+            mWorldDirty[i] = 0;
+        }
+    }
+    return mWorldMatrices[i];
+}
+
+
+// Reorder the packed arrays so every transform comes after its parent. Transforms are sorted by their depth in
+// the hierarchy (roots, then their children, grandchildren etc.), otherwise keeping their existing order
+void TransformStorage::SortByDepth()
+{
+    // Find the depth of each transform, walking up to the nearest parent whose depth is already known
+    std::size_t count = Count();
+    std::vector<uint32_t> depths(count, UINT32_MAX);
+    std::vector<uint32_t> path;
+    uint32_t maxDepth = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t current = i;
+        while (depths[current] == UINT32_MAX && mParents[current] != UINT32_MAX)
+        {
+            path.push_back(current);
+            current = mSparseToDense[mParents[current]];
+        }
+        if (depths[current] == UINT32_MAX)  depths[current] = 0;
+        uint32_t depth = depths[current];
+        while (!path.empty())
+        {
+            depths[path.back()] = ++depth;
+            path.pop_back();
+        }
+        if (depths[i] > maxDepth)  maxDepth = depths[i];
+    }
+
+    // Counting sort by depth, gives new position for each transform
+    std::vector<uint32_t> starts(maxDepth + 2, 0);
+    for (uint32_t i = 0; i < count; ++i)  ++starts[depths[i] + 1];
+    for (uint32_t d = 1; d <= maxDepth + 1; ++d)  starts[d] += starts[d - 1];
+    std::vector<uint32_t> order(count); // Old position of the transform that goes in each new position
+    for (uint32_t i = 0; i < count; ++i)  order[starts[depths[i]]++] = i;
+
+    // Move the data to its new positions and update the lookup table
+    ForEachPackedArray([&](auto& a)
+    {
+        std::decay_t<decltype(a)> old = a;
+        for (uint32_t i = 0; i < count; ++i)  a[i] = old[order[i]];
+    });
+    for (uint32_t i = 0; i < count; ++i)  mSparseToDense[mDenseToSparse[i]] = i;
+
+    mOrderDirty = false;
+}
+
+
+// Call the given function on each of the packed arrays (used when moving or reordering transforms)
+template <typename Function>
+void TransformStorage::ForEachPackedArray(Function f)
+{
+    f(mPositionX);  f(mPositionY);  f(mPositionZ);
+    f(mRotationX);  f(mRotationY);  f(mRotationZ);  f(mRotationW);
+    f(mScaleX);     f(mScaleY);     f(mScaleZ);
+    f(mLocalMatrices);
+    f(mWorldMatrices);
+    f(mLocalDirty);
+    f(mWorldDirty);
+    f(mWorldVersions);
+    f(mParentVersions);
+    f(mParents);
+    f(mChildCounts);
+    f(mDenseToSparse);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Data access
+-----------------------------------------------------------------------------------------*/
+
+CVector3 TransformStorage::Position(TransformHandle handle) const
+{
+    uint32_t i = mSparseToDense[handle.index];
+    return { mPositionX[i], mPositionY[i], mPositionZ[i] };
+}
+
+CQuaternion TransformStorage::Rotation(TransformHandle handle) const
+{
+    uint32_t i = mSparseToDense[handle.index];
+    return { mRotationX[i], mRotationY[i], mRotationZ[i], mRotationW[i] };
+}
+
+CVector3 TransformStorage::Scale(TransformHandle handle) const
+{
+    uint32_t i = mSparseToDense[handle.index];
+    return { mScaleX[i], mScaleY[i], mScaleZ[i] };
+}
+
+
+void TransformStorage::SetPosition(TransformHandle handle, CVector3 position)
+{
+    uint32_t i = mSparseToDense[handle.index];
+    mPositionX[i] = position.x;  mPositionY[i] = position.y;  mPositionZ[i] = position.z;
+    mLocalDirty[i] = mWorldDirty[i] = 1;
+}
+
+void TransformStorage::SetRotation(TransformHandle handle, CQuaternion rotation)
+{
+    uint32_t i = mSparseToDense[handle.index];
+    mRotationX[i] = rotation.x;  mRotationY[i] = rotation.y;  mRotationZ[i] = rotation.z;  mRotationW[i] = rotation.w;
+    mLocalDirty[i] = mWorldDirty[i] = 1;
+}
+
+void TransformStorage::SetScale(TransformHandle handle, CVector3 scale)
+{
+    uint32_t i = mSparseToDense[handle.index];
+    mScaleX[i] = scale.x;  mScaleY[i] = scale.y;  mScaleZ[i] = scale.z;
+    mLocalDirty[i] = mWorldDirty[i] = 1;
+}
+
+
+// World matrix built from the position, rotation and scale and those of all parents, rebuilt first if it is out of date
+const CMatrix4x4& TransformStorage::WorldMatrix(TransformHandle handle)
+{
+    return UpdateWorldMatrix(mSparseToDense[handle.index]);
+}
@@ -0,0 +1,138 @@
+//--------------------------------------------------------------------------------------
+// Storage for the positions, rotations, scales and world matrices of all models
+//--------------------------------------------------------------------------------------
+// Rather than each model holding its own transform, all transforms are kept together in arrays. Each
+// component has its own array (x positions, y positions etc.) so world matrices can be built for several
+// models at once with SIMD instructions, and updating thousands of models walks through memory in order
+// rather than jumping between separately allocated objects.
+//
+// Transforms are referred to with a TransformHandle. When a transform is destroyed the last transform in
+// the arrays is moved into its place to keep the arrays packed, so handles go through a lookup table to
+// find where their data currently is. Handles to destroyed transforms are detected (see IsValid).
+//
+// Transforms can be attached to a parent transform, their position, rotation and scale are then relative
+// to the parent. The packed arrays are kept sorted so parents always come before their children (roots
+// first, then their children, then grandchildren etc.), so world matrices can be calculated in a single
+// pass through the arrays.
+//
+// World matrices are rebuilt when requested if the transform or any of its parents have changed. Call
+// UpdateWorldMatrices once per frame to rebuild all changed matrices in one go, which is much faster than
+// rebuilding them one by one. Only transforms that changed, and those attached beneath them, are rebuilt.
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "CQuaternion.h"
+
+#include <vector>
+#include <cstdint>
+
+#ifndef _TRANSFORM_STORAGE_H_INCLUDED_
+#define _TRANSFORM_STORAGE_H_INCLUDED_
+
+
+// Refers to a transform in a TransformStorage. Default constructed handles don't refer to anything
+struct TransformHandle
+{
+    uint32_t index      = UINT32_MAX; // Entry in the storage's lookup table
+    uint32_t generation = 0;          // Changes each time the lookup entry is reused so old handles can be detected
+};
+
+
+class TransformStorage
+{
+public:
+    //-------------------------------------
+    // Construction / Usage
+    //-------------------------------------
+
+    // Add a new transform, returns handle used to access it
+    TransformHandle Create(CVector3 position = { 0,0,0 }, CQuaternion rotation = { 0,0,0,1 }, CVector3 scale = { 1,1,1 });
+
+    // Remove a transform, the handle (and any copies of it) will no longer be valid. Any transforms attached
+    // to it become unattached, keeping their current position, rotation and scale relative to the world
+    void Destroy(TransformHandle handle);
+
+    // Returns true if the handle refers to a transform that has not been destroyed
+    bool IsValid(TransformHandle handle) const;
+
+    // Number of transforms currently stored
+    std::size_t Count() const  { return mDenseToSparse.size(); }
+
+    // Attach a transform to a parent, pass a default constructed handle as the parent to detach it. The
+    // transform's position, rotation and scale are used as is, but are now relative to the parent.
+    // Returns false if the handles are not valid or if the parent is attached below the child
+    bool SetParent(TransformHandle child, TransformHandle parent);
+
+    // Parent of the transform, or a default constructed handle if it has none
+    TransformHandle Parent(TransformHandle handle) const;
+
+    // Rebuild the world matrices of all transforms that have changed since their matrix was last built
+    void UpdateWorldMatrices();
+
+
+    //-------------------------------------
+    // Data access
+    //-------------------------------------
+    // Handles must be valid. Position, rotation and scale are relative to the parent if there is one.
+    // Setters flag the world matrix to be rebuilt
+
+    CVector3    Position(TransformHandle handle) const;
+    CQuaternion Rotation(TransformHandle handle) const;
+    CVector3    Scale   (TransformHandle handle) const;
+
+    void SetPosition(TransformHandle handle, CVector3 position);
+    void SetRotation(TransformHandle handle, CQuaternion rotation);
+    void SetScale   (TransformHandle handle, CVector3 scale);
+
+    // World matrix built from the position, rotation and scale and those of all parents, rebuilt first if it is out of date
+    const CMatrix4x4& WorldMatrix(TransformHandle handle);
+
+    // Number of times the world matrix has been rebuilt. Other systems can keep a copy of this to tell if the transform
+    // has moved since they last used it, including moves caused by a parent. Call after UpdateWorldMatrices
+    uint32_t WorldVersion(TransformHandle handle) const  { return mWorldVersions[mSparseToDense[handle.index]]; }
+
+
+    //-------------------------------------
+    // Private data / members
+    //-------------------------------------
+private:
+    // Build local matrices (from position, rotation and scale only) for count transforms starting at the given
+    // index in the packed arrays
+    void BuildLocalMatrices(std::size_t first, std::size_t count);
+
+    // Bring the world matrix at the given index in the packed arrays up to date, updating its parents first
+    const CMatrix4x4& UpdateWorldMatrix(uint32_t i);
+
+    // Reorder the packed arrays so every transform comes after its parent
+    void SortByDepth();
+
+    // Call the given function on each of the packed arrays (used when moving or reordering transforms)
+    template <typename Function> void ForEachPackedArray(Function f);
+
+    // Packed arrays, one entry per transform, parents always before their children
+    std::vector<float> mPositionX, mPositionY, mPositionZ;
+    std::vector<float> mRotationX, mRotationY, mRotationZ, mRotationW;
+    std::vector<float> mScaleX,    mScaleY,    mScaleZ;
+    std::vector<CMatrix4x4> mLocalMatrices;  // Position, rotation and scale as a matrix, relative to the parent
+    std::vector<CMatrix4x4> mWorldMatrices;  // Kept as whole matrices since that is the form the GPU needs
+    std::vector<uint8_t>    mLocalDirty;     // Non-zero if the local matrix needs rebuilding
+    std::vector<uint8_t>    mWorldDirty;     // Non-zero if the world matrix needs rebuilding due to a local change
+    std::vector<uint32_t>   mWorldVersions;  // Increased each time the world matrix is rebuilt...
+    std::vector<uint32_t>   mParentVersions; // ...so children can tell if their parent's world matrix has changed since they used it
+    std::vector<uint32_t>   mParents;        // Lookup table entry of the parent, UINT32_MAX if none
+    std::vector<uint32_t>   mChildCounts;    // Number of transforms directly attached to this one
+    std::vector<uint32_t>   mDenseToSparse;  // Which lookup table entry points at each transform
+    bool mOrderDirty = false;                // Set when a transform may have been moved before its parent
+
+    // Lookup table from handle index to position in the packed arrays
+    std::vector<uint32_t> mSparseToDense;
+    std::vector<uint32_t> mGenerations;
+    std::vector<uint32_t> mFreeList;        // Unused lookup table entries
+};
+
+
+// Transforms for all the models in the app
+extern TransformStorage gTransforms;
+
+
+#endif //_TRANSFORM_STORAGE_H_INCLUDED_
@@ -0,0 +1,497 @@
+//--------------------------------------------------------------------------------------
+// Bounding volume hierarchy (BVH) over the triangles of a mesh, used for ray casts
+//--------------------------------------------------------------------------------------
+// The binary tree is built top-down with binned SAH: triangle centres are sorted into a few equal sized bins along
+// the longest axis of the group and only the splits between bins are considered, which keeps the build linear time
+// at each level. Trying all three axes gives trees that are only slightly faster for much longer builds.
+// Ray tests use the slab method for boxes and the Moller-Trumbore method for triangles, four at a time.
+
+#include "TriangleBVH.h"
+#include "MathSIMD.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+
+namespace
+{
+    // Number of bins per axis when choosing a split. More gives slightly better trees but takes longer to build
+    const int SAH_BINS = 16;
+
+    // Below this depth of the binary tree groups are split in half instead of using SAH. This limits the depth
+    // of the tree (and so the traversal stack below) even for unusual meshes where SAH makes very uneven splits
+    const int MAX_SAH_DEPTH = 48;
+
+    // Entries in the traversal stack. Each level of the four-way tree adds at most three entries, and the tree is
+    // no deeper than MAX_SAH_DEPTH plus the depth of a balanced tree of 2^32 triangles
+    const int MAX_STACK = 256;
+
+
+    AABB EmptyBox()
+    {
+        return { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+    }
+
+    // Local versions of MergeBoxes and a point version, so they can be inlined in the build loops
+    AABB Merge(const AABB& a, const AABB& b)
+    {
+        return { { std::min(a.minPoint.x, b.minPoint.x), std::min(a.minPoint.y, b.minPoint.y), std::min(a.minPoint.z, b.minPoint.z) },
+                 { std::max(a.maxPoint.x, b.maxPoint.x), std::max(a.maxPoint.y, b.maxPoint.y), std::max(a.maxPoint.z, b.maxPoint.z) } };
+    }
+
+    AABB AddPoint(const AABB& box, const CVector3& p)
+    {
+        return { { std::min(box.minPoint.x, p.x), std::min(box.minPoint.y, p.y), std::min(box.minPoint.z, p.z) },
+                 { std::max(box.maxPoint.x, p.x), std::max(box.maxPoint.y, p.y), std::max(box.maxPoint.z, p.z) } };
+    }
+
+
+    // Ray values used by every box and triangle test, set up once per ray. The inverse direction is used by the box
+    // tests. Zero direction components are replaced by tiny ones so the tests never multiply 0 by infinity
+    struct PreparedRay
+    {
+        CVector3 origin;
+        CVector3 direction;
+        CVector3 inverse;
+#if defined(MATH_SSE)
+        __m128 originX, originY, originZ;
+        __m128 directionX, directionY, directionZ;
+        __m128 inverseX, inverseY, inverseZ;
+#endif
+
+        explicit PreparedRay(const Ray& ray) : origin(ray.origin), direction(ray.direction)
+        {
+            const float* d = &ray.direction.x;
+            float* inv = &inverse.x;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                float safe = std::abs(d[axis]) > 1e-30f ? d[axis] : (d[axis] < 0.0f ? -1e-30f : 1e-30f);
+                inv[axis] = 1.0f / safe;
+            }
+#if defined(MATH_SSE)
+            originX    = _mm_set1_ps(origin.x);     originY    = _mm_set1_ps(origin.y);     originZ    = _mm_set1_ps(origin.z);
+            directionX = _mm_set1_ps(direction.x);  directionY = _mm_set1_ps(direction.y);  directionZ = _mm_set1_ps(direction.z);
+            inverseX   = _mm_set1_ps(inverse.x);    inverseY   = _mm_set1_ps(inverse.y);    inverseZ   = _mm_set1_ps(inverse.z);
+#endif
+        }
+    };
+
+
+    // Test the ray against four boxes given as arrays of min and max coordinates. Returns a bit mask of the boxes hit
+    // no further than maxDistance along the ray, and sets distances to where the ray enters each box (0 if inside)
+    int IntersectBoxes(const PreparedRay& ray, const float* minX, const float* minY, const float* minZ,
+                       const float* maxX, const float* maxY, const float* maxZ, float maxDistance, float* distances)
+    {
+#if defined(MATH_SSE)
+        __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minX), ray.originX), ray.inverseX);
+        __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxX), ray.originX), ray.inverseX);
+        __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minY), ray.originY), ray.inverseY);
+        __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxY), ray.originY), ray.inverseY);
+        __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minZ), ray.originZ), ray.inverseZ);
+        __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxZ), ray.originZ), ray.inverseZ);
+
+        __m128 nearT = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                  _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+        __m128 farT  = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                  _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(maxDistance)));
+        _mm_storeu_ps(distances, nearT);
+        return _mm_movemask_ps(_mm_cmple_ps(nearT, farT));
+#else
+        int mask = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            float t0x = (minX[i] - ray.origin.x) * ray.inverse.x,  t1x = (maxX[i] - ray.origin.x) * ray.inverse.x;
+            float t0y = (minY[i] - ray.origin.y) * ray.inverse.y,  t1y = (maxY[i] - ray.origin.y) * ray.inverse.y;
+            float t0z = (minZ[i] - ray.origin.z) * ray.inverse.z,  t1z = (maxZ[i] - ray.origin.z) * ray.inverse.z;
+            float nearT = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), 0.0f));
+            float farT  = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), maxDistance));
+            distances[i] = nearT;
+            if (nearT <= farT)  mask |= 1 << i;
+        }
+        return mask;
+#endif
+    }
+
+
+    // Test the ray against four triangles given as a first corner and two edges, as arrays of coordinates. Returns a
+    // bit mask of the triangles hit no further than maxDistance along the ray, and sets the distance and u, v
+    // coordinates of each (see TriangleHit)
+    int IntersectTriangles(const PreparedRay& ray, const float* p0X, const float* p0Y, const float* p0Z,
+                           const float* e1X, const float* e1Y, const float* e1Z,
+                           const float* e2X, const float* e2Y, const float* e2Z,
+                           float maxDistance, float* distances, float* us, float* vs)
+    {
+#if defined(MATH_SSE)
+        __m128 e1x = _mm_loadu_ps(e1X), e1y = _mm_loadu_ps(e1Y), e1z = _mm_loadu_ps(e1Z);
+        __m128 e2x = _mm_loadu_ps(e2X), e2y = _mm_loadu_ps(e2Y), e2z = _mm_loadu_ps(e2Z);
+
+        // p = direction x e2, det = e1 . p
+        __m128 px = _mm_sub_ps(_mm_mul_ps(ray.directionY, e2z), _mm_mul_ps(ray.directionZ, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(ray.directionZ, e2x), _mm_mul_ps(ray.directionX, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(ray.directionX, e2y), _mm_mul_ps(ray.directionY, e2x));
+        __m128 det = MulAdd(e1x, px, MulAdd(e1y, py, _mm_mul_ps(e1z, pz)));
+        __m128 inverseDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+        // t = origin - p0, u = (t . p) / det
+        __m128 tx = _mm_sub_ps(ray.originX, _mm_loadu_ps(p0X));
+        __m128 ty = _mm_sub_ps(ray.originY, _mm_loadu_ps(p0Y));
+        __m128 tz = _mm_sub_ps(ray.originZ, _mm_loadu_ps(p0Z));
+        __m128 u = _mm_mul_ps(MulAdd(tx, px, MulAdd(ty, py, _mm_mul_ps(tz, pz))), inverseDet);
+
+        // q = t x e1, v = (direction . q) / det, distance = (e2 . q) / det
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+        __m128 v = _mm_mul_ps(MulAdd(ray.directionX, qx, MulAdd(ray.directionY, qy, _mm_mul_ps(ray.directionZ, qz))), inverseDet);
+        __m128 t = _mm_mul_ps(MulAdd(e2x, qx, MulAdd(e2y, qy, _mm_mul_ps(e2z, qz))), inverseDet);
+
+        // Comparisons with NaN (from degenerate triangles, where det is 0) are false, so those are never hit
+        __m128 zero = _mm_setzero_ps();
+        __m128 hit = _mm_cmpneq_ps(det, zero);
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(t, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(t, _mm_set1_ps(maxDistance)));
+        _mm_storeu_ps(distances, t);
+        _mm_storeu_ps(us, u);
+        _mm_storeu_ps(vs, v);
+        return _mm_movemask_ps(hit);
+#else
+        int mask = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            CVector3 e1 = { e1X[i], e1Y[i], e1Z[i] };
+            CVector3 e2 = { e2X[i], e2Y[i], e2Z[i] };
+            CVector3 p = Cross(ray.direction, e2);
+            float det = Dot(e1, p);
+            if (det == 0.0f)  continue;
+            float inverseDet = 1.0f / det;
+
+            CVector3 t = ray.origin - CVector3{ p0X[i], p0Y[i], p0Z[i] };
+            CVector3 q = Cross(t, e1);
+            us[i] = Dot(t, p) * inverseDet;
+            vs[i] = Dot(ray.direction, q) * inverseDet;
+            distances[i] = Dot(e2, q) * inverseDet;
+            if (us[i] >= 0.0f && vs[i] >= 0.0f && us[i] + vs[i] <= 1.0f && distances[i] >= 0.0f && distances[i] <= maxDistance)
+            {
+                mask |= 1 << i;
+            }
+        }
+        return mask;
+#endif
+    }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Construction / Usage
+-----------------------------------------------------------------------------------------*/
+
+// Build the tree for a triangle list, replacing any previous contents. Indices refer to the positions array.
+// The triangles are copied so the arrays are not needed afterwards
+void TriangleBVH::Build(const CVector3* positions, std::size_t numPositions, const uint32_t* indices, std::size_t numIndices)
+{
+    Clear();
+    mNumTriangles = numIndices / 3;
+    if (mNumTriangles == 0)  return;
+
+    // Corners, boxes and centres of each triangle. Indices outside the positions array give a degenerate triangle,
+    // which is never hit
+    mCorners.resize(mNumTriangles * 3);
+    mBuildTriangles.resize(mNumTriangles);
+    for (std::size_t t = 0; t < mNumTriangles; ++t)
+    {
+        const uint32_t* triangle = indices + t * 3;
+        bool valid = triangle[0] < numPositions && triangle[1] < numPositions && triangle[2] < numPositions;
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            mCorners[t * 3 + corner] = valid ? positions[triangle[corner]] : CVector3{ 0, 0, 0 };
+        }
+        AABB box = EmptyBox();
+        for (int corner = 0; corner < 3; ++corner)  box = AddPoint(box, mCorners[t * 3 + corner]);
+        mBuildTriangles[t] = { box, (box.minPoint + box.maxPoint) * 0.5f, static_cast<uint32_t>(t) };
+    }
+
+    // Build the binary tree then collapse it into the four-way tree, which puts the root at mNodes[0]
+    mBuildNodes.reserve(2 * mNumTriangles);
+    uint32_t root = BuildBinaryNode(0, static_cast<uint32_t>(mNumTriangles), 0);
+    mBoundingBox = mBuildNodes[root].box;
+
+    mPackets.reserve(mNumTriangles / 2);
+    mNodes.reserve(mNumTriangles / 3 + 1);
+    if (mBuildNodes[root].count > 0)
+    {
+        // Few enough triangles for a single leaf, the root holds just that
+        Node node;
+        for (int i = 0; i < 4; ++i)
+        {
+            node.minX[i] = node.minY[i] = node.minZ[i] = node.maxX[i] = node.maxY[i] = node.maxZ[i] = 0.0f;
+            node.children[i] = EMPTY_CHILD;
+        }
+        node.minX[0] = mBoundingBox.minPoint.x;  node.minY[0] = mBoundingBox.minPoint.y;  node.minZ[0] = mBoundingBox.minPoint.z;
+        node.maxX[0] = mBoundingBox.maxPoint.x;  node.maxY[0] = mBoundingBox.maxPoint.y;  node.maxZ[0] = mBoundingBox.maxPoint.z;
+        mNodes.push_back(node);
+        mNodes[0].children[0] = CreatePacket(mBuildNodes[root]);
+    }
+    else
+    {
+        CollapseNode(root);
+    }
+
+    // Release the memory used while building
+    std::vector<BuildNode>().swap(mBuildNodes);
+    std::vector<BuildTriangle>().swap(mBuildTriangles);
+    std::vector<CVector3>().swap(mCorners);
+}
+
+
+// Remove all triangles
+void TriangleBVH::Clear()
+{
+    mNodes.clear();
+    mPackets.clear();
+    mBoundingBox = { { 0, 0, 0 }, { 0, 0, 0 } };
+    mNumTriangles = 0;
+}
+
+
+// Create binary nodes for mBuildTriangles[first] to mBuildTriangles[first + count - 1]. Returns the node
+uint32_t TriangleBVH::BuildBinaryNode(uint32_t first, uint32_t count, int depth)
+{
+    AABB box = EmptyBox();
+    AABB centres = EmptyBox();
+    BuildTriangle* triangles = mBuildTriangles.data() + first;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        box = Merge(box, triangles[i].box);
+        centres = AddPoint(centres, triangles[i].centre);
+    }
+
+    uint32_t node = static_cast<uint32_t>(mBuildNodes.size());
+    mBuildNodes.push_back({ box, first, count, 0, 0 });
+    if (count <= 4)  return node; // Fits in one triangle packet
+
+    // Try the splits between bins on the longest axis, choosing the one with the lowest SAH cost. The cost is
+    // relative, it is the surface area of each side times its number of triangles
+    uint32_t leftCount = 0;
+    CVector3 size = centres.maxPoint - centres.minPoint;
+    int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+    float minCentre = (&centres.minPoint.x)[axis];
+    float extent = (&centres.maxPoint.x)[axis] - minCentre;
+    if (depth < MAX_SAH_DEPTH && extent > 0.0f)
+    {
+        float scale = SAH_BINS / extent;
+        auto binOf = [&](const BuildTriangle& triangle)
+        {
+            return std::min(static_cast<int>(((&triangle.centre.x)[axis] - minCentre) * scale), SAH_BINS - 1);
+        };
+
+        uint32_t binCounts[SAH_BINS] = {};
+        AABB     binBoxes[SAH_BINS];
+        for (auto& binBox : binBoxes)  binBox = EmptyBox();
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            int bin = binOf(triangles[i]);
+            ++binCounts[bin];
+            binBoxes[bin] = Merge(binBoxes[bin], triangles[i].box);
+        }
+
+        // Sweep from the right to get the area of everything right of each split, then from the left to get the costs
+        float    rightAreas[SAH_BINS];
+        uint32_t rightCounts[SAH_BINS];
+        AABB     sweepBox = EmptyBox();
+        uint32_t sweepCount = 0;
+        for (int bin = SAH_BINS - 1; bin > 0; --bin)
+        {
+            sweepBox = Merge(sweepBox, binBoxes[bin]);
+            sweepCount += binCounts[bin];
+            rightAreas[bin]  = sweepCount > 0 ? SurfaceArea(sweepBox) : 0.0f;
+            rightCounts[bin] = sweepCount;
+        }
+
+        float bestCost = FLT_MAX;
+        int   bestSplit = 0;
+        sweepBox = EmptyBox();
+        sweepCount = 0;
+        for (int split = 1; split < SAH_BINS; ++split)
+        {
+            sweepBox = Merge(sweepBox, binBoxes[split - 1]);
+            sweepCount += binCounts[split - 1];
+            if (sweepCount == 0 || rightCounts[split] == 0)  continue;
+
+            float cost = SurfaceArea(sweepBox) * sweepCount + rightAreas[split] * rightCounts[split];
+            if (cost < bestCost)
+            {
+                bestCost  = cost;
+                bestSplit = split;
+            }
+        }
+
+        if (bestSplit > 0)
+        {
+            BuildTriangle* middle = std::partition(triangles, triangles + count, [&](const BuildTriangle& triangle)
+            {
+                return binOf(triangle) < bestSplit;
+            });
+            leftCount = static_cast<uint32_t>(middle - triangles);
+        }
+    }
+
+    // When SAH can't split the triangles (e.g. all centres in the same place) or the tree is getting deep, split them
+    // in half along the longest axis of their centres
+    if (leftCount == 0 || leftCount == count)
+    {
+        leftCount = count / 2;
+        std::nth_element(triangles, triangles + leftCount, triangles + count, [&](const BuildTriangle& a, const BuildTriangle& b)
+        {
+            return (&a.centre.x)[axis] < (&b.centre.x)[axis];
+        });
+    }
+
+    uint32_t left  = BuildBinaryNode(first,             leftCount,         depth + 1);
+    uint32_t right = BuildBinaryNode(first + leftCount, count - leftCount, depth + 1);
+    mBuildNodes[node].count = 0;
+    mBuildNodes[node].left  = left;
+    mBuildNodes[node].right = right;
+    return node;
+}
+
+
+// Create a four-way node from the given binary node and everything below it. Returns the node
+uint32_t TriangleBVH::CollapseNode(uint32_t buildNode)
+{
+    // Start with the two children, then replace the child with the largest surface area (the one most likely to be
+    // hit) by its own children until there are four or only leaves are left
+    uint32_t children[4] = { mBuildNodes[buildNode].left, mBuildNodes[buildNode].right };
+    int numChildren = 2;
+    while (numChildren < 4)
+    {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int i = 0; i < numChildren; ++i)
+        {
+            const BuildNode& child = mBuildNodes[children[i]];
+            if (child.count == 0 && SurfaceArea(child.box) > largestArea)
+            {
+                largest = i;
+                largestArea = SurfaceArea(child.box);
+            }
+        }
+        if (largest < 0)  break;
+
+        uint32_t opened = children[largest];
+        children[largest] = mBuildNodes[opened].left;
+        children[numChildren++] = mBuildNodes[opened].right;
+    }
+
+    // Add the node before its children so the root is the first node. Recursion can reallocate mNodes, so the node
+    // is only accessed by index
+    uint32_t node = static_cast<uint32_t>(mNodes.size());
+    mNodes.emplace_back();
+    for (int i = 0; i < 4; ++i)
+    {
+        AABB box = { { 0, 0, 0 }, { 0, 0, 0 } };
+        uint32_t child = EMPTY_CHILD;
+        if (i < numChildren)
+        {
+            const BuildNode& buildChild = mBuildNodes[children[i]];
+            box = buildChild.box;
+            child = buildChild.count > 0 ? CreatePacket(buildChild) : CollapseNode(children[i]);
+        }
+        Node& n = mNodes[node];
+        n.minX[i] = box.minPoint.x;  n.minY[i] = box.minPoint.y;  n.minZ[i] = box.minPoint.z;
+        n.maxX[i] = box.maxPoint.x;  n.maxY[i] = box.maxPoint.y;  n.maxZ[i] = box.maxPoint.z;
+        n.children[i] = child;
+    }
+    return node;
+}
+
+
+// Create a triangle packet from a binary leaf. Returns the child value for the leaf
+uint32_t TriangleBVH::CreatePacket(const BuildNode& leaf)
+{
+    TrianglePacket packet;
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        CVector3 p0 = { 0, 0, 0 }, e1 = { 0, 0, 0 }, e2 = { 0, 0, 0 };
+        packet.triangles[i] = UINT32_MAX;
+        if (i < leaf.count)
+        {
+            uint32_t triangle = mBuildTriangles[leaf.first + i].triangle;
+            p0 = mCorners[triangle * 3];
+            e1 = mCorners[triangle * 3 + 1] - p0;
+            e2 = mCorners[triangle * 3 + 2] - p0;
+            packet.triangles[i] = triangle;
+        }
+        packet.p0X[i] = p0.x;  packet.p0Y[i] = p0.y;  packet.p0Z[i] = p0.z;
+        packet.e1X[i] = e1.x;  packet.e1Y[i] = e1.y;  packet.e1Z[i] = e1.z;
+        packet.e2X[i] = e2.x;  packet.e2Y[i] = e2.y;  packet.e2Z[i] = e2.z;
+    }
+    mPackets.push_back(packet);
+    return LEAF_CHILD | static_cast<uint32_t>(mPackets.size() - 1);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Queries
+-----------------------------------------------------------------------------------------*/
+
+// Find the nearest triangle hit by the ray no further than maxDistance along it. Triangles are hit from either
+// side. Returns false if nothing was hit, otherwise fills in hit
+bool TriangleBVH::RayCast(const Ray& ray, float maxDistance, TriangleHit& hit) const
+{
+    if (mNodes.empty())  return false;
+
+    PreparedRay preparedRay(ray);
+    float nearest = maxDistance;
+    bool  found = false;
+
+    // Stack holds nodes or leaves and where the ray enters them. The nearest children are visited first so the
+    // nearest hit so far can be used to skip those further away
+    struct Entry { uint32_t child; float distance; };
+    Entry stack[MAX_STACK];
+    int top = 0;
+    stack[top++] = { 0, 0.0f };
+    while (top > 0)
+    {
+        Entry entry = stack[--top];
+        if (entry.distance > nearest)  continue;
+
+        if (entry.child & LEAF_CHILD)
+        {
+            const TrianglePacket& packet = mPackets[entry.child & ~LEAF_CHILD];
+            float distances[4], us[4], vs[4];
+            int mask = IntersectTriangles(preparedRay, packet.p0X, packet.p0Y, packet.p0Z, packet.e1X, packet.e1Y, packet.e1Z,
+                                          packet.e2X, packet.e2Y, packet.e2Z, nearest, distances, us, vs);
+            for (int i = 0; i < 4; ++i)
+            {
+                if ((mask & (1 << i)) && distances[i] <= nearest)
+                {
+                    nearest = distances[i];
+                    hit = { packet.triangles[i], distances[i], us[i], vs[i] };
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        const Node& node = mNodes[entry.child];
+        float distances[4];
+        int mask = IntersectBoxes(preparedRay, node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, nearest, distances);
+
+        // Sort the children hit, furthest first, and push them so the nearest is visited next
+        Entry hits[4];
+        int numHits = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            if (!(mask & (1 << i)) || node.children[i] == EMPTY_CHILD)  continue;
+            int j = numHits++;
+            for (; j > 0 && hits[j - 1].distance < distances[i]; --j)  hits[j] = hits[j - 1];
+            hits[j] = { node.children[i], distances[i] };
+        }
+        for (int i = 0; i < numHits; ++i)  stack[top++] = hits[i];
+    }
+    return found;
+}
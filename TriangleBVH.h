@@ -0,0 +1,134 @@
+//--------------------------------------------------------------------------------------
+// Bounding volume hierarchy (BVH) over the triangles of a mesh, used for ray casts
+//--------------------------------------------------------------------------------------
+// A CPU copy of a mesh's triangles arranged in a tree of axis-aligned boxes, so a ray only needs to be tested
+// against the few triangles in the boxes it passes through. Meshes of millions of triangles take a few dozen box
+// tests and a handful of triangle tests per ray.
+//
+// The tree is built with the surface area heuristic (SAH): each group of triangles is split where the total
+// surface area of the two halves, weighted by the number of triangles in each, is smallest. This is a good guess
+// at the split that makes rays cheapest, as the chance of a ray hitting a box is proportional to its surface area.
+// The binary tree is then collapsed into a tree with four children per node so that the ray can be tested
+// against all four child boxes at once with SIMD instructions. Each leaf is a packet of up to four triangles,
+// also tested at once.
+//
+// Positions are in model space. The tree does not change once built, use SceneBVH::RayCastTriangles to cast rays
+// against the models in a scene, which moves the ray into each model's space.
+
+#include "Bounds.h"
+#include "CVector3.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _TRIANGLE_BVH_H_INCLUDED_
+#define _TRIANGLE_BVH_H_INCLUDED_
+
+
+// Where a ray hit a triangle. For a triangle with corners p0, p1 and p2 the hit point is
+//   p0 + u * (p1 - p0) + v * (p2 - p0)
+// so its barycentric coordinates are (1 - u - v, u, v). These can be used to interpolate normals, UVs etc.
+struct TriangleHit
+{
+    uint32_t triangle; // Position of the triangle in the list the tree was built from
+    float    distance; // Along the ray in multiples of the ray direction's length (see Ray in Bounds.h)
+    float    u;
+    float    v;
+};
+
+
+class TriangleBVH
+{
+public:
+    //-------------------------------------
+    // Construction / Usage
+    //-------------------------------------
+
+    // Build the tree for a triangle list, replacing any previous contents. Indices refer to the positions array.
+    // The triangles are copied so the arrays are not needed afterwards
+    void Build(const CVector3* positions, std::size_t numPositions, const uint32_t* indices, std::size_t numIndices);
+
+    // Remove all triangles
+    void Clear();
+
+    std::size_t NumTriangles() const  { return mNumTriangles; }
+
+    // Box around all the triangles
+    const AABB& BoundingBox() const  { return mBoundingBox; }
+
+
+    //-------------------------------------
+    // Queries
+    //-------------------------------------
+
+    // Find the nearest triangle hit by the ray no further than maxDistance along it. Triangles are hit from either
+    // side. Returns false if nothing was hit, otherwise fills in hit
+    bool RayCast(const Ray& ray, float maxDistance, TriangleHit& hit) const;
+
+
+    //-------------------------------------
+    // Private data / members
+    //-------------------------------------
+private:
+    // Boxes of up to four children, stored as four min x values, four min y values etc. for SIMD tests. Each child
+    // is another node, a leaf (LEAF_CHILD | packet index) or EMPTY_CHILD if the node has fewer than four children
+    struct Node
+    {
+        float    minX[4], minY[4], minZ[4];
+        float    maxX[4], maxY[4], maxZ[4];
+        uint32_t children[4];
+    };
+
+    // Up to four triangles stored as their first corner and two edges, again as four x values, four y values etc.
+    // Unused places have zero edges, which rays never hit
+    struct TrianglePacket
+    {
+        float    p0X[4], p0Y[4], p0Z[4];
+        float    e1X[4], e1Y[4], e1Z[4];
+        float    e2X[4], e2Y[4], e2Z[4];
+        uint32_t triangles[4];
+    };
+
+    static const uint32_t LEAF_CHILD  = 0x80000000;
+    static const uint32_t EMPTY_CHILD = 0xffffffff;
+
+    // Binary tree used while building. A node is a leaf if count is non-zero, holding build triangles first to
+    // first + count - 1. Otherwise its children are left and right
+    struct BuildNode
+    {
+        AABB     box;
+        uint32_t first, count;
+        uint32_t left, right;
+    };
+
+    // Triangle details used while building, sorted in place so each leaf's triangles are together
+    struct BuildTriangle
+    {
+        AABB     box;
+        CVector3 centre;
+        uint32_t triangle;
+    };
+
+    // Create binary nodes for mBuildTriangles[first] to mBuildTriangles[first + count - 1]. Returns the node
+    uint32_t BuildBinaryNode(uint32_t first, uint32_t count, int depth);
+
+    // Create a four-way node from the given binary node and everything below it. Returns the node
+    uint32_t CollapseNode(uint32_t buildNode);
+
+    // Create a triangle packet from a binary leaf. Returns the child value for the leaf
+    uint32_t CreatePacket(const BuildNode& leaf);
+
+    std::vector<Node>           mNodes;   // mNodes[0] is the root
+    std::vector<TrianglePacket> mPackets;
+    AABB        mBoundingBox = { { 0, 0, 0 }, { 0, 0, 0 } };
+    std::size_t mNumTriangles = 0;
+
+    // Used while building only
+    std::vector<BuildNode>     mBuildNodes;
+    std::vector<BuildTriangle> mBuildTriangles;
+    std::vector<CVector3>      mCorners;     // Three per triangle, in the original order
+};
+
+
+#endif //_TRIANGLE_BVH_H_INCLUDED_
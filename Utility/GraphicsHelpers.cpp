@@ -3,6 +3,7 @@
 //--------------------------------------------------------------------------------------
 
 #include "GraphicsHelpers.h"
+#include "MappedFile.h"
 #include "../Shader.h"
 #include <cmath>
 #include <cctype>
@@ -12,16 +13,25 @@
 // Texture Loading
 //--------------------------------------------------------------------------------------
 
+// DDS files need different loading functions from other files, so check the filename extension (case insensitive)
+static bool IsDDSFile(const std::string& filename)
+{
+    std::string dds = ".dds";
+    return filename.size() >= 4 &&
+           std::equal(dds.rbegin(), dds.rend(), filename.rbegin(), [](unsigned char a, unsigned char b) { return std::tolower(a) == std::tolower(b); });
+}
+
 // Using Microsoft's open source DirectX Tool Kit (DirectXTK) to simplify texture loading
 // This function requires you to pass a ID3D11Resource* (e.g. &gTilesDiffuseMap), which manages the GPU memory for the
 // texture and also a ID3D11ShaderResourceView* (e.g. &gTilesDiffuseMapSRV), which allows us to use the texture in shaders
 // The function will fill in these pointers with usable data. Returns false on failure
+// If the texture has been cooked (see TextureFileToLoad) the cooked file is loaded instead
 bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV)
 {
+    filename = TextureFileToLoad(filename);
+
     // DDS files need a different function from other files
-    std::string dds = ".dds"; // So check the filename extension (case insensitive)
-    if (filename.size() >= 4 &&
-        std::equal(dds.rbegin(), dds.rend(), filename.rbegin(), [](unsigned char a, unsigned char b) { return std::tolower(a) == std::tolower(b); }))
+    if (IsDDSFile(filename))
     {
         return SUCCEEDED(DirectX::CreateDDSTextureFromFile(gD3DDevice, CA2CT(filename.c_str()), texture, textureSRV));
     }
@@ -32,6 +42,41 @@ bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderRes
 }
 
 
+// As above, but using the contents of a texture file that has already been read into memory. The file type is
+// taken from the data. Returns false on failure
+bool LoadTextureFromMemory(const uint8_t* data, std::size_t size, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV)
+{
+    // DDS files start with the characters "DDS "
+    if (size >= 4 && data[0] == 'D' && data[1] == 'D' && data[2] == 'S' && data[3] == ' ')
+    {
+        return SUCCEEDED(DirectX::CreateDDSTextureFromMemory(gD3DDevice, data, size, texture, textureSRV));
+    }
+    else
+    {
+        return SUCCEEDED(DirectX::CreateWICTextureFromMemory(gD3DDevice, gD3DContext, data, size, texture, textureSRV));
+    }
+}
+
+
+// Name of the cooked file for a texture, a block compressed DDS file with mip-maps made by the texture cooker
+// (see Tools/TextureCooker/Main.cpp), e.g. Smoke.png.dds
+std::string CookedTextureFileName(const std::string& filename)
+{
+    return filename + ".dds";
+}
+
+
+// The file that should be loaded for a texture: its cooked file if there is one at least as new as the texture,
+// otherwise the texture file itself
+std::string TextureFileToLoad(const std::string& filename)
+{
+    if (IsDDSFile(filename))  return filename; // Already in the GPU's format
+
+    std::string cookedFileName = CookedTextureFileName(filename);
+    uint64_t cookedTime = FileWriteTime(cookedFileName);
+    return (cookedTime != 0 && cookedTime >= FileWriteTime(filename)) ? cookedFileName : filename;
+}
+
 //--------------------------------------------------------------------------------------
 // Camera Helpers
 //--------------------------------------------------------------------------------------
@@ -38,8 +38,21 @@ void UpdateConstantBuffer(ID3D11Buffer* buffer, const T& bufferData)
 // This function requires you to pass a ID3D11Resource* (e.g. &gTilesDiffuseMap), which manages the GPU memory for the
 // texture and also a ID3D11ShaderResourceView* (e.g. &gTilesDiffuseMapSRV), which allows us to use the texture in shaders
 // The function will fill in these pointers with usable data. Returns false on failure
+// If the texture has been cooked (see TextureFileToLoad) the cooked file is loaded instead
 bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV);
 
+// As above, but using the contents of a texture file that has already been read into memory. The file type is
+// taken from the data. Returns false on failure
+bool LoadTextureFromMemory(const uint8_t* data, std::size_t size, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV);
+
+// Name of the cooked file for a texture, a block compressed DDS file with mip-maps made by the texture cooker
+// (see Tools/TextureCooker/Main.cpp), e.g. Smoke.png.dds
+std::string CookedTextureFileName(const std::string& filename);
+
+// The file that should be loaded for a texture: its cooked file if there is one at least as new as the texture,
+// otherwise the texture file itself
+std::string TextureFileToLoad(const std::string& filename);
+
 
 //--------------------------------------------------------------------------------------
 // Camera helpers
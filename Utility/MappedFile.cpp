@@ -0,0 +1,88 @@
+//--------------------------------------------------------------------------------------
+// Read-only memory mapped file
+//--------------------------------------------------------------------------------------
+
+#include "MappedFile.h"
+#include <utility>
+
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+
+MappedFile::MappedFile(MappedFile&& other)
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+    if (this != &other)
+    {
+        Close();
+        mFile    = other.mFile;     other.mFile    = INVALID_HANDLE_VALUE;
+        mMapping = other.mMapping;  other.mMapping = nullptr;
+        mData    = other.mData;     other.mData    = nullptr;
+        mSize    = other.mSize;     other.mSize    = 0;
+    }
+    return *this;
+}
+
+
+// Map the given file into memory, closing any file already open. Returns false on failure
+bool MappedFile::Open(const std::string& fileName)
+{
+    Close();
+
+    mFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (mFile == INVALID_HANDLE_VALUE)  return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0)
+    {
+        Close(); // Empty files cannot be mapped
+        return false;
+    }
+    mSize = static_cast<std::size_t>(size.QuadPart);
+
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mMapping == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    mData = static_cast<const unsigned char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    if (mData == nullptr)
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+
+// Unmap the file, any pointers to its data become invalid
+void MappedFile::Close()
+{
+    if (mData != nullptr)                 UnmapViewOfFile(mData);
+    if (mMapping != nullptr)              CloseHandle(mMapping);
+    if (mFile != INVALID_HANDLE_VALUE)    CloseHandle(mFile);
+    mFile    = INVALID_HANDLE_VALUE;
+    mMapping = nullptr;
+    mData    = nullptr;
+    mSize    = 0;
+}
+
+
+// Time the file was last written to, can be compared with other files to see which is newer. Returns 0 if the file
+// doesn't exist
+uint64_t FileWriteTime(const std::string& fileName)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &attributes))  return 0;
+    return (static_cast<uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+}
@@ -0,0 +1,54 @@
+//--------------------------------------------------------------------------------------
+// Read-only memory mapped file
+//--------------------------------------------------------------------------------------
+// The operating system makes the file's contents appear in memory, reading it from disk as it is accessed.
+// Nothing is copied into our own buffers, so data can be passed straight from the file to e.g. buffer creation.
+
+#ifndef _MAPPED_FILE_H_INCLUDED_
+#define _MAPPED_FILE_H_INCLUDED_
+
+#ifndef NOMINMAX
+#define NOMINMAX // See Common.h
+#endif
+#include <windows.h>
+#include <string>
+#include <cstdint>
+
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    // Mapped files can be moved but not copied
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+
+    // Map the given file into memory, closing any file already open. Returns false on failure
+    bool Open(const std::string& fileName);
+
+    // Unmap the file, any pointers to its data become invalid
+    void Close();
+
+    // Contents of the file, nullptr if no file is open
+    const unsigned char* Data() const  { return mData; }
+    std::size_t          Size() const  { return mSize; }
+
+
+private:
+    HANDLE               mFile    = INVALID_HANDLE_VALUE;
+    HANDLE               mMapping = nullptr;
+    const unsigned char* mData    = nullptr;
+    std::size_t          mSize    = 0;
+};
+
+
+// Time the file was last written to, can be compared with other files to see which is newer. Returns 0 if the file
+// doesn't exist
+uint64_t FileWriteTime(const std::string& fileName);
+
+
+#endif //_MAPPED_FILE_H_INCLUDED_